@@ -0,0 +1,253 @@
+/**
+*	Measures the shared cache of decoded blocks under concurrent queries. A QuadStack is
+*	built from a generated layered dataset and its heightfields are released after being
+*	compressed, so every height is decoded from the compressed blocks. For every cache
+*	budget and number of threads a CSV row reports the query throughput, the latency
+*	percentiles, the hit rate and the memory of the cache. A row with the raw heightfields
+*	and one without any cache (budget 0) are the references.
+*
+*	Usage: blockcachebench [--size 512] [--depth 64] [--layers 4] [--queries 200000]
+*		[--threads 1,2,4,8] [--budgets 0,262144,4194304,16777216] [--hot 0.9] [--output file.csv]
+*
+*	Every thread runs the given number of queries: point queries and, every eighth query,
+*	a column query. With probability hot a query falls in a window of 1/64 of the terrain
+*	that every thread shares, otherwise anywhere. Checksums must agree between rows.
+*/
+
+#include "core/blockcache.h"
+#include "core/compressionmanager.h"
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+#include "core/voxelmodel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Query {
+		unsigned x, y;
+		float height;
+		bool column;
+	};
+
+	struct Result {
+		double queriesPerSecond;
+		double p50, p99, p999; /** < Latencies in microseconds */
+		long long checksum;
+	};
+
+	std::vector<long long> parseList(const char* list) {
+		std::vector<long long> values;
+		std::stringstream stream(list);
+		std::string value;
+		while (std::getline(stream, value, ','))
+			values.push_back(atoll(value.c_str()));
+		return values;
+	}
+
+	/**
+	Layered terrain of size x size x depth voxels with undulating boundaries between layers,
+	stored in the order expected by StackBasedRep
+	*/
+	ShortVM* generate(int size, int depth, int layers) {
+		ShortVM *vm = new ShortVM(ivec3(size, size, depth), vec3(1.0f), vec3(0.0f), "material");
+		short *data = vm->getBuffer();
+
+		parallel::forRange(0, size, [&](size_t x) {
+			for (int y = 0; y < size; ++y) {
+				for (int z = 0; z < depth; ++z) {
+					float relativeZ = static_cast<float>(z) / depth;
+					short material = 0;
+
+					for (int layer = 0; layer < layers; ++layer) {
+						float boundary = (layer + 1.0f) / (layers + 1) + 0.08f * std::sin(0.05f * x + layer) * std::cos(0.03f * y + layer) + 0.01f * std::sin(0.7f * (x + y));
+						if (relativeZ > boundary)
+							material = layer + 1;
+					}
+
+					data[y + size * (x + size * static_cast<size_t>(z))] = material;
+				}
+			}
+		});
+
+		return vm;
+	}
+
+	std::vector<std::vector<Query>> makeQueries(int size, float minHeight, float maxHeight, unsigned nThreads, size_t nQueries, double hot) {
+		std::vector<std::vector<Query>> queries(nThreads);
+		int window = std::max(size / 8, 1);
+
+		for (unsigned thread = 0; thread < nThreads; ++thread) {
+			std::mt19937 generator(thread * 7919 + 13);
+			std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+			queries[thread].resize(nQueries);
+			for (size_t i = 0; i < nQueries; ++i) {
+				Query& query = queries[thread][i];
+				bool inside = unit(generator) < hot;
+				int extent = inside ? window : size;
+				int origin = inside ? (size - window) / 2 : 0;
+
+				query.x = origin + static_cast<unsigned>(unit(generator) * extent);
+				query.y = origin + static_cast<unsigned>(unit(generator) * extent);
+				query.height = static_cast<float>(minHeight + unit(generator) * (maxHeight - minHeight));
+				query.column = i % 8 == 0;
+			}
+		}
+
+		return queries;
+	}
+
+	Result run(QuadStack *quadStack, const std::vector<std::vector<Query>>& queries, float maxHeight) {
+		unsigned nThreads = static_cast<unsigned>(queries.size());
+		std::vector<std::vector<float>> latencies(nThreads);
+		std::vector<long long> checksums(nThreads, 0);
+		std::vector<std::thread> threads;
+
+		auto start = Clock::now();
+		for (unsigned thread = 0; thread < nThreads; ++thread) {
+			threads.emplace_back([&, thread]() {
+				QuadStack::Column column;
+				auto& latency = latencies[thread];
+				latency.reserve(queries[thread].size());
+
+				for (auto& query : queries[thread]) {
+					auto queryStart = Clock::now();
+					if (query.column) {
+						quadStack->getColumn(query.x, query.y, maxHeight, column);
+						for (auto& interval : column)
+							checksums[thread] += interval._attribute + static_cast<long long>(interval._accumulatedHeight);
+					} else
+						checksums[thread] += quadStack->sample(query.x, query.y, query.height, maxHeight);
+					latency.push_back(std::chrono::duration<float, std::micro>(Clock::now() - queryStart).count());
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::vector<float> all;
+		Result result = {};
+		for (unsigned thread = 0; thread < nThreads; ++thread) {
+			all.insert(all.end(), latencies[thread].begin(), latencies[thread].end());
+			result.checksum += checksums[thread];
+		}
+
+		auto percentile = [&](double p) {
+			size_t index = std::min(all.size() - 1, static_cast<size_t>(p * all.size()));
+			std::nth_element(all.begin(), all.begin() + index, all.end());
+			return all[index];
+		};
+		result.queriesPerSecond = all.size() / seconds;
+		result.p50 = percentile(0.5);
+		result.p99 = percentile(0.99);
+		result.p999 = percentile(0.999);
+
+		return result;
+	}
+
+}
+
+int main(int argc, char** argv) {
+	int size = 512, depth = 64, layers = 4;
+	size_t nQueries = 200000;
+	double hot = 0.9;
+	std::vector<long long> threadCounts = { 1, 2, 4, 8 };
+	std::vector<long long> budgets = { 0, 256 << 10, 4 << 20, 16 << 20 };
+	std::string outputPath;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--depth") && i + 1 < argc)
+			depth = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--layers") && i + 1 < argc)
+			layers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--queries") && i + 1 < argc)
+			nQueries = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threadCounts = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "--budgets") && i + 1 < argc)
+			budgets = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "--hot") && i + 1 < argc)
+			hot = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			outputPath = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--size 512] [--depth 64] [--layers 4] [--queries 200000] [--threads 1,2,4,8] [--budgets 0,262144,4194304,16777216] [--hot 0.9] [--output file.csv]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (size <= 0 || (size & (size - 1)) != 0 || depth <= 0 || layers <= 0 || nQueries == 0) {
+		std::cerr << "Size must be a power of two and depth, layers and queries positive" << std::endl;
+		return 1;
+	}
+
+	std::ofstream outputFile;
+	if (!outputPath.empty()) {
+		outputFile.open(outputPath);
+		if (!outputFile) {
+			std::cerr << "Cannot open " << outputPath << " for writing" << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& output = outputPath.empty() ? std::cout : outputFile;
+
+	std::cerr << "Dataset " << size << "x" << size << "x" << depth << ", " << layers << " layers" << std::endl;
+	ShortVM *vm = generate(size, depth, layers);
+	ShortSBR *sbr = new ShortSBR(*vm);
+	float minHeight = sbr->getMinHeight(), maxHeight = sbr->getMaxHeight();
+
+	CompressionManager rawManager(sbr);
+	rawManager.execute();
+	QuadStack *raw = rawManager.getQuadStack();
+
+	CompressionManager releasedManager(sbr);
+	releasedManager.execute(true);
+	QuadStack *released = releasedManager.getQuadStack();
+
+	output << "size,layers,heightfields,budget_bytes,threads,queries_per_s,p50_us,p99_us,p999_us,hit_rate,evictions,cache_bytes,checksum" << std::endl;
+
+	for (long long nThreads : threadCounts) {
+		if (nThreads <= 0)
+			continue;
+
+		auto queries = makeQueries(size, minHeight, maxHeight, static_cast<unsigned>(nThreads), nQueries, hot);
+
+		Result result = run(raw, queries, maxHeight);
+		output << size << "," << layers << ",raw,0," << nThreads << "," << result.queriesPerSecond << ","
+			<< result.p50 << "," << result.p99 << "," << result.p999 << ",0,0,0," << result.checksum << std::endl;
+
+		for (long long budget : budgets) {
+			std::unique_ptr<BlockCache> cache(budget > 0 ? new BlockCache(static_cast<size_t>(budget)) : nullptr);
+			released->setBlockCache(cache.get());
+
+			result = run(released, queries, maxHeight);
+			BlockCache::Statistics statistics = cache ? cache->getStatistics() : BlockCache::Statistics();
+			output << size << "," << layers << ",released," << budget << "," << nThreads << "," << result.queriesPerSecond << ","
+				<< result.p50 << "," << result.p99 << "," << result.p999 << ","
+				<< statistics.hitRate() << "," << statistics._evictions << "," << statistics._bytes << "," << result.checksum << std::endl;
+		}
+	}
+
+	// The caches of the loop are gone
+	released->setBlockCache(nullptr);
+
+	return 0;
+}
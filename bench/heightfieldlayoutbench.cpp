@@ -0,0 +1,170 @@
+/**
+*	Compares the row-major and the Morton layouts of HeightField on a generated terrain.
+*	For every layout a CSV row reports the time to convert the terrain into it, to compress
+*	it with HeightFieldCompressor and to build its min and max mipmaps.
+*
+*	Usage: heightfieldlayoutbench [--size 4096] [--block 8] [--repeat 3] [--threads N]
+*		[--output file.csv]
+*
+*	Times are the best of the repetitions, in milliseconds. The compressed stream and the
+*	mipmaps do not depend on the layout, so their checksums must agree between rows.
+*/
+
+#include "core/heightfield.h"
+#include "core/heightfieldcompressor.h"
+#include "core/heightmipmap.h"
+#include "core/parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	const float OFFSET = 0.01f; /** < Height resolution of the terrain and of the compressor */
+
+	struct Result {
+		double convertSeconds = std::numeric_limits<double>::max();
+		double compressSeconds = std::numeric_limits<double>::max();
+		double mipmapSeconds = std::numeric_limits<double>::max();
+		size_t compressedWords = 0;
+		unsigned long long compressedHash = 0;
+		double mipmapChecksum = 0;
+	};
+
+	double since(Clock::time_point start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	unsigned long long hash(unsigned long long seed, unsigned long long value) {
+		return (seed ^ value) * 1099511628211ull;
+	}
+
+	/**
+	Row-major terrain of size x size heights, multiples of OFFSET
+	*/
+	std::vector<float> generate(int size) {
+		std::vector<float> data(static_cast<size_t>(size) * size);
+
+		parallel::forRange(0, size, [&](size_t row) {
+			for (int col = 0; col < size; ++col) {
+				float height = 40.0f + 12.0f * std::sin(0.011f * col) * std::cos(0.007f * row) + 3.0f * std::sin(0.09f * (col + row));
+				data[col + row * static_cast<size_t>(size)] = std::round(height / OFFSET) * OFFSET;
+			}
+		});
+
+		return data;
+	}
+
+	void run(const std::vector<float>& terrain, int size, unsigned block, HeightField::Layout layout, int repeat, Result& result) {
+		float minHeight = *std::min_element(terrain.begin(), terrain.end());
+		float maxHeight = *std::max_element(terrain.begin(), terrain.end());
+
+		for (int i = 0; i < repeat; ++i) {
+			auto start = Clock::now();
+			HeightField heightField(vec2(0.0f), vec2(1.0f), ivec2(size), minHeight, maxHeight, -999.0f, const_cast<float*>(terrain.data()), nullptr, layout);
+			result.convertSeconds = std::min(result.convertSeconds, since(start));
+
+			start = Clock::now();
+			HeightFieldCompressor compressor(&heightField, block, block, OFFSET);
+			compressor.compress();
+			result.compressSeconds = std::min(result.compressSeconds, since(start));
+
+			start = Clock::now();
+			HeightMipmap maxMipmap(&heightField, MipmapMode::MAX);
+			HeightMipmap minMipmap(&heightField, MipmapMode::MIN);
+			maxMipmap.computeMipmap();
+			minMipmap.computeMipmap();
+			result.mipmapSeconds = std::min(result.mipmapSeconds, since(start));
+
+			if (i == 0) {
+				auto data = compressor.getData();
+				result.compressedWords = data.size();
+				result.compressedHash = 14695981039346656037ull;
+				for (auto word : data)
+					result.compressedHash = hash(result.compressedHash, word);
+				for (auto base : compressor.getBaseValues())
+					result.compressedHash = hash(result.compressedHash, static_cast<unsigned long long>(std::llround(base / OFFSET)));
+
+				// Every level is visited in row-major order, whatever the layout
+				result.mipmapChecksum = 0;
+				for (int level = 1; (size >> level) > 0; ++level)
+					for (int row = 0; row < (size >> level); ++row)
+						for (int col = 0; col < (size >> level); ++col)
+							result.mipmapChecksum += (maxMipmap.getData(col, row, level) - minMipmap.getData(col, row, level)) * (1 + (col ^ row) % 7);
+			}
+		}
+	}
+
+}
+
+int main(int argc, char** argv) {
+	int size = 4096;
+	unsigned block = 8;
+	int repeat = 3;
+	std::string outputPath;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--block") && i + 1 < argc)
+			block = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			parallel::setThreads(atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			outputPath = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--size 4096] [--block 8] [--repeat 3] [--threads N] [--output file.csv]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (size <= 0 || block == 0 || repeat <= 0) {
+		std::cerr << "Size, block and number of repetitions must be positive" << std::endl;
+		return 1;
+	}
+
+	std::ofstream outputFile;
+	if (!outputPath.empty()) {
+		outputFile.open(outputPath);
+		if (!outputFile) {
+			std::cerr << "Cannot open " << outputPath << " for writing" << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& output = outputPath.empty() ? std::cout : outputFile;
+
+	std::cerr << "Heightfield " << size << "x" << size << ", blocks of " << block << "x" << block << ", threads: " << parallel::getThreads() << std::endl;
+	std::vector<float> terrain = generate(size);
+
+	output << "size,block,layout,convert_ms,compress_ms,mipmap_ms,compressed_words,compressed_hash,mipmap_checksum" << std::endl;
+
+	const HeightField::Layout layouts[] = { HeightField::Layout::ROW_MAJOR, HeightField::Layout::MORTON };
+	const char* names[] = { "row_major", "morton" };
+
+	for (int i = 0; i < 2; ++i) {
+		Result result;
+		run(terrain, size, block, layouts[i], repeat, result);
+
+		output << size << "," << block << "," << names[i] << ","
+			<< result.convertSeconds * 1000.0 << ","
+			<< result.compressSeconds * 1000.0 << ","
+			<< result.mipmapSeconds * 1000.0 << ","
+			<< result.compressedWords << ","
+			<< result.compressedHash << ","
+			<< result.mipmapChecksum << std::endl;
+	}
+
+	return 0;
+}
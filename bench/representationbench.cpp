@@ -0,0 +1,340 @@
+/**
+*	Compares the voxel model, the octree, the SBR, its interned copy and the QuadStack of
+*	the same generated layered datasets. For every dataset and representation a CSV row
+*	reports the build time, the memory and the point and column query throughput.
+*
+*	Usage: representationbench [--sizes 64,128,256] [--layers 2,4,8] [--depth 64]
+*		[--queries N] [--threads N] [--output file.csv]
+*
+*	Memory is reported in bytes: model_bytes is the size accounted by the representation
+*	itself and rss_delta_bytes how much the resident set of the process grew while it was
+*	built. Every representation is built in the same process after the previous ones, so
+*	memory the allocator reuses does not count and the delta can be near 0; model_bytes is
+*	the figure to compare. Point queries return the material of a voxel and column queries the intervals
+*	of a whole column; the checksums must agree between representations.
+*/
+
+#include "core/compressionmanager.h"
+#include "core/flatoctree.h"
+#include "core/internedsbr.h"
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+#include "core/voxelmodel.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	struct Result {
+		double buildSeconds;
+		double modelBytes;
+		double rssDeltaBytes;
+		double pointSeconds;
+		double columnSeconds;
+		long long pointChecksum;
+		long long columnChecksum;
+	};
+
+	struct Query {
+		unsigned x, y, z;
+	};
+
+	size_t residentBytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.WorkingSetSize;
+		return 0;
+#else
+		std::ifstream statm("/proc/self/statm");
+		size_t pages = 0, resident = 0;
+		if (statm >> pages >> resident)
+			return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		return 0;
+#endif
+	}
+
+	double since(Clock::time_point start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	std::vector<int> parseList(const char* list) {
+		std::vector<int> values;
+		std::stringstream stream(list);
+		std::string value;
+		while (std::getline(stream, value, ','))
+			values.push_back(atoi(value.c_str()));
+		return values;
+	}
+
+	/**
+	Layered terrain of size x size x depth voxels with undulating boundaries between layers
+	and lenses of another material. Voxels are stored as the readers do, in the order
+	expected by StackBasedRep
+	*/
+	ShortVM* generate(int size, int depth, int layers) {
+		ShortVM *vm = new ShortVM(ivec3(size, size, depth), vec3(1.0f), vec3(0.0f), "material");
+		short *data = vm->getBuffer();
+
+		parallel::forRange(0, size, [&](size_t x) {
+			for (int y = 0; y < size; ++y) {
+				for (int z = 0; z < depth; ++z) {
+					float relativeZ = static_cast<float>(z) / depth;
+					short material = 0;
+
+					for (int layer = 0; layer < layers; ++layer) {
+						float boundary = (layer + 1.0f) / (layers + 1) + 0.08f * std::sin(0.3f * x + layer) * std::cos(0.2f * y + layer);
+						if (relativeZ > boundary)
+							material = layer + 1;
+					}
+
+					if ((x / 4 + y / 4) % 7 == 3 && relativeZ > 0.5f && relativeZ < 0.6f)
+						material = layers + 1;
+
+					data[y + size * (x + size * static_cast<size_t>(z))] = material;
+				}
+			}
+		});
+
+		return vm;
+	}
+
+	/**
+	Runs the point queries and then a column query at the cell of every eighth point.
+	point(query) returns a material and column(x, y) the checksum of a column
+	*/
+	template<class Point, class Column>
+	void runQueries(const std::vector<Query>& queries, Point point, Column column, Result& result) {
+		auto start = Clock::now();
+		long long checksum = 0;
+		for (auto& query : queries)
+			checksum += point(query);
+		result.pointSeconds = since(start);
+		result.pointChecksum = checksum;
+
+		start = Clock::now();
+		checksum = 0;
+		for (size_t index = 0; index < queries.size(); index += 8)
+			checksum += column(queries[index].x, queries[index].y);
+		result.columnSeconds = since(start);
+		result.columnChecksum = checksum;
+	}
+
+	/**
+	Checksum of the intervals of a column given voxel by voxel
+	*/
+	template<class Voxel>
+	long long runLengthChecksum(unsigned depth, Voxel voxel) {
+		long long checksum = 0;
+		int previous = voxel(0);
+		for (unsigned z = 1; z < depth; ++z) {
+			int material = voxel(z);
+			if (material != previous) {
+				checksum += previous;
+				previous = material;
+			}
+		}
+		return checksum + previous;
+	}
+
+	void writeRow(std::ostream& output, int size, int depth, int layers, const char* name, const Result& result, size_t nQueries) {
+		output << size << "," << depth << "," << layers << "," << name << ","
+			<< result.buildSeconds * 1000.0 << ","
+			<< static_cast<long long>(result.modelBytes) << ","
+			<< static_cast<long long>(result.rssDeltaBytes) << ","
+			<< nQueries / result.pointSeconds << ","
+			<< (nQueries + 7) / 8 / result.columnSeconds << ","
+			<< result.pointChecksum << "," << result.columnChecksum << std::endl;
+	}
+
+	void runDataset(std::ostream& output, int size, int depth, int layers, size_t nQueries) {
+		std::mt19937 generator(size * 31 + layers);
+		std::uniform_int_distribution<unsigned> cell(0, size - 1), level(0, depth - 1);
+		std::vector<Query> queries(nQueries);
+		for (auto& query : queries)
+			query = { cell(generator), cell(generator), level(generator) };
+
+		Result result;
+		size_t resident = residentBytes();
+
+		// Voxel model
+		auto start = Clock::now();
+		ShortVM *vm = generate(size, depth, layers);
+		result.buildSeconds = since(start);
+		result.rssDeltaBytes = static_cast<double>(residentBytes()) - resident;
+		result.modelBytes = vm->memorySize();
+
+		const short *data = vm->getData();
+		auto voxel = [&](unsigned x, unsigned y, unsigned z) { return data[y + size * (x + size * static_cast<size_t>(z))]; };
+
+		runQueries(queries,
+			[&](const Query& query) { return voxel(query.x, query.y, query.z); },
+			[&](unsigned x, unsigned y) { return runLengthChecksum(depth, [&](unsigned z) { return voxel(x, y, z); }); },
+			result);
+		writeRow(output, size, depth, layers, "voxelmodel", result, nQueries);
+
+		// Octree, whose x axis is the fastest one of the voxel model
+		resident = residentBytes();
+		start = Clock::now();
+		ShortFlatOctree *octree = new ShortFlatOctree(*vm);
+		result.buildSeconds = since(start);
+		result.rssDeltaBytes = static_cast<double>(residentBytes()) - resident;
+		result.modelBytes = octree->memorySize();
+
+		runQueries(queries,
+			[&](const Query& query) { return octree->getValue(query.y, query.x, query.z); },
+			[&](unsigned x, unsigned y) { return runLengthChecksum(depth, [&](unsigned z) { return octree->getValue(y, x, z); }); },
+			result);
+		writeRow(output, size, depth, layers, "octree", result, nQueries);
+		delete octree;
+
+		// Stack-based representation
+		resident = residentBytes();
+		start = Clock::now();
+		ShortSBR *sbr = new ShortSBR(*vm);
+		result.buildSeconds = since(start);
+		result.rssDeltaBytes = static_cast<double>(residentBytes()) - resident;
+		result.modelBytes = sbr->memorySize();
+
+		float minHeight = sbr->getMinHeight(), maxHeight = sbr->getMaxHeight(), spacingZ = vm->getSpacingZ();
+		auto height = [&](unsigned z) { return minHeight + (z + 0.5f) * spacingZ; };
+
+		runQueries(queries,
+			[&](const Query& query) { return sbr->getStack(query.x, query.y).getAttribute(height(query.z)); },
+			[&](unsigned x, unsigned y) {
+				long long checksum = 0;
+				for (auto& interval : sbr->getStack(x, y).getIntervals())
+					checksum += interval._attribute;
+				return checksum;
+			},
+			result);
+		writeRow(output, size, depth, layers, "sbr", result, nQueries);
+
+		// Stack-based representation with interned material sequences
+		resident = residentBytes();
+		start = Clock::now();
+		ShortInternedSBR *interned = new ShortInternedSBR(*sbr);
+		result.buildSeconds = since(start);
+		result.rssDeltaBytes = static_cast<double>(residentBytes()) - resident;
+		result.modelBytes = interned->memorySize();
+
+		runQueries(queries,
+			[&](const Query& query) { return interned->getAttribute(query.x, query.y, height(query.z)); },
+			[&](unsigned x, unsigned y) {
+				long long checksum = 0;
+				const short *materials = interned->getMaterials(x, y);
+				for (size_t i = 0; i < interned->getLength(x, y); ++i)
+					checksum += materials[i];
+				return checksum;
+			},
+			result);
+		writeRow(output, size, depth, layers, "internedsbr", result, nQueries);
+		delete interned;
+
+		// QuadStack, built from the SBR
+		resident = residentBytes();
+		start = Clock::now();
+		CompressionManager manager(sbr);
+		manager.execute();
+		QuadStack *quadStack = manager.getQuadStack();
+		result.buildSeconds = since(start);
+		result.rssDeltaBytes = static_cast<double>(residentBytes()) - resident;
+		vec4 quadStackBytes = quadStack->memorySize();
+		result.modelBytes = quadStackBytes.x + quadStackBytes.y + quadStackBytes.z;
+
+		QuadStack::Column column;
+		runQueries(queries,
+			[&](const Query& query) { return quadStack->sample(query.x, query.y, height(query.z), maxHeight); },
+			[&](unsigned x, unsigned y) {
+				long long checksum = 0;
+				quadStack->getColumn(x, y, maxHeight, column);
+				for (auto& interval : column)
+					checksum += interval._attribute;
+				return checksum;
+			},
+			result);
+		writeRow(output, size, depth, layers, "quadstack", result, nQueries);
+
+		delete quadStack;
+		delete sbr;
+		delete vm;
+	}
+
+}
+
+int main(int argc, char** argv) {
+	std::vector<int> sizes = { 64, 128, 256 };
+	std::vector<int> layers = { 2, 4, 8 };
+	int depth = 64;
+	size_t nQueries = 1 << 20;
+	std::string outputPath;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--sizes") && i + 1 < argc)
+			sizes = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "--layers") && i + 1 < argc)
+			layers = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "--depth") && i + 1 < argc)
+			depth = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--queries") && i + 1 < argc)
+			nQueries = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			parallel::setThreads(atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			outputPath = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--sizes 64,128,256] [--layers 2,4,8] [--depth 64] [--queries N] [--threads N] [--output file.csv]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (depth <= 0 || nQueries == 0) {
+		std::cerr << "Depth and number of queries must be positive" << std::endl;
+		return 1;
+	}
+
+	std::ofstream outputFile;
+	if (!outputPath.empty()) {
+		outputFile.open(outputPath);
+		if (!outputFile) {
+			std::cerr << "Cannot open " << outputPath << " for writing" << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& output = outputPath.empty() ? std::cout : outputFile;
+
+	output << "size,depth,layers,representation,build_ms,model_bytes,rss_delta_bytes,point_queries_per_s,column_queries_per_s,point_checksum,column_checksum" << std::endl;
+
+	for (int size : sizes) {
+		for (int nLayers : layers) {
+			if (size <= 0 || (size & (size - 1)) != 0) {
+				std::cerr << "Skipping size " << size << ": the QuadStack needs a power-of-two grid" << std::endl;
+				continue;
+			}
+
+			std::cerr << "Dataset " << size << "x" << size << "x" << depth << ", " << nLayers << " layers, threads: " << parallel::getThreads() << std::endl;
+			runDataset(output, size, depth, nLayers, nQueries);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/**
+*	Compares the stream based VTK reader with the parallel memory mapped reader.
+*
+*	Usage: vtkreaderbench <file.vtk> [threads] [--generate dimX dimY dimZ]
+*
+*	With --generate a synthetic layered dataset is first written to <file.vtk>.
+*/
+
+#include "core/parallel.h"
+#include "io/parallelvtkgridreader.h"
+#include "io/vtkgridreader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+	void generate(const std::string& filePath, int dimX, int dimY, int dimZ) {
+		std::ofstream output(filePath);
+
+		output << "# vtk DataFile Version 3.0\n";
+		output << "Synthetic layered terrain\n";
+		output << "ASCII\n";
+		output << "DATASET STRUCTURED_POINTS\n";
+		output << "DIMENSIONS " << dimX + 1 << " " << dimY + 1 << " " << dimZ + 1 << "\n";
+		output << "SPACING 1 1 1\n";
+		output << "ORIGIN 0 0 0\n";
+		output << "CELL_DATA " << static_cast<long long>(dimX) * dimY * dimZ << "\n";
+		output << "SCALARS material short\n";
+		output << "LOOKUP_TABLE default\n";
+
+		std::string line;
+		for (int z = 0; z < dimZ; ++z) {
+			for (int x = 0; x < dimX; ++x) {
+				line.clear();
+				for (int y = 0; y < dimY; ++y) {
+					int layer = (z * 8) / dimZ + ((x / 16 + y / 16) % 3 == 0 ? 1 : 0);
+					line += std::to_string(layer);
+					line += ' ';
+				}
+				line += '\n';
+				output << line;
+			}
+		}
+	}
+
+	template<class Reader>
+	ShortVM* run(const char* name, const std::string& filePath, double fileBytes) {
+		Reader reader;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		ShortVM *vm = reader.open(filePath);
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		if (!vm) {
+			std::cerr << name << ": cannot read " << filePath << std::endl;
+			return nullptr;
+		}
+
+		double seconds = std::chrono::duration<double>(stop - start).count();
+		std::cout << name << ": " << seconds << " s, " << fileBytes / seconds / (1 << 20) << " MB/s" << std::endl;
+
+		return vm;
+	}
+
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <file.vtk> [threads] [--generate dimX dimY dimZ]" << std::endl;
+		return 1;
+	}
+
+	std::string filePath = argv[1];
+
+	for (int i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "--generate") && i + 3 < argc) {
+			generate(filePath, atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+			i += 3;
+		} else {
+			parallel::setThreads(atoi(argv[i]));
+		}
+	}
+
+	std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+	if (!file) {
+		std::cerr << "Cannot open " << filePath << std::endl;
+		return 1;
+	}
+	double fileBytes = static_cast<double>(file.tellg());
+	file.close();
+
+	std::cout << "File size: " << fileBytes / (1 << 20) << " MB, threads: " << parallel::getThreads() << std::endl;
+
+	ShortVM *parallelVM = run<ShortParallelVTKReader>("Parallel reader", filePath, fileBytes);
+	ShortVM *streamVM = run<ShortVTKReader>("Stream reader", filePath, fileBytes);
+
+	if (!parallelVM || !streamVM) {
+		delete parallelVM;
+		delete streamVM;
+		return 1;
+	}
+
+	int status = 0;
+	if (parallelVM->getNData() != streamVM->getNData()
+		|| memcmp(parallelVM->getData(), streamVM->getData(), parallelVM->getNData() * sizeof(short))) {
+		std::cerr << "Readers disagree" << std::endl;
+		status = 1;
+	}
+
+	delete parallelVM;
+	delete streamVM;
+
+	return status;
+}
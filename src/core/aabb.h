@@ -7,7 +7,7 @@
 #ifndef AABB_H
 #define AABB_H
 
-#include <glm\glm.hpp>
+#include <glm/glm.hpp>
 
 using glm::ivec3;
 using glm::vec3;
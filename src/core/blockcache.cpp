@@ -0,0 +1,163 @@
+#include "blockcache.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+	std::atomic<unsigned> nextThread(0);
+
+	thread_local unsigned threadIndex = nextThread.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool BlockCache::Slot::read(uint64_t owner, uint64_t block, unsigned first, unsigned count, float *values) const {
+	uint32_t version = _version.load(std::memory_order_acquire);
+	if ((version & 1) || _owner.load(std::memory_order_relaxed) != owner || _block.load(std::memory_order_relaxed) != block)
+		return false;
+
+	for (unsigned i = 0; i < count; ++i)
+		values[i] = _values[first + i].load(std::memory_order_relaxed);
+
+	// The values are only valid if no writer started meanwhile
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return _version.load(std::memory_order_relaxed) == version;
+}
+
+void BlockCache::Slot::write(uint64_t owner, uint64_t block, const float *values, unsigned count) {
+	uint32_t version = _version.load(std::memory_order_relaxed);
+	_version.store(version + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	_owner.store(owner, std::memory_order_relaxed);
+	_block.store(block, std::memory_order_relaxed);
+	for (unsigned i = 0; i < count; ++i)
+		_values[i].store(values[i], std::memory_order_relaxed);
+
+	_version.store(version + 2, std::memory_order_release);
+}
+
+BlockCache::BlockCache(size_t budget, unsigned shards) :
+	_nSets(std::max<size_t>(budget / (sizeof(Slot) * WAYS + sizeof(Tags) + 2), 1)),
+	_nShards(shards ? shards : 4 * std::max(1u, std::thread::hardware_concurrency())),
+	_slots(nullptr),
+	_tags(new Tags[_nSets]()),
+	_referenced(new std::atomic<unsigned char>[_nSets]()),
+	_hands(new unsigned char[_nSets]()) {
+
+	_nShards = static_cast<unsigned>(std::min<size_t>(_nShards, _nSets));
+	_shards.reset(new Shard[_nShards]());
+	_counters.reset(new Counters[COUNTERS]());
+}
+
+BlockCache::~BlockCache() {
+	delete[] _slots.load();
+}
+
+uint64_t BlockCache::hash(uint64_t owner, uint64_t block) {
+	uint64_t key = owner * 0x9E3779B97F4A7C15ull ^ block;
+	key = (key ^ (key >> 31)) * 0xBF58476D1CE4E5B9ull;
+	key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+	return (key ^ (key >> 31)) | 1;
+}
+
+BlockCache::Counters& BlockCache::getCounters() const {
+	return _counters[threadIndex % COUNTERS];
+}
+
+bool BlockCache::find(uint64_t owner, uint64_t block, unsigned first, unsigned count, float *values) {
+	uint64_t key = hash(owner, block);
+	size_t set = key % _nSets;
+	Slot *slots = _slots.load(std::memory_order_acquire);
+
+	for (unsigned way = 0; slots && way < WAYS; ++way) {
+		if (_tags[set]._keys[way].load(std::memory_order_relaxed) == key && slots[set * WAYS + way].read(owner, block, first, count, values)) {
+			// Avoids writing the line of the bits again on every hit
+			unsigned char bit = static_cast<unsigned char>(1u << way);
+			if (!(_referenced[set].load(std::memory_order_relaxed) & bit))
+				_referenced[set].fetch_or(bit, std::memory_order_relaxed);
+			getCounters()._hits.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	getCounters()._misses.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void BlockCache::insert(uint64_t owner, uint64_t block, const float *values, unsigned count) {
+	uint64_t key = hash(owner, block);
+	size_t set = key % _nSets;
+	std::call_once(_allocation, [this]() { _slots.store(new Slot[_nSets * WAYS](), std::memory_order_release); });
+
+	Shard& shard = getShard(set);
+	Slot *slots = _slots.load(std::memory_order_relaxed) + set * WAYS;
+	std::atomic<uint64_t> *keys = _tags[set]._keys;
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	for (unsigned way = 0; way < WAYS; ++way)
+		if (keys[way].load(std::memory_order_relaxed) == key && slots[way]._owner.load(std::memory_order_relaxed) == owner && slots[way]._block.load(std::memory_order_relaxed) == block)
+			return;
+
+	// Referenced slots are given a second chance as the hand sweeps over them
+	unsigned char& hand = _hands[set];
+	while (keys[hand].load(std::memory_order_relaxed) != 0 && (_referenced[set].fetch_and(static_cast<unsigned char>(~(1u << hand)), std::memory_order_relaxed) & (1u << hand)))
+		hand = (hand + 1) % WAYS;
+
+	if (keys[hand].load(std::memory_order_relaxed) != 0)
+		shard._evictions.fetch_add(1, std::memory_order_relaxed);
+	else
+		shard._blocks.fetch_add(1, std::memory_order_relaxed);
+
+	// Readers that still match the old key fail on the owner, the block or the version
+	keys[hand].store(0, std::memory_order_relaxed);
+	slots[hand].write(owner, block, values, count);
+	keys[hand].store(key, std::memory_order_release);
+	hand = (hand + 1) % WAYS;
+}
+
+void BlockCache::clear() {
+	Slot *slots = _slots.load(std::memory_order_acquire);
+	for (size_t set = 0; slots && set < _nSets; ++set) {
+		std::lock_guard<std::mutex> lock(getShard(set)._mutex);
+		for (unsigned way = 0; way < WAYS; ++way) {
+			_tags[set]._keys[way].store(0, std::memory_order_relaxed);
+			slots[set * WAYS + way].write(0, 0, nullptr, 0);
+		}
+		_referenced[set].store(0, std::memory_order_relaxed);
+	}
+
+	for (unsigned shard = 0; shard < _nShards; ++shard)
+		_shards[shard]._blocks.store(0, std::memory_order_relaxed);
+}
+
+BlockCache::Statistics BlockCache::getStatistics() const {
+	Statistics statistics = {};
+	for (unsigned counter = 0; counter < COUNTERS; ++counter) {
+		statistics._hits += _counters[counter]._hits.load(std::memory_order_relaxed);
+		statistics._misses += _counters[counter]._misses.load(std::memory_order_relaxed);
+	}
+	for (unsigned shard = 0; shard < _nShards; ++shard) {
+		statistics._evictions += _shards[shard]._evictions.load(std::memory_order_relaxed);
+		statistics._blocks += _shards[shard]._blocks.load(std::memory_order_relaxed);
+	}
+
+	statistics._capacity = _nSets * WAYS;
+	statistics._bytes = _nSets * (sizeof(Tags) + 2);
+	if (_slots.load(std::memory_order_relaxed))
+		statistics._bytes += statistics._capacity * sizeof(Slot);
+	return statistics;
+}
+
+void BlockCache::resetStatistics() {
+	for (unsigned counter = 0; counter < COUNTERS; ++counter) {
+		_counters[counter]._hits.store(0, std::memory_order_relaxed);
+		_counters[counter]._misses.store(0, std::memory_order_relaxed);
+	}
+	for (unsigned shard = 0; shard < _nShards; ++shard)
+		_shards[shard]._evictions.store(0, std::memory_order_relaxed);
+}
+
+BlockCache& BlockCache::getShared() {
+	static BlockCache cache;
+	return cache;
+}
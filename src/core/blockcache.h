@@ -0,0 +1,186 @@
+/**
+*	Cache of decoded heightfield blocks shared by every thread. Blocks are identified by
+*	the compressor that encoded them and their index along its block curve. Compressors
+*	look it up behind the blocks each thread keeps, only for the blocks they would decode
+*	whole otherwise, so a hit replaces a decoding by a copy.
+*
+*	The cache is set associative: a block can only live in the WAYS slots of the set its
+*	key hashes to, and sets are spread among shards. The tags of a set share a cache line,
+*	so a lookup reads that line and the slot that matches. Hits are lock-free, every slot
+*	is a seqlock whose readers give up as a miss if a writer got in the way. Lookups are
+*	counted on a line of their thread, not of the shard. Misses decode the block outside
+*	any lock and then take the mutex of the shard to insert it, evicting with the CLOCK
+*	policy among the slots of the set. Slots are allocated by the first insertion, so a
+*	cache that is never used takes no memory.
+*
+*	@class BlockCache
+*/
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class BlockCache {
+
+public:
+
+	static const unsigned BLOCK_VALUES = 64; /*< Values of a decoded 8x8 block, larger blocks are not cached */
+
+	static const unsigned WAYS = 8; /*< Slots of every set */
+
+	static const size_t DEFAULT_BUDGET = 16 << 20; /*< Bytes of the shared cache */
+
+	static const unsigned COUNTERS = 64; /*< Lines of lookup counters, threads beyond them share */
+
+	struct Statistics {
+		uint64_t _hits;
+		uint64_t _misses;
+		uint64_t _evictions;
+		size_t _blocks; /*< Blocks held */
+		size_t _capacity; /*< Blocks that fit in the budget */
+		size_t _bytes; /*< Memory taken by the cache, the slots are allocated by the first insertion */
+
+		double hitRate() const { return _hits + _misses == 0 ? 0.0 : static_cast<double>(_hits) / (_hits + _misses); }
+	};
+
+private:
+
+	struct Slot {
+		std::atomic<uint32_t> _version; /*< Odd while the slot is written */
+		std::atomic<uint64_t> _owner; /*< Identifier of the compressor, 0 for empty slots */
+		std::atomic<uint64_t> _block;
+		std::atomic<float> _values[BLOCK_VALUES]; /*< Row-major order of the block */
+
+		/**
+		Copies count values from first on if the slot holds the block
+		*/
+		bool read(uint64_t owner, uint64_t block, unsigned first, unsigned count, float *values) const;
+
+		void write(uint64_t owner, uint64_t block, const float *values, unsigned count);
+	};
+
+	/**
+	Hashed keys of the slots of a set, 0 for empty slots
+	*/
+	struct alignas(64) Tags {
+		std::atomic<uint64_t> _keys[WAYS];
+	};
+
+	struct alignas(64) Shard {
+		std::mutex _mutex; /*< Serializes the insertions */
+		std::atomic<uint64_t> _evictions;
+		std::atomic<size_t> _blocks;
+	};
+
+	/**
+	Lookups of a thread, so that hits do not write a line shared with the other threads
+	*/
+	struct alignas(64) Counters {
+		std::atomic<uint64_t> _hits;
+		std::atomic<uint64_t> _misses;
+	};
+
+	size_t _nSets;
+
+	unsigned _nShards;
+
+	std::atomic<Slot*> _slots; /*< Null until the first insertion */
+
+	std::unique_ptr<Tags[]> _tags;
+
+	std::unique_ptr<std::atomic<unsigned char>[]> _referenced; /*< Second chances of the CLOCK policy, a bit per slot of every set */
+
+	std::unique_ptr<unsigned char[]> _hands; /*< Position of the CLOCK hand of every set */
+
+	std::once_flag _allocation;
+
+	std::unique_ptr<Shard[]> _shards;
+
+	std::unique_ptr<Counters[]> _counters;
+
+	/**
+	Hashed key of a block, never 0
+	*/
+	static uint64_t hash(uint64_t owner, uint64_t block);
+
+	Shard& getShard(size_t set) const { return _shards[set % _nShards]; }
+
+	Counters& getCounters() const;
+
+public:
+
+	/**
+	Cache taking about budget bytes. The shards default to four per hardware thread
+	*/
+	explicit BlockCache(size_t budget = DEFAULT_BUDGET, unsigned shards = 0);
+
+	BlockCache(const BlockCache&) = delete;
+
+	BlockCache& operator=(const BlockCache&) = delete;
+
+	/**
+	Copies count values from first on of a block, in row-major order of the block, if it
+	is cached
+	*/
+	bool find(uint64_t owner, uint64_t block, unsigned first, unsigned count, float *values);
+
+	/**
+	Inserts a block of count values, at most BLOCK_VALUES, decoded after a missed lookup,
+	unless another thread already did
+	*/
+	void insert(uint64_t owner, uint64_t block, const float *values, unsigned count);
+
+	/**
+	Copies count values from first on of a block of blockValues values, at most BLOCK_VALUES,
+	in row-major order of the block. On a miss decode(float *values) fills the whole block,
+	which is then cached
+	*/
+	template<class Decoder>
+	void get(uint64_t owner, uint64_t block, unsigned first, unsigned count, float *values, unsigned blockValues, Decoder decode);
+
+	/**
+	Value at cell of a block of blockValues values
+	*/
+	template<class Decoder>
+	float get(uint64_t owner, uint64_t block, unsigned cell, unsigned blockValues, Decoder decode) {
+		float value;
+		get(owner, block, cell, 1, &value, blockValues, decode);
+		return value;
+	}
+
+	/**
+	Drops every block. Not to be called while other threads use the cache
+	*/
+	void clear();
+
+	Statistics getStatistics() const;
+
+	void resetStatistics();
+
+	/**
+	Cache used by the compressors unless told otherwise
+	*/
+	static BlockCache& getShared();
+
+	~BlockCache();
+};
+
+template<class Decoder>
+void BlockCache::get(uint64_t owner, uint64_t block, unsigned first, unsigned count, float *values, unsigned blockValues, Decoder decode) {
+	if (find(owner, block, first, count, values))
+		return;
+
+	float decoded[BLOCK_VALUES];
+	decode(decoded);
+	for (unsigned i = 0; i < count; ++i)
+		values[i] = decoded[first + i];
+
+	insert(owner, block, decoded, blockValues);
+}
+
+#endif
@@ -1,7 +1,7 @@
 #include "compressionmanager.h"
 #include <chrono>
 
-void CompressionManager::execute() {
+void CompressionManager::execute(bool releaseData) {
 	auto startTD = std::chrono::high_resolution_clock::now();
 	_quadStack->topDownPhase();
 	auto stopTD = std::chrono::high_resolution_clock::now();
@@ -18,9 +18,9 @@ void CompressionManager::execute() {
 	auto durationRH = std::chrono::duration_cast<std::chrono::milliseconds>(stopRH - startRH).count();
 
 	auto startCH = std::chrono::high_resolution_clock::now();
-	_quadStack->compressHeightField(_sbr->getHeightResolution());
+	_quadStack->compressHeightField(_sbr->getHeightResolution(), releaseData);
 	auto stopCH = std::chrono::high_resolution_clock::now();
-	auto durationCH = std::chrono::duration_cast<std::chrono::milliseconds>(stopRH - startRH).count();
-	auto durationTotal = std::chrono::duration_cast<std::chrono::milliseconds>(stopRH - startTD).count();
+	auto durationCH = std::chrono::duration_cast<std::chrono::milliseconds>(stopCH - startCH).count();
+	auto durationTotal = std::chrono::duration_cast<std::chrono::milliseconds>(stopCH - startTD).count();
 
 }
\ No newline at end of file
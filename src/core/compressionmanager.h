@@ -23,7 +23,11 @@ public:
 	CompressionManager(ShortSBR *sbr) : _sbr(sbr), _quadStack(new QuadStack(sbr)) {};
 
 	QuadStack* getQuadStack() { return _quadStack; }
-	void execute();
+
+	/**
+	Builds and compresses the QuadStack. With releaseData the raw heights are freed once compressed
+	*/
+	void execute(bool releaseData = false);
 
 	~CompressionManager() {};
 };
@@ -0,0 +1,342 @@
+/**
+*	Octree of a voxel model built bottom-up and stored as a flat node array.
+*
+*	The subdivision is the same as the one of Octree: a node is split at the middle of
+*	its range until it is uniform or one of its sides is a single voxel, which makes it a
+*	RAW leaf whose voxels are copied. Instead of measuring every node before splitting it,
+*	the uniformity of a node is derived from its eight children in a single post-order
+*	pass. Only regions of at most SMALL_REGION voxels are scanned before subdividing
+*	them, so voxels are read a bounded number of times instead of once per level. The
+*	eight top-level octants are built in parallel.
+*
+*	The eight children of an internal node are consecutive in the node array; node regions
+*	are implicit and recomputed while descending.
+*/
+
+#ifndef FLAT_OCTREE_H
+#define FLAT_OCTREE_H
+
+#include "core/parallel.h"
+#include "core/voxelmodel.h"
+
+#include <cstdint>
+#include <vector>
+
+template<class T>
+class FlatOctree {
+
+public:
+
+	enum NodeType : uint8_t { INTERNAL, UNIFORM, RAW };
+
+	struct Node {
+		uint32_t _index; /** < INTERNAL: first child, RAW: offset of the voxels in the raw buffer */
+		T _value; /** < UNIFORM: value of every voxel of the node */
+		NodeType _type;
+	};
+
+	/**
+	Region of voxels of a node, with exclusive bound
+	*/
+	struct Region {
+		unsigned _initX, _initY, _initZ;
+		unsigned _boundX, _boundY, _boundZ;
+
+		bool lastVoxel() const { return _boundX == _initX + 1 || _boundY == _initY + 1 || _boundZ == _initZ + 1; }
+
+		size_t size() const { return static_cast<size_t>(_boundX - _initX) * (_boundY - _initY) * (_boundZ - _initZ); }
+
+		/**
+		Region of child, numbered as in Octree: bit 0 for x, bit 1 for y and bit 2 for z
+		*/
+		Region child(unsigned child) const;
+	};
+
+private:
+
+	std::vector<Node> _nodes; /** < Flat node array, the root is the first node */
+
+	std::vector<T> _raw; /** < Voxels of the RAW leaves */
+
+	ivec3 _dimension;
+
+	/**
+	Partial tree built by a thread. Its root is its first node
+	*/
+	struct Subtree {
+		std::vector<Node> _nodes;
+		std::vector<T> _raw;
+	};
+
+	/**
+	Builds in post-order the node of region stored at slot. Returns true if every voxel
+	of the region has the same value, which is then stored in value
+	*/
+	static bool build(const VoxelModel<T>& vm, const Region& region, size_t slot, Subtree& tree, T& value);
+
+	/**
+	Copies the voxels of a single voxel thick region as a RAW leaf
+	*/
+	static bool buildRaw(const VoxelModel<T>& vm, const Region& region, Node& node, Subtree& tree, T& value);
+
+	/**
+	Scans region until a voxel differs from the first one, which is stored in value
+	*/
+	static bool isUniform(const VoxelModel<T>& vm, const Region& region, T& value);
+
+	static const size_t SMALL_REGION = 512; /** < Regions up to this size are scanned before being subdivided */
+
+public:
+
+	FlatOctree(const VoxelModel<T>& vm);
+
+	const std::vector<Node>& getNodes() const { return _nodes; }
+
+	size_t getNNodes() const { return _nodes.size(); }
+
+	size_t getNRawVoxels() const { return _raw.size(); }
+
+	Region getRootRegion() const { Region root = { 0, 0, 0, unsigned(_dimension.x), unsigned(_dimension.y), unsigned(_dimension.z) }; return root; }
+
+	T getValue(unsigned x, unsigned y, unsigned z) const;
+
+	/**
+	Memory consumption in bytes
+	*/
+	double memorySize() const;
+
+	/**
+	Return a Voxel Model with the original size
+	*/
+	VoxelModel<T>* decompress(vec3 spacing, vec3 origin, std::string attributeName) const;
+};
+
+
+template<class T>
+typename FlatOctree<T>::Region FlatOctree<T>::Region::child(unsigned child) const {
+	unsigned halfX = (_boundX + _initX + 1) / 2;
+	unsigned halfY = (_boundY + _initY + 1) / 2;
+	unsigned halfZ = (_boundZ + _initZ + 1) / 2;
+
+	Region region;
+	region._initX = child & 1 ? halfX : _initX;
+	region._boundX = child & 1 ? _boundX : halfX;
+	region._initY = child & 2 ? halfY : _initY;
+	region._boundY = child & 2 ? _boundY : halfY;
+	region._initZ = child & 4 ? halfZ : _initZ;
+	region._boundZ = child & 4 ? _boundZ : halfZ;
+
+	return region;
+}
+
+template<class T>
+FlatOctree<T>::FlatOctree(const VoxelModel<T>& vm) :
+_dimension(vm.getDimensionX(), vm.getDimensionY(), vm.getDimensionZ()) {
+
+	Region root = getRootRegion();
+	Subtree tree;
+	tree._nodes.resize(1);
+
+	if (root.lastVoxel()) {
+		T value;
+		buildRaw(vm, root, tree._nodes[0], tree, value);
+		_nodes.swap(tree._nodes);
+		_raw.swap(tree._raw);
+		return;
+	}
+
+	// Top-level octants are independent subtrees
+	Subtree octants[8];
+	T values[8];
+	bool uniform[8];
+
+	parallel::forChunks(8, [&](size_t child) {
+		octants[child]._nodes.resize(1);
+		uniform[child] = build(vm, root.child(child), 0, octants[child], values[child]);
+	});
+
+	bool uniformRoot = true;
+	for (int child = 0; child < 8; ++child)
+		uniformRoot = uniformRoot && uniform[child] && values[child] == values[0];
+
+	if (uniformRoot) {
+		Node node = { 0, values[0], UNIFORM };
+		_nodes.assign(1, node);
+		return;
+	}
+
+	// Merge: the root, its eight children and then the descendants of every octant
+	size_t nNodes = 9, nRaw = 0;
+	for (auto& octant : octants) {
+		nNodes += octant._nodes.size() - 1;
+		nRaw += octant._raw.size();
+	}
+
+	_nodes.reserve(nNodes);
+	_raw.reserve(nRaw);
+	_nodes.resize(9);
+	_nodes[0]._index = 1;
+	_nodes[0]._type = INTERNAL;
+
+	for (int child = 0; child < 8; ++child) {
+		Subtree& octant = octants[child];
+		uint32_t nodeBase = static_cast<uint32_t>(_nodes.size()) - 1;
+		uint32_t rawBase = static_cast<uint32_t>(_raw.size());
+
+		for (size_t index = 0; index < octant._nodes.size(); ++index) {
+			Node node = octant._nodes[index];
+			if (node._type == INTERNAL)
+				node._index += nodeBase;
+			else if (node._type == RAW)
+				node._index += rawBase;
+
+			if (index == 0)
+				_nodes[1 + child] = node;
+			else
+				_nodes.push_back(node);
+		}
+
+		_raw.insert(_raw.end(), octant._raw.begin(), octant._raw.end());
+		std::vector<Node>().swap(octant._nodes);
+		std::vector<T>().swap(octant._raw);
+	}
+}
+
+template<class T>
+bool FlatOctree<T>::buildRaw(const VoxelModel<T>& vm, const Region& region, Node& node, Subtree& tree, T& value) {
+	const T *data = vm.getData();
+	size_t dimX = vm.getDimensionX(), dimXY = dimX * vm.getDimensionY();
+	size_t offset = tree._raw.size();
+
+	node._type = RAW;
+	node._index = static_cast<uint32_t>(offset);
+
+	tree._raw.resize(offset + region.size());
+	T *raw = &tree._raw[offset];
+
+	value = data[region._initX + region._initY * dimX + region._initZ * dimXY];
+	bool uniform = true;
+
+	for (unsigned z = region._initZ; z < region._boundZ; ++z) {
+		for (unsigned y = region._initY; y < region._boundY; ++y) {
+			const T *row = data + y * dimX + z * dimXY;
+			for (unsigned x = region._initX; x < region._boundX; ++x, ++raw) {
+				*raw = row[x];
+				uniform &= row[x] == value;
+			}
+		}
+	}
+
+	node._value = value;
+	return uniform;
+}
+
+template<class T>
+bool FlatOctree<T>::isUniform(const VoxelModel<T>& vm, const Region& region, T& value) {
+	const T *data = vm.getData();
+	size_t dimX = vm.getDimensionX(), dimXY = dimX * vm.getDimensionY();
+
+	value = data[region._initX + region._initY * dimX + region._initZ * dimXY];
+
+	for (unsigned z = region._initZ; z < region._boundZ; ++z) {
+		for (unsigned y = region._initY; y < region._boundY; ++y) {
+			const T *row = data + y * dimX + z * dimXY;
+			for (unsigned x = region._initX; x < region._boundX; ++x)
+				if (row[x] != value)
+					return false;
+		}
+	}
+
+	return true;
+}
+
+template<class T>
+bool FlatOctree<T>::build(const VoxelModel<T>& vm, const Region& region, size_t slot, Subtree& tree, T& value) {
+	if (region.lastVoxel())
+		return buildRaw(vm, region, tree._nodes[slot], tree, value);
+
+	// Small uniform regions are detected directly to avoid building subtrees that collapse
+	if (region.size() <= SMALL_REGION && isUniform(vm, region, value)) {
+		Node node = { 0, value, UNIFORM };
+		tree._nodes[slot] = node;
+		return true;
+	}
+
+	// Reserve the slots of the children, which are filled after their own descendants
+	size_t firstChild = tree._nodes.size();
+	size_t rawSize = tree._raw.size();
+	tree._nodes.resize(firstChild + 8);
+
+	T values[8];
+	bool uniform = true;
+
+	for (unsigned child = 0; child < 8; ++child) {
+		bool uniformChild = build(vm, region.child(child), firstChild + child, tree, values[child]);
+		uniform = uniform && uniformChild && values[child] == values[0];
+	}
+
+	Node& node = tree._nodes[slot];
+	value = values[0];
+
+	if (uniform) {
+		// The subtree collapses into a leaf: drop everything built for it
+		tree._nodes.resize(firstChild);
+		tree._raw.resize(rawSize);
+		node._type = UNIFORM;
+		node._value = value;
+		node._index = 0;
+	} else {
+		node._type = INTERNAL;
+		node._index = static_cast<uint32_t>(firstChild);
+	}
+
+	return uniform;
+}
+
+template<class T>
+T FlatOctree<T>::getValue(unsigned x, unsigned y, unsigned z) const {
+	Region region = getRootRegion();
+	const Node *node = &_nodes[0];
+
+	while (node->_type == INTERNAL) {
+		unsigned halfX = (region._boundX + region._initX + 1) / 2;
+		unsigned halfY = (region._boundY + region._initY + 1) / 2;
+		unsigned halfZ = (region._boundZ + region._initZ + 1) / 2;
+		unsigned child = (x >= halfX ? 1 : 0) | (y >= halfY ? 2 : 0) | (z >= halfZ ? 4 : 0);
+
+		region = region.child(child);
+		node = &_nodes[node->_index + child];
+	}
+
+	if (node->_type == UNIFORM)
+		return node->_value;
+
+	unsigned sizeX = region._boundX - region._initX, sizeY = region._boundY - region._initY;
+	return _raw[node->_index + (x - region._initX) + sizeX * ((y - region._initY) + sizeY * (z - region._initZ))];
+}
+
+template<class T>
+double FlatOctree<T>::memorySize() const {
+	return static_cast<double>(_nodes.size() * sizeof(Node) + _raw.size() * sizeof(T));
+}
+
+template<class T>
+VoxelModel<T>* FlatOctree<T>::decompress(vec3 spacing, vec3 origin, std::string attributeName) const {
+	VoxelModel<T>* vm = new VoxelModel<T>(_dimension, spacing, origin, attributeName);
+	T *data = vm->getBuffer();
+	size_t dimX = _dimension.x, dimXY = dimX * _dimension.y;
+
+	parallel::forRange(0, _dimension.z, [&](size_t z) {
+		for (unsigned y = 0; y < unsigned(_dimension.y); ++y)
+			for (unsigned x = 0; x < unsigned(_dimension.x); ++x)
+				data[x + y * dimX + z * dimXY] = getValue(x, y, static_cast<unsigned>(z));
+	});
+
+	return vm;
+}
+
+using IntFlatOctree = FlatOctree<int>;
+using ShortFlatOctree = FlatOctree<short>;
+using ByteFlatOctree = FlatOctree<char>;
+
+#endif
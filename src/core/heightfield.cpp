@@ -1,74 +1,89 @@
 #include "heightfield.h"
-//#include "HeightFieldcompressor.h"
+#include "core/heightfieldcompressor.h"
+#include "core/parallel.h"
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <algorithm>
 #include <set>
 #include <fstream>
 #include <chrono>
+#include <stdexcept>
 
 
 HeightField::HeightField()
-	: _data(new float[0]) {
+	: _offset(0, 0),
+	_data(new float[0]),
+	_compressor(nullptr),
+	_layout(Layout::ROW_MAJOR) {
 }
 
 HeightField::HeightField(vec2 origin, vec2 spacing, ivec2 dimension, float minHeight, float maxHeight,
-	float nullData, float *data, HeightFieldCompressor *compressor)
+	float nullData, float *data, HeightFieldCompressor *compressor, Layout layout)
 	: _origin(origin),
 	_spacing(spacing),
 	_dimension(dimension),
+	_offset(0, 0),
 	_minHeight(minHeight),
 	_maxHeight(maxHeight),
 	_data(new float[dimension.x * dimension.y]),
 	_nullData(nullData),
 	_resolution(nullData),
-	_compressor(compressor) {
+	_compressor(compressor),
+	_layout(layout),
+	_curve(dimension.x, dimension.y) {
 
 	if (data)
-		std::copy(data, data + (dimension.x * dimension.y), _data);
-
-
+		convertLayout(data, Layout::ROW_MAJOR, _data, layout, dimension);
 }
 
 HeightField::HeightField(const HeightField& other) :
 	_origin(other._origin),
 	_spacing(other._spacing),
 	_dimension(other._dimension),
+	_offset(other._offset),
 	_minHeight(other._minHeight),
 	_maxHeight(other._maxHeight),
 	_data(new float[other._dimension.x * other._dimension.y]),
 	_nullData(other._nullData),
-	_resolution(other._resolution) {
+	_resolution(other._resolution),
+	_compressor(nullptr),
+	_layout(other._layout),
+	_curve(other._curve) {
 
-	if (other._data)
-		std::copy(other._data, other._data + (_dimension.x * _dimension.y), _data);
+	copyData(other);
 }
 
-HeightField::HeightField(const HeightField& other, iaabb2 bb) {
+HeightField::HeightField(const HeightField& other, iaabb2 bb) :
+	_compressor(nullptr),
+	_layout(other._layout) {
 	_dimension.x = bb.max.x - bb.min.x;
 	_dimension.y = bb.max.y - bb.min.y;
 	_spacing = other._spacing;
-	_origin.x = other._origin.x + _dimension.x * _spacing.x;
-	_origin.y = other._origin.y + _dimension.y * _spacing.y;
+	_origin.x = other._origin.x + bb.min.x * _spacing.x;
+	_origin.y = other._origin.y + bb.min.y * _spacing.y;
+	_offset = other._offset + bb.min;
 
 	_minHeight = std::numeric_limits<float>::max();
 	_maxHeight = std::numeric_limits<float>::min();
 	_data = new float[_dimension.x * _dimension.y];
 	_nullData = other._nullData;
 	_resolution = other._resolution;
+	_curve = MortonCurve(_dimension.x, _dimension.y);
 
-	int index = 0;
 	for (int x = bb.min.x; x < bb.max.x; ++x) {
 		for (int y = bb.min.y; y < bb.max.y; ++y) {
 			float height = other.getData(x, y);
 			if (height < _minHeight) _minHeight = height;
 			if (height > _maxHeight) _maxHeight = height;
-			_data[index++] = height;
+			setData(height, x - bb.min.x, y - bb.min.y);
 		}
 	}
 }
 
-HeightField::HeightField(const HeightField& other, Quadrant q) {
+HeightField::HeightField(const HeightField& other, Quadrant q) :
+	_compressor(nullptr),
+	_layout(other._layout) {
 	unsigned halfX = floor(other._dimension.x / 2.0);
 	unsigned halfY = floor(other._dimension.y / 2.0);
 
@@ -98,14 +113,15 @@ HeightField::HeightField(const HeightField& other, Quadrant q) {
 	_spacing.y = other._spacing.y;
 	_origin.x = other._origin.x + bb.min.x * _spacing.x;
 	_origin.y = other._origin.y + bb.min.y * _spacing.y;
+	_offset = other._offset + bb.min;
 
 	_minHeight = std::numeric_limits<float>::max();
 	_maxHeight = std::numeric_limits<float>::min();
 	_data = new float[_dimension.x * _dimension.y];
 	_nullData = other._nullData;
 	_resolution = _nullData;
+	_curve = MortonCurve(_dimension.x, _dimension.y);
 
-	int index = 0;
 	for (int x = bb.min.x; x < bb.max.x; ++x) {
 		for (int y = bb.min.y; y < bb.max.y; ++y) {
 			float height = other.getData(x, y);
@@ -128,26 +144,64 @@ HeightField& HeightField::operator=(const HeightField& other) {
 		_spacing.y = other._spacing.y;
 		_dimension.x = other._dimension.x;
 		_dimension.y = other._dimension.y;
+		_offset = other._offset;
 		_minHeight = other._minHeight;
 		_maxHeight = other._maxHeight;
 		_data = new float[other._dimension.x * other._dimension.y];
 		_nullData = other._nullData;
+		_layout = other._layout;
+		_curve = other._curve;
 
-		if (other._data)
-			std::copy(other._data, other._data + (_dimension.x * _dimension.y), _data);
+		copyData(other);
 	}
 
 	return *this;
 }
 
+void HeightField::copyData(const HeightField& other) {
+	if (other._data)
+		std::copy(other._data, other._data + (_dimension.x * _dimension.y), _data);
+	else if (other.isCompressed()) {
+		vector<float> values = other.getVectorOfData();
+		convertLayout(values.data(), Layout::ROW_MAJOR, _data, _layout, _dimension);
+	}
+}
+
+float HeightField::getCompressedData(unsigned int col, unsigned int row) const {
+	return _compressor->getHeight(col, row);
+}
+
+bool HeightField::isCompressed() const {
+	return _compressor && _compressor->blockSize() > 0;
+}
+
+void HeightField::setCompressor(HeightFieldCompressor *compressor) {
+	if (compressor == _compressor)
+		return;
+
+	if (!_data && !(compressor && compressor->blockSize() > 0))
+		throw std::logic_error("HeightField: the data was released, the new compressor must hold it");
+
+	delete _compressor;
+	_compressor = compressor;
+}
+
+void HeightField::releaseData() {
+	if (!isCompressed())
+		throw std::logic_error("HeightField: only compressed heightfields can release their data");
+
+	delete[] _data;
+	_data = nullptr;
+}
+
 double HeightField::memorySize() const {
 	return (sizeof(short)* _dimension.x * _dimension.y);
 }
 
 double HeightField::memorySizeCompressed() const {
-	//if (_compressor)
-	//	return _compressor->memorySize();
-	return 0;
+	if (isCompressed())
+		return _compressor->memorySize();
+	return memorySize();
 }
 
 double HeightField::memorySizeCompressedDelta() const {
@@ -202,15 +256,150 @@ float HeightField::getData(vec2 point) const {
 }
 
 
+vector<float> HeightField::getVectorOfData() const {
+	vector<float> values(static_cast<size_t>(_dimension.x) * _dimension.y);
+	if (_data)
+		convertLayout(_data, _layout, values.data(), Layout::ROW_MAJOR, _dimension);
+	else
+		getRegion(ivec2(0, 0), _dimension, values.data());
+	return values;
+}
+
+void HeightField::getBlock(ivec2 min, ivec2 dimension, float *values) const {
+	// An aligned power of two square inside the heightfield is a quadrant of its curve
+	int side = dimension.x;
+	if (_data && _layout == Layout::MORTON && side == dimension.y && morton::isPowerOfTwo(side) &&
+		min.x % side == 0 && min.y % side == 0 && min.x + side <= _dimension.x && min.y + side <= _dimension.y) {
+		std::memcpy(values, _data + _curve.computeMortonCode(min.x, min.y), sizeof(float) * side * side);
+		return;
+	}
+
+	const size_t CHUNK = 1024;
+	ivec2 cells[CHUNK];
+	MortonCurve curve(dimension.x, dimension.y);
+
+	for (uint64_t first = 0; first < curve.size(); first += CHUNK) {
+		size_t n = static_cast<size_t>(std::min<uint64_t>(CHUNK, curve.size() - first));
+		curve.decomputeMortonCodes(first, cells, n);
+		for (size_t i = 0; i < n; ++i)
+			values[first + i] = getData(min.x + cells[i].x, min.y + cells[i].y);
+	}
+}
+
+void HeightField::getRegion(ivec2 min, ivec2 dimension, float *values) const {
+	if (_data && _layout == Layout::ROW_MAJOR) {
+		for (int row = 0; row < dimension.y; ++row) {
+			const float *source = _data + min.x + (min.y + row) * static_cast<size_t>(_dimension.x);
+			std::copy(source, source + dimension.x, values + row * static_cast<size_t>(dimension.x));
+		}
+		return;
+	}
+
+	// The curve of a power of two square is the plain Morton code, whose x can be
+	// incremented without decoding it
+	if (_data && _dimension.x == _dimension.y && morton::isPowerOfTwo(_dimension.x)) {
+		for (int row = 0; row < dimension.y; ++row) {
+			uint64_t code = morton::encode(min.x, min.y + row);
+			for (int col = 0; col < dimension.x; ++col) {
+				*values++ = _data[code];
+				code = (((code | morton::Y_BITS) + 1) & morton::X_BITS) | (code & morton::Y_BITS);
+			}
+		}
+		return;
+	}
+
+	if (!_data) {
+		_compressor->getRegion(min, dimension, values);
+		return;
+	}
+
+	for (int row = 0; row < dimension.y; ++row)
+		for (int col = 0; col < dimension.x; ++col)
+			*values++ = getData(min.x + col, min.y + row);
+}
+
+void HeightField::setLayout(Layout layout) {
+	if (layout == _layout)
+		return;
+
+	// Compressed blocks do not depend on the layout
+	if (!_data) {
+		_layout = layout;
+		return;
+	}
+
+	float *data = new float[_dimension.x * _dimension.y];
+	convertLayout(_data, _layout, data, layout, _dimension);
+	delete[] _data;
+	_data = data;
+	_layout = layout;
+}
+
+void HeightField::convertLayout(const float *source, Layout from, float *target, Layout to, ivec2 dimension) {
+	size_t size = static_cast<size_t>(dimension.x) * dimension.y;
+	if (from == to) {
+		std::copy(source, source + size, target);
+		return;
+	}
+
+	// Runs of the curve cover small squares, so both buffers are read and written by tiles
+	const size_t CHUNK = 4096;
+	MortonCurve curve(dimension.x, dimension.y);
+	size_t dimX = dimension.x;
+
+	// Power of two squares are moved by 2x2 squares, whose four cells are consecutive
+	if (dimension.x == dimension.y && dimension.x > 1 && morton::isPowerOfTwo(dimension.x)) {
+		parallel::forRange(0, (size + CHUNK - 1) / CHUNK, [&](size_t chunk) {
+			size_t first = chunk * CHUNK, last = std::min(first + CHUNK, size);
+
+			for (size_t index = first; index < last; index += 4) {
+				uint32_t x, y;
+				morton::decode(index >> 2, x, y);
+				size_t cell = 2 * (x + y * dimX);
+
+				if (to == Layout::MORTON) {
+					target[index] = source[cell];
+					target[index + 1] = source[cell + 1];
+					target[index + 2] = source[cell + dimX];
+					target[index + 3] = source[cell + dimX + 1];
+				} else {
+					target[cell] = source[index];
+					target[cell + 1] = source[index + 1];
+					target[cell + dimX] = source[index + 2];
+					target[cell + dimX + 1] = source[index + 3];
+				}
+			}
+		});
+		return;
+	}
+
+	parallel::forRange(0, (size + CHUNK - 1) / CHUNK, [&](size_t chunk) {
+		ivec2 cells[CHUNK];
+		size_t first = chunk * CHUNK, n = std::min(CHUNK, size - first);
+		curve.decomputeMortonCodes(first, cells, n);
+
+		if (to == Layout::MORTON) {
+			for (size_t i = 0; i < n; ++i)
+				target[first + i] = source[cells[i].x + cells[i].y * dimX];
+		} else {
+			for (size_t i = 0; i < n; ++i)
+				target[cells[i].x + cells[i].y * dimX] = source[first + i];
+		}
+	});
+}
+
 float HeightField::getHeightResolution() {
 
 	if (_resolution == _nullData) {
 		_resolution = std::numeric_limits<float>::max();
 
+		vector<float> values = _data ? vector<float>() : getVectorOfData();
+		const float *data = _data ? _data : values.data();
+
 		for (int i = 0; i < (_dimension.x * _dimension.y) - 1; ++i) {
 			for (int j = i + 1; j < _dimension.x * _dimension.y; ++j) {
-				float difference = abs(_data[i] - _data[j]);
-				if (difference < _resolution && _data[i] != _data[j])
+				float difference = abs(data[i] - data[j]);
+				if (difference < _resolution && data[i] != data[j])
 					_resolution = difference;
 			}
 		}
@@ -277,8 +466,10 @@ void HeightField::computeMipmap() {
 
 
 	_mipmap.push_back(new ivec2[_dimension.x * _dimension.y]);
-	for (int i = 0; i < _dimension.x * _dimension.y; ++i)
-		_mipmap[0][i] = ivec2(_data[i], _data[i]);
+	for (int i = 0; i < _dimension.x * _dimension.y; ++i) {
+		float height = getData(i % _dimension.x, i / _dimension.x);
+		_mipmap[0][i] = ivec2(height, height);
+	}
 
 	for (int l = 1; l < maxMipmap; ++l) {
 
@@ -10,6 +10,9 @@
 
 #include <glm/glm.hpp>
 #include "core/aabb.h"
+#include "core/mortoncurve.h"
+#include <ostream>
+#include <string>
 #include <vector>
 
 
@@ -21,6 +24,16 @@ class HeightFieldCompressor;
 
 class HeightField {
 
+	public:
+
+		/**
+		Order of the cells in the data buffer
+		*/
+		enum class Layout {
+			ROW_MAJOR, /** < col + row * dimension.x */
+			MORTON /** < Along the Morton curve of the heightfield, see MortonCurve */
+		};
+
 	private:
 
 		vec2 _origin; /** < Coordinates origin */
@@ -29,11 +42,13 @@ class HeightField {
 
 		ivec2 _dimension; /** < Number of cells */
 
+		ivec2 _offset; /** < Cell of the enclosing grid where the heightfield starts */
+
 		float _minHeight; /** < Min height boundaries. Usefull for bounding box */
 
 		float _maxHeight; /** < Max height boundaries. Usefull for bounding box */
 
-		float *_data; /** < Data buffer */
+		float *_data; /** < Data buffer, null once released after compression */
 
 		float _nullData; /** < Representation value of void data */
 
@@ -43,6 +58,24 @@ class HeightField {
 
 		HeightFieldCompressor *_compressor;
 
+		Layout _layout; /** < Order of the cells in _data */
+
+		MortonCurve _curve; /** < Curve of the MORTON layout */
+
+		size_t getIndex(unsigned int col, unsigned int row) const {
+			return _layout == Layout::MORTON ? static_cast<size_t>(_curve.computeMortonCode(col, row)) : col + row * static_cast<size_t>(_dimension.x);
+		}
+
+		/**
+		Height at (col, row) decoded by the compressor, for heightfields whose data was released
+		*/
+		float getCompressedData(unsigned int col, unsigned int row) const;
+
+		/**
+		Copies the values of other, decoding them if other released its data
+		*/
+		void copyData(const HeightField& other);
+
 	public:
 
 		enum class Quadrant {
@@ -51,8 +84,11 @@ class HeightField {
 
 		HeightField();
 
+		/**
+		Constructor. data, if any, is given in row-major order whatever the layout is
+		*/
 		HeightField(vec2 origin, vec2 spacing, ivec2 dimension, float minHeight, float maxHeight,
-			float nullData, float *data, HeightFieldCompressor *compressor = nullptr);
+			float nullData, float *data, HeightFieldCompressor *compressor = nullptr, Layout layout = Layout::ROW_MAJOR);
 
 		HeightField(const HeightField& other);
 
@@ -87,13 +123,19 @@ class HeightField {
 
 		unsigned int getDimensionY() const { return _dimension.y; }
 
+		/**
+		Cell of the enclosing grid where the heightfield starts. Heightfields cut from another
+		one are offset by the cut, the rest start at (0, 0) unless told otherwise
+		*/
+		ivec2 getOffset() const { return _offset; }
+
 		float getSpacingX() const { return _spacing.x; }
 
 		float getSpacingY() const { return _spacing.y; }
 
 		float getNullData() const { return _nullData; }
 
-		float getData(unsigned int col, unsigned int row) const { return _data[col + row * _dimension.x]; }
+		float getData(unsigned int col, unsigned int row) const { return _data ? _data[getIndex(col, row)] : getCompressedData(col, row); }
 
 		ivec2 getData(unsigned int col, unsigned int row, unsigned int mipmap) const { return _mipmap[mipmap][col + row * (_dimension.x >> mipmap)]; }
 
@@ -101,15 +143,47 @@ class HeightField {
 
 		float getData(vec2 point) const;
 
-		vector<float> getVectorOfData() const { return vector<float>(_data, _data + (_dimension.x * _dimension.y)); }
+		/**
+		Values in row-major order
+		*/
+		vector<float> getVectorOfData() const;
 
+		/**
+		Data buffer, in the layout of the heightfield. Null if the data was released
+		*/
 		float* getBuffer() { return _data; }
 
+		Layout getLayout() const { return _layout; }
+
+		/**
+		Copies the values of the block at min into values, ordered along the Morton curve
+		of the block. Blocks stored contiguously are copied at once
+		*/
+		void getBlock(ivec2 min, ivec2 dimension, float *values) const;
+
+		/**
+		Copies the values of the rectangle at min into values, in row-major order of the rectangle
+		*/
+		void getRegion(ivec2 min, ivec2 dimension, float *values) const;
+
 		//@}
 
 		float getHeightResolution();
 
-		void setData(float height, unsigned int col, unsigned int row) { _data[col + row * _dimension.x] = height; }
+		void setData(float height, unsigned int col, unsigned int row) { _data[getIndex(col, row)] = height; }
+
+		void setOffset(ivec2 offset) { _offset = offset; }
+
+		/**
+		Reorders the stored data into layout
+		*/
+		void setLayout(Layout layout);
+
+		/**
+		Reorders the dimension.x * dimension.y values of source, stored in layout from,
+		into target with layout to
+		*/
+		static void convertLayout(const float *source, Layout from, float *target, Layout to, ivec2 dimension);
 
 		double memorySize() const;
 
@@ -119,9 +193,23 @@ class HeightField {
 
 		void computeMipmap();
 
-		bool isCompressed() { return !_compressor; }
+		bool isCompressed() const;
+
+		/**
+		Takes ownership of compressor, which must have already compressed the heightfield if
+		the data was released
+		*/
+		void setCompressor(HeightFieldCompressor *compressor);
+
+		HeightFieldCompressor* getCompressor() const { return _compressor; }
+
+		/**
+		Frees the values of a compressed heightfield. From then on they are decoded from the
+		compressed blocks, so the heightfield takes the memory reported by memorySizeCompressed
+		*/
+		void releaseData();
 
-		void setCompressor(HeightFieldCompressor *compressor) { _compressor = compressor; }
+		bool hasData() const { return _data != nullptr; }
 
 		friend std::ostream& operator<<(std::ostream& os, HeightField &hm);
 
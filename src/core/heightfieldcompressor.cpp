@@ -1,93 +1,171 @@
 #include "heightfieldcompressor.h"
 #include "core/mortoncurve.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <glm/vec2.hpp>
 
 using glm::vec2;
 
+namespace {
+
+	const unsigned DECODED_SLOTS = 1024; /*< Decoded blocks kept by every thread */
+
+	const unsigned DECODE_AFTER = 16; /*< Reads of a block in a row before it is decoded whole */
+
+	struct DecodedBlock {
+		uint64_t _identifier = 0; /*< Compressor of the block, 0 for empty slots */
+		uint64_t _block = 0;
+		uint64_t _seenIdentifier = 0, _seenBlock = 0; /*< Last block of the slot that was read but not decoded */
+		unsigned _seen = 0; /*< Times it was read in a row */
+		float _values[BlockCache::BLOCK_VALUES]; /*< Row-major order of the block */
+	};
+
+	thread_local DecodedBlock decodedBlocks[DECODED_SLOTS];
+
+}
+
+HeightFieldCompressor::HeightFieldCompressor(HeightField *heightField, unsigned blockCol, unsigned blockRow, float offset, std::vector<float> baseValues,
+	std::vector<int> bits, std::vector<int> pointers, std::vector<unsigned> data) :
+	_HeightField(heightField),
+	_blockRow(std::max(blockRow, 1u)),
+	_blockCol(std::max(blockCol, 1u)),
+	_offset(offset),
+	_encoding(std::make_shared<Encoding>(Encoding{ std::move(baseValues), std::move(data), std::move(pointers), std::move(bits) })),
+	_baseOffset(0),
+	_sharesEncoding(false),
+	_reference(nullptr),
+	_blockCurve((heightField->getDimensionX() + _blockRow - 1) / _blockRow, (heightField->getDimensionY() + _blockCol - 1) / _blockCol),
+	_identifier(nextIdentifier()),
+	_cache(&BlockCache::getShared()) {
+
+	const Encoding& encoding = *_encoding;
+	if (encoding._baseValues.size() != _blockCurve.size() || (!encoding._bits.empty() && (encoding._bits.size() != encoding._baseValues.size() || encoding._pointers.size() != encoding._baseValues.size())))
+		throw std::invalid_argument("Encoded heights do not match the blocks of the heightfield");
+}
 
 void HeightFieldCompressor::compress() {
+	encode(nullptr);
+}
+
+void HeightFieldCompressor::encode(const HeightFieldCompressor *reference) {
 	unsigned rows = _HeightField->getDimensionX();
 	unsigned cols = _HeightField->getDimensionY();
-	unsigned blockSize = _blockRow * _blockCol;
 
-	MortonCurve mc(rows, cols);
-	unsigned size = rows * cols;
+	// Heightfields of a single row or column keep every value as a block base
+	bool line = rows <= 1 || cols <= 1;
+	if (line)
+		_blockRow = _blockCol = 1;
+	unsigned blockRow = _blockRow;
+	unsigned blockCol = _blockCol;
 
-	vector<float> currentBlock;
-	float baseBlock = std::numeric_limits<float>::max();
+	std::shared_ptr<Encoding> encoded = std::make_shared<Encoding>();
+	Encoding& encoding = *encoded;
+
+	// Blocks follow the Morton curve of the block grid and values the curve of their block,
+	// which for power of two squares is the plain Morton curve of the heightfield
+	_blockCurve = MortonCurve((rows + blockRow - 1) / blockRow, (cols + blockCol - 1) / blockCol);
+	const MortonCurve& blockCurve = _blockCurve;
 
+	vector<float> currentBlock;
 	vector<float> aux;
+	vector<float> referenceBlock;
+	vector<ivec2> cells;
 
 	unsigned accum = 0;
 	unsigned bitPointer = 0;
-	for (int index = 0; index < size; ++index) {
-
-		vec2 mortonIndex = mc.decomputeMortonCode(index);
-		float value = _HeightField->getData(mortonIndex.x, mortonIndex.y);
-		baseBlock = value < baseBlock ? value : baseBlock;
-		
-		if (rows <= 1 || cols <= 1)
-			_baseValues.push_back(value);
-		else {
-			currentBlock.push_back(value);
-
-			if ((index + 1) % blockSize == 0) { // End of block
-
-				_pointers.push_back(bitPointer);
-				_baseValues.push_back(baseBlock);
-				float maxDiff = std::numeric_limits<float>::min();
-				for (auto height : currentBlock) {
-					float diff = height - baseBlock;
-
-					maxDiff = diff > maxDiff ? diff : maxDiff;
-					aux.push_back(diff);
+	for (uint64_t blockIndex = 0; blockIndex < blockCurve.size(); ++blockIndex) {
+		ivec2 block = blockCurve.decomputeMortonCode(blockIndex);
+		ivec2 blockMin(block.x * blockRow, block.y * blockCol);
+		ivec2 blockDimension(std::min(blockRow, rows - blockMin.x), std::min(blockCol, cols - blockMin.y));
+
+		// Heightfields in MORTON layout hand whole blocks over with a single copy
+		currentBlock.resize(static_cast<size_t>(blockDimension.x) * blockDimension.y);
+		_HeightField->getBlock(blockMin, blockDimension, currentBlock.data());
+
+		// Residuals follow the curve of the block too, the reference decodes it in row-major order
+		if (reference) {
+			referenceBlock.resize(currentBlock.size());
+			reference->getRegion(blockMin, blockDimension, referenceBlock.data());
+
+			cells.resize(currentBlock.size());
+			MortonCurve curve(blockDimension.x, blockDimension.y);
+			curve.decomputeMortonCodes(0, cells.data(), curve.size());
+			for (size_t i = 0; i < currentBlock.size(); ++i)
+				currentBlock[i] -= referenceBlock[cells[i].x + cells[i].y * blockDimension.x];
+		}
+
+		float baseBlock = std::numeric_limits<float>::max();
+		for (auto value : currentBlock)
+			baseBlock = value < baseBlock ? value : baseBlock;
+
+		if (line) {
+			encoding._baseValues.push_back(baseBlock);
+			currentBlock.clear();
+			continue;
+		}
+
+		encoding._pointers.push_back(bitPointer);
+		encoding._baseValues.push_back(baseBlock);
+		float maxDiff = std::numeric_limits<float>::min();
+		for (auto height : currentBlock) {
+			float diff = height - baseBlock;
+
+			maxDiff = diff > maxDiff ? diff : maxDiff;
+			aux.push_back(diff);
+		}
+
+		int bits = _offset == 0 ? 0 : ceil(std::log2(maxDiff / _offset + 1));
+		encoding._bits.push_back(bits);
+
+		if (bits > 0) {
+			for (int i = 0; i < aux.size(); ++i) {
+				unsigned scale = static_cast<unsigned>(std::lround(aux[i] / _offset));
+				unsigned leftBits = 32 - accum;
+				int currentBits = bits;
+
+				if (leftBits < bits && leftBits > 0) { // split shifted
+					int splitBits = leftBits;
+					currentBits = bits - splitBits;
+					unsigned splitted = extractBits(scale, currentBits, splitBits);
+					scale = extractBits(scale, 0, currentBits);
+					encoding._data[encoding._data.size() - 1] <<= leftBits;
+					encoding._data[encoding._data.size() - 1] |= splitted;
+
+					accum = (accum + splitBits) % 32;
 				}
 
-				int bits = _offset == 0 ? 0 : ceil(std::log2(maxDiff / _offset + 1));
-				_bits.push_back(bits);
-				int valuesInPack = bits == 0 ? 0 : 32 / bits;
-
-				if (bits > 0) {
-					for (int i = 0; i < aux.size(); ++i) {
-						unsigned scale = aux[i] / _offset;
-						unsigned leftBits = 32 - accum;
-						int currentBits = bits;
-
-						if (leftBits < bits && leftBits > 0) { // split shifted
-							int splitBits = leftBits;
-							currentBits = bits - splitBits;
-							unsigned splitted = extractBits(scale, currentBits, splitBits);
-							scale = extractBits(scale, 0, currentBits);
-							_data[_data.size() - 1] <<= leftBits;
-							_data[_data.size() - 1] |= splitted;
-
-							accum = (accum + splitBits) % 32;
-						}
-
-						if (accum == 0) {
-							_data.push_back(0);
-						}
-
-						accum = (accum + currentBits) % 32;
-						bitPointer += bits;
-						_data[_data.size() - 1] <<= currentBits;
-						_data[_data.size() - 1] |= scale;
-
-					}
+				if (accum == 0) {
+					encoding._data.push_back(0);
 				}
-				aux.clear();
-				currentBlock.clear();
-				baseBlock = std::numeric_limits<float>::max();
+
+				accum = (accum + currentBits) % 32;
+				bitPointer += bits;
+				encoding._data[encoding._data.size() - 1] <<= currentBits;
+				encoding._data[encoding._data.size() - 1] |= scale;
 
 			}
 		}
+		aux.clear();
+		currentBlock.clear();
 
 	}
 
-	if (!_data.empty())
-		_data[_data.size() - 1] <<= (32 - (accum % 32));
+	// A word that is already full is not shifted
+	if (!encoding._data.empty() && accum % 32 != 0)
+		encoding._data[encoding._data.size() - 1] <<= (32 - (accum % 32));
+
+	// Blocks decoded from a previous compression must not be taken from a cache
+	_identifier = nextIdentifier();
+	_encoding = encoded;
+	_baseOffset = 0;
+	_sharesEncoding = false;
+	_reference = reference;
 
 }
 
@@ -95,12 +173,288 @@ int HeightFieldCompressor::extractBits(int buffer, int firstBit, int nBits) {
 	return (((1 << nBits) - 1) & (buffer >> firstBit));
 }
 
+unsigned HeightFieldCompressor::readBits(uint64_t bitPointer, int nBits) const {
+	// Values are stored from the most significant bit on and may span two words
+	const std::vector<unsigned>& data = _encoding->_data;
+	size_t word = bitPointer >> 5;
+	uint64_t window = static_cast<uint64_t>(data[word]) << 32;
+	if (word + 1 < data.size())
+		window |= data[word + 1];
+
+	return static_cast<unsigned>((window << (bitPointer & 31)) >> (64 - nBits));
+}
+
+void HeightFieldCompressor::decodeBlock(uint64_t blockIndex, ivec2 blockDimension, float *values) const {
+	const Encoding& encoding = *_encoding;
+	float base = encoding._baseValues[blockIndex] + _baseOffset;
+	int bits = encoding._bits[blockIndex];
+	uint64_t pointer = static_cast<unsigned>(encoding._pointers[blockIndex]);
+	unsigned nValues = blockDimension.x * blockDimension.y;
+
+	// Residuals are consecutive, so they are shifted out of a window refilled a word at a time
+	unsigned residuals[BlockCache::BLOCK_VALUES];
+	if (bits == 0)
+		std::fill(residuals, residuals + nValues, 0u);
+	else {
+		const unsigned *data = encoding._data.data();
+		size_t nWords = encoding._data.size();
+		size_t word = pointer >> 5;
+		uint64_t window = static_cast<uint64_t>(data[word++]) << (32 + (pointer & 31));
+		unsigned available = 32 - (pointer & 31);
+
+		for (unsigned i = 0; i < nValues; ++i) {
+			if (available < static_cast<unsigned>(bits)) {
+				window |= static_cast<uint64_t>(word < nWords ? data[word] : 0) << (32 - available);
+				++word;
+				available += 32;
+			}
+			residuals[i] = static_cast<unsigned>(window >> (64 - bits));
+			window <<= bits;
+			available -= bits;
+		}
+	}
+
+	// Full blocks of a power of two side follow the plain Morton curve
+	if (blockDimension.x == blockDimension.y && morton::isPowerOfTwo(blockDimension.x)) {
+		for (unsigned i = 0; i < nValues; ++i) {
+			uint32_t x, y;
+			morton::decode(i, x, y);
+			values[x + y * blockDimension.x] = base + residuals[i] * _offset;
+		}
+	} else {
+		ivec2 cells[BlockCache::BLOCK_VALUES];
+		MortonCurve curve(blockDimension.x, blockDimension.y);
+		curve.decomputeMortonCodes(0, cells, nValues);
+		for (unsigned i = 0; i < nValues; ++i)
+			values[cells[i].x + cells[i].y * blockDimension.x] = base + residuals[i] * _offset;
+	}
+
+	// Residuals are added to the block of the reference, which is decoded first
+	if (_reference) {
+		ivec2 block = _blockCurve.decomputeMortonCode(blockIndex);
+		float referenceValues[BlockCache::BLOCK_VALUES];
+		_reference->getRegion(ivec2(block.x * _blockRow, block.y * _blockCol), blockDimension, referenceValues);
+		for (unsigned i = 0; i < nValues; ++i)
+			values[i] += referenceValues[i];
+	}
+}
+
+const float* HeightFieldCompressor::getDecodedBlock(uint64_t blockIndex, ivec2 blockDimension, bool decodeFirst) const {
+	// Consecutive blocks of a compressor go to consecutive slots
+	DecodedBlock& decoded = decodedBlocks[(blockIndex + _identifier * 31) % DECODED_SLOTS];
+	if (decoded._identifier == _identifier && decoded._block == blockIndex)
+		return decoded._values;
+
+	// Blocks read a few times, as random queries do, are not worth decoding whole
+	if (!decodeFirst) {
+		if (decoded._seenIdentifier != _identifier || decoded._seenBlock != blockIndex) {
+			decoded._seenIdentifier = _identifier;
+			decoded._seenBlock = blockIndex;
+			decoded._seen = 0;
+		}
+		if (++decoded._seen < DECODE_AFTER)
+			return nullptr;
+	}
+
+	// A block decoded by another thread is cheaper to copy than to decode
+	float values[BlockCache::BLOCK_VALUES];
+	unsigned blockValues = blockDimension.x * blockDimension.y;
+	bool cached = _cache && _cache->find(_identifier, blockIndex, 0, blockValues, values);
+
+	// The reference may take the same slot while the block is decoded, so it is written after
+	if (!cached) {
+		decodeBlock(blockIndex, blockDimension, values);
+		if (_cache)
+			_cache->insert(_identifier, blockIndex, values, blockValues);
+	}
+
+	std::copy(values, values + blockValues, decoded._values);
+	decoded._identifier = _identifier;
+	decoded._block = blockIndex;
+	return decoded._values;
+}
+
+float HeightFieldCompressor::getHeight(unsigned col, unsigned row) const {
+	ivec2 block(col / _blockRow, row / _blockCol);
+	uint64_t blockIndex = _blockCurve.computeMortonCode(block.x, block.y);
+	const Encoding& encoding = *_encoding;
+
+	float base = encoding._baseValues[blockIndex] + _baseOffset;
+	if (encoding._bits.empty() || encoding._bits[blockIndex] == 0)
+		return _reference ? base + _reference->getHeight(col, row) : base;
+
+	ivec2 blockMin(block.x * _blockRow, block.y * _blockCol);
+	ivec2 blockDimension(std::min(_blockRow, _HeightField->getDimensionX() - blockMin.x), std::min(_blockCol, _HeightField->getDimensionY() - blockMin.y));
+	ivec2 cell(col - blockMin.x, row - blockMin.y);
+	unsigned blockValues = blockDimension.x * blockDimension.y;
+
+	if (blockValues <= BlockCache::BLOCK_VALUES) {
+		const float *decoded = getDecodedBlock(blockIndex, blockDimension, false);
+		if (decoded)
+			return decoded[cell.x + cell.y * blockDimension.x];
+	}
+
+	MortonCurve curve(blockDimension.x, blockDimension.y);
+	uint64_t pointer = static_cast<unsigned>(encoding._pointers[blockIndex]);
+	float height = base + readBits(pointer + curve.computeMortonCode(cell.x, cell.y) * encoding._bits[blockIndex], encoding._bits[blockIndex]) * _offset;
+	return _reference ? height + _reference->getHeight(col, row) : height;
+}
+
+void HeightFieldCompressor::getRegion(ivec2 min, ivec2 dimension, float *values) const {
+	unsigned rows = _HeightField->getDimensionX();
+	unsigned cols = _HeightField->getDimensionY();
+	const Encoding& encoding = *_encoding;
+
+	// Every run of a row inside a block is taken from the decoded block at once
+	for (int row = min.y; row < min.y + dimension.y; ++row) {
+		for (int col = min.x; col < min.x + dimension.x;) {
+			ivec2 block(col / _blockRow, row / _blockCol);
+			uint64_t blockIndex = _blockCurve.computeMortonCode(block.x, block.y);
+			ivec2 blockMin(block.x * _blockRow, block.y * _blockCol);
+			ivec2 blockDimension(std::min(_blockRow, rows - blockMin.x), std::min(_blockCol, cols - blockMin.y));
+			unsigned blockValues = blockDimension.x * blockDimension.y;
+			int run = std::min(blockMin.x + blockDimension.x, min.x + dimension.x) - col;
+
+			if (encoding._bits.empty() || encoding._bits[blockIndex] == 0) {
+				float base = encoding._baseValues[blockIndex] + _baseOffset;
+				if (_reference) {
+					_reference->getRegion(ivec2(col, row), ivec2(run, 1), values);
+					for (int i = 0; i < run; ++i)
+						values[i] = base + values[i];
+				} else
+					std::fill(values, values + run, base);
+			}
+			else if (blockValues > BlockCache::BLOCK_VALUES || run == 1) {
+				for (int i = 0; i < run; ++i)
+					values[i] = getHeight(col + i, row);
+			} else {
+				const float *decoded = getDecodedBlock(blockIndex, blockDimension, true) + (col - blockMin.x) + (row - blockMin.y) * blockDimension.x;
+				std::copy(decoded, decoded + run, values);
+			}
+
+			values += run;
+			col += run;
+		}
+	}
+}
+
+uint64_t HeightFieldCompressor::nextIdentifier() {
+	static std::atomic<uint64_t> identifier(1);
+	return identifier++;
+}
+
+uint64_t HeightFieldCompressor::fingerprint() const {
+	const Encoding& encoding = *_encoding;
+	uint64_t hash = 0x9E3779B97F4A7C15ull;
+	auto mix = [&hash](uint64_t value) {
+		hash ^= value;
+		hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+		hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+		hash ^= hash >> 31;
+	};
+
+	mix(_HeightField->getDimensionX());
+	mix(_HeightField->getDimensionY());
+	mix(_blockRow);
+	mix(_blockCol);
+	uint32_t step;
+	std::memcpy(&step, &_offset, sizeof(step));
+	mix(step);
+
+	for (int bits : encoding._bits)
+		mix(static_cast<uint32_t>(bits));
+	for (unsigned word : encoding._data)
+		mix(word);
+
+	// Bases are taken relative to the first one in steps, since an offset rounds their differences
+	if (_offset > 0 && !encoding._baseValues.empty())
+		for (float base : encoding._baseValues)
+			mix(static_cast<uint64_t>(std::llround((base - encoding._baseValues[0]) / _offset)));
+
+	return hash;
+}
+
+bool HeightFieldCompressor::share(const HeightFieldCompressor& other) {
+	const Encoding& own = *_encoding;
+	const Encoding& shared = *other._encoding;
+	if (&own == &shared)
+		return true;
+
+	// Residuals only decode the same heights over the same reference, and encodings of a few
+	// cells take less than the offset
+	if (_reference || other._reference || memorySize() <= sizeof(float))
+		return false;
+
+	if (_HeightField->getDimensionX() != other._HeightField->getDimensionX() || _HeightField->getDimensionY() != other._HeightField->getDimensionY() ||
+		_blockRow != other._blockRow || _blockCol != other._blockCol || _offset != other._offset || own._baseValues.empty() ||
+		own._baseValues.size() != shared._baseValues.size() || own._bits != shared._bits || own._pointers != shared._pointers || own._data != shared._data)
+		return false;
+
+	// Every base must be rebuilt bit by bit, as the heights decoded from it
+	float baseOffset = (own._baseValues[0] + _baseOffset) - shared._baseValues[0];
+	for (size_t i = 0; i < own._baseValues.size(); ++i)
+		if (shared._baseValues[i] + baseOffset != own._baseValues[i] + _baseOffset)
+			return false;
+
+	_encoding = other._encoding;
+	_baseOffset = baseOffset;
+	_sharesEncoding = true;
+	return true;
+}
+
+bool HeightFieldCompressor::predict(const HeightFieldCompressor& reference) {
+	unsigned rows = _HeightField->getDimensionX();
+	unsigned cols = _HeightField->getDimensionY();
+	if (&reference == this || !compressed() || _encoding.use_count() > 1 || reference.getPredictionDepth() + 1 > MAX_PREDICTION_DEPTH ||
+		rows != reference._HeightField->getDimensionX() || cols != reference._HeightField->getDimensionY() ||
+		_blockRow != reference._blockRow || _blockCol != reference._blockCol || _offset != reference._offset)
+		return false;
+
+	HeightFieldCompressor independent(*this);
+	encode(&reference);
+
+	// Rounding of the residuals must not change a single decoded height
+	bool kept = memorySize() < independent.memorySize();
+	std::vector<float> heights(rows), predicted(rows);
+	for (unsigned row = 0; row < cols && kept; ++row) {
+		independent.getRegion(ivec2(0, row), ivec2(rows, 1), heights.data());
+		getRegion(ivec2(0, row), ivec2(rows, 1), predicted.data());
+		kept = std::memcmp(heights.data(), predicted.data(), rows * sizeof(float)) == 0;
+	}
+
+	if (!kept)
+		*this = independent;
+	return kept;
+}
+
+std::vector<float> HeightFieldCompressor::getBaseValues() {
+	std::vector<float> baseValues(_encoding->_baseValues);
+	for (float& base : baseValues)
+		base += _baseOffset;
+
+	return baseValues;
+}
+
+HeightFieldCompressor::Encoding& HeightFieldCompressor::ownEncoding() {
+	if (_encoding.use_count() > 1) {
+		_encoding = std::make_shared<Encoding>(*_encoding);
+		_sharesEncoding = false;
+	}
+
+	return *_encoding;
+}
+
 double HeightFieldCompressor::memorySize() const {
+	// A shared encoding is counted once, by the compressor that encoded it
+	if (_sharesEncoding)
+		return sizeof(float);
+
+	const Encoding& encoding = *_encoding;
 	double memory = 0;
-	memory += _data.size() * sizeof(int);
-	memory += _bits.size() * 5 / 8;
-	memory += _pointers.size() * sizeof(int);
-	memory += _baseValues.size() * sizeof(short);
+	memory += encoding._data.size() * sizeof(int);
+	memory += encoding._bits.size() * 5 / 8;
+	memory += encoding._pointers.size() * sizeof(int);
+	memory += encoding._baseValues.size() * sizeof(short);
 
 	return memory;
 }
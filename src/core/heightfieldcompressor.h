@@ -9,61 +9,193 @@
 #ifndef HEIGHT_MAP_COMPRESSOR_H
 #define HEIGHT_MAP_COMPRESSOR_H
 
+#include "core/blockcache.h"
 #include "core/heightfield.h"
+#include "core/mortoncurve.h"
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <bitset>
 
 class HeightFieldCompressor {
+
+	/**
+	* Encoded heights. Compressors of heightfields equal up to a constant offset share them
+	*/
+	struct Encoding {
+		std::vector<float> _baseValues;
+		std::vector<unsigned> _data;
+		std::vector<int> _pointers;
+		std::vector<int> _bits;
+	};
+
 	HeightField *_HeightField;
 	unsigned _blockRow;
 	unsigned _blockCol;
 	unsigned _wordSize;
 	float _offset;
-	std::vector<float> _baseValues;
-	std::vector<unsigned> _data;
-	std::vector<int> _pointers;
-	std::vector<int> _bits;
+	std::shared_ptr<Encoding> _encoding;
+	float _baseOffset; /*< Added to the base values of a shared encoding, 0 for the own one */
+	bool _sharesEncoding; /*< Tells if the encoding was taken from another compressor by share */
+	const HeightFieldCompressor *_reference; /*< Heights the encoded ones are residuals of, none if null */
 	std::vector<bool> _bitData;
 	unsigned _indexBase;
 	unsigned _indexPointers;
 	unsigned _indexData;
 	unsigned _indexBits;
 	unsigned _blockSize;
+	MortonCurve _blockCurve; /*< Order of the blocks in the compressed data */
+	uint64_t _identifier; /*< Tells the blocks of every compressor apart in the decoded block caches */
+	BlockCache *_cache; /*< Decoded blocks shared by the threads, looked up behind their own, none if null */
 
 	/**
 	* Method that extracts nBits of a buffer
 	*/
 	int extractBits(int buffer, int firstBit, int nBits);
 
+	/**
+	* Reads nBits of the compressed data from bitPointer on
+	*/
+	unsigned readBits(uint64_t bitPointer, int nBits) const;
+
+	/**
+	* Decodes the values of a block of BlockCache::BLOCK_VALUES values or less in row-major order of the block
+	*/
+	void decodeBlock(uint64_t blockIndex, ivec2 blockDimension, float *values) const;
+
+	/**
+	* Values of a block of BlockCache::BLOCK_VALUES values or less in row-major order of the
+	* block, from the blocks the thread decoded last, then from the cache, then decoded. They
+	* are valid until the thread decodes another block. Unless decodeFirst, a block is only
+	* decoded after it was asked for a few times in a row, and null is returned until then
+	*/
+	const float* getDecodedBlock(uint64_t blockIndex, ivec2 blockDimension, bool decodeFirst) const;
+
+	/**
+	* Encoding owned by this compressor alone, copied first if it is shared
+	*/
+	Encoding& ownEncoding();
+
+	/**
+	* Encodes the heights of the heightfield, minus those decoded from reference if given.
+	* The heightfield may still be decoded by this compressor meanwhile
+	*/
+	void encode(const HeightFieldCompressor *reference);
+
+	static uint64_t nextIdentifier();
+
 public:
 
 	HeightFieldCompressor(HeightField *HeightField, unsigned blockCol, unsigned blockRow, float offset) :
 		_HeightField(HeightField),
 		_blockRow(blockRow <= _HeightField->getDimensionX() ? blockRow : _HeightField->getDimensionX()),
 		_blockCol(blockCol <= _HeightField->getDimensionY() ? blockCol : _HeightField->getDimensionY()),
-		_offset(offset) {
+		_offset(offset),
+		_encoding(std::make_shared<Encoding>()),
+		_baseOffset(0),
+		_sharesEncoding(false),
+		_reference(nullptr),
+		_identifier(nextIdentifier()),
+		_cache(&BlockCache::getShared()) {
 	};
 
+	/**
+	* Compressor of heights already encoded, as getBaseValues, getEncodingBits, getPointer and
+	* getData return them, so that they can be decoded without compressing them again
+	*/
+	HeightFieldCompressor(HeightField *heightField, unsigned blockCol, unsigned blockRow, float offset, std::vector<float> baseValues,
+		std::vector<int> bits, std::vector<int> pointers, std::vector<unsigned> data);
+
+	/**
+	* Longest chain of references a compressor decodes its heights through
+	*/
+	static const unsigned MAX_PREDICTION_DEPTH = 8;
+
 	/**
 	* Actual compression algorithm
 	*/
 	void compress();
 
+	/**
+	* Encodes the heights again as residuals of the heights decoded from reference, the layer
+	* below in the same node, which are mostly a smooth thickness. The residual encoding is
+	* kept if it is smaller and decodes exactly the same heights; then every block is decoded
+	* by adding the block of reference. Returns false and keeps the current encoding otherwise.
+	* Encodings shared with other compressors are kept too.
+	*
+	* The reference must outlive this compressor, or at least its last decoded height
+	*/
+	bool predict(const HeightFieldCompressor& reference);
+
+	/**
+	* Compressor of the heights the encoded ones are residuals of, none if null
+	*/
+	const HeightFieldCompressor* getReference() const { return _reference; }
+
+	/**
+	* Number of references decoded along with the heights of this compressor
+	*/
+	unsigned getPredictionDepth() const { return _reference ? _reference->getPredictionDepth() + 1 : 0; }
+
+	/**
+	* Height at (col, row) decoded from the compressed blocks, so the heightfield does not need
+	* to keep its values. Every thread keeps the blocks it decoded last to absorb repeated access
+	*/
+	float getHeight(unsigned col, unsigned row) const;
+
+	/**
+	* Decodes the heights of the rectangle at min into values, in row-major order of the rectangle
+	*/
+	void getRegion(ivec2 min, ivec2 dimension, float *values) const;
+
+	/**
+	* Hash of the encoded heights that does not change when a constant is added to all of
+	* them, so that compressors which may share their encoding have the same one
+	*/
+	uint64_t fingerprint() const;
+
+	/**
+	* Takes the encoding of other if both decode the same heights up to a constant offset,
+	* so that every height decoded from the shared blocks plus the offset is exactly the one
+	* decoded from the own blocks, and the own encoding is larger than the offset. Returns
+	* false and keeps the own encoding otherwise
+	*/
+	bool share(const HeightFieldCompressor& other);
+
+	/**
+	* Tells if the encoding was taken from another compressor
+	*/
+	bool sharesEncoding() const { return _sharesEncoding; }
+
+	/**
+	* Identity of the encoding, the same for the compressors that share it
+	*/
+	const void* getEncodingIdentifier() const { return _encoding.get(); }
+
+	/**
+	* Offset added to the heights of the shared encoding, 0 unless it was shared
+	*/
+	float getBaseOffset() const { return _baseOffset; }
+
 	//@{
 	/** Getter and setter methods */
-	std::vector<unsigned> getData() { return _data; }
-	unsigned getData(int index) { return _data[index]; }
-	int getBit(int index) { return _bits[index]; }
-	unsigned getPointers(int index) { return _pointers[index]; }
-	float getBaseValue(int index) { return _baseValues[index]; }
-	void setBaseValue(int index, float value) { _baseValues[index] = value; }
-	std::vector<int> getEncodingBits() { return _bits; }
-	std::vector<float> getBaseValues() { return _baseValues; }
-	std::vector<int> getPointer() { return _pointers; }
-	bool compressed() const { return _bits.size() > 0; }
-	unsigned blockSize() const { return _baseValues.size(); }
+	std::vector<unsigned> getData() { return _encoding->_data; }
+	unsigned getData(int index) { return _encoding->_data[index]; }
+	int getBit(int index) { return _encoding->_bits[index]; }
+	unsigned getPointers(int index) { return _encoding->_pointers[index]; }
+	float getBaseValue(int index) { return _encoding->_baseValues[index] + _baseOffset; }
+	void setBaseValue(int index, float value) { ownEncoding()._baseValues[index] = value - _baseOffset; _identifier = nextIdentifier(); }
+	std::vector<int> getEncodingBits() { return _encoding->_bits; }
+	std::vector<float> getBaseValues();
+	std::vector<int> getPointer() { return _encoding->_pointers; }
+	bool compressed() const { return _encoding->_bits.size() > 0; }
+	unsigned blockSize() const { return _encoding->_baseValues.size(); }
+	unsigned getBlockRow() const { return _blockRow; }
+	unsigned getBlockCol() const { return _blockCol; }
+	float getOffset() const { return _offset; }
 	double memorySize() const;
+	BlockCache* getCache() const { return _cache; }
+	void setCache(BlockCache *cache) { _cache = cache; }
 	//@}
 
 	~HeightFieldCompressor();
@@ -1,5 +1,6 @@
 #include "heightmipmap.h"
 #include <algorithm>
+#include <limits>
 #include <iostream>
 #include <chrono>
 
@@ -12,6 +13,7 @@ void HeightMipmap::computeMipmap() {
 	auto minHeight = _heightField->getMinHeight();
 	auto maxHeight = _heightField->getMaxHeight();
 	auto nullData = _heightField->getNullData();
+	auto layout = _heightField->getLayout();
 
 	int maxMipmap = std::floor(std::log2(std::max(dimension.x, dimension.y))) + 1;
 
@@ -22,78 +24,78 @@ void HeightMipmap::computeMipmap() {
 		mipDimension.x = std::max(dimension.x >> l, 1);
 		mipDimension.y = std::max(dimension.y >> l, 1);
 
-		HeightField *mp = new HeightField(origin, spacing, mipDimension, minHeight, maxHeight, nullData, nullptr);
-
-		_difference.push_back(new HeightField(origin, spacing, mipDimension, minHeight, maxHeight, nullData, nullptr));
+		HeightField *mp = new HeightField(origin, spacing, mipDimension, minHeight, maxHeight, nullData, nullptr, nullptr, layout);
+		HeightField *difference = new HeightField(origin, spacing, mipDimension, minHeight, maxHeight, nullData, nullptr, nullptr, layout);
 
+		_difference.push_back(difference);
 		_mipmap.push_back(mp);
 
-		for (int x = 0; x < std::max(1, dimension.x >> l); ++x) {
-			//std::cout << "x:" << x << "/" << std::max(1, dimension.x >> l) << std::endl;
-			float x0 = x << 1;
-			float x1 = std::min(x0 + 1, (float)std::max(1, dimension.x >> (l - 1)) - 1);
-
-			for (int y = 0; y < std::max(1, dimension.y >> l); ++y) {
-				//std::cout << "y:" << y << "/" << std::max(1, dimension.y >> l) << std::endl;
-				
-				float y0 = y << 1;
-				float y1 = std::min(y0 + 1, (float)std::max(1, dimension.y >> (l - 1)) - 1);
-
-
-				//float mip1 = _mipmap[l - 1]->getVectorOfData()[(int)x1 + (int)y0 * (dimension.x >> (l - 1))];
-				//float mip2 = _mipmap[l - 1]->getVectorOfData()[(int)x1 + (int)y1 * (dimension.x >> (l - 1))];
-				//float mip3 = _mipmap[l - 1]->getVectorOfData()[(int)x0 + (int)y0 * (dimension.x >> (l - 1))];
-				//float mip4 = _mipmap[l - 1]->getVectorOfData()[(int)x0 + (int)y1 * (dimension.x >> (l - 1))];
-				
-				float mip1 = _mipmap[l - 1]->getBuffer()[(int)x1 + (int)y0 * (dimension.x >> (l - 1))];
-				float mip2 = _mipmap[l - 1]->getBuffer()[(int)x1 + (int)y1 * (dimension.x >> (l - 1))];
-				float mip3 = _mipmap[l - 1]->getBuffer()[(int)x0 + (int)y0 * (dimension.x >> (l - 1))];
-				float mip4 = _mipmap[l - 1]->getBuffer()[(int)x0 + (int)y1 * (dimension.x >> (l - 1))];
-
-				float finalMip;
-				if (_mode == MipmapMode::MAX) {
-					finalMip = std::numeric_limits<float>::min();
-
-					if (mip1 != _heightField->getNullData())
-						finalMip = std::max(mip1, finalMip);
-					if (mip2 != _heightField->getNullData())
-						finalMip = std::max(mip2, finalMip);
-					if (mip3 != _heightField->getNullData())
-						finalMip = std::max(mip3, finalMip);
-					if (mip4 != _heightField->getNullData())
-						finalMip = std::max(mip4, finalMip);
-
-					//_mipmap[l]->getVectorOfData()[x + y * (dimension.x >> l)] = std::max(finalMip, std::numeric_limits<float>::min());
-					_mipmap[l]->setData(std::max(finalMip, std::numeric_limits<float>::min()), x, y);
-				} else {
-					finalMip = std::numeric_limits<float>::max();
-
-
-					if (mip1 != _heightField->getNullData())
-						finalMip = std::min(mip1, finalMip);
-					if (mip2 != _heightField->getNullData())
-						finalMip = std::min(mip2, finalMip);
-					if (mip3 != _heightField->getNullData())
-						finalMip = std::min(mip3, finalMip);
-					if (mip4 != _heightField->getNullData())
-						finalMip = std::min(mip4, finalMip);
-
-					//_mipmap[l]->getVectorOfData()[x + y * (dimension.x >> l)] = std::min(finalMip, std::numeric_limits<float>::max());
-					_mipmap[l]->setData(std::min(finalMip, std::numeric_limits<float>::max()), x, y);
-				}
-				int diff = 1;
-				if (mip1 == finalMip && mip2 == finalMip && mip3 == finalMip && mip4 == finalMip)
-					diff = 0;
-
-				_difference[_difference.size() - 1]->setData(diff, x, y);
+		HeightField *previous = _mipmap[l - 1];
+		ivec2 previousDimension(previous->getDimensionX(), previous->getDimensionY());
+
+		// Along the Morton curve of a power of two square the four children of a cell are
+		// consecutive, so the previous level is read sequentially. A heightfield that released
+		// its data is decoded cell by cell
+		if (previous->hasData() && layout == HeightField::Layout::MORTON && previousDimension.x == previousDimension.y &&
+			previousDimension.x > 1 && morton::isPowerOfTwo(previousDimension.x)) {
+			const float *children = previous->getBuffer();
+			float *values = mp->getBuffer();
+			float *differences = difference->getBuffer();
+			size_t size = static_cast<size_t>(mipDimension.x) * mipDimension.y;
+
+			for (size_t index = 0; index < size; ++index, children += 4) {
+				bool uniform;
+				values[index] = reduce(children, 4, uniform);
+				differences[index] = uniform ? 0 : 1;
 			}
+			continue;
+		}
 
+		// The last cell of an odd row or column also covers the cell left over by halving it,
+		// so every cell of the previous level is bounded by a cell of this one
+		for (int x = 0; x < mipDimension.x; ++x) {
+			int x0 = x << 1;
+			int x1 = x == mipDimension.x - 1 ? previousDimension.x : std::min(x0 + 2, previousDimension.x);
+
+			for (int y = 0; y < mipDimension.y; ++y) {
+				int y0 = y << 1;
+				int y1 = y == mipDimension.y - 1 ? previousDimension.y : std::min(y0 + 2, previousDimension.y);
+
+				float children[9];
+				unsigned nChildren = 0;
+				for (int i = x0; i < x1; ++i)
+					for (int j = y0; j < y1; ++j)
+						children[nChildren++] = previous->getData(i, j);
+
+				bool uniform;
+				mp->setData(reduce(children, nChildren, uniform), x, y);
+				difference->setData(uniform ? 0 : 1, x, y);
+			}
 		}
 	}
 
 }
 
+float HeightMipmap::reduce(const float *values, unsigned n, bool& uniform) const {
+	float nullData = _heightField->getNullData();
+	float finalMip = _mode == MipmapMode::MAX ? std::numeric_limits<float>::min() : std::numeric_limits<float>::max();
+
+	for (unsigned i = 0; i < n; ++i) {
+		if (values[i] != nullData)
+			finalMip = _mode == MipmapMode::MAX ? std::max(values[i], finalMip) : std::min(values[i], finalMip);
+	}
+
+	uniform = true;
+	for (unsigned i = 0; i < n; ++i)
+		uniform = uniform && values[i] == finalMip;
+
+	return finalMip;
+}
+
 HeightMipmap::~HeightMipmap() {
 	for (int i = 1; i < _mipmap.size(); ++i)
 		delete _mipmap[i];
+
+	for (auto difference : _difference)
+		delete difference;
 }
@@ -24,12 +24,17 @@ class HeightMipmap {
 	std::vector<HeightField*> _mipmap;
 	std::vector<HeightField*> _difference;
 
+	/**
+	Min or max of the non null values of n cells. uniform tells if all of them are equal to it
+	*/
+	float reduce(const float *values, unsigned n, bool& uniform) const;
 
 public:
 	HeightMipmap(HeightField *heightField, MipmapMode mode) : _heightField(heightField), _mode(mode) {};
 	void computeMipmap();
 	float getData(unsigned int col, unsigned int row, unsigned int mipmap) const { return _mipmap[mipmap]->getData(col, row); }
 	HeightField* getHeightField(int index) { return _mipmap[index]; }
+	unsigned getLevels() const { return _mipmap.size(); }
 	~HeightMipmap();
 };
 
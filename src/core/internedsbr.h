@@ -0,0 +1,183 @@
+/**
+*	Stack-based representation whose columns keep the id of their material sequence in a
+*	MaterialSequenceTable and only their own heights. The heights of every column lie in a
+*	single array in compressed sparse row layout: those of the column i go from the offset i
+*	to the offset i + 1, bottom up, and the materials are those of its sequence in the same
+*	order. Columns are stored row by row, as the stacks of StackBasedRep.
+*
+*	Columns with the same materials have the same id, so their materials are compared with a
+*	single integer compare, and the materials of a few dozen sequences replace the ones every
+*	interval of a StackBasedRep stores.
+*
+*	@class InternedSBR
+*/
+
+#ifndef INTERNED_SBR_H
+#define INTERNED_SBR_H
+
+#include "core/materialsequencetable.h"
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+template<class T>
+class InternedSBR {
+
+public:
+
+	using Id = typename MaterialSequenceTable<T>::Id;
+
+private:
+
+	vec2 _origin;
+
+	vec2 _spacing;
+
+	ivec2 _dimension;
+
+	float _minHeight, _maxHeight;
+
+	float _heightResolution;
+
+	std::string _attributeName;
+
+	MaterialSequenceTable<T> _table;
+
+	std::vector<Id> _sequences; /*< Sequence of every column */
+
+	std::vector<uint64_t> _offsets; /*< Start of the heights of every column, then the end of the last one */
+
+	std::vector<float> _heights; /*< Heights where the intervals of the columns end */
+
+	size_t index(int x, int y) const { return x + y * static_cast<size_t>(_dimension.x); }
+
+public:
+
+	/**
+	Interned copy of sbr, built in parallel
+	*/
+	explicit InternedSBR(StackBasedRep<T>& sbr);
+
+	/**
+	Expands the columns back into a stack-based representation
+	*/
+	StackBasedRep<T>* toSBR() const;
+
+	Id getSequence(int x, int y) const { return _sequences[index(x, y)]; }
+
+	/**
+	Sequence of every column, in the row-major order of the columns
+	*/
+	const std::vector<Id>& getSequences() const { return _sequences; }
+
+	const MaterialSequenceTable<T>& getTable() const { return _table; }
+
+	/**
+	Number of intervals of the column
+	*/
+	size_t getLength(int x, int y) const { return _offsets[index(x, y) + 1] - _offsets[index(x, y)]; }
+
+	const T* getMaterials(int x, int y) const { return _table.getMaterials(getSequence(x, y)); }
+
+	const float* getHeights(int x, int y) const { return _heights.data() + _offsets[index(x, y)]; }
+
+	/**
+	Material at height in the column, as Stack::getAttribute
+	*/
+	T getAttribute(int x, int y, float height) const;
+
+	/**
+	Tells if two columns have the same materials
+	*/
+	bool compareAttributes(int x1, int y1, int x2, int y2) const { return getSequence(x1, y1) == getSequence(x2, y2); }
+
+	ivec2 getDimension() const { return _dimension; }
+
+	vec2 getOrigin() const { return _origin; }
+
+	vec2 getSpacing() const { return _spacing; }
+
+	float getMinHeight() const { return _minHeight; }
+
+	float getMaxHeight() const { return _maxHeight; }
+
+	float getHeightResolution() const { return _heightResolution; }
+
+	std::string getAttributeName() const { return _attributeName; }
+
+	/**
+	Memory consumption in bytes
+	*/
+	double memorySize() const;
+};
+
+template<class T>
+InternedSBR<T>::InternedSBR(StackBasedRep<T>& sbr) :
+	_origin(sbr.getOriginX(), sbr.getOriginY()),
+	_spacing(sbr.getSpacing()),
+	_dimension(sbr.getDimension()),
+	_minHeight(sbr.getMinHeight()),
+	_maxHeight(sbr.getMaxHeight()),
+	_heightResolution(sbr.getHeightResolution()),
+	_attributeName(sbr.getAttributeName()),
+	_sequences(_table.intern(sbr)) {
+
+	Stack<T> *stacks = sbr.begin();
+	size_t nColumns = _sequences.size();
+
+	_offsets.resize(nColumns + 1);
+	_offsets[0] = 0;
+	for (size_t column = 0; column < nColumns; ++column)
+		_offsets[column + 1] = _offsets[column] + _table.getLength(_sequences[column]);
+
+	_heights.resize(_offsets[nColumns]);
+	parallel::forRange(0, nColumns, [&](size_t column) {
+		float *heights = _heights.data() + _offsets[column];
+		for (auto& interval : stacks[column].getIntervals())
+			*heights++ = interval._accumulatedHeight;
+	}, 1024);
+}
+
+template<class T>
+StackBasedRep<T>* InternedSBR<T>::toSBR() const {
+	StackBasedRep<T> *sbr = new StackBasedRep<T>(_minHeight, _maxHeight, _heightResolution, _attributeName, _origin, _spacing, _dimension);
+	Stack<T> *stacks = sbr->begin();
+
+	parallel::forRange(0, _sequences.size(), [&](size_t column) {
+		const T *materials = _table.getMaterials(_sequences[column]);
+		const float *heights = _heights.data() + _offsets[column];
+		size_t length = _offsets[column + 1] - _offsets[column];
+
+		auto& intervals = stacks[column].getIntervals();
+		intervals.resize(length);
+		for (size_t i = 0; i < length; ++i)
+			intervals[i] = Interval<T>{ heights[i], materials[i] };
+	}, 1024);
+
+	return sbr;
+}
+
+template<class T>
+T InternedSBR<T>::getAttribute(int x, int y, float height) const {
+	const float *first = getHeights(x, y), *last = first + getLength(x, y);
+
+	// Heights grow bottom up, so the interval is the first one ending at or above height
+	const float *top = std::lower_bound(first, last, height);
+	if (top == last)
+		return Stack<T>::UNKNOWN_VALUE;
+
+	return getMaterials(x, y)[top - first];
+}
+
+template<class T>
+double InternedSBR<T>::memorySize() const {
+	return static_cast<double>(_sequences.capacity() * sizeof(Id) + _offsets.capacity() * sizeof(uint64_t) + _heights.capacity() * sizeof(float)) + _table.memorySize();
+}
+
+using ShortInternedSBR = InternedSBR<short>;
+
+#endif
@@ -0,0 +1,177 @@
+/**
+*	Interning table of the material sequences of columns. Every distinct sequence, the
+*	materials of a column from the bottom up, gets a dense id, so two columns have the same
+*	materials if and only if they have the same id. Stratigraphic data hold a few dozen
+*	sequences for millions of columns, which then compare their materials with a single
+*	integer compare.
+*
+*	Ids are given in the order the sequences are first found, row by row, also when a whole
+*	representation is interned in parallel.
+*
+*	@class MaterialSequenceTable
+*/
+
+#ifndef MATERIAL_SEQUENCE_TABLE_H
+#define MATERIAL_SEQUENCE_TABLE_H
+
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+template<class T>
+class MaterialSequenceTable {
+
+public:
+
+	using Id = uint32_t;
+
+private:
+
+	static const size_t ROWS_PER_CHUNK = 16; /*< Rows interned by every parallel task */
+
+	std::vector<T> _materials; /*< Sequences one after the other */
+
+	std::vector<size_t> _offsets; /*< Start of every sequence in _materials, then the end of the last one */
+
+	std::unordered_multimap<uint64_t, Id> _ids; /*< Ids by the hash of their sequence */
+
+	static uint64_t hash(const T *materials, size_t count);
+
+	/**
+	Id of the sequence, adding it if it is not in the table yet
+	*/
+	Id intern(const T *materials, size_t count, uint64_t hash);
+
+	/**
+	Materials of the column, bottom up
+	*/
+	static void gather(Stack<T>& stack, std::vector<T>& materials);
+
+public:
+
+	MaterialSequenceTable();
+
+	Id intern(const T *materials, size_t count) { return intern(materials, count, hash(materials, count)); }
+
+	Id intern(Stack<T>& stack);
+
+	/**
+	Interns every column of sbr and returns their ids, in the row-major order of the stacks.
+	Rows are interned in parallel
+	*/
+	std::vector<Id> intern(StackBasedRep<T>& sbr);
+
+	/**
+	Number of distinct sequences
+	*/
+	size_t size() const { return _offsets.size() - 1; }
+
+	const T* getMaterials(Id id) const { return _materials.data() + _offsets[id]; }
+
+	size_t getLength(Id id) const { return _offsets[id + 1] - _offsets[id]; }
+
+	double memorySize() const;
+};
+
+template<class T>
+MaterialSequenceTable<T>::MaterialSequenceTable() :
+	_offsets(1, 0) {
+}
+
+template<class T>
+uint64_t MaterialSequenceTable<T>::hash(const T *materials, size_t count) {
+	uint64_t hash = 0x9E3779B97F4A7C15ull ^ count;
+	for (size_t i = 0; i < count; ++i) {
+		hash ^= static_cast<uint64_t>(static_cast<int64_t>(materials[i]));
+		hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+		hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+		hash ^= hash >> 31;
+	}
+
+	return hash;
+}
+
+template<class T>
+typename MaterialSequenceTable<T>::Id MaterialSequenceTable<T>::intern(const T *materials, size_t count, uint64_t hash) {
+	auto range = _ids.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+		if (getLength(it->second) == count && std::equal(materials, materials + count, getMaterials(it->second)))
+			return it->second;
+
+	Id id = static_cast<Id>(size());
+	_materials.insert(_materials.end(), materials, materials + count);
+	_offsets.push_back(_materials.size());
+	_ids.emplace(hash, id);
+	return id;
+}
+
+template<class T>
+void MaterialSequenceTable<T>::gather(Stack<T>& stack, std::vector<T>& materials) {
+	materials.clear();
+	for (auto& interval : stack.getIntervals())
+		materials.push_back(interval._attribute);
+}
+
+template<class T>
+typename MaterialSequenceTable<T>::Id MaterialSequenceTable<T>::intern(Stack<T>& stack) {
+	std::vector<T> materials;
+	gather(stack, materials);
+	return intern(materials.data(), materials.size());
+}
+
+template<class T>
+std::vector<typename MaterialSequenceTable<T>::Id> MaterialSequenceTable<T>::intern(StackBasedRep<T>& sbr) {
+	ivec2 dimension = sbr.getDimension();
+	std::vector<Id> ids(static_cast<size_t>(dimension.x) * dimension.y);
+	Stack<T> *stacks = sbr.begin();
+
+	// Every chunk of rows is interned in a table of its own, whose sequences are few
+	size_t nChunks = (dimension.y + ROWS_PER_CHUNK - 1) / ROWS_PER_CHUNK;
+	std::vector<MaterialSequenceTable<T>> tables(nChunks);
+	parallel::forRange(0, nChunks, [&](size_t chunk) {
+		size_t first = chunk * ROWS_PER_CHUNK * dimension.x;
+		size_t last = std::min<size_t>((chunk + 1) * ROWS_PER_CHUNK, dimension.y) * dimension.x;
+		std::vector<T> materials;
+		uint64_t previousHash = 0;
+		Id previous = 0;
+
+		for (size_t index = first; index < last; ++index) {
+			gather(stacks[index], materials);
+			uint64_t sequenceHash = hash(materials.data(), materials.size());
+
+			// Neighbours mostly share their sequence
+			if (index == first || sequenceHash != previousHash || tables[chunk].getLength(previous) != materials.size() ||
+				!std::equal(materials.begin(), materials.end(), tables[chunk].getMaterials(previous)))
+				previous = tables[chunk].intern(materials.data(), materials.size(), sequenceHash);
+
+			previousHash = sequenceHash;
+			ids[index] = previous;
+		}
+	});
+
+	// Chunks are merged in order, so ids follow the first appearance of the sequences
+	std::vector<std::vector<Id>> remaps(nChunks);
+	for (size_t chunk = 0; chunk < nChunks; ++chunk)
+		for (Id id = 0; id < tables[chunk].size(); ++id)
+			remaps[chunk].push_back(intern(tables[chunk].getMaterials(id), tables[chunk].getLength(id)));
+
+	parallel::forRange(0, nChunks, [&](size_t chunk) {
+		size_t first = chunk * ROWS_PER_CHUNK * dimension.x;
+		size_t last = std::min<size_t>((chunk + 1) * ROWS_PER_CHUNK, dimension.y) * dimension.x;
+		for (size_t index = first; index < last; ++index)
+			ids[index] = remaps[chunk][ids[index]];
+	});
+
+	return ids;
+}
+
+template<class T>
+double MaterialSequenceTable<T>::memorySize() const {
+	return static_cast<double>(_materials.capacity() * sizeof(T) + _offsets.capacity() * sizeof(size_t) + _ids.size() * (sizeof(uint64_t) + sizeof(Id) + sizeof(void*)));
+}
+
+#endif
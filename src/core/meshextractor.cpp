@@ -0,0 +1,324 @@
+#include "meshextractor.h"
+#include "core/heightmipmap.h"
+#include "core/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+	const int TILE = 64; /** < Side of the tiles of cells processed in parallel */
+
+	struct Span {
+		float _bottom, _top;
+	};
+
+	/**
+	Intervals of material in column, whose first interval starts at low
+	*/
+	void materialSpans(const QuadStack::Column& column, int material, float low, std::vector<Span>& spans) {
+		spans.clear();
+		float bottom = low;
+		for (auto& interval : column) {
+			if (interval._attribute == material)
+				spans.push_back({ bottom, interval._accumulatedHeight });
+			bottom = interval._accumulatedHeight;
+		}
+	}
+
+	uint64_t vertexKey(uint64_t corner, float height) {
+		uint32_t bits;
+		std::memcpy(&bits, &height, sizeof(bits));
+		return corner << 32 | bits;
+	}
+
+}
+
+
+void MeshExtractor::execute(iaabb2 region, float low, float high) {
+	_meshes.clear();
+
+	std::vector<QuadStack::Column> columns;
+	_quadStack->getColumns(region, low, high, columns);
+	region = _quadStack->clampRegion(region);
+
+	ivec2 size = region.max - region.min;
+	ivec2 tiles((size.x + TILE - 1) / TILE, (size.y + TILE - 1) / TILE);
+	std::vector<Boundaries> tileBoundaries(static_cast<size_t>(tiles.x) * tiles.y);
+
+	parallel::forRange(0, tileBoundaries.size(), [&](size_t index) {
+		ivec2 min(TILE * static_cast<int>(index % tiles.x), TILE * static_cast<int>(index / tiles.x));
+		iaabb2 tile(min, ivec2(std::min(min.x + TILE, size.x), std::min(min.y + TILE, size.y)));
+		extractTile(tile, size, low, columns, tileBoundaries[index]);
+	});
+
+	// Materials are triangulated independently
+	std::map<int, std::vector<const Boundary*>> parts;
+	for (auto& boundaries : tileBoundaries)
+		for (auto& boundary : boundaries)
+			parts[boundary.first].push_back(&boundary.second);
+
+	std::vector<int> materials;
+	for (auto& material : parts) {
+		materials.push_back(material.first);
+		_meshes[material.first];
+	}
+
+	ShortSBR *terrain = _quadStack->getTerrain();
+	vec2 spacing = terrain->getSpacing();
+	vec2 origin(terrain->getOriginX() + region.min.x * spacing.x, terrain->getOriginY() + region.min.y * spacing.y);
+
+	parallel::forRange(0, materials.size(), [&](size_t index) {
+		buildMesh(parts[materials[index]], size, origin, spacing, _meshes[materials[index]]);
+	});
+}
+
+void MeshExtractor::extractTile(const iaabb2& tile, ivec2 size, float low, const std::vector<QuadStack::Column>& columns, Boundaries& boundaries) const {
+	int width = tile.max.x - tile.min.x;
+	size_t nCells = static_cast<size_t>(width) * (tile.max.y - tile.min.y);
+
+	auto columnAt = [&](int x, int y) -> const QuadStack::Column& { return columns[x + y * static_cast<size_t>(size.x)]; };
+
+	std::vector<int> materials;
+	for (int y = tile.min.y; y < tile.max.y; ++y)
+		for (int x = tile.min.x; x < tile.max.x; ++x)
+			for (auto& interval : columnAt(x, y))
+				materials.push_back(interval._attribute);
+
+	std::sort(materials.begin(), materials.end());
+	materials.erase(std::unique(materials.begin(), materials.end()), materials.end());
+
+	// Corners of a cell counter-clockwise seen from above, so every edge has its outside on the right
+	const ivec2 corners[4] = { ivec2(0, 0), ivec2(1, 0), ivec2(1, 1), ivec2(0, 1) };
+	const ivec2 neighbours[4] = { ivec2(0, -1), ivec2(1, 0), ivec2(0, 1), ivec2(-1, 0) };
+
+	std::vector<Span> spans, neighbourSpans;
+	std::vector<std::vector<Span>> cellSpans(nCells);
+
+	for (int material : materials) {
+		Boundary& boundary = boundaries[material];
+		size_t nLayers = 0;
+
+		for (int y = tile.min.y; y < tile.max.y; ++y) {
+			for (int x = tile.min.x; x < tile.max.x; ++x) {
+				materialSpans(columnAt(x, y), material, low, spans);
+				cellSpans[(x - tile.min.x) + (y - tile.min.y) * static_cast<size_t>(width)] = spans;
+				nLayers = std::max(nLayers, spans.size());
+
+				if (spans.empty())
+					continue;
+
+				// Walls where the neighbour lacks the material
+				for (int edge = 0; edge < 4; ++edge) {
+					ivec2 neighbour = ivec2(x, y) + neighbours[edge];
+					bool outside = neighbour.x < 0 || neighbour.y < 0 || neighbour.x >= size.x || neighbour.y >= size.y;
+					if (outside)
+						neighbourSpans.clear();
+					else
+						materialSpans(columnAt(neighbour.x, neighbour.y), material, low, neighbourSpans);
+
+					ivec2 from = ivec2(x, y) + corners[edge], to = ivec2(x, y) + corners[(edge + 1) % 4];
+
+					for (auto& span : spans) {
+						float bottom = span._bottom;
+						for (auto& other : neighbourSpans) {
+							if (other._top <= bottom || other._bottom >= span._top)
+								continue;
+							if (other._bottom > bottom)
+								boundary._walls.push_back({ from, to, bottom, other._bottom });
+							bottom = std::max(bottom, other._top);
+						}
+						if (bottom < span._top)
+							boundary._walls.push_back({ from, to, bottom, span._top });
+					}
+				}
+			}
+		}
+
+		// Faces of the k-th interval of the material in every cell. Heights are replaced by
+		// their rank so that flat regions are found comparing them exactly
+		for (size_t layer = 0; layer < nLayers; ++layer) {
+			for (bool top : { true, false }) {
+				std::vector<float> heights;
+				for (auto& cell : cellSpans)
+					if (layer < cell.size())
+						heights.push_back(top ? cell[layer]._top : cell[layer]._bottom);
+
+				std::sort(heights.begin(), heights.end());
+				heights.erase(std::unique(heights.begin(), heights.end()), heights.end());
+
+				std::vector<float> ranks(nCells, -1.0f);
+				for (size_t cell = 0; cell < nCells; ++cell) {
+					if (layer < cellSpans[cell].size()) {
+						float height = top ? cellSpans[cell][layer]._top : cellSpans[cell][layer]._bottom;
+						ranks[cell] = static_cast<float>(std::lower_bound(heights.begin(), heights.end(), height) - heights.begin());
+					}
+				}
+
+				mergeFaces(tile, ranks, heights, top, boundary._faces);
+			}
+		}
+	}
+}
+
+void MeshExtractor::mergeFaces(const iaabb2& tile, const std::vector<float>& ranks, const std::vector<float>& heights, bool top, std::vector<Face>& faces) const {
+	ivec2 dimension = tile.max - tile.min;
+
+	auto rank = [&](int x, int y) { return ranks[x + y * static_cast<size_t>(dimension.x)]; };
+
+	if (!_decimate) {
+		for (int y = 0; y < dimension.y; ++y)
+			for (int x = 0; x < dimension.x; ++x)
+				if (rank(x, y) >= 0)
+					faces.push_back({ tile.min + ivec2(x, y), 1, heights[static_cast<size_t>(rank(x, y))], top });
+		return;
+	}
+
+	// Ranks are at least 1 in the mipmaps, as the max mipmap starts from the smallest positive
+	// float. Cells without face are the lowest value, so no square holding one is flat
+	std::vector<float> values(ranks.size());
+	for (size_t cell = 0; cell < ranks.size(); ++cell)
+		values[cell] = ranks[cell] >= 0 ? ranks[cell] + 1.0f : -std::numeric_limits<float>::max();
+
+	HeightField field(vec2(0.0f), vec2(1.0f), dimension, 0.0f, 0.0f, std::numeric_limits<float>::quiet_NaN(), values.data());
+	HeightMipmap minMipmap(&field, MipmapMode::MIN), maxMipmap(&field, MipmapMode::MAX);
+	minMipmap.computeMipmap();
+	maxMipmap.computeMipmap();
+
+	int maxLevel = static_cast<int>(std::floor(std::log2(std::max(dimension.x, dimension.y))));
+
+	// Squares lying inside the tile whose min and max agree become a single face
+	std::function<void(int, int, int)> emit = [&](int level, int x, int y) {
+		int side = 1 << level;
+		ivec2 min(x * side, y * side);
+		if (min.x >= dimension.x || min.y >= dimension.y)
+			return;
+
+		if (level == 0) {
+			if (rank(min.x, min.y) >= 0)
+				faces.push_back({ tile.min + min, 1, heights[static_cast<size_t>(rank(min.x, min.y))], top });
+			return;
+		}
+
+		bool inside = min.x + side <= dimension.x && min.y + side <= dimension.y;
+		if (inside) {
+			float lowest = minMipmap.getData(x, y, level);
+			if (lowest >= 1.0f && lowest == maxMipmap.getData(x, y, level)) {
+				faces.push_back({ tile.min + min, side, heights[static_cast<size_t>(lowest - 1.0f)], top });
+				return;
+			}
+		}
+
+		for (int child = 0; child < 4; ++child)
+			emit(level - 1, 2 * x + (child & 1), 2 * y + (child >> 1));
+	};
+
+	int side = 1 << maxLevel;
+	for (int y = 0; y * side < dimension.y; ++y)
+		for (int x = 0; x * side < dimension.x; ++x)
+			emit(maxLevel, x, y);
+}
+
+void MeshExtractor::buildMesh(const std::vector<const Boundary*>& parts, ivec2 size, vec2 origin, vec2 spacing, TriangleMesh& mesh) {
+	auto cornerKey = [&](ivec2 corner) { return static_cast<uint64_t>(corner.x) + static_cast<uint64_t>(corner.y) * (size.x + 1); };
+
+	// Heights of the vertices lying on the vertical line of every corner
+	std::unordered_map<uint64_t, std::vector<float>> cornerHeights;
+
+	auto forEachBorderCorner = [](const Face& face, const std::function<void(ivec2)>& function) {
+		ivec2 min = face._min, max(face._min.x + face._side, face._min.y + face._side);
+		for (int i = 0; i < face._side; ++i) function(ivec2(min.x + i, min.y));
+		for (int i = 0; i < face._side; ++i) function(ivec2(max.x, min.y + i));
+		for (int i = 0; i < face._side; ++i) function(ivec2(max.x - i, max.y));
+		for (int i = 0; i < face._side; ++i) function(ivec2(min.x, max.y - i));
+	};
+
+	for (auto part : parts) {
+		for (auto& face : part->_faces)
+			forEachBorderCorner(face, [&](ivec2 corner) { cornerHeights[cornerKey(corner)].push_back(face._height); });
+
+		for (auto& wall : part->_walls) {
+			for (ivec2 corner : { wall._from, wall._to }) {
+				auto& heights = cornerHeights[cornerKey(corner)];
+				heights.push_back(wall._bottom);
+				heights.push_back(wall._top);
+			}
+		}
+	}
+
+	for (auto& corner : cornerHeights) {
+		std::sort(corner.second.begin(), corner.second.end());
+		corner.second.erase(std::unique(corner.second.begin(), corner.second.end()), corner.second.end());
+	}
+
+	std::unordered_map<uint64_t, unsigned> vertices;
+
+	auto vertex = [&](ivec2 corner, float height) {
+		auto inserted = vertices.insert({ vertexKey(cornerKey(corner), height), static_cast<unsigned>(mesh._vertices.size()) });
+		if (inserted.second)
+			mesh._vertices.push_back(vec3(origin.x + corner.x * spacing.x, origin.y + corner.y * spacing.y, height));
+		return inserted.first->second;
+	};
+
+	auto triangle = [&](unsigned a, unsigned b, unsigned c) {
+		mesh._indices.push_back(a);
+		mesh._indices.push_back(b);
+		mesh._indices.push_back(c);
+	};
+
+	std::vector<unsigned> ring;
+
+	for (auto part : parts) {
+		for (auto& face : part->_faces) {
+			ring.clear();
+			forEachBorderCorner(face, [&](ivec2 corner) { ring.push_back(vertex(corner, face._height)); });
+
+			// Faces are counter-clockwise from above, so bottom faces are reversed
+			if (face._side == 1) {
+				if (face._top) {
+					triangle(ring[0], ring[1], ring[2]);
+					triangle(ring[0], ring[2], ring[3]);
+				} else {
+					triangle(ring[0], ring[2], ring[1]);
+					triangle(ring[0], ring[3], ring[2]);
+				}
+				continue;
+			}
+
+			// Merged faces keep every corner of their border, joined to their centre
+			float half = face._side * 0.5f;
+			unsigned centre = static_cast<unsigned>(mesh._vertices.size());
+			mesh._vertices.push_back(vec3(origin.x + (face._min.x + half) * spacing.x, origin.y + (face._min.y + half) * spacing.y, face._height));
+
+			for (size_t i = 0; i < ring.size(); ++i) {
+				unsigned next = ring[(i + 1) % ring.size()];
+				if (face._top)
+					triangle(centre, ring[i], next);
+				else
+					triangle(centre, next, ring[i]);
+			}
+		}
+
+		// Walls zip the vertices of both vertical edges from the bottom
+		for (auto& wall : part->_walls) {
+			auto& fromHeights = cornerHeights[cornerKey(wall._from)];
+			auto& toHeights = cornerHeights[cornerKey(wall._to)];
+			auto i = std::lower_bound(fromHeights.begin(), fromHeights.end(), wall._bottom);
+			auto j = std::lower_bound(toHeights.begin(), toHeights.end(), wall._bottom);
+
+			while (*i < wall._top || *j < wall._top) {
+				if (*j < wall._top && (*i >= wall._top || *(j + 1) <= *(i + 1))) {
+					triangle(vertex(wall._from, *i), vertex(wall._to, *j), vertex(wall._to, *(j + 1)));
+					++j;
+				} else {
+					triangle(vertex(wall._from, *i), vertex(wall._to, *j), vertex(wall._from, *(i + 1)));
+					++i;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/**
+*	Extracts the boundary of every material of a QuadStack as an indexed triangle mesh.
+*
+*	A material is the union of the prisms of its intervals, so its mesh is made of the
+*	top and bottom faces of the intervals and of vertical walls wherever a neighbouring
+*	cell does not hold the material at the same heights. Faces of flat regions are merged
+*	into power of two squares found with the min and max mipmaps of every tile. Edges on
+*	the cell grid are split at every vertex lying on them, so the meshes are closed and
+*	free of T-junctions.
+*
+*	@class MeshExtractor
+*/
+
+#ifndef MESH_EXTRACTOR_H
+#define MESH_EXTRACTOR_H
+
+#include "core/quadstack.h"
+
+#include <map>
+#include <vector>
+
+using glm::vec3;
+
+class MeshExtractor {
+
+public:
+
+	struct TriangleMesh {
+		std::vector<vec3> _vertices;
+		std::vector<unsigned> _indices; /** < Three per triangle, counter-clockwise seen from outside */
+	};
+
+private:
+
+	/**
+	Top or bottom face of the cells of a square
+	*/
+	struct Face {
+		ivec2 _min;
+		int _side;
+		float _height;
+		bool _top;
+	};
+
+	/**
+	Vertical wall along a cell edge. Its outward normal is (to - from) x up
+	*/
+	struct Wall {
+		ivec2 _from, _to;
+		float _bottom, _top;
+	};
+
+	struct Boundary {
+		std::vector<Face> _faces;
+		std::vector<Wall> _walls;
+	};
+
+	using Boundaries = std::map<int, Boundary>;
+
+	QuadStack *_quadStack;
+
+	bool _decimate; /** < Merge the faces of flat regions */
+
+	std::map<int, TriangleMesh> _meshes; /** < Mesh of every material */
+
+	/**
+	Faces and walls of the cells of tile. Cells and corners are relative to the region
+	*/
+	void extractTile(const iaabb2& tile, ivec2 size, float low, const std::vector<QuadStack::Column>& columns, Boundaries& boundaries) const;
+
+	/**
+	Emits the faces of a tile given the height of a face per cell, or a negative rank
+	for cells without face. Ranks index heights
+	*/
+	void mergeFaces(const iaabb2& tile, const std::vector<float>& ranks, const std::vector<float>& heights, bool top, std::vector<Face>& faces) const;
+
+	/**
+	Triangulates the faces and walls of a material
+	*/
+	static void buildMesh(const std::vector<const Boundary*>& parts, ivec2 size, vec2 origin, vec2 spacing, TriangleMesh& mesh);
+
+public:
+
+	MeshExtractor(QuadStack *quadStack, bool decimate = true) : _quadStack(quadStack), _decimate(decimate) {}
+
+	/**
+	Extracts the meshes of the cells of region between the heights low and high
+	*/
+	void execute(iaabb2 region, float low, float high);
+
+	const std::map<int, TriangleMesh>& getMeshes() const { return _meshes; }
+
+	~MeshExtractor() {}
+};
+
+#endif
@@ -0,0 +1,133 @@
+/**
+*	Morton (Z-order) codes of 2D coordinates. Codes are 64 bits wide, so each coordinate
+*	may use its full 32 bits: x goes to the even bits and y to the odd ones.
+*
+*	The BMI2 instructions pdep/pext are used when the compiler targets them (-mbmi2 or
+*	/arch:AVX2, see QUADSTACK_ENABLE_BMI2). Otherwise codes are built a byte at a time
+*	with a lookup table and decoded with masks, which measured faster than gathering
+*	the bits through a table.
+*/
+
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__)))
+#define QUADSTACK_MORTON_BMI2
+#include <immintrin.h>
+#endif
+
+namespace morton {
+
+	const uint64_t X_BITS = 0x5555555555555555ull; /** < Bits of the code taken by x */
+
+	const uint64_t Y_BITS = 0xAAAAAAAAAAAAAAAAull; /** < Bits of the code taken by y */
+
+	namespace detail {
+
+		/**
+		Bytes with a zero bit inserted after every bit
+		*/
+		struct SpreadTable {
+			uint16_t values[256];
+		};
+
+		constexpr SpreadTable makeSpreadTable() {
+			SpreadTable table = {};
+			for (unsigned value = 0; value < 256; ++value)
+				for (unsigned bit = 0; bit < 8; ++bit)
+					if (value & (1u << bit))
+						table.values[value] |= static_cast<uint16_t>(1u << (2 * bit));
+			return table;
+		}
+
+		inline constexpr SpreadTable SPREAD_TABLE = makeSpreadTable();
+
+		inline uint64_t spreadBits(uint32_t value) {
+			return static_cast<uint64_t>(SPREAD_TABLE.values[value & 0xFF]) |
+				static_cast<uint64_t>(SPREAD_TABLE.values[(value >> 8) & 0xFF]) << 16 |
+				static_cast<uint64_t>(SPREAD_TABLE.values[(value >> 16) & 0xFF]) << 32 |
+				static_cast<uint64_t>(SPREAD_TABLE.values[value >> 24]) << 48;
+		}
+
+		/**
+		Gathers the even bits of value
+		*/
+		inline uint32_t compactBits(uint64_t value) {
+			value &= X_BITS;
+			value = (value ^ (value >> 1)) & 0x3333333333333333ull;
+			value = (value ^ (value >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+			value = (value ^ (value >> 4)) & 0x00FF00FF00FF00FFull;
+			value = (value ^ (value >> 8)) & 0x0000FFFF0000FFFFull;
+			value = (value ^ (value >> 16)) & 0x00000000FFFFFFFFull;
+			return static_cast<uint32_t>(value);
+		}
+
+	}
+
+	inline uint64_t encode(uint32_t x, uint32_t y) {
+#ifdef QUADSTACK_MORTON_BMI2
+		return _pdep_u64(x, X_BITS) | _pdep_u64(y, Y_BITS);
+#else
+		return detail::spreadBits(x) | detail::spreadBits(y) << 1;
+#endif
+	}
+
+	inline void decode(uint64_t code, uint32_t& x, uint32_t& y) {
+#ifdef QUADSTACK_MORTON_BMI2
+		x = static_cast<uint32_t>(_pext_u64(code, X_BITS));
+		y = static_cast<uint32_t>(_pext_u64(code, Y_BITS));
+#else
+		x = detail::compactBits(code);
+		y = detail::compactBits(code >> 1);
+#endif
+	}
+
+	/**
+	Codes of n coordinates
+	*/
+	inline void encode(const uint32_t *x, const uint32_t *y, uint64_t *codes, size_t n) {
+		for (size_t i = 0; i < n; ++i)
+			codes[i] = encode(x[i], y[i]);
+	}
+
+	/**
+	Coordinates of n codes
+	*/
+	inline void decode(const uint64_t *codes, uint32_t *x, uint32_t *y, size_t n) {
+		for (size_t i = 0; i < n; ++i)
+			decode(codes[i], x[i], y[i]);
+	}
+
+	inline bool isPowerOfTwo(uint64_t value) {
+		return value != 0 && (value & (value - 1)) == 0;
+	}
+
+	/**
+	Smallest power of two not lower than value
+	*/
+	inline uint64_t nextPowerOf2(uint64_t value) {
+		uint64_t power = 1;
+		while (power < value)
+			power <<= 1;
+		return power;
+	}
+
+	/**
+	Largest power of two not greater than value, 0 for 0
+	*/
+	inline uint64_t lastPowerOf2(uint64_t value) {
+		value |= value >> 1;
+		value |= value >> 2;
+		value |= value >> 4;
+		value |= value >> 8;
+		value |= value >> 16;
+		value |= value >> 32;
+		return value - (value >> 1);
+	}
+
+}
+
+#endif
@@ -1,170 +1,96 @@
-#include "MortonCurve.h"
+#include "mortoncurve.h"
 #include <algorithm>
-#include <iostream>
 
-using namespace std;
 
-
-MortonCurve::MortonCurve(unsigned int rows, unsigned int cols) :
-_rows(rows),
-_cols(cols),
-_root(new Division(ivec2(0, 0), ivec2(cols, rows))) {
-
-	_root->subdivide();
+MortonCurve::MortonCurve(unsigned int dimensionX, unsigned int dimensionY) :
+_dimensionX(dimensionX),
+_dimensionY(dimensionY),
+_side(morton::nextPowerOf2(std::max(dimensionX, dimensionY))) {
 }
 
+uint64_t MortonCurve::cellsInside(uint64_t originX, uint64_t originY, uint64_t size) const {
+	if (originX >= _dimensionX || originY >= _dimensionY)
+		return 0;
 
-
-unsigned int MortonCurve::nextPowerOf2(unsigned int number) {
-
-	unsigned int returnNumber = number - 1;
-	returnNumber |= returnNumber >> 1;
-	returnNumber |= returnNumber >> 2;
-	returnNumber |= returnNumber >> 4;
-	returnNumber |= returnNumber >> 8;
-	returnNumber |= returnNumber >> 16;
-
-	return ++returnNumber;
+	return (std::min(originX + size, _dimensionX) - originX) * (std::min(originY + size, _dimensionY) - originY);
 }
 
-unsigned int MortonCurve::lastPowerOf2(unsigned int number) {
-
-	unsigned int returnNumber = number;
-	returnNumber = returnNumber | (returnNumber >> 1);
-	returnNumber = returnNumber | (returnNumber >> 2);
-	returnNumber = returnNumber | (returnNumber >> 4);
-	returnNumber = returnNumber | (returnNumber >> 8);
-	returnNumber = returnNumber | (returnNumber >> 16);
+uint64_t MortonCurve::computeMortonCode(unsigned int x, unsigned int y) const {
+	uint64_t originX = 0, originY = 0, side = _side;
+	uint64_t index = 0;
 
-	return returnNumber - (returnNumber >> 1);
-}
+	// Quadrants before the one holding the cell add the cells they have inside the rectangle
+	while (side > 1 && !isInside(originX, originY, side)) {
+		uint64_t half = side >> 1;
+		unsigned quadrant = (x >= originX + half ? 1 : 0) | (y >= originY + half ? 2 : 0);
 
-unsigned int MortonCurve::computeMortonCode(unsigned int col, unsigned int row) {
-	return spreadBits(col) | (spreadBits(row) << 1);
-	//return _root->computeMortonCode(col, row);
-}
+		for (unsigned previous = 0; previous < quadrant; ++previous)
+			index += cellsInside(originX + (previous & 1) * half, originY + (previous >> 1) * half, half);
 
-ivec2 MortonCurve::decomputeMortonCode(unsigned int index) {
-	return ivec2(unSpreadBits(index), unSpreadBits(index >> 1));
-	//return _root->decomputeMortonCode(index);
-}
-
-unsigned int MortonCurve::spreadBits(unsigned int x) {
-	unsigned int r = x;
-	r = (r | (r << 8)) & 0x00FF00FF;
-	r = (r | (r << 4)) & 0x0F0F0F0F;
-	r = (r | (r << 2)) & 0x33333333;
-	r = (r | (r << 1)) & 0x55555555;
-
-	return r;
-}
-
-unsigned int MortonCurve::unSpreadBits(unsigned int x) {
-	unsigned int r = x & 0x55555555;
-	r = (r ^ (r >> 1)) & 0x33333333;
-	r = (r ^ (r >> 2)) & 0x0F0F0F0F;
-	r = (r ^ (r >> 4)) & 0x00FF00FF;
-	r = (r ^ (r >> 8)) & 0x0000FFFF;
-
-	return r;
-}
+		originX += (quadrant & 1) * half;
+		originY += (quadrant >> 1) * half;
+		side = half;
+	}
 
-bool MortonCurve::isPowerOfTwo(unsigned int x) {
-	while (((x % 2) == 0) && x > 1) /* While x is even and > 1 */
-		x /= 2;
-	return (x == 1);
+	return index + morton::encode(static_cast<uint32_t>(x - originX), static_cast<uint32_t>(y - originY));
 }
 
-MortonCurve::~MortonCurve() {
-	delete _root;
-}
+uint64_t MortonCurve::descend(uint64_t index, uint64_t& originX, uint64_t& originY, uint64_t& side) const {
+	originX = originY = 0;
+	side = _side;
 
+	while (side > 1 && !isInside(originX, originY, side)) {
+		uint64_t half = side >> 1;
 
-/**
-Division node operations
-*/
+		for (unsigned quadrant = 0; quadrant < 4; ++quadrant) {
+			uint64_t quadrantX = originX + (quadrant & 1) * half;
+			uint64_t quadrantY = originY + (quadrant >> 1) * half;
+			uint64_t cells = cellsInside(quadrantX, quadrantY, half);
 
-MortonCurve::Division::Division(ivec2 init, ivec2 dimension) :
-_init(init),
-_dimension(dimension),
-_child0(nullptr),
-_child1(nullptr) {
-}
+			if (index < cells || quadrant == 3) {
+				originX = quadrantX;
+				originY = quadrantY;
+				break;
+			}
 
-void MortonCurve::Division::subdivide() {
-	if (!isLeaf()) {
-		unsigned int powerOf2Block = min(lastPowerOf2(_dimension.x), lastPowerOf2(_dimension.y));
-		unsigned int xDifference = _dimension.x - powerOf2Block;
-		unsigned int yDifference = _dimension.y - powerOf2Block;
-
-		if (isPowerOfTwo(_dimension.y) && _dimension.x >= _dimension.y) { // left-right
-			_child0 = new Division(_init, ivec2(_dimension.y, _dimension.y));
-			_child1 = new Division(ivec2(_init.x + _dimension.y, _init.y), ivec2(_dimension.x - _dimension.y, _dimension.y));
-		} else if (_dimension.y > 1) { // up-down
-			_child0 = new Division(_init, ivec2(_dimension.x, powerOf2Block));
-			_child1 = new Division(ivec2(_init.x, _init.y + powerOf2Block), ivec2(_dimension.x, _dimension.y - powerOf2Block));
-		} else { // left-right
-			_child0 = new Division(_init, ivec2(1, 1));
-			_child1 = new Division(ivec2(_init.x + 1, _init.y), ivec2(_dimension.x - 1, _dimension.y));
+			index -= cells;
 		}
 
-		//cout << "child0 ->(" << _child0->_init.x << ", " << _child0->_init.y << ")" << "->(" << _child0->_dimension.x << ", " << _child0->_dimension.y << ")" << endl;
-		//cout << "child1 ->(" << _child1->_init.x << ", " << _child1->_init.y << ")" << "->(" << _child1->_dimension.x << ", " << _child1->_dimension.y << ")" << endl;
-		_child0->subdivide();
-		_child1->subdivide();
+		side = half;
 	}
 
-
+	return index;
 }
 
-unsigned int MortonCurve::Division::computeMortonCode(unsigned int col, unsigned int row) {
-	Division* _child;
-	unsigned int xIndex = col - _init.x;
-	unsigned int yIndex = row - _init.y;
-	unsigned int acum = 0;
+ivec2 MortonCurve::decomputeMortonCode(uint64_t index) const {
+	uint64_t originX, originY, side;
+	uint32_t x, y;
 
-	if (isLeaf()) {
-		return spreadBits(xIndex) | (spreadBits(yIndex) << 1);
-	}
-
-	if (_child0->contains(col, row)) {
-		_child = _child0;
-	} else if (_child1 != nullptr && _child1->contains(col, row)) {
-		acum += _child0->_dimension.x * _child0->_dimension.y;
-		_child = _child1;
-	}
+	morton::decode(descend(index, originX, originY, side), x, y);
 
-	////cout << "is in a child. Adding " << acum << " to a local index" << endl;
-	return acum + _child->computeMortonCode(col, row);
+	return ivec2(static_cast<int>(originX + x), static_cast<int>(originY + y));
 }
 
-ivec2 MortonCurve::Division::decomputeMortonCode(unsigned int index) {
-	Division* _child;
-
-	unsigned int acum = 0;
-
-	if (isLeaf()) {
-		return ivec2(unSpreadBits(index), unSpreadBits(index >> 1));
-	}
-	//
-	//	if (_child0->contains(col, row)){
-	//		_child = _child0;
-	//	}
-	//	else if (_child1 != nullptr && _child1->contains(col, row)) {
-	//		acum += _child0->_dimension.x * _child0->_dimension.y;
-	//		_child = _child1;
-	//	}
-	//
-	//	////cout << "is in a child. Adding " << acum << " to a local index" << endl;
-	//	return acum + _child->computeMortonCode(col, row);
+void MortonCurve::computeMortonCodes(const ivec2 *cells, uint64_t *indices, size_t n) const {
+	for (size_t i = 0; i < n; ++i)
+		indices[i] = computeMortonCode(cells[i].x, cells[i].y);
 }
 
-bool MortonCurve::Division::isPowerOfTwoSquare() {
+void MortonCurve::decomputeMortonCodes(uint64_t first, ivec2 *cells, size_t n) const {
+	size_t done = 0;
 
-	return _dimension.x == _dimension.y && isPowerOfTwo(_dimension.x) && isPowerOfTwo(_dimension.y);
-}
+	// Consecutive indices inside the same square are plain Morton codes
+	while (done < n) {
+		uint64_t originX, originY, side;
+		uint64_t local = descend(first + done, originX, originY, side);
+		size_t count = static_cast<size_t>(std::min<uint64_t>(side * side - local, n - done));
 
-MortonCurve::Division::~Division() {
-	delete _child0;
-	delete _child1;
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t x, y;
+			morton::decode(local + i, x, y);
+			cells[done + i] = ivec2(static_cast<int>(originX + x), static_cast<int>(originY + y));
+		}
+
+		done += count;
+	}
 }
@@ -1,71 +1,69 @@
 /**
-*	Class that encapsulates a Morton space-filling curve.
-*	Translated (col,row) into 1d index. It only works for 16 bit col and 15 bit row!
-* 
+*	Class that encapsulates a Morton space-filling curve over a rectangle of any size.
+*	Translates (x, y) into a 1D index in [0, dimensionX * dimensionY) and back.
+*
+*	The index of a cell is its position along the Morton curve of the enclosing power of
+*	two square, counting only the cells inside the rectangle. For power of two squares it
+*	is the plain Morton code. Quadrants lying completely inside the rectangle are solved
+*	with a single code, so only the cells near its border descend quadrant by quadrant.
+*
 *	@author Alejandro Graciano
 */
 
 #ifndef MORTON_CURVE_H
 #define MORTON_CURVE_H
 
-#include <vector>
-#include <glm\vec2.hpp>
+#include "core/morton.h"
+
+#include <cstdint>
+#include <glm/vec2.hpp>
 
 using glm::ivec2;
 
 
 class MortonCurve {
 
-	class Division {
-		ivec2 _init, _dimension;
-		Division *_child0, *_child1;
-
-	public:
-
-		Division(ivec2 init, ivec2 dimension);
-
-		void subdivide();
-
-		bool isPowerOfTwoSquare();
-
-		bool isLeaf() { return (_dimension.x == 1 && _dimension.y == 1) || isPowerOfTwoSquare(); }
-
-		unsigned int computeMortonCode(unsigned int col, unsigned int row);
+	uint64_t _dimensionX;
+	uint64_t _dimensionY;
+	uint64_t _side; /*< Side of the power of two square that encloses the rectangle */
 
-		ivec2 decomputeMortonCode(unsigned int index);
+	/**
+	Number of cells of the rectangle inside the square of side size at (originX, originY)
+	*/
+	uint64_t cellsInside(uint64_t originX, uint64_t originY, uint64_t size) const;
 
-		bool contains(unsigned int col, unsigned int row) {
-			return col >= _init.x && col < _init.x + _dimension.x &&
-				row >= _init.y && row < _init.y + _dimension.y;
-		}
+	bool isInside(uint64_t originX, uint64_t originY, uint64_t size) const {
+		return originX + size <= _dimensionX && originY + size <= _dimensionY;
+	}
 
-		~Division();
+	/**
+	Descends from the enclosing square to the largest square completely inside the
+	rectangle that holds index, returning the position of index within it
+	*/
+	uint64_t descend(uint64_t index, uint64_t& originX, uint64_t& originY, uint64_t& side) const;
 
+public:
+	MortonCurve(unsigned int dimensionX = 0, unsigned int dimensionY = 0);
 
-	};
-
-	static unsigned int spreadBits(unsigned int x);
-
-	static unsigned int unSpreadBits(unsigned int x);
-
-	static bool isPowerOfTwo(unsigned int x);
-
-	unsigned int _rows;
-	unsigned int _cols;
-	Division *_root;
+	uint64_t size() const { return _dimensionX * _dimensionY; }
 
-public:
-	MortonCurve(unsigned int rows, unsigned int cols);
+	uint64_t computeMortonCode(unsigned int x, unsigned int y) const;
 
-	unsigned int computeMortonCode(unsigned int col, unsigned int row);
+	ivec2 decomputeMortonCode(uint64_t index) const;
 
-	ivec2 decomputeMortonCode(unsigned int index);
+	/**
+	Indices of n cells
+	*/
+	void computeMortonCodes(const ivec2 *cells, uint64_t *indices, size_t n) const;
 
-	static unsigned int nextPowerOf2(unsigned int number);
+	/**
+	Cells of the n consecutive indices from first
+	*/
+	void decomputeMortonCodes(uint64_t first, ivec2 *cells, size_t n) const;
 
-	static unsigned int lastPowerOf2(unsigned int number);
+	static unsigned int nextPowerOf2(unsigned int number) { return static_cast<unsigned int>(morton::nextPowerOf2(number)); }
 
-	~MortonCurve();
+	static unsigned int lastPowerOf2(unsigned int number) { return static_cast<unsigned int>(morton::lastPowerOf2(number)); }
 };
 
 #endif
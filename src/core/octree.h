@@ -196,13 +196,13 @@ VoxelModel<T> Octree<T>::decompress() {
 
 	auto attributeName = _pVM->getAttributeName();
 	VoxelModel<T> returnVM(dimension, spacing, origin, attributeName);
-	int *data = new int[dimensionX * dimensionY * dimensionZ];
+	int *data = new int[dimension.x * dimension.y * dimension.z];
 
 
 	for (auto zIndex = 0; zIndex < dimension.z; ++zIndex) {
 		for (auto yIndex = 0; yIndex < dimension.y; ++yIndex) {
 			for (auto xIndex = 0; xIndex < dimension.x; ++xIndex) {
-				int index = VoxelModel<T>::index1D(xIndex, yIndex, zIndex, dimensionX, dimensionY, dimensionZ);
+				int index = VoxelModel<T>::index1D(xIndex, yIndex, zIndex, dimension.x, dimension.y, dimension.z);
 				data[index] = _root->getValue(xIndex, yIndex, zIndex);
 			}
 		}
@@ -0,0 +1,848 @@
+#include "pagedquadstack.h"
+#include "core/heightfieldcompressor.h"
+#include "core/parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using std::runtime_error;
+
+namespace {
+
+	const char MAGIC[4] = { 'Q', 'S', 'P', 'G' };
+
+	const uint32_t BYTE_ORDER_MARK = 0x01020304; /*< Read back swapped on machines of the other byte order */
+
+	const uint32_t VERSION = 1;
+
+	const size_t HEADER_BYTES = 4 + 2 * 4 + 2 * 4 + 3 * 4 + 3 * 4 + 8;
+
+	const size_t PAGE_ENTRY_BYTES = 2 * 8;
+
+	/**
+	Appends values to a byte buffer
+	*/
+	class Writer {
+
+		std::vector<char>& _buffer;
+
+	public:
+
+		Writer(std::vector<char>& buffer) : _buffer(buffer) {}
+
+		template<class V>
+		void put(V value) {
+			size_t position = _buffer.size();
+			_buffer.resize(position + sizeof(V));
+			memcpy(&_buffer[position], &value, sizeof(V));
+		}
+
+		template<class V>
+		void putVector(const std::vector<V>& values) {
+			put(static_cast<uint32_t>(values.size()));
+			const char *data = reinterpret_cast<const char*>(values.data());
+			_buffer.insert(_buffer.end(), data, data + values.size() * sizeof(V));
+		}
+	};
+
+	/**
+	Reads values from a byte range. Throws if the range is exhausted
+	*/
+	class Reader {
+
+		const char *_current, *_end;
+
+		void require(size_t size) {
+			if (static_cast<size_t>(_end - _current) < size)
+				throw runtime_error("Truncated paged QuadStack data");
+		}
+
+	public:
+
+		Reader(const char *begin, const char *end) : _current(begin), _end(end) {}
+
+		template<class V>
+		V get() {
+			require(sizeof(V));
+			V value;
+			memcpy(&value, _current, sizeof(V));
+			_current += sizeof(V);
+			return value;
+		}
+
+		template<class V>
+		std::vector<V> getVector() {
+			size_t size = get<uint32_t>();
+			require(size * sizeof(V));
+			std::vector<V> values(size);
+			if (size > 0)
+				memcpy(values.data(), _current, size * sizeof(V));
+			_current += size * sizeof(V);
+			return values;
+		}
+	};
+
+	void writeHeightField(Writer& writer, const HeightField& heightField) {
+		writer.put(static_cast<int32_t>(heightField.getDimensionX()));
+		writer.put(static_cast<int32_t>(heightField.getDimensionY()));
+		writer.put(static_cast<int32_t>(heightField.getOffset().x));
+		writer.put(static_cast<int32_t>(heightField.getOffset().y));
+		writer.put(heightField.getOriginX());
+		writer.put(heightField.getOriginY());
+		writer.put(heightField.getSpacingX());
+		writer.put(heightField.getSpacingY());
+		writer.put(heightField.getMinHeight());
+		writer.put(heightField.getMaxHeight());
+		writer.put(heightField.getNullData());
+
+		HeightFieldCompressor *compressor = heightField.getCompressor();
+		writer.put(static_cast<uint32_t>(heightField.isCompressed()));
+
+		// Pages are read on their own, so residuals of another layer are encoded again alone
+		std::unique_ptr<HeightFieldCompressor> independent;
+		if (heightField.isCompressed() && compressor->getReference()) {
+			independent.reset(new HeightFieldCompressor(const_cast<HeightField*>(&heightField), compressor->getBlockCol(), compressor->getBlockRow(), compressor->getOffset()));
+			independent->compress();
+			compressor = independent.get();
+		}
+
+		if (heightField.isCompressed()) {
+			writer.put(static_cast<uint32_t>(compressor->getBlockCol()));
+			writer.put(static_cast<uint32_t>(compressor->getBlockRow()));
+			writer.put(compressor->getOffset());
+			writer.putVector(compressor->getBaseValues());
+			writer.putVector(compressor->getEncodingBits());
+			writer.putVector(compressor->getPointer());
+			writer.putVector(compressor->getData());
+		} else
+			writer.putVector(heightField.getVectorOfData());
+	}
+
+}
+
+/**
+	Writing
+*/
+
+void PagedQuadStack::write(QuadStack& quadStack, const std::string& filePath, unsigned topLevels, unsigned pageLevels) {
+	using QuadNode = QuadStack::Node;
+
+	struct PageLayout {
+		std::vector<QuadNode*> _nodes;
+		std::vector<const HeightField*> _heightFields;
+	};
+
+	topLevels = std::max(topLevels, 1u);
+	pageLevels = std::max(pageLevels, 1u);
+
+	// Nodes and heightfields are located by their page and their index in it
+	std::vector<PageLayout> pages;
+	std::unordered_map<const QuadNode*, std::pair<uint32_t, uint32_t>> nodes;
+	std::unordered_map<const HeightField*, std::pair<uint32_t, uint32_t>> heightFields;
+
+	std::deque<QuadNode*> roots = { quadStack.getRoot() };
+	while (!roots.empty()) {
+		uint32_t id = static_cast<uint32_t>(pages.size());
+		unsigned levels = id == 0 ? topLevels : pageLevels;
+		pages.emplace_back();
+		PageLayout& page = pages.back();
+
+		// Nodes of the page in preorder, the children below its last level root new pages
+		std::vector<std::pair<QuadNode*, unsigned>> pending = { { roots.front(), 0u } };
+		roots.pop_front();
+		while (!pending.empty()) {
+			QuadNode *node = pending.back().first;
+			unsigned level = pending.back().second;
+			pending.pop_back();
+
+			nodes[node] = { id, static_cast<uint32_t>(page._nodes.size()) };
+			page._nodes.push_back(node);
+
+			if (!node->isLeaf()) {
+				QuadNode *children[4] = { node->getNW(), node->getNE(), node->getSW(), node->getSE() };
+				for (int i = 3; i >= 0; --i) {
+					if (level + 1 < levels)
+						pending.push_back({ children[i], level + 1 });
+					else
+						roots.push_back(children[i]);
+				}
+			}
+		}
+
+		// Owners come before the intervals sharing their heightfield, so they keep it
+		for (QuadNode *node : page._nodes) {
+			for (auto& interval : node->getGStack()) {
+				if (interval.hasHeightField() && !heightFields.count(interval.getHeightField())) {
+					heightFields[interval.getHeightField()] = { id, static_cast<uint32_t>(page._heightFields.size()) };
+					page._heightFields.push_back(interval.getHeightField());
+				}
+			}
+		}
+	}
+
+	std::ofstream file(filePath, std::ios::binary);
+	if (!file)
+		throw runtime_error("Cannot open " + filePath + " for writing");
+
+	std::vector<char> buffer;
+	auto writeHeader = [&](uint64_t tableOffset) {
+		buffer.clear();
+		Writer writer(buffer);
+		for (char c : MAGIC)
+			writer.put(c);
+		writer.put(BYTE_ORDER_MARK);
+		writer.put(VERSION);
+		writer.put(static_cast<int32_t>(quadStack.getTerrain()->getDimension().x));
+		writer.put(static_cast<int32_t>(quadStack.getTerrain()->getDimension().y));
+		writer.put(quadStack.getMinHeight());
+		writer.put(quadStack.getMaxHeight());
+		writer.put(quadStack.getHeightResolution());
+		writer.put(static_cast<uint32_t>(topLevels));
+		writer.put(static_cast<uint32_t>(pageLevels));
+		writer.put(static_cast<uint32_t>(pages.size()));
+		writer.put(tableOffset);
+		file.write(buffer.data(), buffer.size());
+	};
+
+	writeHeader(0);
+
+	std::vector<PageEntry> table;
+	uint64_t offset = HEADER_BYTES;
+	for (uint32_t id = 0; id < pages.size(); ++id) {
+		const PageLayout& page = pages[id];
+		buffer.clear();
+		Writer writer(buffer);
+
+		uint32_t nIntervals = 0;
+		for (QuadNode *node : page._nodes)
+			nIntervals += static_cast<uint32_t>(node->getGStack().size());
+
+		writer.put(static_cast<uint32_t>(page._nodes.size()));
+		writer.put(nIntervals);
+		writer.put(static_cast<uint32_t>(page._heightFields.size()));
+
+		uint32_t firstInterval = 0;
+		for (QuadNode *node : page._nodes) {
+			iaabb2 bb = node->getBoundingBox();
+			writer.put(static_cast<int32_t>(bb.min.x));
+			writer.put(static_cast<int32_t>(bb.min.y));
+			writer.put(static_cast<int32_t>(bb.max.x));
+			writer.put(static_cast<int32_t>(bb.max.y));
+
+			QuadNode *children[4] = { node->getNW(), node->getNE(), node->getSW(), node->getSE() };
+			for (QuadNode *child : children) {
+				if (node->isLeaf())
+					writer.put(NONE);
+				else {
+					auto location = nodes.at(child);
+					writer.put(location.first == id ? location.second : PAGE_REFERENCE | location.first);
+				}
+			}
+
+			uint32_t size = static_cast<uint32_t>(node->getGStack().size());
+			writer.put(firstInterval);
+			writer.put(size);
+			firstInterval += size;
+		}
+
+		for (QuadNode *node : page._nodes) {
+			for (auto& interval : node->getGStack()) {
+				writer.put(static_cast<int32_t>(interval.getMaterial()));
+				if (interval.hasHeightField()) {
+					auto location = heightFields.at(interval.getHeightField());
+					writer.put(location.first);
+					writer.put(location.second);
+				} else {
+					writer.put(NONE);
+					writer.put(NONE);
+				}
+			}
+		}
+
+		for (const HeightField *heightField : page._heightFields)
+			writeHeightField(writer, *heightField);
+
+		file.write(buffer.data(), buffer.size());
+		table.push_back({ offset, buffer.size() });
+		offset += buffer.size();
+	}
+
+	buffer.clear();
+	Writer writer(buffer);
+	for (const PageEntry& entry : table) {
+		writer.put(entry._offset);
+		writer.put(entry._bytes);
+	}
+	file.write(buffer.data(), buffer.size());
+
+	file.seekp(0);
+	writeHeader(offset);
+
+	if (!file.flush())
+		throw runtime_error("Cannot write " + filePath);
+}
+
+/**
+	Reading
+*/
+
+#ifdef _WIN32
+
+void PagedQuadStack::read(uint64_t offset, size_t size, char *buffer) const {
+	while (size > 0) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30)), done = 0;
+		if (!ReadFile(_file, buffer, chunk, &done, &overlapped) || done == 0)
+			throw runtime_error("Cannot read " + _filePath);
+
+		offset += done;
+		buffer += done;
+		size -= done;
+	}
+}
+
+#else
+
+void PagedQuadStack::read(uint64_t offset, size_t size, char *buffer) const {
+	while (size > 0) {
+		ssize_t done = pread(_file, buffer, size, static_cast<off_t>(offset));
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			throw runtime_error("Cannot read " + _filePath);
+
+		offset += done;
+		buffer += done;
+		size -= done;
+	}
+}
+
+#endif
+
+PagedQuadStack::PagePointer PagedQuadStack::readPage(uint32_t id) {
+	const PageEntry& entry = _pageTable[id];
+	std::vector<char> buffer(entry._bytes);
+	read(entry._offset, buffer.size(), buffer.data());
+	_bytesRead += buffer.size();
+
+	Reader reader(buffer.data(), buffer.data() + buffer.size());
+	std::shared_ptr<Page> page = std::make_shared<Page>();
+	page->_id = id;
+
+	uint32_t nNodes = reader.get<uint32_t>();
+	uint32_t nIntervals = reader.get<uint32_t>();
+	uint32_t nHeightFields = reader.get<uint32_t>();
+	uint32_t nPages = static_cast<uint32_t>(_pageTable.size());
+	auto malformed = [&]() { return runtime_error("Malformed page " + std::to_string(id) + " of " + _filePath); };
+
+	page->_nodes.resize(nNodes);
+	for (Node& node : page->_nodes) {
+		node._bb.min.x = reader.get<int32_t>();
+		node._bb.min.y = reader.get<int32_t>();
+		node._bb.max.x = reader.get<int32_t>();
+		node._bb.max.y = reader.get<int32_t>();
+		for (uint32_t& child : node._children) {
+			child = reader.get<uint32_t>();
+			if (child != NONE && ((child & PAGE_REFERENCE) ? (child & ~PAGE_REFERENCE) >= nPages : child >= nNodes))
+				throw malformed();
+		}
+		node._firstInterval = reader.get<uint32_t>();
+		node._nIntervals = reader.get<uint32_t>();
+		if (node._firstInterval > nIntervals || node._nIntervals > nIntervals - node._firstInterval)
+			throw malformed();
+	}
+	if (nNodes == 0)
+		throw malformed();
+
+	page->_intervals.resize(nIntervals);
+	for (Interval& interval : page->_intervals) {
+		interval._material = reader.get<int32_t>();
+		interval._page = reader.get<uint32_t>();
+		interval._heightField = reader.get<uint32_t>();
+		if (interval._page != NONE && interval._page >= nPages)
+			throw malformed();
+	}
+
+	page->_bytes = sizeof(Page) + nNodes * sizeof(Node) + nIntervals * sizeof(Interval);
+	for (uint32_t i = 0; i < nHeightFields; ++i) {
+		ivec2 dimension, offset;
+		vec2 origin, spacing;
+		dimension.x = reader.get<int32_t>();
+		dimension.y = reader.get<int32_t>();
+		offset.x = reader.get<int32_t>();
+		offset.y = reader.get<int32_t>();
+		origin.x = reader.get<float>();
+		origin.y = reader.get<float>();
+		spacing.x = reader.get<float>();
+		spacing.y = reader.get<float>();
+		float minHeight = reader.get<float>();
+		float maxHeight = reader.get<float>();
+		float nullData = reader.get<float>();
+		bool compressed = reader.get<uint32_t>() != 0;
+		if (dimension.x < 0 || dimension.y < 0)
+			throw malformed();
+
+		std::unique_ptr<HeightField> heightField;
+		if (compressed) {
+			unsigned blockCol = reader.get<uint32_t>();
+			unsigned blockRow = reader.get<uint32_t>();
+			float resolution = reader.get<float>();
+			std::vector<float> baseValues = reader.getVector<float>();
+			std::vector<int> bits = reader.getVector<int>();
+			std::vector<int> pointers = reader.getVector<int>();
+			std::vector<unsigned> data = reader.getVector<unsigned>();
+			page->_bytes += (baseValues.size() + bits.size() + pointers.size() + data.size()) * 4 + sizeof(HeightFieldCompressor);
+
+			// The buffer of the constructor is never written, so it is released untouched
+			heightField.reset(new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr));
+			HeightFieldCompressor *compressor;
+			try {
+				compressor = new HeightFieldCompressor(heightField.get(), blockCol, blockRow, resolution, std::move(baseValues), std::move(bits), std::move(pointers), std::move(data));
+			} catch (const std::invalid_argument&) {
+				throw malformed();
+			}
+			compressor->setCache(_blockCache);
+			heightField->setCompressor(compressor);
+			heightField->releaseData();
+		} else {
+			std::vector<float> values = reader.getVector<float>();
+			if (values.size() != static_cast<size_t>(dimension.x) * dimension.y)
+				throw malformed();
+			heightField.reset(new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, values.data()));
+			page->_bytes += values.size() * sizeof(float);
+		}
+
+		heightField->setOffset(offset);
+		page->_heightFields.push_back(std::move(heightField));
+		page->_bytes += sizeof(HeightField);
+	}
+
+	for (const Interval& interval : page->_intervals)
+		if (interval._page == id && interval._heightField >= nHeightFields)
+			throw malformed();
+
+	return page;
+}
+
+PagedQuadStack::PagedQuadStack(const std::string& filePath, size_t budget) :
+	_filePath(filePath),
+	_budget(budget),
+	_blockCache(&BlockCache::getShared()),
+	_residentBytes(0),
+	_hits(0),
+	_misses(0),
+	_prefetched(0),
+	_evictions(0),
+	_bytesRead(0),
+	_prefetchBusy(false),
+	_stopping(false) {
+
+#ifdef _WIN32
+	_file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		throw runtime_error("Cannot open " + filePath);
+#else
+	_file = ::open(filePath.c_str(), O_RDONLY);
+	if (_file < 0)
+		throw runtime_error("Cannot open " + filePath);
+#endif
+
+	try {
+		char header[HEADER_BYTES];
+		read(0, HEADER_BYTES, header);
+		Reader reader(header, header + HEADER_BYTES);
+
+		char magic[4];
+		for (char& c : magic)
+			c = reader.get<char>();
+		if (memcmp(magic, MAGIC, 4) != 0)
+			throw runtime_error(filePath + " is not a paged QuadStack");
+		if (reader.get<uint32_t>() != BYTE_ORDER_MARK)
+			throw runtime_error(filePath + " was written by a machine of another byte order");
+		if (reader.get<uint32_t>() != VERSION)
+			throw runtime_error("Unsupported version of paged QuadStack in " + filePath);
+
+		_dimension.x = reader.get<int32_t>();
+		_dimension.y = reader.get<int32_t>();
+		_minHeight = reader.get<float>();
+		_maxHeight = reader.get<float>();
+		_heightResolution = reader.get<float>();
+		reader.get<uint32_t>();
+		reader.get<uint32_t>();
+		uint32_t nPages = reader.get<uint32_t>();
+		uint64_t tableOffset = reader.get<uint64_t>();
+		if (nPages == 0 || nPages > PAGE_REFERENCE)
+			throw runtime_error("Malformed header of " + filePath);
+
+		std::vector<char> table(nPages * PAGE_ENTRY_BYTES);
+		read(tableOffset, table.size(), table.data());
+		Reader tableReader(table.data(), table.data() + table.size());
+		_pageTable.resize(nPages);
+		for (PageEntry& entry : _pageTable) {
+			entry._offset = tableReader.get<uint64_t>();
+			entry._bytes = tableReader.get<uint64_t>();
+		}
+
+		_top = readPage(0);
+
+	} catch (...) {
+#ifdef _WIN32
+		CloseHandle(_file);
+#else
+		::close(_file);
+#endif
+		throw;
+	}
+
+	_prefetcher = std::thread(&PagedQuadStack::prefetchLoop, this);
+}
+
+PagedQuadStack::~PagedQuadStack() {
+	{
+		std::lock_guard<std::mutex> lock(_prefetchMutex);
+		_stopping = true;
+	}
+	_prefetchCondition.notify_all();
+	_prefetcher.join();
+
+#ifdef _WIN32
+	CloseHandle(_file);
+#else
+	::close(_file);
+#endif
+}
+
+PagedQuadStack::PagePointer PagedQuadStack::insert(PagePointer page) {
+	std::lock_guard<std::mutex> lock(_residentMutex);
+
+	auto found = _resident.find(page->_id);
+	if (found != _resident.end()) {
+		_recency.splice(_recency.begin(), _recency, found->second._position);
+		return found->second._page;
+	}
+
+	_recency.push_front(page->_id);
+	_resident[page->_id] = { page, _recency.begin() };
+	_residentBytes += page->_bytes;
+
+	// The page just read stays, whatever its size
+	while (_residentBytes > _budget && _recency.size() > 1) {
+		auto evicted = _resident.find(_recency.back());
+		_residentBytes -= evicted->second._page->_bytes;
+		_resident.erase(evicted);
+		_recency.pop_back();
+		_evictions++;
+	}
+
+	return page;
+}
+
+const PagedQuadStack::Page* PagedQuadStack::getPage(uint32_t id, Pins& pins, bool prefetching) {
+	if (id == 0)
+		return _top.get();
+
+	for (auto& pin : pins)
+		if (pin->_id == id)
+			return pin.get();
+
+	{
+		std::lock_guard<std::mutex> lock(_residentMutex);
+		auto found = _resident.find(id);
+		if (found != _resident.end()) {
+			_recency.splice(_recency.begin(), _recency, found->second._position);
+			pins.push_back(found->second._page);
+			if (!prefetching)
+				_hits++;
+			return pins.back().get();
+		}
+	}
+
+	// Read outside the lock, a concurrent query may read the same page meanwhile
+	if (prefetching)
+		_prefetched++;
+	else
+		_misses++;
+	pins.push_back(insert(readPage(id)));
+	return pins.back().get();
+}
+
+iaabb2 PagedQuadStack::getChildBox(const iaabb2& bb, int child) {
+	// Same split as QuadStack::Node::subdivide
+	int halfX = (bb.max.x + bb.min.x) / 2;
+	int halfY = (bb.max.y + bb.min.y) / 2;
+
+	switch (child) {
+	case 0: return iaabb2(ivec2(bb.min.x, halfY), ivec2(halfX, bb.max.y));
+	case 1: return iaabb2(ivec2(halfX, halfY), bb.max);
+	case 2: return iaabb2(bb.min, ivec2(halfX, halfY));
+	default: return iaabb2(ivec2(halfX, bb.min.y), ivec2(bb.max.x, halfY));
+	}
+}
+
+const PagedQuadStack::Node& PagedQuadStack::getChild(const Page*& page, const Node& node, int x, int y, Pins& pins) {
+	int child = 0;
+	for (; child < 3; ++child) {
+		iaabb2 bb = getChildBox(node._bb, child);
+		if (bb.min.x <= x && bb.max.x > x && bb.min.y <= y && bb.max.y > y)
+			break;
+	}
+
+	uint32_t reference = node._children[child];
+	if (reference & PAGE_REFERENCE) {
+		page = getPage(reference & ~PAGE_REFERENCE, pins);
+		return page->_nodes[0];
+	}
+
+	return page->_nodes[reference];
+}
+
+float PagedQuadStack::getHeight(const Interval& interval, int x, int y, Pins& pins) {
+	const HeightField *heightField = getPage(interval._page, pins)->_heightFields[interval._heightField].get();
+	ivec2 origin = heightField->getOffset();
+
+	return heightField->getData(x - origin.x, y - origin.y);
+}
+
+/**
+	Queries
+*/
+
+int PagedQuadStack::sample(int x, int y, float height, float fatherHeight) {
+	Pins pins;
+	const Page *page = _top.get();
+	const Node *node = &page->_nodes[0];
+
+	while (true) {
+		float currentHeight = fatherHeight;
+
+		for (uint32_t i = 0; i < node->_nIntervals; ++i) {
+			const Interval& interval = page->_intervals[node->_firstInterval + i];
+			currentHeight = interval._page != NONE ? getHeight(interval, x, y, pins) : fatherHeight;
+
+			if (currentHeight >= height) {
+				if (interval._material == NULL_VALUE)
+					break;
+				else
+					return interval._material;
+			}
+		}
+
+		// The terrain of the leaves is not kept in the file
+		if (node->_children[0] == NONE)
+			return NULL_VALUE;
+
+		fatherHeight = currentHeight;
+		node = &getChild(page, *node, x, y, pins);
+	}
+}
+
+void PagedQuadStack::column(const Page *page, const Node& node, int x, int y, float low, float high, Column& column, Pins& pins) {
+
+	// Consecutive intervals with the same material are joined, as in Stack::addInterval
+	auto addInterval = [&column](int material, float height) {
+		if (!column.empty() && column.back()._attribute == material)
+			column.back()._accumulatedHeight = height;
+		else
+			column.push_back({ height, material });
+	};
+
+	bool leaf = node._children[0] == NONE;
+
+	if (node._nIntervals > 0) {
+		float bottom = low;
+
+		for (uint32_t i = 0; i < node._nIntervals; ++i) {
+			const Interval& interval = page->_intervals[node._firstInterval + i];
+			float top = interval._page != NONE ? std::min(getHeight(interval, x, y, pins), high) : high;
+
+			if (top > bottom) {
+				if (interval._material != NULL_VALUE)
+					addInterval(interval._material, top);
+				else if (!leaf) {
+					const Page *childPage = page;
+					const Node& child = getChild(childPage, node, x, y, pins);
+					this->column(childPage, child, x, y, bottom, top, column, pins);
+				}
+
+				bottom = top;
+			}
+
+			if (bottom >= high)
+				break;
+		}
+
+	} else if (!leaf) {
+		const Page *childPage = page;
+		const Node& child = getChild(childPage, node, x, y, pins);
+		this->column(childPage, child, x, y, low, high, column, pins);
+	}
+}
+
+void PagedQuadStack::getColumn(int x, int y, float fatherHeight, Column& column) {
+	Pins pins;
+	column.clear();
+	this->column(_top.get(), _top->_nodes[0], x, y, _minHeight, fatherHeight, column, pins);
+}
+
+void PagedQuadStack::getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) {
+	region.min = ivec2(std::min(std::max(region.min.x, 0), _dimension.x), std::min(std::max(region.min.y, 0), _dimension.y));
+	region.max = ivec2(std::min(std::max(region.max.x, region.min.x), _dimension.x), std::min(std::max(region.max.y, region.min.y), _dimension.y));
+	int width = region.max.x - region.min.x;
+
+	columns.assign(static_cast<size_t>(width) * (region.max.y - region.min.y), Column());
+
+	parallel::forRange(region.min.y, region.max.y, [&](size_t y) {
+		for (int x = region.min.x; x < region.max.x; ++x) {
+			// Pins are dropped after every cell, so a row does not hold every page it crosses
+			Pins pins;
+			Column& column = columns[(x - region.min.x) + (y - region.min.y) * static_cast<size_t>(width)];
+			this->column(_top.get(), _top->_nodes[0], x, static_cast<int>(y), low, high, column, pins);
+		}
+	});
+}
+
+void PagedQuadStack::batch(const std::vector<ivec2>& cells, const std::function<void(size_t index)>& function) {
+	for (size_t first = 0; first < cells.size(); first += PREFETCH_CHUNK) {
+		size_t last = std::min(first + PREFETCH_CHUNK, cells.size());
+
+		if (last < cells.size())
+			prefetch(std::vector<ivec2>(cells.begin() + last, cells.begin() + std::min(last + PREFETCH_CHUNK, cells.size())));
+
+		for (size_t i = first; i < last; ++i)
+			function(i);
+	}
+}
+
+void PagedQuadStack::sample(const std::vector<vec3>& points, float fatherHeight, std::vector<int>& materials) {
+	std::vector<ivec2> cells(points.size());
+	for (size_t i = 0; i < points.size(); ++i)
+		cells[i] = ivec2(static_cast<int>(points[i].x), static_cast<int>(points[i].y));
+
+	materials.resize(points.size());
+	batch(cells, [&](size_t i) { materials[i] = sample(cells[i].x, cells[i].y, points[i].z, fatherHeight); });
+}
+
+void PagedQuadStack::getColumns(const std::vector<ivec2>& cells, float fatherHeight, std::vector<Column>& columns) {
+	columns.resize(cells.size());
+	batch(cells, [&](size_t i) { getColumn(cells[i].x, cells[i].y, fatherHeight, columns[i]); });
+}
+
+/**
+	Prefetching
+*/
+
+void PagedQuadStack::load(const iaabb2& region) {
+	Pins pins;
+	size_t bytes = 0;
+
+	std::vector<std::pair<const Page*, const Node*>> pending = { { _top.get(), &_top->_nodes[0] } };
+	while (!pending.empty() && bytes <= _budget / 2) {
+		const Page *page = pending.back().first;
+		const Node& node = *pending.back().second;
+		pending.pop_back();
+
+		if (node._children[0] == NONE)
+			continue;
+
+		for (int i = 0; i < 4; ++i) {
+			iaabb2 bb = getChildBox(node._bb, i);
+			if (bb.min.x >= region.max.x || region.min.x >= bb.max.x || bb.min.y >= region.max.y || region.min.y >= bb.max.y)
+				continue;
+
+			const Page *childPage = page;
+			uint32_t reference = node._children[i];
+			if (reference & PAGE_REFERENCE) {
+				size_t pinned = pins.size();
+				childPage = getPage(reference & ~PAGE_REFERENCE, pins, true);
+				if (pins.size() > pinned)
+					bytes += childPage->_bytes;
+				reference = 0;
+			}
+
+			pending.push_back({ childPage, &childPage->_nodes[reference] });
+		}
+	}
+}
+
+void PagedQuadStack::prefetchLoop() {
+	std::unique_lock<std::mutex> lock(_prefetchMutex);
+
+	while (true) {
+		_prefetchCondition.wait(lock, [this]() { return _stopping || !_prefetchQueue.empty(); });
+		if (_stopping)
+			return;
+
+		iaabb2 region = _prefetchQueue.front();
+		_prefetchQueue.pop_front();
+		_prefetchBusy = true;
+		lock.unlock();
+
+		// A page that cannot be read is reported by the query that needs it
+		try {
+			load(region);
+		} catch (const std::exception&) {
+		}
+
+		lock.lock();
+		_prefetchBusy = false;
+		_prefetchCondition.notify_all();
+	}
+}
+
+void PagedQuadStack::prefetch(const iaabb2& region) {
+	{
+		std::lock_guard<std::mutex> lock(_prefetchMutex);
+		_prefetchQueue.push_back(region);
+	}
+	_prefetchCondition.notify_all();
+}
+
+void PagedQuadStack::prefetch(const std::vector<ivec2>& cells) {
+	{
+		std::lock_guard<std::mutex> lock(_prefetchMutex);
+		for (ivec2 cell : cells)
+			_prefetchQueue.push_back(iaabb2(cell, cell + ivec2(1)));
+	}
+	_prefetchCondition.notify_all();
+}
+
+void PagedQuadStack::waitPrefetch() {
+	std::unique_lock<std::mutex> lock(_prefetchMutex);
+	_prefetchCondition.wait(lock, [this]() { return _prefetchQueue.empty() && !_prefetchBusy; });
+}
+
+/**
+	Resident set
+*/
+
+void PagedQuadStack::setBlockCache(BlockCache *cache) {
+	// The compressors of the pages read are left alone, queries may be decoding through them
+	_blockCache = cache;
+}
+
+PagedQuadStack::Statistics PagedQuadStack::getStatistics() {
+	std::lock_guard<std::mutex> lock(_residentMutex);
+	return { _hits, _misses, _prefetched, _evictions, _bytesRead, _resident.size(), _residentBytes };
+}
+
+void PagedQuadStack::clear() {
+	std::lock_guard<std::mutex> lock(_residentMutex);
+	_resident.clear();
+	_recency.clear();
+	_residentBytes = 0;
+}
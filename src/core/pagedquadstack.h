@@ -0,0 +1,285 @@
+/**
+*	QuadStack queried from a file without loading it whole. The tree is cut into pages:
+*	the top levels form a page that is always resident, and every node below them roots a
+*	page with the next levels of its subtree. A page holds its nodes and the heightfields
+*	they own, compressed as QuadStack::compressHeightField left them.
+*
+*	Pages are read with pread when a query reaches them and kept in a resident set of a
+*	bounded number of bytes, which evicts the least recently used page. Queries pin the
+*	pages they walk through, so a page evicted meanwhile is freed once they finish. Pages
+*	can be requested ahead of the queries with prefetch, which reads them in a background
+*	thread. As a QuadStackQueries it can replace the QuadStack it was written from in any
+*	caller of those queries.
+*
+*	File layout, in the byte order of the machine that wrote it:
+*		Header			magic "QSPG", byte order mark, version, dimension, height range,
+*						height resolution, levels of the top page and of the rest, number of
+*						pages, page table offset
+*		Pages			nodes with their bounding box, children and intervals, then the
+*						intervals, then the heightfields. A child is a node of the page or the
+*						root of another page, and an interval refers to a heightfield by its
+*						page and its index in that page
+*		Page table		offset and size of every page, the top page first
+*
+*	Heights are the ones decoded from the compressed blocks, as in a QuadStack whose data was
+*	released. Heightfields that were not compressed are stored as they are.
+*
+*	@class PagedQuadStack
+*/
+
+#ifndef PAGED_QUAD_STACK_H
+#define PAGED_QUAD_STACK_H
+
+#include "core/blockcache.h"
+#include "core/quadstack.h"
+#include "core/quadstackqueries.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class PagedQuadStack final : public QuadStackQueries {
+
+public:
+
+	static const size_t DEFAULT_BUDGET = 256 << 20; /*< Bytes of the resident pages, besides the top one */
+
+	static const unsigned DEFAULT_TOP_LEVELS = 6; /*< Levels of the tree in the top page */
+
+	static const unsigned DEFAULT_PAGE_LEVELS = 4; /*< Levels of the tree in the rest of pages */
+
+	using Column = QuadStackQueries::Column;
+
+	struct Statistics {
+		uint64_t _hits; /*< Pages found resident */
+		uint64_t _misses; /*< Pages read by a query */
+		uint64_t _prefetched; /*< Pages read ahead by prefetch */
+		uint64_t _evictions;
+		uint64_t _bytesRead;
+		size_t _residentPages; /*< Besides the top page */
+		size_t _residentBytes;
+	};
+
+private:
+
+	static const int NULL_VALUE = -1;
+
+	static const uint32_t NONE = 0xFFFFFFFF;
+
+	static const uint32_t PAGE_REFERENCE = 0x80000000; /*< Flags the children that root another page */
+
+	static const unsigned PREFETCH_CHUNK = 256; /*< Queries of a batch whose pages are requested together */
+
+	struct Node {
+		iaabb2 _bb;
+		uint32_t _children[4]; /*< NW, NE, SW, SE, NONE for leaves */
+		uint32_t _firstInterval, _nIntervals;
+	};
+
+	struct Interval {
+		int _material;
+		uint32_t _page, _heightField; /*< Heightfield of the interval, _page is NONE if it has none */
+	};
+
+	struct Page {
+		uint32_t _id;
+		std::vector<Node> _nodes; /*< The root of the page first */
+		std::vector<Interval> _intervals;
+		std::vector<std::unique_ptr<HeightField>> _heightFields;
+		size_t _bytes; /*< Memory taken by the page */
+	};
+
+	using PagePointer = std::shared_ptr<const Page>;
+
+	/**
+	Pages pinned by a query, in the order it reached them
+	*/
+	using Pins = std::vector<PagePointer>;
+
+	struct Resident {
+		PagePointer _page;
+		std::list<uint32_t>::iterator _position; /*< In the recency list */
+	};
+
+	struct PageEntry {
+		uint64_t _offset, _bytes;
+	};
+
+#ifdef _WIN32
+	void *_file; /*< File handle */
+#else
+	int _file; /*< File descriptor */
+#endif
+
+	std::string _filePath;
+
+	ivec2 _dimension;
+
+	float _minHeight, _maxHeight, _heightResolution;
+
+	std::vector<PageEntry> _pageTable;
+
+	PagePointer _top;
+
+	size_t _budget;
+
+	std::atomic<BlockCache*> _blockCache; /*< Given to the compressors of the pages read */
+
+	std::mutex _residentMutex;
+	std::unordered_map<uint32_t, Resident> _resident;
+	std::list<uint32_t> _recency; /*< Resident pages from the most recently used */
+	size_t _residentBytes;
+
+	std::atomic<uint64_t> _hits, _misses, _prefetched, _evictions, _bytesRead;
+
+	std::mutex _prefetchMutex;
+	std::condition_variable _prefetchCondition;
+	std::deque<iaabb2> _prefetchQueue;
+	bool _prefetchBusy; /*< A region taken from the queue is being read */
+	bool _stopping;
+	std::thread _prefetcher;
+
+	/**
+	Reads size bytes at offset. Throws std::runtime_error if they cannot be read
+	*/
+	void read(uint64_t offset, size_t size, char *buffer) const;
+
+	PagePointer readPage(uint32_t id);
+
+	/**
+	Page id, resident or read from the file. Pages already pinned by the query are reused
+	*/
+	const Page* getPage(uint32_t id, Pins& pins, bool prefetching = false);
+
+	/**
+	Makes page resident, evicting the least recently used ones beyond the budget. Returns
+	the page that is resident, which is another one if a concurrent query read it first
+	*/
+	PagePointer insert(PagePointer page);
+
+	/**
+	Bounding box of the child of a node with bounding box bb, in the order of Node::_children
+	*/
+	static iaabb2 getChildBox(const iaabb2& bb, int child);
+
+	/**
+	Child of a node that contains the cell (x, y), and the page it belongs to
+	*/
+	const Node& getChild(const Page*& page, const Node& node, int x, int y, Pins& pins);
+
+	float getHeight(const Interval& interval, int x, int y, Pins& pins);
+
+	void column(const Page *page, const Node& node, int x, int y, float low, float high, Column& column, Pins& pins);
+
+	/**
+	Reads the pages below the top one with nodes that overlap region, stopping when the
+	pages read would take half the budget
+	*/
+	void load(const iaabb2& region);
+
+	void prefetchLoop();
+
+	/**
+	Calls function with the index of every cell in order, requesting the pages of the next
+	chunk of cells before querying the current one
+	*/
+	void batch(const std::vector<ivec2>& cells, const std::function<void(size_t index)>& function);
+
+public:
+
+	/**
+	Opens a file written by write. The top page is read at once. Throws std::runtime_error
+	if the file cannot be read or is not a paged QuadStack of this machine
+	*/
+	explicit PagedQuadStack(const std::string& filePath, size_t budget = DEFAULT_BUDGET);
+
+	PagedQuadStack(const PagedQuadStack&) = delete;
+
+	PagedQuadStack& operator=(const PagedQuadStack&) = delete;
+
+	/**
+	Writes quadStack into filePath cut into pages: topLevels levels in the top page and
+	pageLevels in each of the rest. Throws std::runtime_error if the file cannot be written
+	*/
+	static void write(QuadStack& quadStack, const std::string& filePath, unsigned topLevels = DEFAULT_TOP_LEVELS, unsigned pageLevels = DEFAULT_PAGE_LEVELS);
+
+	/**
+	Same as QuadStack::sample
+	*/
+	int sample(int x, int y, float height, float fatherHeight) override;
+
+	/**
+	Same as QuadStack::getColumn
+	*/
+	void getColumn(int x, int y, float fatherHeight, Column& column) override;
+
+	/**
+	Same as QuadStack::getColumns. Rows of the region are filled in parallel
+	*/
+	void getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) override;
+
+	/**
+	Samples every point, with x and y its cell and z its height, prefetching the pages of
+	the points ahead
+	*/
+	void sample(const std::vector<vec3>& points, float fatherHeight, std::vector<int>& materials);
+
+	/**
+	Columns of every cell, prefetching the pages of the cells ahead
+	*/
+	void getColumns(const std::vector<ivec2>& cells, float fatherHeight, std::vector<Column>& columns);
+
+	/**
+	Hints that the cells of region are about to be queried. Their pages are read in the
+	background, as far as half the budget allows
+	*/
+	void prefetch(const iaabb2& region);
+
+	/**
+	Hints that the cells are about to be queried
+	*/
+	void prefetch(const std::vector<ivec2>& cells);
+
+	/**
+	Blocks until the prefetched pages have been read
+	*/
+	void waitPrefetch();
+
+	/**
+	Cache of decoded blocks for the heightfields of the pages read from now on, none if null.
+	The cache shared by the whole process is used unless told otherwise, and the top page,
+	read on opening, always uses it. Resident pages keep the cache they were read with until
+	they are evicted or dropped by clear, so a cache must outlive them
+	*/
+	void setBlockCache(BlockCache *cache);
+
+	Statistics getStatistics();
+
+	/**
+	Evicts every page but the top one
+	*/
+	void clear();
+
+	ivec2 getDimension() const override { return _dimension; }
+
+	float getMinHeight() const override { return _minHeight; }
+
+	float getMaxHeight() const override { return _maxHeight; }
+
+	float getHeightResolution() const { return _heightResolution; }
+
+	size_t getNumberOfPages() const { return _pageTable.size(); }
+
+	~PagedQuadStack();
+};
+
+#endif
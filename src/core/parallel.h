@@ -0,0 +1,103 @@
+/**
+*	Minimal helpers to spread loops among the hardware threads. Work is handed out
+*	dynamically in chunks, so unbalanced iterations do not stall the whole loop.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+	/**
+	Number of threads used by the parallel loops. Defaults to the hardware concurrency
+	*/
+	inline unsigned& threadCount() {
+		static unsigned count = std::max(1u, std::thread::hardware_concurrency());
+		return count;
+	}
+
+	inline unsigned getThreads() { return threadCount(); }
+
+	inline void setThreads(unsigned threads) { threadCount() = std::max(1u, threads); }
+
+	/**
+	Tells if the calling thread is a worker of a parallel loop
+	*/
+	inline bool& insideLoop() {
+		thread_local bool inside = false;
+		return inside;
+	}
+
+	/**
+	Calls function(index) for every index in [begin, end). Indices are grabbed in
+	groups of grain elements by the workers. The first exception thrown by any
+	iteration is rethrown in the calling thread once every worker has finished. Loops
+	nested in the iterations of another run in the thread of the iteration, instead of
+	starting threads of their own
+	*/
+	template<class Function>
+	void forRange(size_t begin, size_t end, Function function, size_t grain = 1) {
+		if (end <= begin)
+			return;
+
+		grain = std::max<size_t>(grain, 1);
+		size_t nGroups = (end - begin + grain - 1) / grain;
+		unsigned nWorkers = static_cast<unsigned>(std::min<size_t>(getThreads(), nGroups));
+
+		if (nWorkers <= 1 || insideLoop()) {
+			for (size_t i = begin; i < end; ++i)
+				function(i);
+			return;
+		}
+
+		std::atomic<size_t> next(begin);
+		std::exception_ptr error;
+		std::atomic<bool> failed(false);
+
+		auto worker = [&]() {
+			insideLoop() = true;
+			try {
+				size_t first;
+				while (!failed && (first = next.fetch_add(grain)) < end) {
+					size_t last = std::min(first + grain, end);
+					for (size_t i = first; i < last; ++i)
+						function(i);
+				}
+			} catch (...) {
+				if (!failed.exchange(true))
+					error = std::current_exception();
+			}
+			insideLoop() = false;
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(nWorkers - 1);
+		for (unsigned t = 1; t < nWorkers; ++t)
+			threads.emplace_back(worker);
+
+		worker();
+
+		for (auto& thread : threads)
+			thread.join();
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	/**
+	Calls function(chunk) for every chunk in [0, nChunks), one chunk per grab
+	*/
+	template<class Function>
+	void forChunks(size_t nChunks, Function function) {
+		forRange(0, nChunks, function, 1);
+	}
+
+}
+
+#endif
@@ -1,7 +1,12 @@
 #include "quadstack.h"
 #include "core/heightfieldcompressor.h"
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <limits>
 #include <sstream>
+#include <stdexcept>
 
 /**
 	QuadStack::Node methods
@@ -93,7 +98,7 @@ bool QuadStack::Node::isInside(unsigned x, unsigned y) {
 }
 
 
-bool QuadStack::Node::compress() {
+void QuadStack::Node::compress() {
 
 	Stack<short>& firstStack = _terrain->getStack(_bb.min.x, _bb.min.y);
 	std::vector<HeightField*> heights;
@@ -114,30 +119,20 @@ bool QuadStack::Node::compress() {
 	float nullData = -999;
 
 	// We introduce the height and materials of the first stack
-	for (auto interval : firstStack.getIntervals()) {
-		HeightField *map = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr);
-
-		map->setData(interval._accumulatedHeight, 0, 0);
+	for (size_t i = 0; i < firstStack.getIntervals().size(); ++i) {
+		HeightField *map = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr, nullptr, HEIGHT_FIELD_LAYOUT);
+		map->setOffset(_bb.min);
 
 		heights.push_back(map);
 	}
 
-	// Check if every stack is equal to the first one
+	// The caller knows every stack has the materials of the first one
 	for (int x = _bb.min.x; x < _bb.max.x; ++x) {
 		for (int y = _bb.min.y; y < _bb.max.y; ++y) {
 			unsigned relativeX = x - _bb.min.x;
 			unsigned relativeY = y - _bb.min.y;
 			Stack<short>& nextStack = _terrain->getStack(x, y);
 
-			if (!(firstStack.compareAttributes(nextStack))) {
-
-				// Reset the height maps introduced so far
-				for (auto map : heights)
-					delete map;
-
-				return false;
-			}
-
 			int i = 0;
 			for (auto interval : nextStack.getIntervals())
 				heights[i++]->setData(interval._accumulatedHeight, relativeX, relativeY);
@@ -152,11 +147,9 @@ bool QuadStack::Node::compress() {
 		_stack.push_back(newInterval);
 
 	}
-
-	return true;
 }
 
-bool QuadStack::Node::unify() {
+void QuadStack::Node::unify() {
 
 	vec2 origin;
 	origin.x = _terrain->getOriginX() + _bb.min.x * _terrain->getResolution();
@@ -173,29 +166,23 @@ bool QuadStack::Node::unify() {
 	float maxHeight = _terrain->getMaxHeight();
 	float nullData = NULL_VALUE;
 
-	if (!divisible())
-		auto heightField = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr);
-	
 	auto& reference = _terrain->getStack(_bb.min.x, _bb.min.y);
 
 	unsigned stackSize = reference.getIntervals().size();
 	vector<HeightField*> heightFields(stackSize);
 
-	for (int i = 0; i < stackSize; ++i)
-		heightFields[i] = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr);
+	for (int i = 0; i < stackSize; ++i) {
+		heightFields[i] = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr, nullptr, HEIGHT_FIELD_LAYOUT);
+		heightFields[i]->setOffset(_bb.min);
+	}
 
 	for (int x = _bb.min.x; x < _bb.max.x; ++x) {
 		for (int y = _bb.min.y; y < _bb.max.y; ++y) {
 			auto& stack = _terrain->getStack(x, y);
 
-			if (!stack.compareAttributes(reference)) {
-				heightFields.clear();
-				return false;
-			} else {
-				for (int i = 0; i < stackSize; ++i) {
-					float height = stack.getAttributeAtIndex(i)._accumulatedHeight;
-					heightFields[i]->setData(height, x - _bb.min.x, y - _bb.min.y);
-				}
+			for (int i = 0; i < stackSize; ++i) {
+				float height = stack.getAttributeAtIndex(i)._accumulatedHeight;
+				heightFields[i]->setData(height, x - _bb.min.x, y - _bb.min.y);
 			}
 		}
 	}
@@ -203,9 +190,6 @@ bool QuadStack::Node::unify() {
 	int i = 0;
 	for (auto& interval : reference.getIntervals())
 		_stack.push_back(Interval(interval._attribute, heightFields[i++]));
-
-
-	return true;
 }
 
 unsigned QuadStack::Node::nonUIntervals(GStack& stack) {
@@ -316,7 +300,7 @@ QuadStack::GStack QuadStack::Node::compact(Interval *s1, Interval *s2, Interval
 }
 
 
-QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, HeightField::Quadrant quadrant) {
+QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, std::vector<Quadrants>& quadrants, HeightField::Quadrant quadrant) {
 	std::vector<Interval*> aux;
 	
 	int lastUnknowns = 0;
@@ -328,8 +312,8 @@ QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, HeightField::Quadran
 	int stackSize = _stack.size();
 
 	int newSize = newStack.size();
-	while (!newStack[newSize - 1].isNull())
-		newStack[newSize-- - 1].addQuadrant(&_stack[stackSize-- - 1], quadrant);
+	while (newSize > 0 && stackSize > 0 && !newStack[newSize - 1].isNull())
+		Interval::addQuadrant(quadrants[--newSize], &_stack[stackSize-- - 1], quadrant);
 
 
 	while (selfIndex < stackSize) {
@@ -338,7 +322,7 @@ QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, HeightField::Quadran
 
 
 		if (iNew.isNull()) {
-			iNew.addQuadrant(&iSelf, quadrant);
+			Interval::addQuadrant(quadrants[newIndex], &iSelf, quadrant);
 
 			newCheck = newIndex;
 			newIndex = std::min(newIndex + 1, static_cast<int>(newSize - 1));
@@ -348,7 +332,7 @@ QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, HeightField::Quadran
 
 
 		} else if (iNew == iSelf) {
-			iNew.addQuadrant(&iSelf, quadrant);
+			Interval::addQuadrant(quadrants[newIndex], &iSelf, quadrant);
 
 			newIndex++;
 			selfIndex++;
@@ -365,6 +349,8 @@ QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, HeightField::Quadran
 		last.setMaterial(Stack<int>::UNKNOWN_VALUE);
 		_stack.clear();
 		_stack.push_back(last);
+
+		return _stack;
 	} else {
 		GStack retStack;
 		
@@ -375,17 +361,17 @@ QuadStack::GStack QuadStack::Node::shrink(GStack &newStack, HeightField::Quadran
 	}
 }
 
-void QuadStack::Node::promote() {
+void QuadStack::Node::promote(std::vector<HeightField*>& replaced, Merges& merges) {
 
 	if (!isLeaf()) {
 		if (!_nw->isLeaf())
-			_nw->promote();
+			_nw->promote(replaced, merges);
 		if (!_ne->isLeaf())
-			_ne->promote();
+			_ne->promote(replaced, merges);
 		if (!_sw->isLeaf())
-			_sw->promote();
+			_sw->promote(replaced, merges);
 		if (!_se->isLeaf())
-			_se->promote();
+			_se->promote(replaced, merges);
 
 		auto nw = _nw;
 		auto ne = _ne;
@@ -416,13 +402,26 @@ void QuadStack::Node::promote() {
 		if (_stack.empty())
 			_stack.push_back(Interval(NULL_VALUE, nullptr));
 
-		auto newNw = nw->shrink(_stack, HeightField::Quadrant::NW);
-		auto newNe = ne->shrink(_stack, HeightField::Quadrant::NE);
-		auto newSw = sw->shrink(_stack, HeightField::Quadrant::SW);
-		auto newSe = se->shrink(_stack, HeightField::Quadrant::SE);
+		// Children of every interval, dropped once the intervals are merged
+		std::vector<Quadrants> quadrants(_stack.size());
+
+		auto newNw = nw->shrink(_stack, quadrants, HeightField::Quadrant::NW);
+		auto newNe = ne->shrink(_stack, quadrants, HeightField::Quadrant::NE);
+		auto newSw = sw->shrink(_stack, quadrants, HeightField::Quadrant::SW);
+		auto newSe = se->shrink(_stack, quadrants, HeightField::Quadrant::SE);
 
-		for (auto &interval : _stack)
-			interval.merge();
+		for (size_t i = 0; i < _stack.size(); ++i) {
+			_stack[i].merge(quadrants[i]);
+
+			if (quadrants[i].size() == 4)
+				for (auto& quadrant : quadrants[i])
+					merges.emplace_back(quadrant.second->getHeightField(), _stack[i].getHeightField());
+		}
+
+		for (auto child : { nw, ne, sw, se })
+			for (auto& interval : child->_stack)
+				if (interval.hasHeightField())
+					replaced.push_back(interval.getHeightField());
 
 		nw->_stack = newNw;
 		ne->_stack = newNe;
@@ -432,74 +431,52 @@ void QuadStack::Node::promote() {
 
 }
 
-void QuadStack::Node::decompose() {
+void QuadStack::Node::decompose(const UniformityIndex& index, uint32_t entry) {
 
-	if (!unify() && divisible()) {
+	// Columns of mixed nodes differ, so these have at least two of them and are divisible
+	if (!index.isMixed(entry))
+		unify();
+	else {
 
 		subdivide();
 
-		_nw->decompose();
-		_ne->decompose();
-		_sw->decompose();
-		_se->decompose();
+		_nw->decompose(index, index.getChild(entry, 0));
+		_ne->decompose(index, index.getChild(entry, 1));
+		_sw->decompose(index, index.getChild(entry, 2));
+		_se->decompose(index, index.getChild(entry, 3));
 	}
 }
 
-void QuadStack::Node::classify() {
-	_compressed = compress();
-	
-	if (divisible() && !_compressed) {
+void QuadStack::Node::classify(const UniformityIndex& index, uint32_t entry) {
+	_compressed = !index.isMixed(entry);
+
+	if (_compressed)
+		compress();
+	else {
 
 		subdivide();
 
-		_nw->classify();
-		_ne->classify();
-		_sw->classify();
-		_se->classify();
+		_nw->classify(index, index.getChild(entry, 0));
+		_ne->classify(index, index.getChild(entry, 1));
+		_sw->classify(index, index.getChild(entry, 2));
+		_se->classify(index, index.getChild(entry, 3));
 	}
 }
 
 
-void QuadStack::Node::rearrangeHeightFields(std::vector<std::pair<Interval*, ivec2>> intervals, int& index) {
+void QuadStack::Node::shareHeightFields(const SharingRegistry& registry) {
 	for (auto& i : _stack) {
-
-		if (i.isOwner()) {
-			i.setHfIndex(index++);
-			std::pair<Interval*, ivec2> p(&i, _bb.min);
-			intervals.push_back(p);
-		} else {
-
-			bool cent = false;
-			unsigned x = _bb.min.x;
-			unsigned y = _bb.min.y;
-
-			for (auto& entry : intervals) {
-
-
-				Interval *ihf = entry.first;
-				ivec2 min = entry.second;
-
-				int rx = x - min.x;
-				int ry = y - min.y;
-				if (ihf->getHeight(rx, ry) == i.getHeight(0, 0)) {
-					i.setHeightField(ihf->getHeightField());
-					i.setHfIndex(ihf->getHfIndex());
-					break;
-				}
-			}
-
+		if (i.isOwner() || !i.hasHeightField())
+			continue;
+
+		// Intervals not merged into a surviving heightfield keep their own. Until then every
+		// interval holds a heightfield of its own, so the replaced one can be deleted
+		auto shared = registry.find(i.getHeightField());
+		if (shared != registry.end()) {
+			delete i.getHeightField();
+			i.setHeightField(shared->second);
 		}
 	}
-	if (!isLeaf()) {
-		if (!_nw->noCompression())
-			_nw->rearrangeHeightFields(intervals, index);
-		if (!_ne->noCompression())
-			_ne->rearrangeHeightFields(intervals, index);
-		if (!_sw->noCompression())
-			_sw->rearrangeHeightFields(intervals, index);
-		if (!_se->noCompression())
-			_se->rearrangeHeightFields(intervals, index);
-	}
 }
 
 
@@ -575,10 +552,7 @@ vec4 QuadStack::Node::memorySize() {
 		for (auto& interval : _stack) {
 			accumulatedSize += sizeof(int);
 
-			if (interval.isOwner()) {
-				unsigned xSize = _bb.max.x - _bb.min.x;
-				unsigned ySize = _bb.max.y - _bb.min.y;
-				interval.getHeightField()->getHeightResolution();
+			if (interval.isOwner() && interval.hasHeightField()) {
 				accumulatedSize.z += interval.getHeightField()->memorySizeCompressed();
 
 			}
@@ -625,35 +599,60 @@ void QuadStack::Node::subdivide() {
 }
 
 
+float QuadStack::Node::getHeight(const Interval& interval, int x, int y) const {
+	ivec2 origin = interval.getOrigin();
+
+	return interval.getHeight(x - origin.x, y - origin.y);
+}
+
+void QuadStack::Node::getHeights(const Interval& interval, const iaabb2& region, float *heights) const {
+	ivec2 origin = interval.getOrigin();
+	interval.getHeightField()->getRegion(region.min - origin, region.max - region.min, heights);
+}
+
+void QuadStack::Node::getHeightBounds(const Interval& interval, const iaabb2& region, unsigned level, const LevelsOfDetail& levels, float& minHeight, float& maxHeight) const {
+	ivec2 origin = interval.getOrigin();
+	const LevelOfDetail& mipmaps = levels.at(interval.getHeightField());
+	level = std::min(level, mipmaps._min->getLevels() - 1);
+
+	// Odd rows and columns are folded into the last cell of every level
+	int lastX = std::max(static_cast<int>(interval.getDimensionX() >> level), 1) - 1;
+	int lastY = std::max(static_cast<int>(interval.getDimensionY() >> level), 1) - 1;
+	ivec2 min(std::min((region.min.x - origin.x) >> level, lastX), std::min((region.min.y - origin.y) >> level, lastY));
+	ivec2 max(std::min((region.max.x - 1 - origin.x) >> level, lastX), std::min((region.max.y - 1 - origin.y) >> level, lastY));
+
+	minHeight = std::numeric_limits<float>::max();
+	maxHeight = std::numeric_limits<float>::lowest();
+	for (int row = min.y; row <= max.y; ++row) {
+		for (int col = min.x; col <= max.x; ++col) {
+			minHeight = std::min(minHeight, mipmaps._min->getData(col, row, level));
+			maxHeight = std::max(maxHeight, mipmaps._max->getData(col, row, level));
+		}
+	}
+}
+
+QuadStack::Node* QuadStack::Node::getChild(int x, int y) {
+	if (_nw->isInside(x, y)) return _nw;
+	else if (_ne->isInside(x, y)) return _ne;
+	else if (_sw->isInside(x, y)) return _sw;
+	else return _se;
+}
+
 int QuadStack::Node::sample(int x, int y, float height, float fatherHeight) {
 
-	Interval currentInterval;
 	float currentHeight = fatherHeight;
 	int currentMaterial;
-	bool hasHeightMap = false;
-	bool isOwner = false;
 
 
-	if (_compressed) {
-		auto stackSize = _stack.size();
+	// Nodes built top-down are not flagged as compressed, so the stack itself tells
+	if (!_stack.empty()) {
 
 		for (auto& interval : _stack) {
 
-			int relativeX, relativeY;
-
-			if (interval.isOwner()) {
-				relativeX = x - _bb.min.x;
-				relativeY = y - _bb.min.y;
-			} else {
-				auto relativeHM = interval.getRelativeCoordinates();
-				relativeX = x - relativeHM.x;
-				relativeY = y - relativeHM.y;
-			}
-
 			currentMaterial = interval.getMaterial();
 
 			if (interval.hasHeightField()) {
-				currentHeight = interval.getHeight(relativeX, relativeY);
+				currentHeight = getHeight(interval, x, y);
 			} else // last interval
 				currentHeight = fatherHeight;
 
@@ -676,29 +675,366 @@ int QuadStack::Node::sample(int x, int y, float height, float fatherHeight) {
 			return NULL_VALUE;
 	}
 
-	else if (_nw->isInside(x, y)) return _nw->sample(x, y, height, currentHeight);
-	else if (_ne->isInside(x, y)) return _ne->sample(x, y, height, currentHeight);
-	else if (_sw->isInside(x, y)) return _sw->sample(x, y, height, currentHeight);
-	else return _se->sample(x, y, height, currentHeight);
+	else return getChild(x, y)->sample(x, y, height, currentHeight);
 
 }
 
+int QuadStack::Node::sample(int x, int y, float height, float fatherHeight, unsigned level, const LevelsOfDetail& levels, MipmapMode mode) {
+	float currentHeight = fatherHeight;
+
+	for (auto& interval : _stack) {
+		if (interval.hasHeightField()) {
+			float minHeight, maxHeight;
+			getHeightBounds(interval, iaabb2(ivec2(x, y), ivec2(x + 1, y + 1)), level, levels, minHeight, maxHeight);
+			currentHeight = mode == MipmapMode::MIN ? minHeight : maxHeight;
+		} else
+			currentHeight = fatherHeight;
+
+		if (currentHeight >= height) {
+			if (interval.getMaterial() == NULL_VALUE)
+				break;
+			else
+				return interval.getMaterial();
+		}
+	}
+
+	if (isLeaf()) {
+		if (_terrain)
+			return _terrain->getStack(x, y).getAttribute(height);
+		else
+			return NULL_VALUE;
+	}
+
+	else return getChild(x, y)->sample(x, y, height, currentHeight, level, levels, mode);
+}
 
-// Iterator Methods
+bool QuadStack::Node::mayContain(const iaabb2& region, int material, float minZ, float maxZ, float minLow, float maxLow, float minHigh, float maxHigh, const LevelsOfDetail& levels) {
 
-bool QuadStack::Iterator::next() {
-	if (!_node->isLeaf()) {
-		_list.push_back(_node->getNW());
-		_list.push_back(_node->getNE());
-		_list.push_back(_node->getSW());
-		_list.push_back(_node->getSE());
+	// An interval may fill the heights from its lowest bottom to its highest top
+	auto overlaps = [&](float bottom, float top) { return top > bottom && top >= minZ && bottom <= maxZ; };
+
+	// Regions larger than a child are split by the caller before their children are read
+	auto descend = [&](float childMinLow, float childMaxLow, float childMinHigh, float childMaxHigh) {
+		for (Node *child : { _nw, _ne, _sw, _se }) {
+			iaabb2 bb = child->getBoundingBox();
+			if (region.min.x >= bb.min.x && region.min.y >= bb.min.y && region.max.x <= bb.max.x && region.max.y <= bb.max.y)
+				return child->mayContain(region, material, minZ, maxZ, childMinLow, childMaxLow, childMinHigh, childMaxHigh, levels);
+		}
+		return true;
+	};
+
+	if (!_stack.empty()) {
+		// Mipmap level whose cells are not larger than region
+		unsigned level = static_cast<unsigned>(std::log2(std::min(region.max.x - region.min.x, region.max.y - region.min.y)));
+		float minBottom = minLow, maxBottom = maxLow;
+
+		for (auto& interval : _stack) {
+			float minTop = minHigh, maxTop = maxHigh;
+			if (interval.hasHeightField()) {
+				float minHeight, maxHeight;
+				getHeightBounds(interval, region, level, levels, minHeight, maxHeight);
+				minTop = std::min(std::max(minBottom, minHeight), minHigh);
+				maxTop = std::min(std::max(maxBottom, maxHeight), maxHigh);
+			}
+
+			if (overlaps(minBottom, maxTop)) {
+				if (interval.getMaterial() == material)
+					return true;
+				if (interval.getMaterial() == NULL_VALUE && !isLeaf() && descend(minBottom, maxBottom, minTop, maxTop))
+					return true;
+			}
+
+			minBottom = std::max(minBottom, minTop);
+			maxBottom = std::max(maxBottom, maxTop);
+			if (minBottom > maxZ)
+				break;
+		}
+
+		return false;
+
+	} else if (isLeaf()) {
+		if (!_terrain)
+			return false;
+
+		for (int x = region.min.x; x < region.max.x; ++x) {
+			for (int y = region.min.y; y < region.max.y; ++y) {
+				float minBottom = minLow, maxBottom = maxLow;
+
+				for (auto& interval : _terrain->getStack(x, y).getIntervals()) {
+					float minTop = std::min(std::max(minBottom, interval._accumulatedHeight), minHigh);
+					float maxTop = std::min(std::max(maxBottom, interval._accumulatedHeight), maxHigh);
+					if (interval._attribute == material && overlaps(minBottom, maxTop))
+						return true;
+
+					minBottom = std::max(minBottom, minTop);
+					maxBottom = std::max(maxBottom, maxTop);
+					if (minBottom > maxZ)
+						break;
+				}
+			}
+		}
 
-	} else if (_list.empty())
 		return false;
 
-	_node = _list.front();
-	_list.pop_front();
-	return true;
+	} else
+		return descend(minLow, maxLow, minHigh, maxHigh);
+}
+
+void QuadStack::Node::column(int x, int y, float low, float high, Column& column) {
+
+	// Consecutive intervals with the same material are joined, as in Stack::addInterval
+	auto addInterval = [&column](int material, float height) {
+		if (!column.empty() && column.back()._attribute == material)
+			column.back()._accumulatedHeight = height;
+		else
+			column.push_back({ height, material });
+	};
+
+	if (!_stack.empty()) {
+		float bottom = low;
+
+		for (auto& interval : _stack) {
+			float top = interval.hasHeightField() ? std::min(getHeight(interval, x, y), high) : high;
+
+			if (top > bottom) {
+				if (interval.getMaterial() != NULL_VALUE)
+					addInterval(interval.getMaterial(), top);
+				else if (!isLeaf())
+					getChild(x, y)->column(x, y, bottom, top, column);
+
+				bottom = top;
+			}
+
+			if (bottom >= high)
+				break;
+		}
+
+	} else if (isLeaf()) {
+		if (_terrain) {
+			for (auto& interval : _terrain->getStack(x, y).getIntervals()) {
+				float top = std::min(interval._accumulatedHeight, high);
+				if (top > low)
+					addInterval(interval._attribute, top);
+				if (top >= high)
+					break;
+			}
+		}
+
+	} else
+		getChild(x, y)->column(x, y, low, high, column);
+}
+
+
+void QuadStack::Node::spans(const iaabb2& region, const float *low, const float *high, const SpanVisitor& visitor) {
+	int width = region.max.x - region.min.x;
+	size_t nCells = static_cast<size_t>(width) * (region.max.y - region.min.y);
+
+	// Children receive the heights of the cells they share with region
+	auto descend = [&](const float *childLow, const float *childHigh) {
+		for (Node *child : { _nw, _ne, _sw, _se }) {
+			iaabb2 bb = child->getBoundingBox();
+			iaabb2 childRegion(ivec2(std::max(bb.min.x, region.min.x), std::max(bb.min.y, region.min.y)),
+				ivec2(std::min(bb.max.x, region.max.x), std::min(bb.max.y, region.max.y)));
+			if (childRegion.min.x >= childRegion.max.x || childRegion.min.y >= childRegion.max.y)
+				continue;
+
+			ivec2 size = childRegion.max - childRegion.min;
+			std::vector<float> subLow(static_cast<size_t>(size.x) * size.y), subHigh(subLow.size());
+			for (int y = 0; y < size.y; ++y) {
+				size_t offset = (childRegion.min.x - region.min.x) + (childRegion.min.y - region.min.y + y) * static_cast<size_t>(width);
+				std::copy(childLow + offset, childLow + offset + size.x, subLow.begin() + y * size.x);
+				std::copy(childHigh + offset, childHigh + offset + size.x, subHigh.begin() + y * size.x);
+			}
+
+			child->spans(childRegion, subLow.data(), subHigh.data(), visitor);
+		}
+	};
+
+	if (!_stack.empty()) {
+		std::vector<float> bottom(low, low + nCells), top(nCells);
+
+		for (auto& interval : _stack) {
+			if (interval.hasHeightField()) {
+				getHeights(interval, region, top.data());
+				for (size_t cell = 0; cell < nCells; ++cell)
+					top[cell] = std::min(top[cell], high[cell]);
+			} else
+				std::copy(high, high + nCells, top.begin());
+
+			if (interval.getMaterial() != NULL_VALUE)
+				visitor(interval.getMaterial(), region, bottom.data(), top.data());
+			else if (!isLeaf())
+				descend(bottom.data(), top.data());
+
+			bool finished = true;
+			for (size_t cell = 0; cell < nCells; ++cell) {
+				bottom[cell] = std::max(bottom[cell], top[cell]);
+				finished = finished && bottom[cell] >= high[cell];
+			}
+
+			if (finished)
+				break;
+		}
+
+	} else if (isLeaf()) {
+		if (_terrain) {
+			for (size_t cell = 0; cell < nCells; ++cell) {
+				ivec2 position(region.min.x + static_cast<int>(cell % width), region.min.y + static_cast<int>(cell / width));
+				iaabb2 single(position, ivec2(position.x + 1, position.y + 1));
+				float bottom = low[cell];
+
+				for (auto& interval : _terrain->getStack(position.x, position.y).getIntervals()) {
+					float top = std::min(interval._accumulatedHeight, high[cell]);
+					if (top > bottom) {
+						visitor(interval._attribute, single, &bottom, &top);
+						bottom = top;
+					}
+					if (top >= high[cell])
+						break;
+				}
+			}
+		}
+
+	} else
+		descend(low, high);
+}
+
+void QuadStack::Node::boundedColumns(const iaabb2& region, float minLow, float maxLow, float minHigh, float maxHigh, unsigned level, const LevelsOfDetail& levels, std::vector<BoundedPiece>& pieces) {
+
+	// Consecutive intervals with the same material are joined, as in Stack::addInterval
+	auto addInterval = [](BoundedColumn& column, const BoundedInterval& interval) {
+		if (!column.empty() && column.back()._material == interval._material) {
+			column.back()._minTop = interval._minTop;
+			column.back()._maxTop = interval._maxTop;
+		} else
+			column.push_back(interval);
+	};
+
+	// Children continue the column of piece in the cells they share with it
+	auto descend = [&](const BoundedPiece& piece, float minTop, float maxTop, std::vector<BoundedPiece>& result) {
+		for (Node *child : { _nw, _ne, _sw, _se }) {
+			iaabb2 bb = child->getBoundingBox();
+			iaabb2 childRegion(ivec2(std::max(bb.min.x, piece._region.min.x), std::max(bb.min.y, piece._region.min.y)),
+				ivec2(std::min(bb.max.x, piece._region.max.x), std::min(bb.max.y, piece._region.max.y)));
+			if (childRegion.min.x >= childRegion.max.x || childRegion.min.y >= childRegion.max.y)
+				continue;
+
+			size_t first = result.size();
+			child->boundedColumns(childRegion, piece._minBottom, piece._maxBottom, minTop, maxTop, level, levels, result);
+
+			for (size_t i = first; i < result.size(); ++i) {
+				BoundedColumn column = piece._column;
+				for (auto& interval : result[i]._column)
+					addInterval(column, interval);
+				result[i]._column = std::move(column);
+			}
+		}
+	};
+
+	std::vector<BoundedPiece> open = { { region, BoundedColumn(), minLow, maxLow } };
+
+	if (!_stack.empty()) {
+		for (auto& interval : _stack) {
+			std::vector<BoundedPiece> next;
+
+			for (auto& piece : open) {
+				float minTop = minHigh, maxTop = maxHigh;
+				if (interval.hasHeightField()) {
+					float minHeight, maxHeight;
+					getHeightBounds(interval, piece._region, level, levels, minHeight, maxHeight);
+					minTop = std::min(std::max(piece._minBottom, minHeight), minHigh);
+					maxTop = std::min(std::max(piece._maxBottom, maxHeight), maxHigh);
+				}
+
+				size_t first = next.size();
+				float minBottom = std::max(piece._minBottom, minTop), maxBottom = std::max(piece._maxBottom, maxTop);
+
+				if (maxTop > piece._minBottom && interval.getMaterial() != NULL_VALUE) {
+					next.push_back(std::move(piece));
+					addInterval(next.back()._column, { interval.getMaterial(), minTop, maxTop });
+				} else if (maxTop > piece._minBottom && !isLeaf())
+					descend(piece, minTop, maxTop, next);
+				else
+					next.push_back(std::move(piece));
+
+				for (size_t i = first; i < next.size(); ++i) {
+					next[i]._minBottom = minBottom;
+					next[i]._maxBottom = maxBottom;
+				}
+			}
+
+			open.swap(next);
+
+			bool finished = true;
+			for (auto& piece : open)
+				finished = finished && piece._minBottom >= maxHigh;
+
+			if (finished)
+				break;
+		}
+
+	} else if (isLeaf()) {
+		if (_terrain) {
+			open.clear();
+
+			for (int y = region.min.y; y < region.max.y; ++y) {
+				for (int x = region.min.x; x < region.max.x; ++x) {
+					BoundedPiece piece = { iaabb2(ivec2(x, y), ivec2(x + 1, y + 1)), BoundedColumn(), minLow, maxLow };
+
+					for (auto& interval : _terrain->getStack(x, y).getIntervals()) {
+						float minTop = std::min(std::max(piece._minBottom, interval._accumulatedHeight), minHigh);
+						float maxTop = std::min(std::max(piece._maxBottom, interval._accumulatedHeight), maxHigh);
+						if (maxTop > piece._minBottom)
+							addInterval(piece._column, { interval._attribute, minTop, maxTop });
+
+						piece._minBottom = std::max(piece._minBottom, minTop);
+						piece._maxBottom = std::max(piece._maxBottom, maxTop);
+						if (piece._minBottom >= maxHigh)
+							break;
+					}
+
+					open.push_back(std::move(piece));
+				}
+			}
+		}
+
+	} else {
+		std::vector<BoundedPiece> next;
+		descend(open.front(), minHigh, maxHigh, next);
+		open.swap(next);
+	}
+
+	pieces.insert(pieces.end(), std::make_move_iterator(open.begin()), std::make_move_iterator(open.end()));
+}
+
+
+// Traversal Methods
+
+QuadStack::Traversal::Traversal(Node *root) {
+	_levels.push_back(0);
+	if (root)
+		_nodes.push_back(root);
+
+	// Children of every level are appended in the order of their parents
+	for (size_t first = 0; first < _nodes.size();) {
+		size_t last = _nodes.size();
+		_levels.push_back(last);
+		for (size_t index = first; index < last; ++index) {
+			Node *node = _nodes[index];
+			if (!node->isLeaf())
+				_nodes.insert(_nodes.end(), { node->getNW(), node->getNE(), node->getSW(), node->getSE() });
+		}
+		first = last;
+	}
+
+	_owned.reserve(_nodes.size() + 1);
+	_owned.push_back(0);
+	for (Node *node : _nodes) {
+		size_t owned = 0;
+		for (auto& interval : node->getGStack())
+			owned += interval.isOwner() && interval.hasHeightField();
+		_owned.push_back(_owned.back() + owned);
+	}
 }
 
 
@@ -710,7 +1046,10 @@ bool QuadStack::Iterator::next() {
 QuadStack::QuadStack(ShortSBR *terrain) :
 _terrain(terrain),
 _resolution(terrain->getHeightResolution()),
-_root(new QuadStack::Node(0, ivec2(0, 0), ivec2(terrain->getDimension().x, terrain->getDimension().y), terrain)) {
+_root(new QuadStack::Node(0, ivec2(0, 0), ivec2(terrain->getDimension().x, terrain->getDimension().y), terrain)),
+_levelsOfDetailReady(false),
+_blockCache(&BlockCache::getShared()),
+_compressionStatistics{ 0, 0, 0, 0 } {
 
 	unsigned maxDimension = std::max(_terrain->getDimension().x, _terrain->getDimension().y);
 	float logOf2 = log2(maxDimension);
@@ -720,7 +1059,10 @@ _root(new QuadStack::Node(0, ivec2(0, 0), ivec2(terrain->getDimension().x, terra
 }
 
 void QuadStack::classify() {
-	_root->classify();
+	clearLevelsOfDetail();
+
+	UniformityIndex index(*_terrain);
+	_root->classify(index, index.getRoot());
 }
 
 
@@ -728,6 +1070,548 @@ int QuadStack::sample(int x, int y, float height, float fatherHeight) {
 	return _root->sample(x, y, height, fatherHeight);
 }
 
+void QuadStack::getColumn(int x, int y, float fatherHeight, Column& column) {
+	column.clear();
+	_root->column(x, y, getMinHeight(), fatherHeight, column);
+}
+
+QuadStack::MaterialBounds QuadStack::sample(int x, int y, float height, float fatherHeight, unsigned level) {
+	computeLevelsOfDetail();
+
+	return { _root->sample(x, y, height, fatherHeight, level, _levelsOfDetail, MipmapMode::MAX),
+		_root->sample(x, y, height, fatherHeight, level, _levelsOfDetail, MipmapMode::MIN) };
+}
+
+void QuadStack::getColumn(int x, int y, float fatherHeight, unsigned level, BoundedColumn& column) {
+	computeLevelsOfDetail();
+
+	std::vector<BoundedPiece> pieces;
+	float low = getMinHeight();
+	_root->boundedColumns(iaabb2(ivec2(x, y), ivec2(x + 1, y + 1)), low, low, fatherHeight, fatherHeight, level, _levelsOfDetail, pieces);
+
+	column.clear();
+	if (!pieces.empty())
+		column = std::move(pieces.front()._column);
+}
+
+iaabb2 QuadStack::clampRegion(iaabb2 region) const {
+	ivec2 dimension = _terrain->getDimension();
+	region.min = ivec2(std::min(std::max(region.min.x, 0), dimension.x), std::min(std::max(region.min.y, 0), dimension.y));
+	region.max = ivec2(std::min(std::max(region.max.x, region.min.x), dimension.x), std::min(std::max(region.max.y, region.min.y), dimension.y));
+	return region;
+}
+
+void QuadStack::forEachTile(iaabb2 region, const std::function<void(const iaabb2& tile, size_t index)>& function) {
+	ivec2 size = region.max - region.min;
+	ivec2 tiles((size.x + EXTRACTION_TILE - 1) / EXTRACTION_TILE, (size.y + EXTRACTION_TILE - 1) / EXTRACTION_TILE);
+
+	parallel::forRange(0, static_cast<size_t>(tiles.x) * tiles.y, [&](size_t index) {
+		ivec2 min(region.min.x + EXTRACTION_TILE * static_cast<int>(index % tiles.x), region.min.y + EXTRACTION_TILE * static_cast<int>(index / tiles.x));
+		function(iaabb2(min, ivec2(std::min(min.x + EXTRACTION_TILE, region.max.x), std::min(min.y + EXTRACTION_TILE, region.max.y))), index);
+	});
+}
+
+void QuadStack::getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) {
+	region = clampRegion(region);
+	int width = region.max.x - region.min.x;
+
+	columns.assign(static_cast<size_t>(width) * (region.max.y - region.min.y), Column());
+
+	// Consecutive intervals with the same material are joined, as in Stack::addInterval
+	SpanVisitor visitor = [&](int material, const iaabb2& cells, const float *bottom, const float *top) {
+		int cellsWidth = cells.max.x - cells.min.x;
+		for (int y = cells.min.y; y < cells.max.y; ++y) {
+			Column *column = &columns[(cells.min.x - region.min.x) + (y - region.min.y) * static_cast<size_t>(width)];
+			for (int x = 0; x < cellsWidth; ++x, ++column, ++bottom, ++top) {
+				if (*top <= *bottom)
+					continue;
+				if (!column->empty() && column->back()._attribute == material)
+					column->back()._accumulatedHeight = *top;
+				else
+					column->push_back({ *top, material });
+			}
+		}
+	};
+
+	forEachTile(region, [&](const iaabb2& tile, size_t) {
+		size_t nCells = static_cast<size_t>(tile.max.x - tile.min.x) * (tile.max.y - tile.min.y);
+		std::vector<float> lows(nCells, low), highs(nCells, high);
+		_root->spans(tile, lows.data(), highs.data(), visitor);
+	});
+}
+
+void QuadStack::getColumns(iaabb2 region, float low, float high, unsigned level, const BoundedColumnVisitor& visitor) {
+	region = clampRegion(region);
+	if (region.min.x >= region.max.x || region.min.y >= region.max.y)
+		return;
+
+	computeLevelsOfDetail();
+
+	// Squares larger than the terrain are not needed
+	level = std::min(level, _maxLevels);
+	int side = 1 << level;
+	ivec2 first(region.min.x >> level, region.min.y >> level);
+	ivec2 squares(((region.max.x - 1) >> level) - first.x + 1, ((region.max.y - 1) >> level) - first.y + 1);
+
+	parallel::forRange(0, static_cast<size_t>(squares.x) * squares.y, [&](size_t index) {
+		ivec2 min((first.x + static_cast<int>(index % squares.x)) << level, (first.y + static_cast<int>(index / squares.x)) << level);
+		iaabb2 square(ivec2(std::max(min.x, region.min.x), std::max(min.y, region.min.y)),
+			ivec2(std::min(min.x + side, region.max.x), std::min(min.y + side, region.max.y)));
+
+		std::vector<BoundedPiece> pieces;
+		_root->boundedColumns(square, low, low, high, high, level, _levelsOfDetail, pieces);
+
+		for (auto& piece : pieces)
+			visitor(piece._region, piece._column);
+	});
+}
+
+QuadStack::RayHit QuadStack::intersect(const Ray& ray, int material) {
+	float length = glm::length(ray._direction);
+	if (length == 0)
+		throw std::invalid_argument("Ray direction must not be null");
+
+	computeLevelsOfDetail();
+
+	// Distances are kept along the ray, so only x and y are scaled to cells
+	vec3 direction = ray._direction / length;
+	float spacing = _terrain->getResolution();
+
+	RayQuery query;
+	query._origin = vec3((ray._origin.x - _terrain->getOriginX()) / spacing, (ray._origin.y - _terrain->getOriginY()) / spacing, ray._origin.z);
+	query._direction = vec3(direction.x / spacing, direction.y / spacing, direction.z);
+	query._maxDistance = ray._maxDistance;
+	query._material = material;
+
+	RayHit hit = {};
+	hit._hit = false;
+	hit._material = NULL_VALUE;
+
+	iaabb2 region(ivec2(0, 0), _terrain->getDimension());
+	float enter, exit;
+	if (clipRay(query, region, enter, exit) && intersect(query, region, enter, exit, hit)) {
+		hit._point = ray._origin + direction * hit._distance;
+		hit._entryHeight = hit._point.z;
+		hit._exitHeight = ray._origin.z + direction.z * hit._exitDistance;
+	}
+
+	return hit;
+}
+
+void QuadStack::intersect(const std::vector<Ray>& rays, int material, std::vector<RayHit>& hits) {
+	computeLevelsOfDetail();
+
+	hits.resize(rays.size());
+	parallel::forRange(0, rays.size(), [&](size_t index) {
+		hits[index] = intersect(rays[index], material);
+	}, 16);
+}
+
+bool QuadStack::clipRay(const RayQuery& query, const iaabb2& region, float& enter, float& exit) {
+	enter = 0;
+	exit = query._maxDistance;
+
+	for (int axis = 0; axis < 2; ++axis) {
+		float origin = query._origin[axis], direction = query._direction[axis];
+
+		if (direction == 0) {
+			if (origin < region.min[axis] || origin > region.max[axis])
+				return false;
+		} else {
+			float first = (region.min[axis] - origin) / direction;
+			float last = (region.max[axis] - origin) / direction;
+			enter = std::max(enter, std::min(first, last));
+			exit = std::min(exit, std::max(first, last));
+		}
+	}
+
+	return enter <= exit;
+}
+
+bool QuadStack::intersect(RayQuery& query, const iaabb2& region, float enter, float exit, RayHit& hit) {
+	float enterZ = query._origin.z + query._direction.z * enter;
+	float exitZ = query._origin.z + query._direction.z * exit;
+	float low = getMinHeight(), high = getMaxHeight();
+
+	if (!_root->mayContain(region, query._material, std::min(enterZ, exitZ), std::max(enterZ, exitZ), low, low, high, high, _levelsOfDetail))
+		return false;
+
+	if (region.max.x - region.min.x == 1 && region.max.y - region.min.y == 1)
+		return intersectCell(query, region.min, enter, exit, hit);
+
+	// Halves as Node::subdivide makes them, so that every one lies below a single node
+	int halfX = (region.max.x + region.min.x) / 2;
+	int halfY = (region.max.y + region.min.y) / 2;
+	iaabb2 halves[4] = {
+		iaabb2(region.min, ivec2(halfX, halfY)),
+		iaabb2(ivec2(halfX, region.min.y), ivec2(region.max.x, halfY)),
+		iaabb2(ivec2(region.min.x, halfY), ivec2(halfX, region.max.y)),
+		iaabb2(ivec2(halfX, halfY), region.max)
+	};
+
+	struct Half {
+		float _enter, _exit;
+		const iaabb2 *_region;
+	};
+	std::array<Half, 4> order;
+	size_t nHalves = 0;
+
+	// Kept sorted by entry distance as the halves are inserted
+	for (auto& half : halves) {
+		float halfEnter, halfExit;
+		if (nHalves < order.size() && half.min.x < half.max.x && half.min.y < half.max.y && clipRay(query, half, halfEnter, halfExit)) {
+			size_t i = nHalves++;
+			for (; i > 0 && halfEnter < order[i - 1]._enter; --i)
+				order[i] = order[i - 1];
+			order[i] = { halfEnter, halfExit, &half };
+		}
+	}
+
+	for (size_t i = 0; i < nHalves; ++i) {
+		if (intersect(query, *order[i]._region, order[i]._enter, order[i]._exit, hit))
+			return true;
+	}
+
+	return false;
+}
+
+bool QuadStack::intersectCell(RayQuery& query, ivec2 cell, float enter, float exit, RayHit& hit) {
+	query._column.clear();
+	_root->column(cell.x, cell.y, getMinHeight(), getMaxHeight(), query._column);
+
+	// Distances where the ray lies between the heights bottom and top inside the cell
+	auto clipHeight = [&](float bottom, float top, float& first, float& last) {
+		first = enter;
+		last = exit;
+
+		if (query._direction.z == 0)
+			return query._origin.z >= bottom && query._origin.z <= top;
+
+		float toBottom = (bottom - query._origin.z) / query._direction.z;
+		float toTop = (top - query._origin.z) / query._direction.z;
+		first = std::max(first, std::min(toBottom, toTop));
+		last = std::min(last, std::max(toBottom, toTop));
+		return first <= last;
+	};
+
+	bool found = false;
+	float bottom = getMinHeight();
+
+	for (auto& interval : query._column) {
+		float first, last;
+		if (interval._attribute == query._material && clipHeight(bottom, interval._accumulatedHeight, first, last) && (!found || first < hit._distance)) {
+			found = true;
+			hit._distance = first;
+			hit._exitDistance = last;
+		}
+		bottom = interval._accumulatedHeight;
+	}
+
+	if (found) {
+		hit._hit = true;
+		hit._material = query._material;
+		if (hit._exitDistance >= exit)
+			exitMaterial(query, cell, exit, hit);
+	}
+
+	return found;
+}
+
+void QuadStack::exitMaterial(RayQuery& query, ivec2 cell, float exit, RayHit& hit) {
+	ivec2 dimension = _terrain->getDimension();
+	hit._exitDistance = exit;
+
+	while (hit._exitDistance < query._maxDistance) {
+
+		// The ray crosses into the neighbours whose sides it reaches first
+		float toX = query._direction.x > 0 ? (cell.x + 1 - query._origin.x) / query._direction.x :
+			query._direction.x < 0 ? (cell.x - query._origin.x) / query._direction.x : std::numeric_limits<float>::infinity();
+		float toY = query._direction.y > 0 ? (cell.y + 1 - query._origin.y) / query._direction.y :
+			query._direction.y < 0 ? (cell.y - query._origin.y) / query._direction.y : std::numeric_limits<float>::infinity();
+
+		if (toX <= toY)
+			cell.x += query._direction.x > 0 ? 1 : -1;
+		if (toY <= toX)
+			cell.y += query._direction.y > 0 ? 1 : -1;
+
+		float enter;
+		if (cell.x < 0 || cell.y < 0 || cell.x >= dimension.x || cell.y >= dimension.y ||
+			!clipRay(query, iaabb2(cell, ivec2(cell.x + 1, cell.y + 1)), enter, exit))
+			break;
+
+		// Cells only touched at a corner are skipped
+		if (exit - hit._exitDistance <= 16 * std::numeric_limits<float>::epsilon() * std::max(1.0f, exit))
+			continue;
+
+		// Interval of the material at the height where the ray enters the cell
+		float z = query._origin.z + query._direction.z * hit._exitDistance;
+		float bottom = getMinHeight(), top = bottom;
+		bool inside = false;
+
+		query._column.clear();
+		_root->column(cell.x, cell.y, getMinHeight(), getMaxHeight(), query._column);
+		for (auto& interval : query._column) {
+			top = interval._accumulatedHeight;
+			if (z >= bottom && z <= top) {
+				inside = interval._attribute == query._material;
+				break;
+			}
+			bottom = top;
+		}
+
+		if (!inside)
+			break;
+
+		float last = exit;
+		if (query._direction.z != 0)
+			last = std::min(last, std::max((bottom - query._origin.z) / query._direction.z, (top - query._origin.z) / query._direction.z));
+
+		hit._exitDistance = last;
+		if (last < exit)
+			break;
+	}
+
+	hit._exitDistance = std::min(hit._exitDistance, query._maxDistance);
+}
+
+ShortVM* QuadStack::extractVoxelModel(iaabb2 region, float low, float high, float spacingZ) {
+	if (spacingZ <= 0)
+		throw std::invalid_argument("Voxel height must be positive");
+
+	std::vector<Column> columns;
+	getColumns(region, low, high, columns);
+
+	region = clampRegion(region);
+
+	ivec2 size = region.max - region.min;
+	int dimensionZ = std::max(0, static_cast<int>(std::round((high - low) / spacingZ)));
+	float resolution = _terrain->getResolution();
+	vec3 origin(_terrain->getOriginX() + region.min.x * resolution, _terrain->getOriginY() + region.min.y * resolution, low);
+
+	ShortVM *vm = new ShortVM(ivec3(size.x, size.y, dimensionZ), vec3(resolution, resolution, spacingZ), origin, _terrain->getAttributeName());
+	short *data = vm->getBuffer();
+	size_t dimY = size.y, dimXY = static_cast<size_t>(size.x) * size.y;
+
+	// Every x fills the slab of its cells in a local buffer, a column at a time, and then
+	// copies it slice by slice, so the model is written in runs of dimY voxels
+	parallel::forRange(0, size.x, [&](size_t x) {
+		std::vector<short> slab(dimY * dimensionZ);
+
+		for (int y = 0; y < size.y; ++y) {
+			short *voxel = slab.data() + y;
+			int begin = 0;
+
+			for (auto& interval : columns[x + y * static_cast<size_t>(size.x)]) {
+				// Voxels whose centre is not above the top of the interval
+				int end = std::min(static_cast<int>(std::floor((interval._accumulatedHeight - low) / spacingZ - 0.5f)) + 1, dimensionZ);
+				for (short material = static_cast<short>(interval._attribute); begin < end; ++begin)
+					voxel[dimY * begin] = material;
+			}
+
+			for (; begin < dimensionZ; ++begin)
+				voxel[dimY * begin] = static_cast<short>(Stack<short>::UNKNOWN_VALUE);
+		}
+
+		for (int z = 0; z < dimensionZ; ++z)
+			std::copy(slab.begin() + dimY * z, slab.begin() + dimY * (z + 1), data + dimY * x + dimXY * z);
+	});
+
+	return vm;
+}
+
+ShortSBR* QuadStack::extractSBR(iaabb2 region, float low, float high) {
+	std::vector<Column> columns;
+	getColumns(region, low, high, columns);
+
+	region = clampRegion(region);
+
+	ivec2 size = region.max - region.min;
+	vec2 origin(_terrain->getOriginX() + region.min.x * _terrain->getSpacing().x, _terrain->getOriginY() + region.min.y * _terrain->getSpacing().y);
+
+	ShortSBR *sbr = new ShortSBR(low, high, _terrain->getHeightResolution(), _terrain->getAttributeName(), origin, _terrain->getSpacing(), size);
+
+	parallel::forRange(0, columns.size(), [&](size_t cell) {
+		auto& intervals = sbr->getStack(cell % size.x, cell / size.x).getIntervals();
+		intervals.reserve(columns[cell].size());
+		for (auto& interval : columns[cell])
+			intervals.push_back({ interval._accumulatedHeight, static_cast<short>(interval._attribute) });
+	}, 256);
+
+	return sbr;
+}
+
+QuadStack::Statistics QuadStack::statistics(iaabb2 region, float low, float high, const std::vector<vec2> *polygon) {
+	region = clampRegion(region);
+	ivec2 size = region.max - region.min;
+	vec2 spacing = _terrain->getSpacing();
+	vec2 origin(_terrain->getOriginX(), _terrain->getOriginY());
+
+	std::vector<Statistics> tileStatistics(static_cast<size_t>((size.x + EXTRACTION_TILE - 1) / EXTRACTION_TILE) * ((size.y + EXTRACTION_TILE - 1) / EXTRACTION_TILE));
+
+	forEachTile(region, [&](const iaabb2& tile, size_t index) {
+		int width = tile.max.x - tile.min.x;
+		size_t nCells = static_cast<size_t>(width) * (tile.max.y - tile.min.y);
+
+		// Empty if every cell of the tile is inside
+		std::vector<bool> inside;
+		if (polygon) {
+			inside.assign(nCells, false);
+			size_t nInside = 0;
+			std::vector<float> crossings;
+
+			// Even-odd rule, with the crossings of the row of centres sorted once for the whole row
+			for (int y = tile.min.y; y < tile.max.y; ++y) {
+				float centreY = origin.y + (y + 0.5f) * spacing.y;
+				crossings.clear();
+				for (size_t i = 0, j = polygon->size() - 1; i < polygon->size(); j = i++) {
+					const vec2& a = (*polygon)[i];
+					const vec2& b = (*polygon)[j];
+					if ((a.y > centreY) != (b.y > centreY))
+						crossings.push_back((b.x - a.x) * (centreY - a.y) / (b.y - a.y) + a.x);
+				}
+				std::sort(crossings.begin(), crossings.end());
+
+				size_t passed = 0;
+				for (int x = tile.min.x; x < tile.max.x; ++x) {
+					float centreX = origin.x + (x + 0.5f) * spacing.x;
+					while (passed < crossings.size() && crossings[passed] <= centreX)
+						++passed;
+					if ((crossings.size() - passed) % 2) {
+						inside[(x - tile.min.x) + (y - tile.min.y) * static_cast<size_t>(width)] = true;
+						++nInside;
+					}
+				}
+			}
+
+			// Tiles outside the polygon are not walked down the tree
+			if (nInside == 0)
+				return;
+			if (nInside == nCells)
+				inside.clear();
+		}
+
+		std::vector<float> lows(nCells, low), highs(nCells, high);
+		std::map<int, std::vector<float>> thickness;
+
+		_root->spans(tile, lows.data(), highs.data(), [&](int material, const iaabb2& cells, const float *bottom, const float *top) {
+			std::vector<float>& materialThickness = thickness[material];
+			if (materialThickness.empty())
+				materialThickness.resize(nCells, 0.0f);
+
+			int cellsWidth = cells.max.x - cells.min.x;
+			for (int y = cells.min.y; y < cells.max.y; ++y) {
+				float *cell = &materialThickness[(cells.min.x - tile.min.x) + (y - tile.min.y) * static_cast<size_t>(width)];
+				for (int x = 0; x < cellsWidth; ++x, ++bottom, ++top)
+					cell[x] += std::max(*top - *bottom, 0.0f);
+			}
+		});
+
+		for (auto& material : thickness) {
+			MaterialStatistics statistics = { 0.0, 0.0, std::numeric_limits<float>::max(), 0.0f };
+			size_t nMaterialCells = 0;
+
+			for (size_t cell = 0; cell < nCells; ++cell) {
+				float cellThickness = material.second[cell];
+				if ((!inside.empty() && !inside[cell]) || cellThickness <= 0.0f)
+					continue;
+
+				statistics._volume += cellThickness;
+				statistics._minThickness = std::min(statistics._minThickness, cellThickness);
+				statistics._maxThickness = std::max(statistics._maxThickness, cellThickness);
+				++nMaterialCells;
+			}
+
+			if (nMaterialCells) {
+				statistics._volume *= spacing.x * spacing.y;
+				statistics._area = nMaterialCells * spacing.x * spacing.y;
+				tileStatistics[index][material.first] = statistics;
+			}
+		}
+	});
+
+	Statistics total;
+	for (auto& tile : tileStatistics) {
+		for (auto& material : tile) {
+			auto found = total.find(material.first);
+			if (found == total.end()) {
+				total.insert(material);
+				continue;
+			}
+
+			MaterialStatistics& statistics = found->second;
+			statistics._volume += material.second._volume;
+			statistics._area += material.second._area;
+			statistics._minThickness = std::min(statistics._minThickness, material.second._minThickness);
+			statistics._maxThickness = std::max(statistics._maxThickness, material.second._maxThickness);
+		}
+	}
+
+	return total;
+}
+
+QuadStack::Statistics QuadStack::getStatistics(iaabb2 region, float low, float high) {
+	return statistics(region, low, high, nullptr);
+}
+
+QuadStack::Statistics QuadStack::getStatistics(const std::vector<vec2>& polygon, float low, float high) {
+	if (polygon.size() < 3)
+		return Statistics();
+
+	vec2 spacing = _terrain->getSpacing();
+	vec2 min = polygon[0], max = polygon[0];
+	for (auto& point : polygon) {
+		min = vec2(std::min(min.x, point.x), std::min(min.y, point.y));
+		max = vec2(std::max(max.x, point.x), std::max(max.y, point.y));
+	}
+
+	// Cells whose centre may lie inside the bounding box of the polygon
+	iaabb2 region(ivec2(static_cast<int>(std::floor((min.x - _terrain->getOriginX()) / spacing.x)), static_cast<int>(std::floor((min.y - _terrain->getOriginY()) / spacing.y))),
+		ivec2(static_cast<int>(std::ceil((max.x - _terrain->getOriginX()) / spacing.x)), static_cast<int>(std::ceil((max.y - _terrain->getOriginY()) / spacing.y))));
+
+	return statistics(region, low, high, &polygon);
+}
+
+void QuadStack::clearLevelsOfDetail() {
+	std::lock_guard<std::mutex> lock(_levelsOfDetailMutex);
+	_levelsOfDetail.clear();
+	_levelsOfDetailReady = false;
+}
+
+void QuadStack::computeLevelsOfDetail() {
+	if (_levelsOfDetailReady)
+		return;
+
+	std::lock_guard<std::mutex> lock(_levelsOfDetailMutex);
+	if (_levelsOfDetailReady)
+		return;
+
+	// Intervals sharing a heightfield share its mipmaps
+	std::vector<std::pair<HeightField*, LevelOfDetail*>> heightFields;
+	traversal().forEachNode([&](Node& node, size_t) {
+		for (auto& interval : node.getGStack()) {
+			if (interval.hasHeightField() && _levelsOfDetail.find(interval.getHeightField()) == _levelsOfDetail.end())
+				heightFields.push_back({ interval.getHeightField(), &_levelsOfDetail[interval.getHeightField()] });
+		}
+	}, Execution::SEQUENTIAL);
+
+	parallel::forRange(0, heightFields.size(), [&](size_t index) {
+		LevelOfDetail& mipmaps = *heightFields[index].second;
+		mipmaps._min.reset(new HeightMipmap(heightFields[index].first, MipmapMode::MIN));
+		mipmaps._max.reset(new HeightMipmap(heightFields[index].first, MipmapMode::MAX));
+		mipmaps._min->computeMipmap();
+		mipmaps._max->computeMipmap();
+	});
+
+	_levelsOfDetailReady = true;
+}
+
+HeightMipmap* QuadStack::getMipmap(const HeightField *heightField, MipmapMode mode) {
+	computeLevelsOfDetail();
+
+	auto& mipmaps = _levelsOfDetail.at(heightField);
+	return mode == MipmapMode::MIN ? mipmaps._min.get() : mipmaps._max.get();
+}
+
 void QuadStack::setTerrain(ShortSBR *terrain) {
 	_terrain = terrain;
 	_root->updateTerrain(terrain);
@@ -743,41 +1627,103 @@ vec4 QuadStack::memorySize() const {
 }
 
 
-void QuadStack::compressHeightField(float resolution) {
+void QuadStack::compressHeightField(float resolution, bool releaseData) {
 	unsigned block = 8;
-	Iterator it = iterator();
-	do {
-		auto *node = it.data();
-		for (auto& interval : node->getGStack()) {
-			if (interval.isOwner() && !node->noCompression()) {				
-				auto hfPointer = interval.getHeightField();
-				HeightFieldCompressor *compressor = new HeightFieldCompressor(hfPointer, block, block, resolution);
-				
-				hfPointer->setCompressor(compressor);
-				compressor->compress();
-			}
-		}
-	} while (it.next());
 
+	// Decoded heights may be rounded to the resolution, so the bounds are computed again
+	if (releaseData)
+		clearLevelsOfDetail();
+
+	// Owned heightfields are compressed in parallel, each one into the slot of its interval.
+	// Released ones are decoded by their current compressors until all are replaced
+	Traversal nodes = traversal();
+	std::vector<HeightFieldCompressor*> compressors(nodes.getNumberOfOwnedIntervals(), nullptr);
+	std::vector<const Node*> owners(compressors.size(), nullptr);
+	std::vector<uint64_t> fingerprints(compressors.size());
+
+	nodes.forEachOwnedInterval([&](Node& node, Interval& interval, size_t index) {
+		owners[index] = &node;
+		if (node.noCompression())
+			return;
+
+		HeightFieldCompressor *compressor = new HeightFieldCompressor(interval.getHeightField(), block, block, resolution);
+		compressor->setCache(_blockCache);
+		compressor->compress();
+		fingerprints[index] = compressor->fingerprint();
+		compressors[index] = compressor;
+	}, Execution::PARALLEL, 1);
+
+	// Encodings by their fingerprint. They are shared in level order, so the first compressor
+	// of the tree keeps every one whatever the threads did
+	std::unordered_multimap<uint64_t, const HeightFieldCompressor*> encodings;
+	for (size_t index = 0; index < compressors.size(); ++index) {
+		HeightFieldCompressor *compressor = compressors[index];
+		if (!compressor)
+			continue;
+
+		auto range = encodings.equal_range(fingerprints[index]);
+		bool shared = false;
+		for (auto candidate = range.first; candidate != range.second && !shared; ++candidate)
+			shared = compressor->share(*candidate->second);
+
+		if (!shared)
+			encodings.emplace(fingerprints[index], compressor);
+	}
+
+	// Layers are coded as residuals of the one below in their node when it is smaller. The
+	// intervals of a node are visited in order by a single thread, so a layer is never
+	// predicted before the one below is final
+	nodes.forEachOwnedInterval([&](Node& node, Interval&, size_t index) {
+		if (index > 0 && owners[index - 1] == &node && compressors[index] && compressors[index - 1])
+			compressors[index]->predict(*compressors[index - 1]);
+	}, Execution::PARALLEL, 1);
+
+	nodes.forEachOwnedInterval([&](Node&, Interval& interval, size_t index) {
+		if (!compressors[index])
+			return;
+
+		interval.getHeightField()->setCompressor(compressors[index]);
+		if (releaseData)
+			interval.getHeightField()->releaseData();
+	}, Execution::PARALLEL, 16);
+
+	_compressionStatistics = CompressionStatistics{ 0, 0, 0, 0 };
+	for (auto *compressor : compressors) {
+		if (!compressor)
+			continue;
+
+		++_compressionStatistics._heightFields;
+		_compressionStatistics._encodings += !compressor->sharesEncoding();
+		_compressionStatistics._predicted += compressor->getReference() != nullptr;
+		_compressionStatistics._bytes += compressor->memorySize();
+	}
+}
+
+void QuadStack::setBlockCache(BlockCache *cache) {
+	_blockCache = cache;
+
+	traversal().forEachOwnedInterval([&](Node&, Interval& interval, size_t) {
+		if (interval.getHeightField()->getCompressor())
+			interval.getHeightField()->getCompressor()->setCache(cache);
+	});
 }
 
 float QuadStack::getHeightResolution() {
 
 	if (_resolution == 0) {
 		_resolution = std::numeric_limits<float>::max();
-		Iterator it = iterator();
-
-		do {
-			auto *node = it.data();
-			for (auto& interval : node->getGStack()) {
-				if (interval.isOwner() && !node->noCompression()) {
-					float diff = interval.getHeightField()->getHeightResolution();
-					if (diff < _resolution && diff != 0)
-						_resolution = diff;
-				}
-			}
 
-		} while (it.next());
+		// Every heightfield compares all its heights, so they are measured in parallel
+		Traversal nodes = traversal();
+		std::vector<float> resolutions(nodes.getNumberOfOwnedIntervals(), 0);
+		nodes.forEachOwnedInterval([&](Node& node, Interval& interval, size_t index) {
+			if (!node.noCompression())
+				resolutions[index] = interval.getHeightField()->getHeightResolution();
+		}, Execution::PARALLEL, 1);
+
+		for (float diff : resolutions)
+			if (diff < _resolution && diff != 0)
+				_resolution = diff;
 	}
 
 	if (_resolution == std::numeric_limits<float>::max())
@@ -786,7 +1732,32 @@ float QuadStack::getHeightResolution() {
 	return _resolution;
 }
 
-QuadStack::~QuadStack() {}
+QuadStack::~QuadStack() {
+	// The mipmaps read the heightfields, so they go first
+	clearLevelsOfDetail();
+
+	std::unordered_set<HeightField*> heightFields;
+	std::vector<Node*> nodes = { _root };
+	while (!nodes.empty()) {
+		Node *node = nodes.back();
+		nodes.pop_back();
+
+		for (auto& interval : node->getGStack())
+			if (interval.hasHeightField())
+				heightFields.insert(interval.getHeightField());
+
+		if (!node->isLeaf()) {
+			nodes.push_back(node->getNW());
+			nodes.push_back(node->getNE());
+			nodes.push_back(node->getSW());
+			nodes.push_back(node->getSE());
+		}
+		delete node;
+	}
+
+	for (auto heightField : heightFields)
+		delete heightField;
+}
 
 std::ostream& operator<<(std::ostream& os, QuadStack &quadtree) {
 	std::string outpuString = "";
@@ -804,65 +1775,97 @@ std::ostream& operator<<(std::ostream& os, QuadStack &quadtree) {
 }
 
 void QuadStack::topDownPhase() {
-	_root->decompose();
+	clearLevelsOfDetail();
+
+	// Only the nodes that end up as leaves read their columns
+	UniformityIndex index(*_terrain);
+	_root->decompose(index, index.getRoot());
 }
 
 void QuadStack::bottomUpPhase() {
-	_root->promote();
-}
+	clearLevelsOfDetail();
+
+	std::vector<HeightField*> replaced;
+	Merges merges;
+	_root->promote(replaced, merges);
+	std::sort(merges.begin(), merges.end());
+
+	auto mergedInto = [&](const HeightField *heightField) -> HeightField* {
+		auto merge = std::lower_bound(merges.begin(), merges.end(), std::make_pair(heightField, static_cast<HeightField*>(nullptr)));
+		return merge != merges.end() && merge->first == heightField ? merge->second : nullptr;
+	};
+
+	std::unordered_set<const HeightField*> referenced;
+	std::vector<const HeightField*> shared;
+	traversal().forEachNode([&](Node& node, size_t) {
+		for (auto& interval : node.getGStack()) {
+			if (!interval.hasHeightField())
+				continue;
+
+			referenced.insert(interval.getHeightField());
+			if (!interval.isOwner())
+				shared.push_back(interval.getHeightField());
+		}
+	}, Execution::SEQUENTIAL);
 
-void QuadStack::rearrangeHeightField() {
-	int index = 0;
-	_root->rearrangeHeightFields(std::vector<std::pair<QuadStack::Interval*, ivec2>>(), index);
-}
+	// Heightfields merged again higher up are shared from the topmost one, unless its interval
+	// was dropped
+	_sharing.clear();
+	for (auto heightField : shared) {
+		HeightField *topmost = mergedInto(heightField);
+		if (!topmost)
+			continue;
 
-/**
+		for (auto next = mergedInto(topmost); next; next = mergedInto(topmost))
+			topmost = next;
 
-QuadStack::Interval methods
+		if (referenced.count(topmost))
+			_sharing.emplace(heightField, topmost);
+	}
 
-*/
+	deleteUnreferenced(replaced, referenced);
+}
+
+void QuadStack::deleteUnreferenced(const std::vector<HeightField*>& replaced, const std::unordered_set<const HeightField*>& referenced) {
+	std::unordered_set<const HeightField*> deleted;
+	for (auto heightField : replaced)
+		if (!referenced.count(heightField) && deleted.insert(heightField).second)
+			delete heightField;
+}
 
-QuadStack::Interval::Interval(const QuadStack::Interval& other) :
-_material(other._material),
-_heightField(other._heightField),
-_heightFieldOwner(other._heightFieldOwner),
-_relative(other._relative),
-_erase(other._erase),
-_hfIndex(other._hfIndex) {
+void QuadStack::rearrangeHeightField() {
+	clearLevelsOfDetail();
 
+	traversal().forEachNode([&](Node& node, size_t) {
+		node.shareHeightFields(_sharing);
+	}, Execution::PARALLEL, 64);
 
+	_sharing.clear();
 }
 
-QuadStack::Interval& QuadStack::Interval::operator=(const QuadStack::Interval& other) {
-	if (&other != this) {
-		_material = other._material;
-		_heightField = other._heightField;
-		_heightFieldOwner = other._heightFieldOwner;
-		_relative = other._relative;
-		_erase = other._erase;
-		_hfIndex = other._hfIndex;
-	}
+/**
 
-	return *this;
-}
+QuadStack::Interval methods
+
+*/
 
-void QuadStack::Interval::addQuadrant(QuadStack::Interval *subInterval, HeightField::Quadrant quadrant) {
+void QuadStack::Interval::addQuadrant(Quadrants& quadrants, QuadStack::Interval *subInterval, HeightField::Quadrant quadrant) {
 
-	if (_quadrants.find(quadrant) != _quadrants.end())
-		_quadrants[quadrant]->_heightFieldOwner = true;
+	if (quadrants.find(quadrant) != quadrants.end())
+		quadrants[quadrant]->_heightFieldOwner = true;
 
 
 	subInterval->_heightFieldOwner = false;
-	_quadrants[quadrant] = subInterval;
+	quadrants[quadrant] = subInterval;
 }
 
-void QuadStack::Interval::merge() {
+void QuadStack::Interval::merge(const Quadrants& quadrants) {
 
-	if (_quadrants.size() == 4) {
-		auto nw = _quadrants[HeightField::Quadrant::NW];
-		auto ne = _quadrants[HeightField::Quadrant::NE];
-		auto sw = _quadrants[HeightField::Quadrant::SW];
-		auto se = _quadrants[HeightField::Quadrant::SE];
+	if (quadrants.size() == 4) {
+		auto nw = quadrants.at(HeightField::Quadrant::NW);
+		auto ne = quadrants.at(HeightField::Quadrant::NE);
+		auto sw = quadrants.at(HeightField::Quadrant::SW);
+		auto se = quadrants.at(HeightField::Quadrant::SE);
 
 		vec2 origin;
 		origin.x = sw->_heightField->getOriginX();
@@ -879,7 +1882,8 @@ void QuadStack::Interval::merge() {
 		float maxHeight = nw->_heightField->getMaxHeight();
 		float nullData = nw->_heightField->getNullData();
 
-		_heightField = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr);
+		_heightField = new HeightField(origin, spacing, dimension, minHeight, maxHeight, nullData, nullptr, nullptr, HEIGHT_FIELD_LAYOUT);
+		_heightField->setOffset(sw->_heightField->getOffset());
 
 		for (int x = 0; x < nw->getDimensionX(); ++x) {
 			for (int y = 0; y < nw->getDimensionY(); ++y) {
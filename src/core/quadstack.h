@@ -9,49 +9,80 @@
 #define QUAD_STACK_H
 
 #include "core/stackbasedrep.h"
+#include "core/blockcache.h"
 #include "core/heightfield.h"
+#include "core/heightmipmap.h"
+#include "core/parallel.h"
+#include "core/quadstackqueries.h"
+#include "core/uniformityindex.h"
+#include <atomic>
+#include <functional>
+#include <limits>
 #include <map>
-#include <list>
 #include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 
 using glm::vec4;
 
-class QuadStack {
+class QuadStack final : public QuadStackQueries {
+
+	friend class PagedQuadStack;
 
 	private:
 		static const int NULL_VALUE = -1;
 
+		/**
+		Layout of the heightfields of the intervals. The compressor and the mipmaps read them
+		block by block, which the Morton layout keeps contiguous
+		*/
+		static const HeightField::Layout HEIGHT_FIELD_LAYOUT = HeightField::Layout::MORTON;
+
+		static const int EXTRACTION_TILE = 64; /*< Side of the tiles of cells extracted in parallel */
+
 
 		/**
 			Class that encapsulates each interval within a stack.
 		*/
-		class Interval {
-			int _material; /*< Part of the sequence of materials */
+		class Interval;
 
-			HeightField *_heightField; /*< Layer of consecutive heights with a same material */
+		/**
+		Intervals of the children a merged interval is built from. Only needed while building
+		*/
+		using Quadrants = std::map<HeightField::Quadrant, Interval*>;
 
-			int _hfIndex; /*< Index for the heightfield pool */
+		/**
+		Heightfield every heightfield was merged into by the bottom-up phase, keyed by the
+		latter. The key is a copy of the part of the value over its cells, so the interval that
+		points to it can share the value instead
+		*/
+		using SharingRegistry = std::unordered_map<const HeightField*, HeightField*>;
 
-			bool _heightFieldOwner; /*< Flag that indicates if the height map must be sampled in this interval */
+		/**
+		Heightfields merged by the bottom-up phase, each one along with the heightfield it was
+		merged into
+		*/
+		using Merges = std::vector<std::pair<const HeightField*, HeightField*>>;
 
-			glm::vec2 _relative; /*< Relative position */
+		/**
+		Immutable once built, so it is kept trivially copyable and small. The position of the
+		heightfield in the terrain is held by the heightfield itself
+		*/
+		class Interval {
+			HeightField *_heightField; /*< Layer of consecutive heights with a same material */
 
-			bool _erase;
+			int _material; /*< Part of the sequence of materials */
 
-			std::map<HeightField::Quadrant, Interval*> _quadrants;
+			bool _heightFieldOwner; /*< Flag that indicates if the height map must be sampled in this interval */
 
 		public:
-			Interval() : _erase(false){};
-
-			Interval(int material, HeightField *HeightField) : _material(material), _heightField(HeightField), _heightFieldOwner(true), _relative(), _erase(false), _hfIndex(0) {}
+			Interval() : _heightField(nullptr), _material(NULL_VALUE), _heightFieldOwner(false) {}
 
-			Interval(const Interval& other);
+			Interval(int material, HeightField *heightField) : _heightField(heightField), _material(material), _heightFieldOwner(true) {}
 
-			Interval& operator=(const Interval& other);
-
-			bool operator==(const Interval& other) { return _material == other._material; }
-			
-			bool operator==(Interval& other) { return _material == other._material; }
+			bool operator==(const Interval& other) const { return _material == other._material; }
 
 			bool isNull() const { return _material == NULL_VALUE; }
 
@@ -61,31 +92,35 @@ class QuadStack {
 
 			void setMaterial(int material) { _material = material; }
 
-			void setHfIndex(int index) { _hfIndex = index; }
-
-			int getHfIndex() { return _hfIndex; }
-
-			void setHeightField(HeightField *HeightField) { _heightFieldOwner = false; _heightField = HeightField; }
+			void setHeightField(HeightField *heightField) { _heightFieldOwner = false; _heightField = heightField; }
 
 			bool hasHeightField() const { return _heightField != nullptr; }
 
 			HeightField* getHeightField() { return _heightField; }
 
+			const HeightField* getHeightField() const { return _heightField; }
+
 			unsigned int getDimensionX() const { if (hasHeightField()) return _heightField->getDimensionX(); return 0; }
 
 			unsigned int getDimensionY() const { if (hasHeightField()) return _heightField->getDimensionY(); return 0; }
 
-			glm::vec2 getRelativeCoordinates() const { return _relative; }
-
-			bool isOwner() { return _heightFieldOwner; }
+			/**
+			Cell of the terrain where the heightfield of the interval starts
+			*/
+			ivec2 getOrigin() const { return _heightField->getOffset(); }
 
-			void merge();
+			bool isOwner() const { return _heightFieldOwner; }
 
-			void addQuadrant(Interval *subInterval, HeightField::Quadrant quadrant);
+			/**
+			Replaces the heightfield by the union of the heightfields of quadrants
+			*/
+			void merge(const Quadrants& quadrants);
 
-			~Interval() {}
+			static void addQuadrant(Quadrants& quadrants, Interval *subInterval, HeightField::Quadrant quadrant);
 		};
 
+		static_assert(sizeof(Interval) <= 16 && std::is_trivially_copyable<Interval>::value, "Intervals are copied by value by every query");
+
 
 		/**
 			Class alias
@@ -95,8 +130,120 @@ class QuadStack {
 		using DoublePair = std::pair < IntPair, IntPair>;
 		using Cachemap = std::map<DoublePair, GStack>;
 
+	public:
+
+		using Column = QuadStackQueries::Column;
+
+		/**
+		Amount of a material inside a region
+		*/
+		struct MaterialStatistics {
+			double _volume; /*< Sum of the thickness of the material times the area of the cells */
+			double _area; /*< Area of the cells that hold the material */
+			float _minThickness, _maxThickness; /*< Thickness of the material in a cell that holds it */
+		};
+
+		using Statistics = std::map<int, MaterialStatistics>;
+
+		/**
+		Outcome of the last compressHeightField
+		*/
+		struct CompressionStatistics {
+			size_t _heightFields; /*< Owned heightfields compressed */
+			size_t _encodings; /*< Distinct encodings they keep, the others share one of them */
+			size_t _predicted; /*< Heightfields coded as residuals of the layer below */
+			double _bytes; /*< Size of the distinct encodings and of the offsets of the shared ones */
+		};
+
+		/**
+		Receives an interval of material over the cells of region, from bottom to top. Heights
+		are given per cell of region in row-major order; cells whose top is not above their
+		bottom are not part of the interval
+		*/
+		using SpanVisitor = std::function<void(int material, const iaabb2& region, const float *bottom, const float *top)>;
+
+		/**
+		Interval of a column read from a level of detail. In every cell it stands for, the top
+		of the interval lies between _minTop and _maxTop, and its bottom is the top of the
+		previous interval. An interval whose top may not be above its bottom may be missing
+		from some of those cells
+		*/
+		struct BoundedInterval {
+			int _material;
+			float _minTop, _maxTop;
+		};
+
+		using BoundedColumn = std::vector<BoundedInterval>;
+
+		/**
+		Receives a column that bounds every cell of region. It may be called in parallel
+		*/
+		using BoundedColumnVisitor = std::function<void(const iaabb2& region, const BoundedColumn& column)>;
+
+		/**
+		Materials at a height read from a level of detail. The material of every cell is
+		_lower, _upper or one between them in the column: _lower is found raising every
+		boundary to its maximum and _upper lowering them to their minimum
+		*/
+		struct MaterialBounds {
+			int _lower, _upper;
+		};
+
+		/**
+		Ray in the coordinates of the terrain: x and y as the origin and resolution of the
+		terrain give them, z as a height
+		*/
+		struct Ray {
+			vec3 _origin;
+			vec3 _direction;
+			float _maxDistance = std::numeric_limits<float>::infinity();
+		};
+
+		/**
+		First intersection of a ray with a material. Distances are measured along the ray
+		*/
+		struct RayHit {
+			bool _hit;
+			int _material;
+			vec3 _point; /*< Where the ray enters the material */
+			float _distance; /*< From the origin of the ray to _point */
+			float _entryHeight, _exitHeight; /*< Heights where the ray enters and leaves the material */
+			float _exitDistance;
+		};
+
+	private:
+
+		/**
+		Min and max mipmaps of a heightfield
+		*/
+		struct LevelOfDetail {
+			std::unique_ptr<HeightMipmap> _min, _max;
+		};
+
+		using LevelsOfDetail = std::unordered_map<const HeightField*, LevelOfDetail>;
+
+		/**
+		Ray of a query in the coordinates of the cells, advancing a unit of distance per unit
+		of the direction
+		*/
+		struct RayQuery {
+			vec3 _origin, _direction;
+			float _maxDistance;
+			int _material;
+			Column _column; /*< Column of the last cell read */
+		};
+
+		/**
+		Column of the cells of a region, still open at its top
+		*/
+		struct BoundedPiece {
+			iaabb2 _region;
+			BoundedColumn _column;
+			float _minBottom, _maxBottom; /*< Bounds of the height where the next interval starts */
+		};
+
 		class Node {
-			friend class Iterator;
+			friend class Traversal;
 
 			GStack _stack; /*< Stack in the node (with height)*/
 
@@ -120,6 +267,27 @@ class QuadStack {
 
 			static unsigned nonUIntervals(GStack& stack);
 
+			/**
+			Height of an interval of this node at the cell (x, y)
+			*/
+			float getHeight(const Interval& interval, int x, int y) const;
+
+			/**
+			Heights of an interval of this node at the cells of region, in row-major order
+			*/
+			void getHeights(const Interval& interval, const iaabb2& region, float *heights) const;
+
+			/**
+			Bounds of the heights of an interval of this node at the cells of region, read from
+			the mipmaps of level, or from the deepest one of its heightfield
+			*/
+			void getHeightBounds(const Interval& interval, const iaabb2& region, unsigned level, const LevelsOfDetail& levels, float& minHeight, float& maxHeight) const;
+
+			/**
+			Child that contains the cell (x, y)
+			*/
+			Node* getChild(int x, int y);
+
 		public:
 
 			Node(int level = 0, ivec2 min = { 0, 0 }, ivec2 max = { 0, 0 }, ShortSBR *terrain = nullptr);
@@ -128,7 +296,11 @@ class QuadStack {
 
 			Node& operator=(const Node& other);
 
-			void classify();
+			/**
+			Compresses the node if its columns share their materials, and otherwise classifies
+			its children. Entry is the region of the node in index
+			*/
+			void classify(const UniformityIndex& index, uint32_t entry);
 
 			vec4 memorySize();
 
@@ -158,10 +330,10 @@ class QuadStack {
 			int treeHeight();
 			
 			/**
-			Try the compression of the material of the whole node and return true in afirmative case.
-			False otherwise.
+			Compresses the materials of the whole node. Its columns must have the same materials,
+			which the caller knows from a UniformityIndex
 			*/
-			bool compress();
+			void compress();
 
 			
 			/**
@@ -169,27 +341,74 @@ class QuadStack {
 			*/
 			int sample(int x, int y, float height, float fatherHeight);
 
+			/**
+			Sample at a level of detail, raising every boundary to its maximum or lowering it
+			to its minimum as mode says
+			*/
+			int sample(int x, int y, float height, float fatherHeight, unsigned level, const LevelsOfDetail& levels, MipmapMode mode);
+
+			/**
+			Tells if material may lie between the heights minZ and maxZ in some cell of region,
+			with the heights low and high given by their bounds. Only the mipmaps are read, and
+			the children are only read when one of them holds region
+			*/
+			bool mayContain(const iaabb2& region, int material, float minZ, float maxZ, float minLow, float maxLow, float minHigh, float maxHigh, const LevelsOfDetail& levels);
+
+			/**
+			Appends to column the intervals at (x, y) between the heights low and high
+			*/
+			void column(int x, int y, float low, float high, Column& column);
+
+			/**
+			Visits the intervals of the cells of region between the heights low and high, given
+			per cell of region in row-major order. Every cell is visited from the bottom
+			*/
+			void spans(const iaabb2& region, const float *low, const float *high, const SpanVisitor& visitor);
+
+			/**
+			Appends to pieces the columns of the cells of region between the heights low and
+			high, given by their bounds, reading the heightfields at level. Region is split
+			where the children under a null interval do not cover it together
+			*/
+			void boundedColumns(const iaabb2& region, float minLow, float maxLow, float minHigh, float maxHigh, unsigned level, const LevelsOfDetail& levels, std::vector<BoundedPiece>& pieces);
+
 			/**
 			Traverse the tree in order to update the terrain pointer
 			*/
 			void updateTerrain(ShortSBR *terrain);
 			
-			void rearrangeHeightFields(std::vector<std::pair<Interval*, ivec2>> intervals, int& index);
+			/**
+			Points the intervals merged into an ancestor to the heightfield they were merged into,
+			as found in registry, and deletes the ones they held
+			*/
+			void shareHeightFields(const SharingRegistry& registry);
 			
 			/**
 			Auxiliar method for printing the tree structure
 			*/
 			std::string print();
 
-			void decompose();
+			/**
+			Unifies the node or subdivides it until its children are uniform. Entry is the region
+			of the node in index, which tells which nodes are mixed without reading their columns
+			*/
+			void decompose(const UniformityIndex& index, uint32_t entry);
 
-			void promote();
+			/**
+			Moves the intervals shared by the children up to the node. The heightfields the
+			children held before are appended to replaced, and those merged into the node to
+			merges
+			*/
+			void promote(std::vector<HeightField*>& replaced, Merges& merges);
 
-			bool unify();
+			/**
+			Gives the node the intervals of its columns, which must have the same materials
+			*/
+			void unify();
 
 			bool isCompressed() { return _compressed; }
 
-			GStack shrink(GStack& newStack, HeightField::Quadrant quadrant);
+			GStack shrink(GStack& newStack, std::vector<Quadrants>& quadrants, HeightField::Quadrant quadrant);
 
 			bool divisible();
 
@@ -204,22 +423,136 @@ class QuadStack {
 		bool _compressed;
 		float  _resolution;
 
+		LevelsOfDetail _levelsOfDetail; /*< Mipmaps of every heightfield, built on demand */
+		std::atomic<bool> _levelsOfDetailReady;
+		std::mutex _levelsOfDetailMutex;
+
+		BlockCache *_blockCache; /*< Decoded blocks of the compressed heightfields */
+
+		CompressionStatistics _compressionStatistics;
+
+		SharingRegistry _sharing; /*< Heightfields the bottom-up phase leaves to share, until they are rearranged */
+
+		/**
+		Calls function, in parallel, with every tile of EXTRACTION_TILE cells of region and its index
+		*/
+		void forEachTile(iaabb2 region, const std::function<void(const iaabb2& tile, size_t index)>& function);
+
+		/**
+		Statistics of the cells of region between the heights low and high. If polygon is
+		given, only the cells whose centre lies inside it are measured
+		*/
+		Statistics statistics(iaabb2 region, float low, float high, const std::vector<vec2> *polygon);
+
+		/**
+		Drops the mipmaps of the heightfields, which the tree is about to replace
+		*/
+		void clearLevelsOfDetail();
+
+		/**
+		Deletes the heightfields of replaced that are not in referenced, those the intervals of
+		the tree point to
+		*/
+		void deleteUnreferenced(const std::vector<HeightField*>& replaced, const std::unordered_set<const HeightField*>& referenced);
+
+		/**
+		Distances where the ray of query enters and leaves the cells of region. False if it
+		misses them
+		*/
+		static bool clipRay(const RayQuery& query, const iaabb2& region, float& enter, float& exit);
+
+		/**
+		Finds the first hit of query in the cells of region, which the ray crosses between the
+		distances enter and exit. Halves of region are visited from the nearest one, skipping
+		those where the mipmaps rule the material out
+		*/
+		bool intersect(RayQuery& query, const iaabb2& region, float enter, float exit, RayHit& hit);
+
+		/**
+		Hit of query with the column of cell between the distances enter and exit
+		*/
+		bool intersectCell(RayQuery& query, ivec2 cell, float enter, float exit, RayHit& hit);
+
+		/**
+		Follows the ray of a hit from cell to cell until it leaves the material
+		*/
+		void exitMaterial(RayQuery& query, ivec2 cell, float exit, RayHit& hit);
+
 
 	public:
 
-		/*
-		Auxiliary class to iterate in a level order
+		/**
+		How the visits of a Traversal are run
+		*/
+		enum class Execution { SEQUENTIAL, PARALLEL };
+
+		/**
+		Consecutive nodes of a Traversal
+		*/
+		class NodeSpan {
+			Node * const *_begin, * const *_end;
+
+		public:
+			NodeSpan(Node * const *begin, Node * const *end) : _begin(begin), _end(end) {}
+			Node * const * begin() const { return _begin; }
+			Node * const * end() const { return _end; }
+			size_t size() const { return _end - _begin; }
+			Node* operator[](size_t index) const { return _begin[index]; }
+		};
+
+		/**
+		Nodes of the tree in level order, gathered once: the root, its children, theirs and
+		so on, so the nodes of every level are a span of consecutive nodes. Owned intervals are
+		numbered in the same order, which gives the work done on them in parallel indices that
+		do not depend on the threads.
+
+		The nodes are those of the tree when the traversal is built, so it must be built again
+		once the tree changes
 		*/
+		class Traversal {
+			static const size_t NODE_GRAIN = 16; /*< Nodes handed to a thread at once by default */
 
-		class Iterator {
-			Node *_node;
-			std::list<Node*> _list;
+			std::vector<Node*> _nodes; /*< Level order */
+			std::vector<size_t> _levels; /*< First node of every level, then the number of nodes */
+			std::vector<size_t> _owned; /*< Owned intervals of the nodes before every node, then all of them */
 
 		public:
-			Iterator(Node *node) : _node(node) {}
-			bool end() { return _node->isLeaf(); }
-			bool next();
-			Node* data() { return _node; };
+			explicit Traversal(Node *root);
+
+			size_t size() const { return _nodes.size(); }
+
+			Node* operator[](size_t index) const { return _nodes[index]; }
+
+			Node * const * begin() const { return _nodes.data(); }
+
+			Node * const * end() const { return _nodes.data() + _nodes.size(); }
+
+			unsigned getNumberOfLevels() const { return static_cast<unsigned>(_levels.size() - 1); }
+
+			/**
+			Nodes of a level of the tree, the root being the level 0
+			*/
+			NodeSpan getLevel(unsigned level) const { return NodeSpan(_nodes.data() + _levels[level], _nodes.data() + _levels[level + 1]); }
+
+			/**
+			Number of intervals that own a heightfield
+			*/
+			size_t getNumberOfOwnedIntervals() const { return _owned.back(); }
+
+			/**
+			Calls function(node, index) with every node and its index in level order. In
+			parallel, chunks of grain consecutive nodes are handed to the threads
+			*/
+			template<class Function>
+			void forEachNode(Function function, Execution execution = Execution::PARALLEL, size_t grain = NODE_GRAIN) const;
+
+			/**
+			Calls function(node, interval, index) with every interval that owns a heightfield,
+			along with its node and its index among the owned intervals in level order. Work is
+			spread by chunks of grain nodes, as forEachNode
+			*/
+			template<class Function>
+			void forEachOwnedInterval(Function function, Execution execution = Execution::PARALLEL, size_t grain = NODE_GRAIN) const;
 		};
 		
 
@@ -229,7 +562,87 @@ class QuadStack {
 
 		std::string print();
 
-		int sample(int x, int y, float height, float fatherHeight);
+		int sample(int x, int y, float height, float fatherHeight) override;
+
+		/**
+		Fills column with the intervals at (x, y) up to fatherHeight, without sampling every height
+		*/
+		void getColumn(int x, int y, float fatherHeight, Column& column) override;
+
+		/**
+		Part of region inside the terrain
+		*/
+		iaabb2 clampRegion(iaabb2 region) const;
+
+		/**
+		Fills columns with the intervals between the heights low and high of every cell of
+		region, in row-major order of the region. Tiles of the region are filled in parallel
+		*/
+		void getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) override;
+
+		/**
+		Voxel model of the cells of region between the heights low and high, with voxels of
+		height spacingZ. Voxels are ordered as StackBasedRep expects them
+		*/
+		ShortVM* extractVoxelModel(iaabb2 region, float low, float high, float spacingZ);
+
+		/**
+		SBR of the cells of region between the heights low and high
+		*/
+		ShortSBR* extractSBR(iaabb2 region, float low, float high);
+
+		/**
+		Volume, area and thickness of every material in the cells of region between the
+		heights low and high. The thickness of a material in a cell adds all its intervals
+		*/
+		Statistics getStatistics(iaabb2 region, float low, float high);
+
+		/**
+		Statistics of the cells whose centre lies inside polygon, given in the coordinates of
+		the terrain
+		*/
+		Statistics getStatistics(const std::vector<vec2>& polygon, float low, float high);
+
+		/**
+		Builds the min and max mipmaps of every heightfield, in parallel, unless they already
+		exist. Queries at a level of detail build them on their first call
+		*/
+		void computeLevelsOfDetail();
+
+		/**
+		Mipmap of heightField, which must belong to an interval of the tree
+		*/
+		HeightMipmap* getMipmap(const HeightField *heightField, MipmapMode mode);
+
+		/**
+		Bounds of the material at (x, y) and height, reading every heightfield at the mipmap
+		level, so that the answer holds for the cells of its mipmap cell
+		*/
+		MaterialBounds sample(int x, int y, float height, float fatherHeight, unsigned level);
+
+		/**
+		Fills column with the bounds of the intervals at (x, y) up to fatherHeight, reading
+		every heightfield at the mipmap level
+		*/
+		void getColumn(int x, int y, float fatherHeight, unsigned level, BoundedColumn& column);
+
+		/**
+		Visits columns that bound the intervals between the heights low and high of the cells
+		of region. The region is covered with squares of 2^level cells aligned to the terrain,
+		and one column is computed per square, or per part of it below a different node. The
+		squares are computed in parallel
+		*/
+		void getColumns(iaabb2 region, float low, float high, unsigned level, const BoundedColumnVisitor& visitor);
+
+		/**
+		First intersection of ray with material, or a RayHit without _hit
+		*/
+		RayHit intersect(const Ray& ray, int material);
+
+		/**
+		Intersections of rays with material, computed in parallel
+		*/
+		void intersect(const std::vector<Ray>& rays, int material, std::vector<RayHit>& hits);
 
 		bool isCompressed() { return _compressed; }
 
@@ -245,11 +658,16 @@ class QuadStack {
 
 		unsigned getHfCols() { return _terrain->getDimension().y; }
 
-		Iterator iterator() { return Iterator(_root); }
+		/**
+		Level order of the current nodes of the tree
+		*/
+		Traversal traversal() const { return Traversal(_root); }
+
+		ivec2 getDimension() const override { return _terrain->getDimension(); }
 
-		float getMinHeight() const { return _terrain->getMinHeight(); }
+		float getMinHeight() const override { return _terrain->getMinHeight(); }
 
-		float getMaxHeight() const { return _terrain->getMaxHeight(); }
+		float getMaxHeight() const override { return _terrain->getMaxHeight(); }
 
 		float getHeightResolution();
 
@@ -265,12 +683,51 @@ class QuadStack {
 
 		void rearrangeHeightField();
 
-		void compressHeightField(float resolution);
+		/**
+		Compresses the owned heightfields by blocks. With releaseData the raw heights are freed
+		once encoded and every query decodes them from the compressed blocks. Heightfields
+		equal to one compressed before, or equal up to a constant offset, share its encoding.
+		The others are coded as residuals of the layer below in their node if that is smaller
+		*/
+		void compressHeightField(float resolution, bool releaseData = false);
+
+		CompressionStatistics getCompressionStatistics() const { return _compressionStatistics; }
+
+		/**
+		Cache of decoded blocks for the compressed heightfields, behind the blocks every thread
+		keeps, none if null. The cache shared by the whole process is used unless told otherwise
+		*/
+		void setBlockCache(BlockCache *cache);
+
+		BlockCache* getBlockCache() const { return _blockCache; }
 
 		int treeHeight() { return _root->treeHeight(); }
 
 		~QuadStack();
 };
 
+template<class Function>
+void QuadStack::Traversal::forEachNode(Function function, Execution execution, size_t grain) const {
+	if (execution == Execution::SEQUENTIAL) {
+		for (size_t index = 0; index < _nodes.size(); ++index)
+			function(*_nodes[index], index);
+		return;
+	}
+
+	parallel::forRange(0, _nodes.size(), [&](size_t index) {
+		function(*_nodes[index], index);
+	}, grain);
+}
+
+template<class Function>
+void QuadStack::Traversal::forEachOwnedInterval(Function function, Execution execution, size_t grain) const {
+	forEachNode([&](Node& node, size_t index) {
+		size_t owned = _owned[index];
+		for (auto& interval : node.getGStack())
+			if (interval.isOwner() && interval.hasHeightField())
+				function(node, interval, owned++);
+	}, execution, grain);
+}
+
 #endif
 
@@ -0,0 +1,170 @@
+#include "quadstackforest.h"
+#include "core/compressionmanager.h"
+#include "core/parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+QuadStackForest::QuadStackForest(ShortSBR *terrain, int tileSize, bool releaseData) :
+	_terrain(terrain),
+	_tileSize(tileSize),
+	_tileShift(0),
+	_releaseData(releaseData) {
+
+	if (tileSize <= 0 || (tileSize & (tileSize - 1)) != 0)
+		throw std::invalid_argument("The size of the tiles must be a power of two");
+
+	while ((1 << _tileShift) < tileSize)
+		++_tileShift;
+
+	ivec2 dimension = terrain->getDimension();
+	_nTiles = ivec2((dimension.x + tileSize - 1) >> _tileShift, (dimension.y + tileSize - 1) >> _tileShift);
+
+	// Tiles of the borders end with the terrain
+	_tiles.resize(static_cast<size_t>(_nTiles.x) * _nTiles.y);
+	for (int y = 0; y < _nTiles.y; ++y) {
+		for (int x = 0; x < _nTiles.x; ++x) {
+			ivec2 min(x << _tileShift, y << _tileShift);
+			_tiles[x + y * static_cast<size_t>(_nTiles.x)]._region = iaabb2(min, ivec2(std::min(min.x + tileSize, dimension.x), std::min(min.y + tileSize, dimension.y)));
+		}
+	}
+}
+
+QuadStackForest::Tile& QuadStackForest::getTile(int& x, int& y) {
+	ivec2 dimension = _terrain->getDimension();
+	if (x < 0 || y < 0 || x >= dimension.x || y >= dimension.y)
+		throw std::out_of_range("Cell out of the terrain");
+
+	Tile& tile = _tiles[(x >> _tileShift) + (y >> _tileShift) * static_cast<size_t>(_nTiles.x)];
+	x -= tile._region.min.x;
+	y -= tile._region.min.y;
+
+	if (!tile._quadStack && !tile._paged)
+		throw std::logic_error("The tile has not been built");
+
+	return tile;
+}
+
+QuadStackForest::Tile& QuadStackForest::getTile(ivec2 tile) {
+	if (tile.x < 0 || tile.y < 0 || tile.x >= _nTiles.x || tile.y >= _nTiles.y)
+		throw std::out_of_range("Tile out of the forest");
+
+	return _tiles[tile.x + tile.y * static_cast<size_t>(_nTiles.x)];
+}
+
+ShortSBR* QuadStackForest::cutTerrain(const iaabb2& region) const {
+	ivec2 size = region.max - region.min;
+	vec2 spacing = _terrain->getSpacing();
+	vec2 origin(_terrain->getOriginX() + region.min.x * spacing.x, _terrain->getOriginY() + region.min.y * spacing.y);
+
+	// Every tile keeps the height range of the whole terrain, so queries take the same heights
+	ShortSBR *sbr = new ShortSBR(_terrain->getMinHeight(), _terrain->getMaxHeight(), _terrain->getHeightResolution(), _terrain->getAttributeName(), origin, spacing, size);
+	for (int y = 0; y < size.y; ++y)
+		for (int x = 0; x < size.x; ++x)
+			sbr->getStack(x, y).getIntervals() = _terrain->getStack(region.min.x + x, region.min.y + y).getIntervals();
+
+	return sbr;
+}
+
+void QuadStackForest::buildTile(Tile& tile) {
+	std::unique_ptr<ShortSBR> terrain(cutTerrain(tile._region));
+
+	CompressionManager manager(terrain.get());
+	std::unique_ptr<QuadStack> quadStack(manager.getQuadStack());
+	manager.execute(_releaseData);
+
+	tile._paged.reset();
+	tile._quadStack = std::move(quadStack);
+	tile._terrain = std::move(terrain);
+}
+
+void QuadStackForest::build() {
+	parallel::forRange(0, _tiles.size(), [&](size_t index) {
+		buildTile(_tiles[index]);
+	});
+}
+
+void QuadStackForest::rebuild(iaabb2 region) {
+	std::vector<Tile*> tiles;
+	for (auto& tile : _tiles) {
+		bool overlaps = tile._region.min.x < region.max.x && region.min.x < tile._region.max.x &&
+			tile._region.min.y < region.max.y && region.min.y < tile._region.max.y;
+		if (overlaps)
+			tiles.push_back(&tile);
+	}
+
+	parallel::forRange(0, tiles.size(), [&](size_t index) {
+		buildTile(*tiles[index]);
+	});
+}
+
+int QuadStackForest::sample(int x, int y, float height, float fatherHeight) {
+	Tile& tile = getTile(x, y);
+	return tile._quadStack ? tile._quadStack->sample(x, y, height, fatherHeight) : tile._paged->sample(x, y, height, fatherHeight);
+}
+
+void QuadStackForest::getColumn(int x, int y, float fatherHeight, Column& column) {
+	Tile& tile = getTile(x, y);
+	if (tile._quadStack)
+		tile._quadStack->getColumn(x, y, fatherHeight, column);
+	else
+		tile._paged->getColumn(x, y, fatherHeight, column);
+}
+
+void QuadStackForest::getColumns(Tile& tile, const iaabb2& region, float low, float high, std::vector<Column>& columns) {
+	if (tile._quadStack)
+		tile._quadStack->getColumns(region, low, high, columns);
+	else if (tile._paged)
+		tile._paged->getColumns(region, low, high, columns);
+	else
+		throw std::logic_error("The tile has not been built");
+}
+
+void QuadStackForest::getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) {
+	ivec2 dimension = _terrain->getDimension();
+	region.min = ivec2(std::min(std::max(region.min.x, 0), dimension.x), std::min(std::max(region.min.y, 0), dimension.y));
+	region.max = ivec2(std::min(std::max(region.max.x, region.min.x), dimension.x), std::min(std::max(region.max.y, region.min.y), dimension.y));
+	int width = region.max.x - region.min.x;
+
+	columns.assign(static_cast<size_t>(width) * (region.max.y - region.min.y), Column());
+	if (columns.empty())
+		return;
+
+	// Every tile fills its part of the region in parallel by itself
+	std::vector<Column> tileColumns;
+	ivec2 first = getTileOf(region.min.x, region.min.y), last = getTileOf(region.max.x - 1, region.max.y - 1);
+	for (int tileY = first.y; tileY <= last.y; ++tileY) {
+		for (int tileX = first.x; tileX <= last.x; ++tileX) {
+			Tile& tile = getTile(ivec2(tileX, tileY));
+			iaabb2 cells(ivec2(std::max(region.min.x, tile._region.min.x), std::max(region.min.y, tile._region.min.y)),
+				ivec2(std::min(region.max.x, tile._region.max.x), std::min(region.max.y, tile._region.max.y)));
+			getColumns(tile, iaabb2(cells.min - tile._region.min, cells.max - tile._region.min), low, high, tileColumns);
+
+			int cellsWidth = cells.max.x - cells.min.x;
+			for (int y = cells.min.y; y < cells.max.y; ++y) {
+				auto source = tileColumns.begin() + (y - cells.min.y) * static_cast<size_t>(cellsWidth);
+				std::move(source, source + cellsWidth, columns.begin() + (cells.min.x - region.min.x) + (y - region.min.y) * static_cast<size_t>(width));
+			}
+		}
+	}
+}
+
+void QuadStackForest::writeTile(ivec2 tile, const std::string& filePath, unsigned topLevels, unsigned pageLevels) {
+	Tile& written = getTile(tile);
+	if (!written._quadStack)
+		throw std::logic_error("Only tiles held in memory can be written");
+
+	PagedQuadStack::write(*written._quadStack, filePath, topLevels, pageLevels);
+}
+
+void QuadStackForest::loadTile(ivec2 tile, const std::string& filePath, size_t budget) {
+	Tile& loaded = getTile(tile);
+	std::unique_ptr<PagedQuadStack> paged(new PagedQuadStack(filePath, budget));
+
+	if (paged->getDimension() != loaded._region.max - loaded._region.min)
+		throw std::invalid_argument(filePath + " does not hold a tile of the size of the forest tile");
+
+	loaded._quadStack.reset();
+	loaded._terrain.reset();
+	loaded._paged = std::move(paged);
+}
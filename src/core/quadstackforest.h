@@ -0,0 +1,152 @@
+/**
+*	Grid of QuadStacks over square tiles of a terrain. Every tile of tileSize x tileSize
+*	cells, a power of two, gets its own QuadStack, so the trees are built in parallel and a
+*	region of the terrain can be rebuilt without touching the rest. Tiles on the right and
+*	top borders are cut at the border of the terrain instead of being padded.
+*
+*	Queries are given in the cells of the whole terrain and routed to the tile that holds
+*	them by shifting the cell. A tile can be written to a file on its own, as a
+*	PagedQuadStack, and queried from that file instead of memory.
+*
+*	@class QuadStackForest
+*/
+
+#ifndef QUAD_STACK_FOREST_H
+#define QUAD_STACK_FOREST_H
+
+#include "core/pagedquadstack.h"
+#include "core/quadstack.h"
+#include "core/quadstackqueries.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class QuadStackForest final : public QuadStackQueries {
+
+public:
+
+	static const int DEFAULT_TILE_SIZE = 1024;
+
+	using Column = QuadStackQueries::Column;
+
+private:
+
+	struct Tile {
+		iaabb2 _region; /*< Cells of the terrain */
+		std::unique_ptr<ShortSBR> _terrain; /*< Cut of the terrain the QuadStack was built from */
+		std::unique_ptr<QuadStack> _quadStack;
+		std::unique_ptr<PagedQuadStack> _paged; /*< Replaces the QuadStack once the tile is loaded from a file */
+	};
+
+	ShortSBR *_terrain;
+
+	int _tileSize;
+
+	int _tileShift; /*< log2 of the tile size */
+
+	ivec2 _nTiles;
+
+	bool _releaseData; /*< Build the QuadStacks with their raw heights released */
+
+	std::vector<Tile> _tiles; /*< Row-major order of the grid of tiles */
+
+	/**
+	Tile that holds the cell (x, y), and the cell relative to the tile. Throws
+	std::out_of_range if the cell lies outside the terrain
+	*/
+	Tile& getTile(int& x, int& y);
+
+	Tile& getTile(ivec2 tile);
+
+	/**
+	Copy of the stacks of region of the terrain
+	*/
+	ShortSBR* cutTerrain(const iaabb2& region) const;
+
+	void buildTile(Tile& tile);
+
+	/**
+	Columns of the cells of region, relative to the tile, between the heights low and high
+	*/
+	static void getColumns(Tile& tile, const iaabb2& region, float low, float high, std::vector<Column>& columns);
+
+public:
+
+	/**
+	Forest over terrain, which must outlive it. Throws std::invalid_argument if tileSize is
+	not a power of two. Tiles are not built until build is called
+	*/
+	QuadStackForest(ShortSBR *terrain, int tileSize = DEFAULT_TILE_SIZE, bool releaseData = false);
+
+	QuadStackForest(const QuadStackForest&) = delete;
+
+	QuadStackForest& operator=(const QuadStackForest&) = delete;
+
+	/**
+	Builds every tile, in parallel
+	*/
+	void build();
+
+	/**
+	Builds again, in parallel, the tiles that overlap region, after the terrain changed there.
+	Tiles loaded from a file are built from the terrain again
+	*/
+	void rebuild(iaabb2 region);
+
+	/**
+	Same as QuadStack::sample, with (x, y) a cell of the terrain
+	*/
+	int sample(int x, int y, float height, float fatherHeight) override;
+
+	/**
+	Same as QuadStack::getColumn, with (x, y) a cell of the terrain
+	*/
+	void getColumn(int x, int y, float fatherHeight, Column& column) override;
+
+	/**
+	Same as QuadStack::getColumns, with region given in the cells of the terrain
+	*/
+	void getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) override;
+
+	/**
+	Writes the tile as a PagedQuadStack file. Throws std::logic_error if the tile is not
+	held in memory
+	*/
+	void writeTile(ivec2 tile, const std::string& filePath, unsigned topLevels = PagedQuadStack::DEFAULT_TOP_LEVELS,
+		unsigned pageLevels = PagedQuadStack::DEFAULT_PAGE_LEVELS);
+
+	/**
+	Replaces the tile by the PagedQuadStack of filePath, with budget bytes of resident pages.
+	Throws std::invalid_argument if the file does not hold a tile of the same size
+	*/
+	void loadTile(ivec2 tile, const std::string& filePath, size_t budget = PagedQuadStack::DEFAULT_BUDGET);
+
+	/**
+	Tile that holds the cell (x, y) of the terrain
+	*/
+	ivec2 getTileOf(int x, int y) const { return ivec2(x >> _tileShift, y >> _tileShift); }
+
+	iaabb2 getTileRegion(ivec2 tile) { return getTile(tile)._region; }
+
+	/**
+	QuadStack of the tile, null if it is not built or was loaded from a file
+	*/
+	QuadStack* getQuadStack(ivec2 tile) { return getTile(tile)._quadStack.get(); }
+
+	PagedQuadStack* getPagedQuadStack(ivec2 tile) { return getTile(tile)._paged.get(); }
+
+	ivec2 getNumberOfTiles() const { return _nTiles; }
+
+	int getTileSize() const { return _tileSize; }
+
+	ivec2 getDimension() const override { return _terrain->getDimension(); }
+
+	float getMinHeight() const override { return _terrain->getMinHeight(); }
+
+	float getMaxHeight() const override { return _terrain->getMaxHeight(); }
+
+	~QuadStackForest() {}
+};
+
+#endif
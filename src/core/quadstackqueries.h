@@ -0,0 +1,52 @@
+/**
+*	Abstract class with the queries answered by a QuadStack, whether the tree is held in
+*	memory, read from a file as a PagedQuadStack or split in tiles by a QuadStackForest.
+*	Callers written against it run unchanged on any of them. Classes implementing it are
+*	final, so calls on the classes themselves are not dispatched.
+*
+*	@class QuadStackQueries
+*/
+
+#ifndef QUAD_STACK_QUERIES_H
+#define QUAD_STACK_QUERIES_H
+
+#include "core/aabb.h"
+#include "core/stack.h"
+
+#include <vector>
+
+class QuadStackQueries {
+
+public:
+
+	/**
+	Intervals of a column from the bottom, in the same form as a stack of the SBR
+	*/
+	using Column = std::vector<::Interval<int>>;
+
+	/**
+	Material at height in the cell (x, y), with fatherHeight the top of the terrain
+	*/
+	virtual int sample(int x, int y, float height, float fatherHeight) = 0;
+
+	/**
+	Fills column with the intervals at (x, y) up to fatherHeight
+	*/
+	virtual void getColumn(int x, int y, float fatherHeight, Column& column) = 0;
+
+	/**
+	Fills columns with the intervals between the heights low and high of every cell of
+	region, in row-major order of the region
+	*/
+	virtual void getColumns(iaabb2 region, float low, float high, std::vector<Column>& columns) = 0;
+
+	virtual ivec2 getDimension() const = 0;
+
+	virtual float getMinHeight() const = 0;
+
+	virtual float getMaxHeight() const = 0;
+
+	virtual ~QuadStackQueries() {}
+};
+
+#endif
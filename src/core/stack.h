@@ -8,6 +8,8 @@
 #ifndef STACK_H
 #define STACK_H
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 using std::vector;
@@ -279,12 +281,12 @@ Stack<T> Stack<T>::compare(const Stack<T>& other, float& similarity, float error
 	Stack<T> representative;
 	similarity = 0;
 	auto& myIntervals = getIntervals();
-	auto& otherIntervals = other.getIntervals();
+	auto& otherIntervals = const_cast<Stack<T>&>(other).getIntervals();
 
 	if (myIntervals.size() != otherIntervals.size())
 		return Stack<T>();
 
-	for (auto& interval : intervals) {
+	for (size_t i = 0; i < myIntervals.size(); ++i) {
 		auto myInterval = myIntervals[i];
 		auto otherInterval = otherIntervals[i];
 
@@ -311,7 +313,7 @@ Stack<T> Stack<T>::compare(const Stack<T>& other, float& similarity, float error
 			representative.addInterval(myInterval._attribute, averageHeight);
 
 
-			similarity += max(abs(myRelativeHeight - otherRelativeHeight) - error, 0.0f);
+			similarity += std::max(std::abs(myRelativeHeight - otherRelativeHeight) - error, 0.0f);
 		} else {
 			similarity = 0;
 			return Stack<T>();
@@ -319,7 +321,7 @@ Stack<T> Stack<T>::compare(const Stack<T>& other, float& similarity, float error
 	}
 
 	float halfTotalHeight = (totalHeight() + other.totalHeight()) / 2;
-	float norm = min(similarity / halfTotalHeight, 1.0f);
+	float norm = std::min(similarity / halfTotalHeight, 1.0f);
 
 	similarity = 1.0 - norm;
 
@@ -355,7 +357,7 @@ bool Stack<T>::operator==(const Stack<T>& other) const {
 	if (size1 != size2)	return false;
 
 	for (int i = 0; i < size1; ++i) {
-		auto& interval1 = stack[i];
+		auto& interval1 = _stack[i];
 		auto& interval2 = other._stack[i];
 
 		if (interval1._accumulatedHeight != interval2._accumulatedHeight ||
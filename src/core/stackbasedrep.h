@@ -14,6 +14,7 @@
 #ifndef STACK_BASED_REP_H
 #define STACK_BASED_REP_H
 
+#include "core/parallel.h"
 #include "core/stack.h"
 #include "core/voxelmodel.h"
  
@@ -101,6 +102,8 @@ class StackBasedRep {
 
 		ivec2 getDimension() const { return _dimension; }
 
+		vec2 getSpacing() const { return _spacing; }
+
 		Stack<T>& getStack(unsigned int col, unsigned int row);
 
 		unsigned getMaxStack();
@@ -109,20 +112,24 @@ class StackBasedRep {
 
 		void setMaxHeight(float maxHeigh) { _maxHeight = maxHeigh; }
 
-		void setNonEmptyMaxHeight(float nonEmptyMaxHeigh) { _nonEmptyMaxHeight = nonEmptyMaxHeigh; }
-
-		void setOriginX(float originX) { _origin._x = originX; };
+		void setOriginX(float originX) { _origin.x = originX; };
 
-		void setOriginY(float originY) { _origin._y = originY; };
+		void setOriginY(float originY) { _origin.y = originY; };
 
-		void setResolution(float resolution) { _spacingX = _spacingY = resolution; };
+		void setResolution(float resolution) { _spacing.x = _spacing.y = resolution; };
 
 		void setAttributeName(std::string name) { _attributeName = name; }
 
-		void setMaterial(T &material) { _materials.insert(material); }
+		void setHeightResolution(float heightResolution) { _heightResolution = heightResolution; }
 
 		// @}
 
+		/**
+		Stacks a z slice of voxels on top of every stack. The slice is indexed as the
+		slices of the voxel model constructor, and zValue is its index above minHeight
+		*/
+		void addSlice(const T *slice, unsigned zValue);
+
 		/**
 		Begin to iterate
 		*/
@@ -140,11 +147,16 @@ class StackBasedRep {
 		*/
 		Stack<T> copy(unsigned int col, unsigned int row);
 
+		/**
+		Destructor
+		*/
+		~StackBasedRep();
+
 		/**
 		Overloading of the << operator. Prints the data structure state
 		*/
-		template<class T> // Needed for a friend method
-		friend std::ostream& operator<<(std::ostream& os, StackBasedRep<T> &sbr);
+		template<class U> // Needed for a friend method
+		friend std::ostream& operator<<(std::ostream& os, StackBasedRep<U> &sbr);
 		
 };
 
@@ -230,11 +242,14 @@ _stacks(new Stack<T>[vm.getDimensionX() * vm.getDimensionY()]) {
 
 template<class T>
 StackBasedRep<T>& StackBasedRep<T>::operator=(StackBasedRep<T>&& other) {
+	if (this == &other)
+		return *this;
+
 	delete[] _stacks;
 
-	_stacks = std::move(other._stacks);
+	_stacks = other._stacks;
+	other._stacks = nullptr;
 	_origin = other._origin;
-	_spacing.x = other._spacing.y;
 	_spacing = other._spacing;
 	_dimension = other._dimension;
 	_minHeight = other._minHeight;
@@ -263,6 +278,21 @@ Stack<T>& StackBasedRep<T>::getStack(unsigned int col, unsigned int row) {
 	return const_cast<Stack<T>&>(static_cast<const StackBasedRep&>(*this).getStack(col, row));
 }
 
+template<class T>
+StackBasedRep<T>::~StackBasedRep() {
+	delete[] _stacks;
+}
+
+template<class T>
+void StackBasedRep<T>::addSlice(const T *slice, unsigned zValue) {
+	float currentHeight = (zValue + 1) * _heightResolution + _minHeight;
+
+	parallel::forRange(0, _dimension.x, [&](size_t xValue) {
+		for (auto yValue = 0; yValue < _dimension.y; ++yValue)
+			getStack(xValue, yValue).addInterval(slice[yValue + _dimension.y * xValue], currentHeight);
+	}, 64);
+}
+
 template<class T>
 double StackBasedRep<T>::memorySize() const {
 	double accumulatedSize = 0;
@@ -294,56 +324,41 @@ unsigned StackBasedRep<T>::getMaxStack() {
 
 template<class T>
 std::ostream& operator<<(std::ostream& os, StackBasedRep<T> &sbr) {
-	std::string outpuString = "";
-
-	outpuString += "Origin ";
-	outpuString += std::to_string(sbr._origin.x);
-	outpuString += " ";
-	outpuString += std::to_string(sbr._origin.y);
-	outpuString += "\n";
-
-	outpuString += "Dimension ";
-	outpuString += std::to_string(sbr._dimension.x);
-	outpuString += " ";
-	outpuString += std::to_string(sbr._dimension.y);
-	outpuString += "\n";
-
-	outpuString += "Spacing ";
-	outpuString += std::to_string(sbr._spacing.x);
-	outpuString += " ";
-	outpuString += std::to_string(sbr._spacing.y);
-	outpuString += "\n";
-
-	outpuString += "Height ";
-	outpuString += std::to_string(sbr._minHeight);
-	outpuString += " ";
-	outpuString += std::to_string(sbr._maxHeight);
-	outpuString += "\n";
-
-	for (auto yIndex = 0; yIndex < sbr._dimension.y; ++yIndex) {
-		for (auto xIndex = 0; xIndex < sbr._dimension.x; ++xIndex) {
-			auto& stack = sbr.getStack(xIndex, yIndex);
-			auto& intervals = stack.getIntervals();
-
-			if (intervals.size() == 0) {
-				outpuString += std::to_string(Stack<T>::UNKNOWN_VALUE);
-				outpuString += "|";
-				outpuString += std::to_string(sbr._maxHeight);
-				outpuString += "$";
-			}
-			for (const Interval<T> &interval : intervals) {
-				outpuString += std::to_string(interval._attribute);
-				outpuString += "|";
-				outpuString += std::to_string(interval._accumulatedHeight);
-				outpuString += "$";
-			}
-			//outpuString += ";";
-			outpuString += "\n";
+	os << "Origin " << std::to_string(sbr._origin.x) << " " << std::to_string(sbr._origin.y) << "\n";
+	os << "Dimension " << std::to_string(sbr._dimension.x) << " " << std::to_string(sbr._dimension.y) << "\n";
+	os << "Spacing " << std::to_string(sbr._spacing.x) << " " << std::to_string(sbr._spacing.y) << "\n";
+	os << "Height " << std::to_string(sbr._minHeight) << " " << std::to_string(sbr._maxHeight) << "\n";
+
+	// Stacks are streamed line by line. The last line is printed without its final "$\n"
+	std::string line;
+	auto nStacks = sbr._dimension.x * sbr._dimension.y;
+
+	for (auto index = 0; index < nStacks; ++index) {
+		auto& intervals = sbr._stacks[index].getIntervals();
+		line.clear();
+
+		if (intervals.size() == 0) {
+			line += std::to_string(Stack<T>::UNKNOWN_VALUE);
+			line += "|";
+			line += std::to_string(sbr._maxHeight);
+			line += "$";
 		}
-	}
+		for (const Interval<T> &interval : intervals) {
+			line += std::to_string(interval._attribute);
+			line += "|";
+			line += std::to_string(interval._accumulatedHeight);
+			line += "$";
+		}
+		//line += ";";
+		line += "\n";
+
+		if (index == nStacks - 1)
+			line.resize(line.size() - 2);
 
+		os << line;
+	}
 
-	return os << outpuString.substr(0, outpuString.size() - 2);
+	return os;
 }
 
 using IntSBR = StackBasedRep<int>;
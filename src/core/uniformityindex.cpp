@@ -0,0 +1,59 @@
+#include "uniformityindex.h"
+#include "core/materialsequencetable.h"
+
+UniformityIndex::UniformityIndex(ShortSBR& terrain) :
+	UniformityIndex(MaterialSequenceTable<short>().intern(terrain), terrain.getDimension()) {
+}
+
+UniformityIndex::UniformityIndex(const std::vector<uint32_t>& sequences, ivec2 dimension) :
+	_dimension(dimension) {
+
+	_entries.push_back(Entry());
+	build(getRoot(), iaabb2(ivec2(0, 0), dimension), sequences);
+	_entries.shrink_to_fit();
+}
+
+iaabb2 UniformityIndex::getChildBox(const iaabb2& region, int child) {
+	int halfX = (region.max.x + region.min.x) / 2;
+	int halfY = (region.max.y + region.min.y) / 2;
+
+	switch (child) {
+	case 0: return iaabb2(ivec2(region.min.x, halfY), ivec2(halfX, region.max.y));
+	case 1: return iaabb2(ivec2(halfX, halfY), region.max);
+	case 2: return iaabb2(region.min, ivec2(halfX, halfY));
+	default: return iaabb2(ivec2(halfX, region.min.y), ivec2(region.max.x, halfY));
+	}
+}
+
+void UniformityIndex::build(uint32_t entry, const iaabb2& region, const std::vector<uint32_t>& sequences) {
+	ivec2 size = region.max - region.min;
+	if (size.x <= 0 || size.y <= 0) {
+		_entries[entry] = Entry{ EMPTY, NONE };
+		return;
+	}
+
+	if (size.x == 1 && size.y == 1) {
+		_entries[entry] = Entry{ sequences[region.min.x + region.min.y * static_cast<size_t>(_dimension.x)], NONE };
+		return;
+	}
+
+	uint32_t children = static_cast<uint32_t>(_entries.size());
+	_entries.resize(children + 4);
+	for (int child = 0; child < 4; ++child)
+		build(children + child, getChildBox(region, child), sequences);
+
+	uint32_t sequence = EMPTY;
+	for (int child = 0; child < 4 && sequence != MIXED; ++child) {
+		uint32_t childSequence = _entries[children + child]._sequence;
+		if (childSequence != EMPTY)
+			sequence = sequence == EMPTY || sequence == childSequence ? childSequence : MIXED;
+	}
+
+	// The tree stops at uniform regions, so their children are dropped
+	if (sequence == MIXED)
+		_entries[entry] = Entry{ MIXED, children };
+	else {
+		_entries.resize(children);
+		_entries[entry] = Entry{ sequence, NONE };
+	}
+}
@@ -0,0 +1,93 @@
+/**
+*	Quad pyramid of the material sequences of a stack-based representation, built over the
+*	same regions QuadStack::Node::subdivide cuts the terrain into. Every region keeps the id
+*	the MaterialSequenceTable gave to the materials of its columns, if all of them share it,
+*	or is marked as mixed. A node is then known to be uniform without comparing its columns,
+*	which the top-down phase did again at every level.
+*
+*	Regions are only subdivided in the pyramid while they are mixed, since the tree stops
+*	there too, so it takes about as many entries as the nodes of the QuadStack.
+*
+*	@class UniformityIndex
+*/
+
+#ifndef UNIFORMITY_INDEX_H
+#define UNIFORMITY_INDEX_H
+
+#include "core/aabb.h"
+#include "core/stackbasedrep.h"
+
+#include <cstdint>
+#include <vector>
+
+class UniformityIndex {
+
+public:
+
+	static const uint32_t NONE = 0xFFFFFFFF; /*< Entry of the regions below a leaf of the pyramid */
+
+private:
+
+	static const uint32_t MIXED = 0xFFFFFFFF; /*< Sequence of the regions whose columns differ */
+
+	static const uint32_t EMPTY = 0xFFFFFFFE; /*< Sequence of the regions without columns, which match any other */
+
+	struct Entry {
+		uint32_t _sequence; /*< Materials of the columns, MIXED or EMPTY */
+		uint32_t _children; /*< First of the four children, NONE unless the region is mixed */
+	};
+
+	ivec2 _dimension;
+
+	std::vector<Entry> _entries; /*< The whole terrain first, children are consecutive */
+
+	/**
+	Fills the entry of region and, if it is mixed, the entries of its children
+	*/
+	void build(uint32_t entry, const iaabb2& region, const std::vector<uint32_t>& sequences);
+
+public:
+
+	/**
+	Index of terrain, whose columns are interned first
+	*/
+	explicit UniformityIndex(ShortSBR& terrain);
+
+	/**
+	Index of a terrain of dimension whose columns have the ids of sequences, in row-major
+	order, as InternedSBR::getSequences gives them
+	*/
+	UniformityIndex(const std::vector<uint32_t>& sequences, ivec2 dimension);
+
+	/**
+	Bounding box of the child of region, in the order NW, NE, SW, SE of QuadStack::Node
+	*/
+	static iaabb2 getChildBox(const iaabb2& region, int child);
+
+	/**
+	Entry of the whole terrain
+	*/
+	uint32_t getRoot() const { return 0; }
+
+	/**
+	Entry of a child of entry, NONE if entry is NONE or its columns share their materials
+	*/
+	uint32_t getChild(uint32_t entry, int child) const { return entry == NONE || _entries[entry]._children == NONE ? NONE : _entries[entry]._children + child; }
+
+	/**
+	Tells if the columns of the region of entry have the same materials. Regions without
+	columns are uniform
+	*/
+	bool isUniform(uint32_t entry) const { return entry != NONE && _entries[entry]._sequence != MIXED; }
+
+	/**
+	Tells if the columns of the region of entry differ in their materials
+	*/
+	bool isMixed(uint32_t entry) const { return entry != NONE && _entries[entry]._sequence == MIXED; }
+
+	size_t getNumberOfEntries() const { return _entries.size(); }
+
+	double memorySize() const { return static_cast<double>(_entries.capacity() * sizeof(Entry)); }
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef VOXEL_MODEL_H
 #define VOXEL_MODEL_H
 
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <glm/glm.hpp>
@@ -119,6 +120,8 @@ public:
 
 	const T* getData() const { return _data; }
 
+	T* getBuffer() { return _data; }
+
 	T getData(unsigned int x, unsigned int y, unsigned int z) const { return _data[index1D(x, y, z, _dimension.x, _dimension.y, _dimension.z)]; }
 
 	int getNData() const { return _nData; }
@@ -149,9 +152,7 @@ VoxelModel<T>::VoxelModel()
 
 template<class T>
 VoxelModel<T>::VoxelModel(VoxelModel<T>&& vm)
-	: _dimension.x(vm._dimension.x),
-	_dimension.y(vm._dimension.y),
-	_dimension.z(vm._dimension.z),
+	: _dimension(vm._dimension),
 	_spacing(vm._spacing),
 	_origin(vm._origin),
 	_attributeName(move(vm._attributeName)),
@@ -163,9 +164,7 @@ VoxelModel<T>::VoxelModel(VoxelModel<T>&& vm)
 
 template<class T>
 VoxelModel<T>::VoxelModel(const VoxelModel<T>& vm)
-	: _dimension.x(vm._dimension.x),
-	_dimension.y(vm._dimension.y),
-	_dimension.z(vm._dimension.z),
+	: _dimension(vm._dimension),
 	_spacing(vm._spacing),
 	_origin(vm._origin),
 	_attributeName(vm._attributeName),
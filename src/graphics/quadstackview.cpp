@@ -123,7 +123,7 @@ ivec4 QuadStackView::init() {
 	vector<uvec3> treeNodes;
 	vector<vec4> nodeBounds;
 	vector<ivec3> lutData;
-	map<int, ivec2> hfMetadata; // pointer, index
+	map<const HeightField*, ivec2> hfMetadata; // slice, level
 
 	unsigned intervalsIndex = 0;
 	unsigned hfIndex = 0;
@@ -139,7 +139,7 @@ ivec4 QuadStackView::init() {
 	auto actualMinHeight = vec2(_quadstack->getMinHeight(), _quadstack->getMinHeight());
 
 	// root insertion
-	QuadStack::Iterator it = _quadstack->iterator();
+	QuadStack::Traversal nodes = _quadstack->traversal();
 	uvec3 root;
 	unsigned nodesSize = 0;
 	map<int, std::pair<int, float>> filtering;
@@ -148,7 +148,10 @@ ivec4 QuadStackView::init() {
 
 	vector<int> hfDataMin, hfDataMax;
 	vector<ivec2> hfPointers(levels);
-	vector<ivec2> mmPointers;
+	vector<ivec4> mmPointers; // max and min headers, offset added to the bases as float bits
+
+	// First slice packed for every encoding and level, along with the offset of its heightfield
+	map<std::pair<const void*, unsigned>, std::pair<int, float>> encodingSlices;
 
 	int hfPointer = 0;
 	float resolution = _quadstack->getHeightResolution();
@@ -173,8 +176,7 @@ ivec4 QuadStackView::init() {
 	auto start = std::chrono::system_clock::now();
 	int intervalCount = 0;
 
-	do {
-		auto node = it.data();
+	for (auto *node : nodes) {
 		uvec3 treeNode{ 0, 0, 0 };
 
 		auto stack = node->getGStack();
@@ -195,13 +197,36 @@ ivec4 QuadStackView::init() {
 			if (interval.isOwner() && !node->noCompression()) {
 				currentLevel = node->getLevel();
 
-				gpuSizeRawHf1 += interval.getHeightField()->memorySize();
+				// Heightfields sharing their encoding on the CPU share the slices of the first one
+				auto *cpuCompressor = interval.getHeightField()->getCompressor();
+				auto encodingSlice = cpuCompressor ? encodingSlices.find(std::make_pair(cpuCompressor->getEncodingIdentifier(), currentLevel)) : encodingSlices.end();
+				if (encodingSlice != encodingSlices.end()) {
+					int realNRow = ceil(hfRows / pow(2.0, currentLevel));
+					int realNCol = ceil(hfCols / pow(2.0, currentLevel));
+					int mipmapLevels = std::floor(std::log2(std::max(realNRow, realNCol))) + 1;
+					float offset = cpuCompressor->getBaseOffset() - encodingSlice->second.second;
+
+					for (int i = 0; i < mipmapLevels; ++i) {
+						ivec4 pointers = mmPointers[encodingSlice->second.first + i];
+						pointers.z = glm::floatBitsToInt(glm::intBitsToFloat(pointers.z) + offset);
+						mmPointers.push_back(pointers);
+					}
 
-				HeightMipmap maxMipmap(interval.getHeightField(), MipmapMode::MAX);
-				HeightMipmap minMipmap(interval.getHeightField(), MipmapMode::MIN);
+					index = hfPointer;
+					hfPointer += mipmapLevels;
+					levelIndex = currentLevel;
+					hfMetadata[interval.getHeightField()] = ivec2(index, currentLevel);
 
-				maxMipmap.computeMipmap();
-				minMipmap.computeMipmap();
+					gpuSizeQs1 += sizeof(short) / 2 + sizeof (int) + 4 / 8;
+					lutData.push_back(ivec3{ interval.getMaterial(), index, levelIndex });
+					continue;
+				}
+
+				gpuSizeRawHf1 += interval.getHeightField()->memorySize();
+
+				// The quadstack builds the mipmaps once and keeps them for its level of detail queries
+				HeightMipmap *maxMipmap = _quadstack->getMipmap(interval.getHeightField(), MipmapMode::MAX);
+				HeightMipmap *minMipmap = _quadstack->getMipmap(interval.getHeightField(), MipmapMode::MIN);
 
 				// Heightfield insertion
 				int nRow = interval.getDimensionX();
@@ -231,8 +256,8 @@ ivec4 QuadStackView::init() {
 					int blockRows = row / blockMipmapX;
 					int blockCols = col / blockMipmapY;
 
-					auto hfMin = minMipmap.getHeightField(mipIndex);
-					auto hfMax = maxMipmap.getHeightField(mipIndex);
+					auto hfMin = minMipmap->getHeightField(mipIndex);
+					auto hfMax = maxMipmap->getHeightField(mipIndex);
 					HeightFieldCompressor compressorMin(hfMin, blockMipmapY, blockMipmapX, resolution);
 					HeightFieldCompressor compressorMax(hfMax, blockMipmapY, blockMipmapX, resolution);
 					compressorMin.compress();
@@ -307,14 +332,17 @@ ivec4 QuadStackView::init() {
 				index = hfPointer;
 
 				for (int i = 0; i < mipmapLevels; ++i)
-					mmPointers.push_back(hfPointers[i] / 4);
+					mmPointers.push_back(ivec4(hfPointers[i] / 4, 0, 0));
+
+				if (cpuCompressor)
+					encodingSlices[std::make_pair(cpuCompressor->getEncodingIdentifier(), currentLevel)] = std::make_pair(slice, cpuCompressor->getBaseOffset());
 
 				hfPointer += mipmapLevels;
 
 				levelIndex = currentLevel;
-				hfMetadata[interval.getHfIndex()] = ivec2(slice, currentLevel);
+				hfMetadata[interval.getHeightField()] = ivec2(slice, currentLevel);
 			} else {
-				ivec2 indices = hfMetadata[interval.getHfIndex()];
+				ivec2 indices = hfMetadata[interval.getHeightField()];
 				index = indices.x;
 				levelIndex = indices.y;
 
@@ -332,8 +360,7 @@ ivec4 QuadStackView::init() {
 		gpuSizeQs1 += 6 / 8 + sizeof(int)* 2;
 		treeNodes.push_back(treeNode);
 		nodesSize++;
-		
-	} while (it.next());
+	}
 
 	GLsizeiptr bufferSize;
 
@@ -391,7 +418,7 @@ ivec4 QuadStackView::init() {
 	_gl->glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 	_gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	bufferSize = sizeof(ivec2)* mmPointers.size();
+	bufferSize = sizeof(ivec4)* mmPointers.size();
 	_gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointersSSBO);
 	_gl->glBufferData(GL_SHADER_STORAGE_BUFFER, bufferSize, mmPointers.data(), GL_STATIC_DRAW);
 	_gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, pointersSSBO);
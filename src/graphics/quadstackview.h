@@ -10,10 +10,10 @@
 #ifndef QUADSTACK_COMP_VIEW_H
 #define QUADSTACK_COMP_VIEW_H
 
-#include "core\quadstack.h"
-#include "graphics\renderable.h"
+#include "core/quadstack.h"
+#include "graphics/renderable.h"
 
-#include <glm\glm.hpp>
+#include <glm/glm.hpp>
 #include <vector>
 
 using std::vector;
@@ -11,7 +11,7 @@
 #include "glaccessible.h"
 #include "shaderprogram.h"
 
-#include <glm\glm.hpp>
+#include <glm/glm.hpp>
 #include <memory>
 #include <vector>
 
@@ -30,8 +30,9 @@ layout ( binding=4 ) buffer treeSSBO {
 	uvec4 nodes[];
 };
 
+// Max and min headers of every mipmap, then the offset of shared encodings as float bits
 layout ( binding=5 ) buffer mipmapSSBO {
-	ivec2 mmPointers[];
+	ivec4 mmPointers[];
 };
 
 // Vertex shader inputs
@@ -289,6 +290,36 @@ ivec2 decomputeMortonCode(int index) {
 	return ivec2(unSpreadBits(index), unSpreadBits(index >> 1));
 }
 
+int nextPowerOf2(int value) {
+	return value <= 1 ? 1 : 1 << (findMSB(value - 1) + 1);
+}
+
+int cellsInside(ivec2 origin, int size, ivec2 dimension) {
+	ivec2 cells = max(min(origin + size, dimension) - origin, ivec2(0));
+	return cells.x * cells.y;
+}
+
+// Index of pos along the Morton curve of a rectangle, skipping the cells outside it (see MortonCurve)
+int computeCurveIndex(ivec2 pos, ivec2 dimension) {
+	int side = nextPowerOf2(max(dimension.x, dimension.y));
+	ivec2 origin = ivec2(0);
+	int index = 0;
+
+	while (side > 1 && (origin.x + side > dimension.x || origin.y + side > dimension.y)) {
+		int halfSide = side >> 1;
+		ivec2 quadrant = ivec2(greaterThanEqual(pos, origin + halfSide));
+		int quadrantIndex = quadrant.x | (quadrant.y << 1);
+
+		for (int previous = 0; previous < quadrantIndex; ++previous)
+			index += cellsInside(origin + halfSide * ivec2(previous & 1, previous >> 1), halfSide, dimension);
+
+		origin += quadrant * halfSide;
+		side = halfSide;
+	}
+
+	return index + computeMortonCode(pos - origin);
+}
+
 int extractBits(int value, int firstBit, int nBits) {
 	return (((1 << nBits) - 1) & (value >>firstBit));
 }
@@ -309,15 +340,14 @@ int getValue(ivec4 vector, int index) {
 float evaluateInterval(int pointer, ivec2 coords, ivec2 minCoords, ivec2 dimension, int mipmap, int mipValue) {
 	vec2 nodeCoords = vec2(coords - minCoords) / vec2(dimension);
 	ivec2 mipmapDim = dimension;
-	ivec2 mipmapBlock;
+	ivec2 mipmapBlock = blockDim;
 	if (blockDim.x == 0 || blockDim.y == 0)
 		return -1;
-	mipmapBlock.x = min(mipmapDim.x, blockDim.x);
-	mipmapBlock.y = min(mipmapDim.y, blockDim.y);
 	
-	// Optimize this loop
-	for (int i=0; i < mipmap; ++i) {
-		mipmapDim = ivec2(max(mipmapDim.x >> 1, 1), max(mipmapDim.y >> 1, 1));
+	// Block sizes as chosen by the packer, halved while they exceed the mipmap level
+	for (int i=0; i <= mipmap; ++i) {
+		if (i > 0)
+			mipmapDim = ivec2(max(mipmapDim.x >> 1, 1), max(mipmapDim.y >> 1, 1));
 
 		if (mipmapBlock.x > mipmapDim.x)
 			mipmapBlock.x = max(mipmapBlock.x >> 1, 1);
@@ -326,6 +356,9 @@ float evaluateInterval(int pointer, ivec2 coords, ivec2 minCoords, ivec2 dimensi
 			mipmapBlock.y = max(mipmapBlock.y >> 1, 1);
 	}
 
+	// and clipped to the heightfield by the compressor
+	mipmapBlock = min(mipmapBlock, mipmapDim);
+
 	if (mipmapDim.x <= 1 || mipmapDim.y <= 1) {
 		mipmapBlock = ivec2(1, 1);
 		
@@ -333,21 +366,23 @@ float evaluateInterval(int pointer, ivec2 coords, ivec2 minCoords, ivec2 dimensi
 
 	ivec2 mipCoords = ivec2(floor(nodeCoords * vec2(mipmapDim)));
 	
-	int blockRows = mipmapDim.x / mipmapBlock.x;
-	int blockCols = mipmapDim.y / mipmapBlock.y;
+	// Blocks follow the curve of the block grid, whose last row and column may be partial
+	ivec2 blockGrid = (mipmapDim + mipmapBlock - 1) / mipmapBlock;
+	ivec2 blockCoords = mipCoords / mipmapBlock;
+	ivec2 blockMin = blockCoords * mipmapBlock;
 
-	int index = computeMortonCode(mipCoords);
-	int blockIndex = computeMortonCode(ivec2(mipCoords.x / mipmapBlock.x, mipCoords.y / mipmapBlock.y));
-	int dataIndex = blockRows * blockCols;
+	int blockIndex = computeCurveIndex(blockCoords, blockGrid);
+	int dataIndex = blockGrid.x * blockGrid.y;
 
-	int hfPointer = mmPointers[pointer + mipmap][mipValue];
+	ivec4 mmPointer = mmPointers[pointer + mipmap];
+	int hfPointer = mmPointer[mipValue];
 	ivec4 header;
 	if (mipValue == MAX) 
 		header = heightsMax[hfPointer + blockIndex];
 	else
 		header = heightsMin[hfPointer + blockIndex];
 
-	int base = header.x;
+	float base = header.x + intBitsToFloat(mmPointer.z);
 	int bits = header.y;
 	int pointers = header.z;
 
@@ -357,7 +392,7 @@ float evaluateInterval(int pointer, ivec2 coords, ivec2 minCoords, ivec2 dimensi
 	if (bits == 0)
 		return worldBase;
 
-	int valueInBlock = index % (mipmapBlock.x * mipmapBlock.y);
+	int valueInBlock = computeCurveIndex(mipCoords - blockMin, min(mipmapBlock, mipmapDim - blockMin));
 	int startBit = pointers + valueInBlock * bits;
 	int endBit = startBit + bits;
 	float sampled;
@@ -0,0 +1,236 @@
+/**
+*	Layout of the binary container of stack-based representations, shared by
+*	BinarySBRReader and BinarySBRWriter. Every field is stored little-endian.
+*
+*	File layout:
+*		Header			magic "QSBR", version, flags, origin, spacing, dimension, height range,
+*						height resolution, field sizes, block size, index offset, attribute name
+*		Blocks			the grid is split in blockSize x blockSize tiles of stacks, stored
+*						row by row. A tile holds the interval count of its stacks, then the
+*						attributes of all its intervals and then their heights. Stacks of a
+*						tile are ordered row by row, as in StackBasedRep
+*		Block index		offset of every block plus the offset where the last block ends
+*
+*	Heights are floats or, if QUANTIZED_HEIGHTS is set, the number of height resolution
+*	steps above the minimum height.
+*/
+
+#ifndef BINARY_SBR_FORMAT_H
+#define BINARY_SBR_FORMAT_H
+
+#include "io/byteswap.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace io {
+
+	namespace binarysbr {
+
+		const char MAGIC[4] = { 'Q', 'S', 'B', 'R' };
+
+		const uint32_t VERSION = 1;
+
+		const uint32_t QUANTIZED_HEIGHTS = 1; /** < Flag: heights stored as resolution steps */
+
+		struct Header {
+			uint32_t version;
+			uint32_t flags;
+			glm::vec2 origin;
+			glm::vec2 spacing;
+			glm::ivec2 dimension;
+			float minHeight, maxHeight;
+			float heightResolution;
+			uint32_t attributeBytes; /** < Size of a stored attribute, 1, 2 or 4 */
+			uint32_t countBytes; /** < Size of a stored interval count, 2 or 4 */
+			uint32_t heightBytes; /** < Size of a stored height, 2 or 4 */
+			uint32_t blockSize; /** < Stacks per side of a block */
+			uint64_t indexOffset; /** < Position of the block index */
+			std::string attributeName;
+
+			int getBlocksX() const { return (dimension.x + blockSize - 1) / blockSize; }
+
+			int getBlocksY() const { return (dimension.y + blockSize - 1) / blockSize; }
+
+			size_t getNBlocks() const { return static_cast<size_t>(getBlocksX()) * getBlocksY(); }
+
+			bool isQuantized() const { return (flags & QUANTIZED_HEIGHTS) != 0; }
+		};
+
+		/**
+		Appends little-endian values to a byte buffer
+		*/
+		class BufferWriter {
+
+			std::vector<char>& _buffer;
+
+			bool _swap;
+
+		public:
+
+			BufferWriter(std::vector<char>& buffer) : _buffer(buffer), _swap(!hostIsLittleEndian()) {}
+
+			template<class V>
+			void put(V value) {
+				size_t position = _buffer.size();
+				_buffer.resize(position + sizeof(V));
+				storeScalar(&_buffer[position], value, _swap);
+			}
+
+			/**
+			Appends value using its low bytes bytes
+			*/
+			void putSized(int64_t value, uint32_t bytes) {
+				switch (bytes) {
+				case 1: put(static_cast<int8_t>(value)); break;
+				case 2: put(static_cast<int16_t>(value)); break;
+				case 4: put(static_cast<int32_t>(value)); break;
+				default: put(value); break;
+				}
+			}
+
+			void putBytes(const char *data, size_t size) { _buffer.insert(_buffer.end(), data, data + size); }
+		};
+
+		/**
+		Reads little-endian values from a byte range. Throws if the range is exhausted
+		*/
+		class BufferReader {
+
+			const char *_current, *_end;
+
+			bool _swap;
+
+			void require(size_t size) {
+				if (static_cast<size_t>(_end - _current) < size)
+					throw std::runtime_error("Truncated binary SBR data");
+			}
+
+		public:
+
+			BufferReader(const char *begin, const char *end) : _current(begin), _end(end), _swap(!hostIsLittleEndian()) {}
+
+			const char* position() const { return _current; }
+
+			void skip(size_t size) {
+				require(size);
+				_current += size;
+			}
+
+			template<class V>
+			V get() {
+				require(sizeof(V));
+				V value = loadScalar<V>(_current, _swap);
+				_current += sizeof(V);
+				return value;
+			}
+
+			/**
+			Reads a signed value stored in bytes bytes
+			*/
+			int64_t getSized(uint32_t bytes) {
+				switch (bytes) {
+				case 1: return get<int8_t>();
+				case 2: return get<int16_t>();
+				case 4: return get<int32_t>();
+				default: return get<int64_t>();
+				}
+			}
+
+			/**
+			Reads an unsigned value stored in bytes bytes
+			*/
+			uint64_t getUnsigned(uint32_t bytes) {
+				switch (bytes) {
+				case 1: return get<uint8_t>();
+				case 2: return get<uint16_t>();
+				case 4: return get<uint32_t>();
+				default: return get<uint64_t>();
+				}
+			}
+
+			std::string getString(size_t size) {
+				require(size);
+				std::string value(_current, size);
+				_current += size;
+				return value;
+			}
+		};
+
+		/**
+		Position of the index offset field, rewritten once the blocks have been written
+		*/
+		const size_t INDEX_OFFSET_POSITION = 4 + 2 * 4 + 4 * 4 + 2 * 4 + 3 * 4 + 4 * 4;
+
+		inline void writeHeader(std::vector<char>& buffer, const Header& header) {
+			BufferWriter writer(buffer);
+
+			writer.putBytes(MAGIC, 4);
+			writer.put(header.version);
+			writer.put(header.flags);
+			writer.put(header.origin.x);
+			writer.put(header.origin.y);
+			writer.put(header.spacing.x);
+			writer.put(header.spacing.y);
+			writer.put(static_cast<int32_t>(header.dimension.x));
+			writer.put(static_cast<int32_t>(header.dimension.y));
+			writer.put(header.minHeight);
+			writer.put(header.maxHeight);
+			writer.put(header.heightResolution);
+			writer.put(header.attributeBytes);
+			writer.put(header.countBytes);
+			writer.put(header.heightBytes);
+			writer.put(header.blockSize);
+			writer.put(header.indexOffset);
+			writer.put(static_cast<uint32_t>(header.attributeName.size()));
+			writer.putBytes(header.attributeName.data(), header.attributeName.size());
+		}
+
+		/**
+		Parses and validates the header. Throws std::runtime_error if it is not a supported file
+		*/
+		inline Header readHeader(const char *begin, const char *end) {
+			BufferReader reader(begin, end);
+			Header header;
+
+			if (reader.getString(4) != std::string(MAGIC, 4))
+				throw std::runtime_error("Not a binary SBR file");
+
+			header.version = reader.get<uint32_t>();
+			if (header.version != VERSION)
+				throw std::runtime_error("Unsupported binary SBR version " + std::to_string(header.version));
+
+			header.flags = reader.get<uint32_t>();
+			header.origin.x = reader.get<float>();
+			header.origin.y = reader.get<float>();
+			header.spacing.x = reader.get<float>();
+			header.spacing.y = reader.get<float>();
+			header.dimension.x = reader.get<int32_t>();
+			header.dimension.y = reader.get<int32_t>();
+			header.minHeight = reader.get<float>();
+			header.maxHeight = reader.get<float>();
+			header.heightResolution = reader.get<float>();
+			header.attributeBytes = reader.get<uint32_t>();
+			header.countBytes = reader.get<uint32_t>();
+			header.heightBytes = reader.get<uint32_t>();
+			header.blockSize = reader.get<uint32_t>();
+			header.indexOffset = reader.get<uint64_t>();
+			header.attributeName = reader.getString(reader.get<uint32_t>());
+
+			bool validSizes = (header.attributeBytes == 1 || header.attributeBytes == 2 || header.attributeBytes == 4) &&
+				(header.countBytes == 2 || header.countBytes == 4) && (header.heightBytes == 2 || header.heightBytes == 4);
+
+			if (!validSizes || header.blockSize == 0 || header.dimension.x <= 0 || header.dimension.y <= 0)
+				throw std::runtime_error("Malformed binary SBR header");
+
+			return header;
+		}
+
+	}
+
+}
+
+#endif
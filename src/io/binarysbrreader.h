@@ -0,0 +1,191 @@
+/**
+*	Reader of the binary container of stack-based representations described in
+*	binarysbrformat.h. The file is memory mapped and only the blocks overlapping the
+*	requested region are decoded, in parallel, so a sub-rectangle of a large file is
+*	read without scanning it.
+*
+*	@class BinarySBRReader
+*/
+
+#ifndef BINARY_SBR_READER_H
+#define BINARY_SBR_READER_H
+
+#include "core/aabb.h"
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+#include "io/binarysbrformat.h"
+#include "io/mappedfile.h"
+
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace io {
+
+	template<class T>
+	class BinarySBRReader {
+
+		/**
+		Decodes the stacks of block (blockX, blockY) lying inside region into sbr
+		*/
+		static void decodeBlock(const char *begin, const char *end, const binarysbr::Header& header, int blockX, int blockY,
+			const iaabb2& region, StackBasedRep<T>& sbr);
+
+	public:
+
+		/**
+		Constructor
+		*/
+		BinarySBRReader();
+
+		/**
+		Reads the header. Throws std::runtime_error if it is not a supported file
+		*/
+		binarysbr::Header readHeader(const std::string& filePath);
+
+		/**
+		Returns nullptr if the file cannot be read
+		*/
+		StackBasedRep<T>* open(const std::string& filePath);
+
+		/**
+		Reads the stacks of region, in cells with exclusive maximum. The origin of the
+		returned representation is the corner of the region. Returns nullptr if the file
+		cannot be read or the region is empty
+		*/
+		StackBasedRep<T>* open(const std::string& filePath, iaabb2 region);
+
+		/**
+		Destructor
+		*/
+		~BinarySBRReader();
+	};
+
+	template<class T>
+	BinarySBRReader<T>::BinarySBRReader() {
+	}
+
+	template<class T>
+	binarysbr::Header BinarySBRReader<T>::readHeader(const std::string& filePath) {
+		MappedFile file(filePath);
+		return binarysbr::readHeader(file.begin(), file.end());
+	}
+
+	template<class T>
+	StackBasedRep<T>* BinarySBRReader<T>::open(const std::string& filePath) {
+		return open(filePath, iaabb2(ivec2(0), ivec2(std::numeric_limits<int>::max())));
+	}
+
+	template<class T>
+	StackBasedRep<T>* BinarySBRReader<T>::open(const std::string& filePath, iaabb2 region) {
+		StackBasedRep<T> *sbr = nullptr;
+
+		try {
+			MappedFile file(filePath);
+			binarysbr::Header header = binarysbr::readHeader(file.begin(), file.end());
+
+			region.min = ivec2(std::max(region.min.x, 0), std::max(region.min.y, 0));
+			region.max = ivec2(std::min(region.max.x, header.dimension.x), std::min(region.max.y, header.dimension.y));
+			if (region.min.x >= region.max.x || region.min.y >= region.max.y)
+				throw std::runtime_error("Empty region");
+
+			size_t nBlocks = header.getNBlocks();
+			if (header.indexOffset + (nBlocks + 1) * sizeof(uint64_t) > file.size())
+				throw std::runtime_error("Truncated binary SBR block index");
+
+			binarysbr::BufferReader indexReader(file.begin() + header.indexOffset, file.end());
+			std::vector<uint64_t> offsets(nBlocks + 1);
+			for (auto& offset : offsets)
+				offset = indexReader.get<uint64_t>();
+
+			vec2 origin(header.origin.x + region.min.x * header.spacing.x, header.origin.y + region.min.y * header.spacing.y);
+			sbr = new StackBasedRep<T>(header.minHeight, header.maxHeight, header.heightResolution, header.attributeName,
+				origin, header.spacing, region.max - region.min);
+
+			int firstBlockX = region.min.x / header.blockSize, lastBlockX = (region.max.x - 1) / header.blockSize;
+			int firstBlockY = region.min.y / header.blockSize, lastBlockY = (region.max.y - 1) / header.blockSize;
+			int regionBlocksX = lastBlockX - firstBlockX + 1;
+			size_t regionBlocks = static_cast<size_t>(regionBlocksX) * (lastBlockY - firstBlockY + 1);
+
+			parallel::forChunks(regionBlocks, [&](size_t chunk) {
+				int blockX = firstBlockX + static_cast<int>(chunk % regionBlocksX);
+				int blockY = firstBlockY + static_cast<int>(chunk / regionBlocksX);
+				size_t block = blockX + static_cast<size_t>(blockY) * header.getBlocksX();
+
+				if (offsets[block] > offsets[block + 1] || offsets[block + 1] > file.size())
+					throw std::runtime_error("Corrupted binary SBR block index");
+
+				decodeBlock(file.begin() + offsets[block], file.begin() + offsets[block + 1], header, blockX, blockY, region, *sbr);
+			});
+
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file " << e.what() << std::endl;
+			delete sbr;
+			sbr = nullptr;
+		}
+
+		return sbr;
+	}
+
+	template<class T>
+	void BinarySBRReader<T>::decodeBlock(const char *begin, const char *end, const binarysbr::Header& header, int blockX, int blockY,
+		const iaabb2& region, StackBasedRep<T>& sbr) {
+
+		int minX = blockX * header.blockSize, maxX = std::min<int>(minX + header.blockSize, header.dimension.x);
+		int minY = blockY * header.blockSize, maxY = std::min<int>(minY + header.blockSize, header.dimension.y);
+
+		binarysbr::BufferReader reader(begin, end);
+		std::vector<uint32_t> counts((maxX - minX) * (maxY - minY));
+		size_t nIntervals = 0;
+
+		for (auto& count : counts) {
+			count = static_cast<uint32_t>(reader.getUnsigned(header.countBytes));
+			nIntervals += count;
+		}
+
+		if (nIntervals * header.attributeBytes > static_cast<size_t>(end - reader.position()))
+			throw std::runtime_error("Truncated binary SBR block");
+
+		binarysbr::BufferReader attributeReader(reader.position(), end);
+		binarysbr::BufferReader heightReader(reader.position() + nIntervals * header.attributeBytes, end);
+
+		size_t stackIndex = 0;
+		for (int y = minY; y < maxY; ++y) {
+			for (int x = minX; x < maxX; ++x, ++stackIndex) {
+				uint32_t count = counts[stackIndex];
+				bool inside = x >= region.min.x && x < region.max.x && y >= region.min.y && y < region.max.y;
+
+				if (!inside) {
+					attributeReader.skip(count * header.attributeBytes);
+					heightReader.skip(count * header.heightBytes);
+					continue;
+				}
+
+				auto& intervals = sbr.getStack(x - region.min.x, y - region.min.y).getIntervals();
+				intervals.resize(count);
+
+				for (auto& interval : intervals) {
+					interval._attribute = static_cast<T>(attributeReader.getSized(header.attributeBytes));
+
+					if (header.isQuantized())
+						interval._accumulatedHeight = header.minHeight + heightReader.getSized(header.heightBytes) * header.heightResolution;
+					else
+						interval._accumulatedHeight = heightReader.get<float>();
+				}
+			}
+		}
+	}
+
+	template<class T>
+	BinarySBRReader<T>::~BinarySBRReader() {
+	}
+
+}
+
+using IntBinarySBRReader = io::BinarySBRReader<int>;
+using ShortBinarySBRReader = io::BinarySBRReader<short>;
+using ByteBinarySBRReader = io::BinarySBRReader<char>;
+
+#endif
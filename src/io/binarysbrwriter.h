@@ -0,0 +1,177 @@
+/**
+*	Writer of stack-based representations in the binary container described in
+*	binarysbrformat.h. Blocks are encoded in parallel and written in order, followed
+*	by the block index.
+*
+*	@class BinarySBRWriter
+*/
+
+#ifndef BINARY_SBR_WRITER_H
+#define BINARY_SBR_WRITER_H
+
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+#include "io/binarysbrformat.h"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace io {
+
+	template<class T>
+	class BinarySBRWriter {
+
+		bool _quantize; /** < Store heights as height resolution steps */
+
+		unsigned _blockSize; /** < Stacks per side of a block */
+
+		/**
+		Appends the encoding of block (blockX, blockY) to buffer
+		*/
+		void encodeBlock(StackBasedRep<T>& sbr, const binarysbr::Header& header, int blockX, int blockY, std::vector<char>& buffer) const;
+
+	public:
+
+		/**
+		Constructor. Quantized heights are rounded to the height resolution of the representation
+		*/
+		BinarySBRWriter(bool quantize = false, unsigned blockSize = 64);
+
+		/**
+		Returns false if the file cannot be written
+		*/
+		bool write(StackBasedRep<T>& sbr, std::string filePath);
+
+		/**
+		Destructor
+		*/
+		~BinarySBRWriter();
+	};
+
+	template<class T>
+	BinarySBRWriter<T>::BinarySBRWriter(bool quantize, unsigned blockSize) :
+	_quantize(quantize),
+	_blockSize(blockSize > 0 ? blockSize : 64) {
+	}
+
+	template<class T>
+	void BinarySBRWriter<T>::encodeBlock(StackBasedRep<T>& sbr, const binarysbr::Header& header, int blockX, int blockY, std::vector<char>& buffer) const {
+		binarysbr::BufferWriter writer(buffer);
+
+		int minX = blockX * header.blockSize, maxX = std::min<int>(minX + header.blockSize, header.dimension.x);
+		int minY = blockY * header.blockSize, maxY = std::min<int>(minY + header.blockSize, header.dimension.y);
+
+		for (int y = minY; y < maxY; ++y)
+			for (int x = minX; x < maxX; ++x)
+				writer.putSized(sbr.getStack(x, y).getIntervals().size(), header.countBytes);
+
+		for (int y = minY; y < maxY; ++y)
+			for (int x = minX; x < maxX; ++x)
+				for (const Interval<T>& interval : sbr.getStack(x, y).getIntervals())
+					writer.putSized(interval._attribute, header.attributeBytes);
+
+		for (int y = minY; y < maxY; ++y) {
+			for (int x = minX; x < maxX; ++x) {
+				for (const Interval<T>& interval : sbr.getStack(x, y).getIntervals()) {
+					if (header.isQuantized())
+						writer.putSized(std::lround((interval._accumulatedHeight - header.minHeight) / header.heightResolution), header.heightBytes);
+					else
+						writer.put(interval._accumulatedHeight);
+				}
+			}
+		}
+	}
+
+	template<class T>
+	bool BinarySBRWriter<T>::write(StackBasedRep<T>& sbr, std::string filePath) {
+		std::ofstream outputStream(filePath, std::ios::binary);
+		if (!outputStream) {
+			std::cerr << "Cannot open " << filePath << " for writing" << std::endl;
+			return false;
+		}
+
+		binarysbr::Header header;
+		header.version = binarysbr::VERSION;
+		header.flags = 0;
+		header.origin = vec2(sbr.getOriginX(), sbr.getOriginY());
+		header.spacing = sbr.getSpacing();
+		header.dimension = sbr.getDimension();
+		header.minHeight = sbr.getMinHeight();
+		header.maxHeight = sbr.getMaxHeight();
+		header.heightResolution = sbr.getHeightResolution();
+		header.attributeBytes = sizeof(T) > 4 ? 4 : sizeof(T);
+		header.countBytes = sbr.getMaxStack() > UINT16_MAX ? 4 : 2;
+		header.heightBytes = 4;
+		header.blockSize = _blockSize;
+		header.indexOffset = 0;
+		header.attributeName = sbr.getAttributeName();
+
+		// Without a valid resolution the heights cannot be quantized and are kept as floats
+		if (_quantize && header.heightResolution > 0.0f) {
+			float steps = std::ceil((header.maxHeight - header.minHeight) / header.heightResolution);
+			header.flags |= binarysbr::QUANTIZED_HEIGHTS;
+			header.heightBytes = steps > UINT16_MAX / 2 ? 4 : 2;
+		}
+
+		std::vector<char> buffer;
+		binarysbr::writeHeader(buffer, header);
+		outputStream.write(buffer.data(), buffer.size());
+
+		// Blocks are encoded in groups, one buffer per thread, and written in order
+		size_t nBlocks = header.getNBlocks();
+		size_t nBuffers = parallel::getThreads();
+		std::vector<std::vector<char>> buffers(nBuffers);
+		std::vector<uint64_t> offsets(nBlocks + 1);
+		uint64_t offset = buffer.size();
+
+		for (size_t first = 0; first < nBlocks && outputStream; first += nBuffers) {
+			size_t count = std::min(nBuffers, nBlocks - first);
+
+			parallel::forChunks(count, [&](size_t chunk) {
+				size_t block = first + chunk;
+				buffers[chunk].clear();
+				encodeBlock(sbr, header, block % header.getBlocksX(), block / header.getBlocksX(), buffers[chunk]);
+			});
+
+			for (size_t chunk = 0; chunk < count; ++chunk) {
+				offsets[first + chunk] = offset;
+				offset += buffers[chunk].size();
+				outputStream.write(buffers[chunk].data(), buffers[chunk].size());
+			}
+		}
+		offsets[nBlocks] = offset;
+
+		// Block index and, back in the header, its position
+		buffer.clear();
+		binarysbr::BufferWriter writer(buffer);
+		for (uint64_t blockOffset : offsets)
+			writer.put(blockOffset);
+		outputStream.write(buffer.data(), buffer.size());
+
+		buffer.clear();
+		writer.put(offset);
+		outputStream.seekp(binarysbr::INDEX_OFFSET_POSITION);
+		outputStream.write(buffer.data(), buffer.size());
+
+		if (!outputStream) {
+			std::cerr << "Error writing " << filePath << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	template<class T>
+	BinarySBRWriter<T>::~BinarySBRWriter() {
+	}
+
+}
+
+using IntBinarySBRWriter = io::BinarySBRWriter<int>;
+using ShortBinarySBRWriter = io::BinarySBRWriter<short>;
+using ByteBinarySBRWriter = io::BinarySBRWriter<char>;
+
+#endif
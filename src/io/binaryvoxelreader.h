@@ -57,7 +57,7 @@ namespace io {
 
 		char headerBuf[40];
 		Header *header;
-		VoxelModel<T>* vm;
+		VoxelModel<T>* vm = nullptr;
 
 		try {
 
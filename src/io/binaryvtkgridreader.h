@@ -0,0 +1,162 @@
+/**
+*	Reader for legacy binary VTK files with a STRUCTURED_POINTS dataset. Scalars are
+*	stored big-endian and are converted to the attribute type while they are read.
+*
+*	@class BinaryVTKGridReader
+*/
+
+#ifndef BINARY_VTK_GRID_READER_H
+#define BINARY_VTK_GRID_READER_H
+
+#include "io/volumeslicestream.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace io {
+
+	template<class T>
+	class BinaryVTKGridReader {
+
+	public:
+
+		/**
+		Constructor
+		*/
+		BinaryVTKGridReader();
+
+		/**
+		Parses the header. Throws std::runtime_error if it is not a supported file
+		*/
+		RawVolumeLayout readLayout(const std::string& filePath);
+
+		/**
+		Returns nullptr if the file cannot be read
+		*/
+		VoxelModel<T>* open(const std::string& filePath);
+
+		/**
+		Opens the file to be read slice by slice. Returns nullptr if the file cannot be read
+		*/
+		VolumeSliceStream<T>* openSlices(const std::string& filePath);
+
+		/**
+		Default destructor
+		*/
+		~BinaryVTKGridReader();
+	};
+
+	template<class T>
+	BinaryVTKGridReader<T>::BinaryVTKGridReader() {
+	}
+
+	template<class T>
+	RawVolumeLayout BinaryVTKGridReader<T>::readLayout(const std::string& filePath) {
+		std::ifstream inputStream(filePath, std::ios::binary);
+		if (!inputStream)
+			throw std::runtime_error("Cannot open " + filePath);
+
+		std::string line, keyword, typeName;
+
+		std::getline(inputStream, line); // Extract VTK header
+		std::getline(inputStream, line); // Extract name
+		std::getline(inputStream, line); // Extract file type
+		if (line.find("BINARY") == std::string::npos)
+			throw std::runtime_error("Not a binary legacy VTK file");
+
+		std::getline(inputStream, line); // Extract dataset type
+		if (line.find("STRUCTURED_POINTS") == std::string::npos)
+			throw std::runtime_error("Only STRUCTURED_POINTS datasets are supported");
+
+		RawVolumeLayout layout;
+		layout.dimension = ivec3(0);
+		layout.spacing = vec3(1.0f);
+		layout.origin = vec3(0.0f);
+		layout.type = ScalarType::UINT8;
+		layout.swap = hostIsLittleEndian();
+
+		long long nData = -1;
+		bool cellData = true;
+
+		while (inputStream >> keyword) {
+			if (keyword == "DIMENSIONS") {
+				inputStream >> layout.dimension.x >> layout.dimension.y >> layout.dimension.z;
+			} else if (keyword == "SPACING" || keyword == "ASPECT_RATIO") {
+				inputStream >> layout.spacing.x >> layout.spacing.y >> layout.spacing.z;
+			} else if (keyword == "ORIGIN") {
+				inputStream >> layout.origin.x >> layout.origin.y >> layout.origin.z;
+			} else if (keyword == "CELL_DATA" || keyword == "POINT_DATA") {
+				cellData = keyword == "CELL_DATA";
+				inputStream >> nData;
+			} else if (keyword == "SCALARS") {
+				inputStream >> layout.attribute >> typeName;
+				std::getline(inputStream, line); // Extract number of components
+				if (line.find_first_not_of(" \t\r1") != std::string::npos)
+					throw std::runtime_error("Only single component scalars are supported");
+				layout.type = legacyScalarType(typeName);
+			} else if (keyword == "LOOKUP_TABLE") {
+				std::getline(inputStream, line); // Extract table name, the data starts after it
+				break;
+			}
+
+			if (inputStream.fail())
+				throw std::runtime_error("Malformed VTK header near " + keyword);
+		}
+
+		if (!inputStream || typeName.empty())
+			throw std::runtime_error("Missing SCALARS or LOOKUP_TABLE in the VTK header");
+
+		if (cellData)
+			layout.dimension -= ivec3(1);
+
+		if (layout.dimension.x <= 0 || layout.dimension.y <= 0 || layout.dimension.z <= 0)
+			throw std::runtime_error("Missing or empty DIMENSIONS in the VTK header");
+
+		if (nData != static_cast<long long>(layout.dimension.x) * layout.dimension.y * layout.dimension.z)
+			throw std::runtime_error("Number of scalars does not match the dimensions");
+
+		layout.dataOffset = inputStream.tellg();
+
+		return layout;
+	}
+
+	template<class T>
+	VoxelModel<T>* BinaryVTKGridReader<T>::open(const std::string& filePath) {
+		VoxelModel<T>* vm = nullptr;
+
+		try {
+			VolumeSliceStream<T> stream(filePath, readLayout(filePath));
+			vm = stream.readVoxelModel();
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file\n" << e.what() << std::endl;
+		}
+
+		return vm;
+	}
+
+	template<class T>
+	VolumeSliceStream<T>* BinaryVTKGridReader<T>::openSlices(const std::string& filePath) {
+		VolumeSliceStream<T>* stream = nullptr;
+
+		try {
+			stream = new VolumeSliceStream<T>(filePath, readLayout(filePath));
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file\n" << e.what() << std::endl;
+		}
+
+		return stream;
+	}
+
+	template<class T>
+	BinaryVTKGridReader<T>::~BinaryVTKGridReader() {
+	}
+
+}
+
+using IntBinaryVTKReader = io::BinaryVTKGridReader<int>;
+using ShortBinaryVTKReader = io::BinaryVTKGridReader<short>;
+using ByteBinaryVTKReader = io::BinaryVTKGridReader<char>;
+
+#endif
@@ -0,0 +1,83 @@
+/**
+*	Byte order helpers for binary readers. The swap loops are written with plain shifts
+*	and masks so compilers turn them into vector shuffles.
+*/
+
+#ifndef BYTE_SWAP_H
+#define BYTE_SWAP_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace io {
+
+	/**
+	True if the machine stores integers least significant byte first
+	*/
+	inline bool hostIsLittleEndian() {
+		const uint16_t value = 1;
+		unsigned char firstByte;
+		memcpy(&firstByte, &value, 1);
+		return firstByte == 1;
+	}
+
+	inline uint8_t byteSwap(uint8_t value) { return value; }
+
+	inline uint16_t byteSwap(uint16_t value) {
+		return static_cast<uint16_t>((value >> 8) | (value << 8));
+	}
+
+	inline uint32_t byteSwap(uint32_t value) {
+		return ((value >> 24) & 0x000000FFu) | ((value >> 8) & 0x0000FF00u) |
+			((value << 8) & 0x00FF0000u) | ((value << 24) & 0xFF000000u);
+	}
+
+	inline uint64_t byteSwap(uint64_t value) {
+		return (static_cast<uint64_t>(byteSwap(static_cast<uint32_t>(value))) << 32) |
+			byteSwap(static_cast<uint32_t>(value >> 32));
+	}
+
+	/**
+	Unsigned integer with the same size as V, used to swap any scalar through its bits
+	*/
+	template<size_t Size> struct SwapWord;
+	template<> struct SwapWord<1> { typedef uint8_t type; };
+	template<> struct SwapWord<2> { typedef uint16_t type; };
+	template<> struct SwapWord<4> { typedef uint32_t type; };
+	template<> struct SwapWord<8> { typedef uint64_t type; };
+
+	/**
+	Loads a V stored at an arbitrary address, swapping its bytes if requested
+	*/
+	template<class V>
+	inline V loadScalar(const char *address, bool swap) {
+		typedef typename SwapWord<sizeof(V)>::type Word;
+
+		Word word;
+		memcpy(&word, address, sizeof(Word));
+		if (swap)
+			word = byteSwap(word);
+
+		V value;
+		memcpy(&value, &word, sizeof(V));
+		return value;
+	}
+
+	/**
+	Stores a V at an arbitrary address, swapping its bytes if requested
+	*/
+	template<class V>
+	inline void storeScalar(char *address, V value, bool swap) {
+		typedef typename SwapWord<sizeof(V)>::type Word;
+
+		Word word;
+		memcpy(&word, &value, sizeof(V));
+		if (swap)
+			word = byteSwap(word);
+
+		memcpy(address, &word, sizeof(Word));
+	}
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "mappedfile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::runtime_error;
+
+#ifdef _WIN32
+
+io::MappedFile::MappedFile(const std::string& filePath) :
+_data(nullptr),
+_size(0),
+_file(INVALID_HANDLE_VALUE),
+_mapping(nullptr) {
+
+	_file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		throw runtime_error("Cannot open " + filePath);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size)) {
+		CloseHandle(_file);
+		throw runtime_error("Cannot query the size of " + filePath);
+	}
+	_size = static_cast<size_t>(size.QuadPart);
+
+	if (_size > 0) {
+		_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_mapping)
+			_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+
+		if (!_data) {
+			if (_mapping)
+				CloseHandle(_mapping);
+			CloseHandle(_file);
+			throw runtime_error("Cannot map " + filePath);
+		}
+	}
+}
+
+io::MappedFile::~MappedFile() {
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+}
+
+#else
+
+io::MappedFile::MappedFile(const std::string& filePath) :
+_data(nullptr),
+_size(0),
+_file(-1) {
+
+	_file = ::open(filePath.c_str(), O_RDONLY);
+	if (_file < 0)
+		throw runtime_error("Cannot open " + filePath);
+
+	struct stat info;
+	if (fstat(_file, &info) != 0) {
+		::close(_file);
+		throw runtime_error("Cannot query the size of " + filePath);
+	}
+	_size = static_cast<size_t>(info.st_size);
+
+	if (_size > 0) {
+		void *mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+		if (mapping == MAP_FAILED) {
+			::close(_file);
+			throw runtime_error("Cannot map " + filePath);
+		}
+
+		madvise(mapping, _size, MADV_SEQUENTIAL);
+		_data = static_cast<const char*>(mapping);
+	}
+}
+
+io::MappedFile::~MappedFile() {
+	if (_data)
+		munmap(const_cast<char*>(_data), _size);
+	if (_file >= 0)
+		::close(_file);
+}
+
+#endif
@@ -0,0 +1,59 @@
+/**
+*	Read-only memory mapping of a whole file. The mapping is released on destruction.
+*
+*	@class MappedFile
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace io {
+
+	class MappedFile {
+
+		const char *_data; /** < First byte of the mapping */
+
+		size_t _size; /** < Size of the file in bytes */
+
+#ifdef _WIN32
+		void *_file; /** < File handle */
+
+		void *_mapping; /** < File mapping handle */
+#else
+		int _file; /** < File descriptor */
+#endif
+
+		/**
+		Copy constructor disabled
+		*/
+		MappedFile(const MappedFile& other);
+
+		/**
+		Copy assignment operator disabled
+		*/
+		MappedFile& operator=(const MappedFile& other);
+
+	public:
+
+		/**
+		Maps the file. Throws std::runtime_error if the file cannot be opened or mapped
+		*/
+		MappedFile(const std::string& filePath);
+
+		const char* data() const { return _data; }
+
+		const char* begin() const { return _data; }
+
+		const char* end() const { return _data + _size; }
+
+		size_t size() const { return _size; }
+
+		~MappedFile();
+	};
+
+}
+
+#endif
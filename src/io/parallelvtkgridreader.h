@@ -0,0 +1,239 @@
+/**
+*	Reader for legacy ASCII VTK files tuned for large datasets. The file is memory mapped,
+*	the scalar section is split into chunks at whitespace boundaries and each chunk is
+*	parsed by its own thread with std::from_chars, writing directly into the voxel model.
+*
+*	The header is parsed by keyword, so DIMENSIONS, SPACING/ASPECT_RATIO, ORIGIN and
+*	CELL_DATA/POINT_DATA may appear in any order.
+*/
+
+#ifndef PARALLEL_VTK_GRID_READER_H
+#define PARALLEL_VTK_GRID_READER_H
+
+#include "core/parallel.h"
+#include "core/voxelmodel.h"
+#include "io/mappedfile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace io {
+
+	template<class T>
+	class ParallelVTKGridReader {
+
+		static const size_t MIN_CHUNK_BYTES = 1 << 20; /** < Smaller chunks are not worth a thread */
+
+		static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v'; }
+
+		/**
+		Number of whitespace separated tokens in [begin, end)
+		*/
+		static size_t countTokens(const char *begin, const char *end);
+
+		/**
+		Parses the tokens of [begin, end) into output. Throws if a token is not a valid T
+		*/
+		static void parseTokens(const char *begin, const char *end, T *output);
+
+	public:
+
+		/**
+		Constructor
+		*/
+		ParallelVTKGridReader();
+
+		/**
+		Returns nullptr if the file cannot be read
+		*/
+		VoxelModel<T>* open(std::string filePath);
+
+		/**
+		Parses nData scalars of [begin, end) into output using every available thread
+		*/
+		static void parseScalars(const char *begin, const char *end, T *output, size_t nData);
+
+		/**
+		Default destructor
+		*/
+		~ParallelVTKGridReader();
+	};
+
+	template<class T>
+	ParallelVTKGridReader<T>::ParallelVTKGridReader() {
+	}
+
+	template<class T>
+	VoxelModel<T>* ParallelVTKGridReader<T>::open(std::string filePath) {
+		VoxelModel<T>* vm = nullptr;
+
+		try {
+			MappedFile file(filePath);
+
+			static const char TABLE_KEYWORD[] = "LOOKUP_TABLE";
+			const char *table = std::search(file.begin(), file.end(), TABLE_KEYWORD, TABLE_KEYWORD + sizeof(TABLE_KEYWORD) - 1);
+			if (table == file.end())
+				throw std::runtime_error("Missing LOOKUP_TABLE in the VTK header");
+
+			const char *scalars = std::find(table, file.end(), '\n');
+			if (scalars != file.end())
+				++scalars;
+
+			std::istringstream header(std::string(file.begin(), table));
+			std::string line, keyword, attribute;
+
+			std::getline(header, line); // Extract VTK header
+			std::getline(header, line); // Extract name
+			std::getline(header, line); // Extract file type
+			if (line.find("ASCII") == std::string::npos)
+				throw std::runtime_error("Only ASCII legacy VTK files are supported");
+
+			ivec3 dimension(0);
+			vec3 spacing(1.0f), origin(0.0f);
+			long long nData = -1;
+			bool cellData = true;
+
+			while (header >> keyword) {
+				if (keyword == "DIMENSIONS") {
+					header >> dimension.x >> dimension.y >> dimension.z;
+				} else if (keyword == "SPACING" || keyword == "ASPECT_RATIO") {
+					header >> spacing.x >> spacing.y >> spacing.z;
+				} else if (keyword == "ORIGIN") {
+					header >> origin.x >> origin.y >> origin.z;
+				} else if (keyword == "CELL_DATA" || keyword == "POINT_DATA") {
+					cellData = keyword == "CELL_DATA";
+					header >> nData;
+				} else if (keyword == "SCALARS") {
+					header >> attribute;
+					std::getline(header, line); // Extract type and number of components
+				}
+
+				if (header.fail())
+					throw std::runtime_error("Malformed VTK header near " + keyword);
+			}
+
+			if (cellData)
+				dimension -= ivec3(1);
+
+			if (dimension.x <= 0 || dimension.y <= 0 || dimension.z <= 0)
+				throw std::runtime_error("Missing or empty DIMENSIONS in the VTK header");
+
+			vm = new VoxelModel<T>(dimension, spacing, origin, attribute);
+
+			if (nData != vm->getNData())
+				throw std::runtime_error("Number of scalars does not match the dimensions");
+
+			parseScalars(scalars, file.end(), vm->getBuffer(), vm->getNData());
+
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file\n" << e.what() << std::endl;
+			delete vm;
+			vm = nullptr;
+		}
+
+		return vm;
+	}
+
+	template<class T>
+	void ParallelVTKGridReader<T>::parseScalars(const char *begin, const char *end, T *output, size_t nData) {
+		size_t size = end - begin;
+		size_t nChunks = std::max<size_t>(1, std::min<size_t>(size / MIN_CHUNK_BYTES, parallel::getThreads() * 4));
+
+		// Chunk boundaries are moved forward to the next whitespace so no token is split
+		std::vector<const char*> bounds(nChunks + 1);
+		bounds[0] = begin;
+		bounds[nChunks] = end;
+		for (size_t chunk = 1; chunk < nChunks; ++chunk) {
+			const char *bound = std::max(begin + chunk * (size / nChunks), bounds[chunk - 1]);
+			while (bound < end && !isSpace(*bound))
+				++bound;
+			bounds[chunk] = bound;
+		}
+
+		// First pass: every chunk counts its tokens to know where its values start
+		std::vector<size_t> offsets(nChunks + 1, 0);
+		parallel::forChunks(nChunks, [&](size_t chunk) {
+			offsets[chunk + 1] = countTokens(bounds[chunk], bounds[chunk + 1]);
+		});
+
+		for (size_t chunk = 0; chunk < nChunks; ++chunk)
+			offsets[chunk + 1] += offsets[chunk];
+
+		if (offsets[nChunks] < nData)
+			throw std::runtime_error("Truncated scalar data: " + std::to_string(offsets[nChunks]) + " of " + std::to_string(nData) + " values");
+
+		// Second pass: parse straight into the final buffer. Values past nData are ignored
+		parallel::forChunks(nChunks, [&](size_t chunk) {
+			if (offsets[chunk] >= nData)
+				return;
+
+			const char *chunkEnd = bounds[chunk + 1];
+			if (offsets[chunk + 1] > nData) {
+				// Cut the chunk after its last needed token
+				size_t remaining = nData - offsets[chunk];
+				const char *current = bounds[chunk];
+				while (remaining > 0) {
+					while (isSpace(*current)) ++current;
+					while (current < chunkEnd && !isSpace(*current)) ++current;
+					--remaining;
+				}
+				chunkEnd = current;
+			}
+
+			parseTokens(bounds[chunk], chunkEnd, output + offsets[chunk]);
+		});
+	}
+
+	template<class T>
+	size_t ParallelVTKGridReader<T>::countTokens(const char *begin, const char *end) {
+		size_t nTokens = 0;
+		bool previousSpace = true;
+
+		for (const char *current = begin; current < end; ++current) {
+			bool space = isSpace(*current);
+			nTokens += previousSpace & !space;
+			previousSpace = space;
+		}
+
+		return nTokens;
+	}
+
+	template<class T>
+	void ParallelVTKGridReader<T>::parseTokens(const char *begin, const char *end, T *output) {
+		const char *current = begin;
+
+		while (true) {
+			while (current < end && isSpace(*current))
+				++current;
+			if (current >= end)
+				break;
+
+			if (*current == '+')
+				++current;
+
+			auto result = std::from_chars(current, end, *output);
+			if (result.ec != std::errc() || (result.ptr < end && !isSpace(*result.ptr)))
+				throw std::runtime_error("Invalid scalar value at \"" + std::string(current, std::find_if(current, end, isSpace)) + "\"");
+
+			current = result.ptr;
+			++output;
+		}
+	}
+
+	template<class T>
+	ParallelVTKGridReader<T>::~ParallelVTKGridReader() {
+	}
+
+}
+
+using IntParallelVTKReader = io::ParallelVTKGridReader<int>;
+using ShortParallelVTKReader = io::ParallelVTKGridReader<short>;
+using ByteParallelVTKReader = io::ParallelVTKGridReader<char>;
+
+#endif
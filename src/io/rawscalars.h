@@ -0,0 +1,110 @@
+/**
+*	Description of the scalar types found in binary VTK files and conversion of raw
+*	scalar buffers, in any byte order, into the attribute type of the voxel model.
+*/
+
+#ifndef RAW_SCALARS_H
+#define RAW_SCALARS_H
+
+#include "core/parallel.h"
+#include "io/byteswap.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace io {
+
+	enum class ScalarType { INT8, UINT8, INT16, UINT16, INT32, UINT32, INT64, UINT64, FLOAT32, FLOAT64 };
+
+	inline size_t scalarSize(ScalarType type) {
+		switch (type) {
+		case ScalarType::INT8: case ScalarType::UINT8: return 1;
+		case ScalarType::INT16: case ScalarType::UINT16: return 2;
+		case ScalarType::INT32: case ScalarType::UINT32: case ScalarType::FLOAT32: return 4;
+		default: return 8;
+		}
+	}
+
+	/**
+	Scalar type from the names used by the SCALARS keyword of legacy VTK files. Bit scalars,
+	packed eight per byte, are not supported
+	*/
+	inline ScalarType legacyScalarType(const std::string& name) {
+		if (name == "char") return ScalarType::INT8;
+		if (name == "unsigned_char") return ScalarType::UINT8;
+		if (name == "short") return ScalarType::INT16;
+		if (name == "unsigned_short") return ScalarType::UINT16;
+		if (name == "int") return ScalarType::INT32;
+		if (name == "unsigned_int") return ScalarType::UINT32;
+		if (name == "long" || name == "vtktypeint64") return ScalarType::INT64;
+		if (name == "unsigned_long" || name == "vtktypeuint64") return ScalarType::UINT64;
+		if (name == "float") return ScalarType::FLOAT32;
+		if (name == "double") return ScalarType::FLOAT64;
+
+		throw std::runtime_error("Unsupported scalar type " + name);
+	}
+
+	/**
+	Scalar type from the names used by the type attribute of VTK XML files
+	*/
+	inline ScalarType xmlScalarType(const std::string& name) {
+		if (name == "Int8" || name == "Char") return ScalarType::INT8;
+		if (name == "UInt8") return ScalarType::UINT8;
+		if (name == "Int16") return ScalarType::INT16;
+		if (name == "UInt16") return ScalarType::UINT16;
+		if (name == "Int32") return ScalarType::INT32;
+		if (name == "UInt32") return ScalarType::UINT32;
+		if (name == "Int64") return ScalarType::INT64;
+		if (name == "UInt64") return ScalarType::UINT64;
+		if (name == "Float32") return ScalarType::FLOAT32;
+		if (name == "Float64") return ScalarType::FLOAT64;
+
+		throw std::runtime_error("Unsupported scalar type " + name);
+	}
+
+	/**
+	Converts n raw values of type V, swapping bytes if requested
+	*/
+	template<class V, class T>
+	void convertRaw(const char *raw, T *output, size_t n, bool swap) {
+		if (swap) {
+			for (size_t i = 0; i < n; ++i)
+				output[i] = static_cast<T>(loadScalar<V>(raw + i * sizeof(V), true));
+		} else {
+			for (size_t i = 0; i < n; ++i)
+				output[i] = static_cast<T>(loadScalar<V>(raw + i * sizeof(V), false));
+		}
+	}
+
+	/**
+	Converts n raw scalars of the given type into output. Large buffers are split among threads
+	*/
+	template<class T>
+	void convertScalars(const char *raw, T *output, size_t n, ScalarType type, bool swap) {
+		static const size_t GRAIN = 1 << 18;
+		size_t size = scalarSize(type);
+
+		parallel::forRange(0, (n + GRAIN - 1) / GRAIN, [&](size_t block) {
+			size_t first = block * GRAIN;
+			size_t count = std::min(GRAIN, n - first);
+			const char *source = raw + first * size;
+			T *destination = output + first;
+
+			switch (type) {
+			case ScalarType::INT8: convertRaw<int8_t>(source, destination, count, swap); break;
+			case ScalarType::UINT8: convertRaw<uint8_t>(source, destination, count, swap); break;
+			case ScalarType::INT16: convertRaw<int16_t>(source, destination, count, swap); break;
+			case ScalarType::UINT16: convertRaw<uint16_t>(source, destination, count, swap); break;
+			case ScalarType::INT32: convertRaw<int32_t>(source, destination, count, swap); break;
+			case ScalarType::UINT32: convertRaw<uint32_t>(source, destination, count, swap); break;
+			case ScalarType::INT64: convertRaw<int64_t>(source, destination, count, swap); break;
+			case ScalarType::UINT64: convertRaw<uint64_t>(source, destination, count, swap); break;
+			case ScalarType::FLOAT32: convertRaw<float>(source, destination, count, swap); break;
+			case ScalarType::FLOAT64: convertRaw<double>(source, destination, count, swap); break;
+			}
+		});
+	}
+
+}
+
+#endif
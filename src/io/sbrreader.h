@@ -1,6 +1,14 @@
 /**
 *	Implementation of the Reader interface to read objects from stack-based representation custom files
 *
+*	The file is memory mapped, the start of every line is indexed in parallel and the stacks
+*	are then parsed concurrently into the storage of the representation. The format is the
+*	one written by SBRWriter and by operator<< of StackBasedRep: four header lines followed
+*	by one line per stack, row by row, with intervals written as attribute|height$. A stack
+*	holding only the UNKNOWN_VALUE marker is read as an empty stack.
+*
+*	The height resolution is not stored in the file, so it is taken as the thinnest interval.
+*
 *	@class SBReader
 *	@author Alejandro Graciano
 */
@@ -8,12 +16,19 @@
 #ifndef SBR_READER_H
 #define SBR_READER_H
 
-#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include <glm/glm.hpp>
+#include "core/parallel.h"
 #include "core/stackbasedrep.h"
+#include "io/mappedfile.h"
 
-using std::ifstream;
 using std::string;
 using glm::vec2;
 using glm::ivec2;
@@ -24,6 +39,18 @@ namespace io {
 	template <class T>
 	class SBRReader {
 
+		static const size_t MIN_CHUNK_BYTES = 1 << 20; /** < Smaller chunks are not worth a thread */
+
+		/**
+		Parses the intervals of the line [begin, end) into stack. Returns the thinnest interval
+		*/
+		static float parseStack(const char *begin, const char *end, float minHeight, float maxHeight, Stack<T>& stack);
+
+		/**
+		Start of every line of [begin, end), in order. A trailing empty line is not indexed
+		*/
+		static std::vector<const char*> indexLines(const char *begin, const char *end);
+
 	public:
 
 		/**
@@ -31,6 +58,9 @@ namespace io {
 		*/
 		SBRReader();
 
+		/**
+		Returns nullptr if the file cannot be read
+		*/
 		StackBasedRep<T>* open(string filePath);
 
 		/**
@@ -39,7 +69,7 @@ namespace io {
 		~SBRReader();
 	};
 
-	
+
 
 	template<class T>
 	SBRReader<T>::SBRReader() {
@@ -47,87 +77,140 @@ namespace io {
 
 	template<class T>
 	StackBasedRep<T>* SBRReader<T>::open(string filePath) {
-		ifstream inputStream;
-		inputStream.exceptions(ifstream::failbit | ifstream::badbit);
-		ivec2 dimension;
-		vec2 spacing;
-		vec2 origin;
-		double min, max;
-		StackBasedRep<T> *sbr;
+		StackBasedRep<T> *sbr = nullptr;
 
-		string attribute, line;
+		try {
+			MappedFile file(filePath);
+
+			// Header: Origin, Dimension, Spacing and Height lines
+			const char *body = file.begin();
+			for (int line = 0; line < 4 && body != file.end(); ++line) {
+				body = std::find(body, file.end(), '\n');
+				if (body != file.end())
+					++body;
+			}
 
-		string stackDelimiter = ";";
-		string intervalDelimiter = "$";
-		string valueDelimiter = "|";
-		string::size_type sz;
+			std::istringstream header(string(file.begin(), body));
+			string keyword;
+			ivec2 dimension;
+			vec2 spacing, origin;
+			float minHeight, maxHeight;
 
-		try {
-			inputStream.open(filePath);
+			header >> keyword >> origin.x >> origin.y; // Extract origin
+			header >> keyword >> dimension.x >> dimension.y; // Extract dimension
+			header >> keyword >> spacing.x >> spacing.y; // Extract spacing
+			header >> keyword >> minHeight >> maxHeight; // Extract height range
 
-			inputStream >> line; // Extract origin
-			inputStream >> origin.x;
-			inputStream >> origin.y;
+			if (header.fail() || dimension.x <= 0 || dimension.y <= 0)
+				throw std::runtime_error("Malformed SBR header");
 
-			origin.x = originX / CM_FACTOR;
-			origin.y = originY / CM_FACTOR;
+			std::vector<const char*> lines = indexLines(body, file.end());
+			size_t nStacks = static_cast<size_t>(dimension.x) * dimension.y;
 
-			
-			inputStream >> line; // Extract dimension
-			inputStream >> dimensionX;
-			inputStream >> dimensionY;
+			if (lines.size() < nStacks)
+				throw std::runtime_error("Truncated SBR file: " + std::to_string(lines.size()) + " of " + std::to_string(nStacks) + " stacks");
 
-			
-			inputStream >> line; // Extract spacing
-			inputStream >> spacing.x;
-			inputStream >> spacing.y;
+			sbr = new StackBasedRep<T>(minHeight, maxHeight, 0.0f, "material", origin, spacing, dimension);
+			Stack<T> *stacks = sbr->begin();
 
-			inputStream >> line; // Extract spacing
-			inputStream >> min;
-			inputStream >> max;
+			// Stacks are parsed in chunks to keep the thinnest interval of each chunk
+			size_t nChunks = std::min<size_t>(nStacks, parallel::getThreads() * 16);
+			std::vector<float> thinnest(nChunks, std::numeric_limits<float>::max());
 
-			sbr = new StratumSBRTerrain(min, max, "material", origin, spacing, dimension);
+			parallel::forChunks(nChunks, [&](size_t chunk) {
+				size_t first = chunk * nStacks / nChunks, last = (chunk + 1) * nStacks / nChunks;
+				for (size_t index = first; index < last; ++index) {
+					const char *lineEnd = index + 1 < lines.size() ? lines[index + 1] - 1 : file.end();
+					float thickness = parseStack(lines[index], lineEnd, minHeight, maxHeight, stacks[index]);
+					thinnest[chunk] = std::min(thinnest[chunk], thickness);
+				}
+			});
 
-			unsigned int stackPos;
-			unsigned int index1D = 0;
+			float heightResolution = *std::min_element(thinnest.begin(), thinnest.end());
+			sbr->setHeightResolution(heightResolution == std::numeric_limits<float>::max() ? maxHeight - minHeight : heightResolution);
 
-			while (!inputStream.eof()) {
-				string tokenStack;
-				inputStream >> tokenStack;
-				ivec2 ind2D = ivec2{ index1D % dimension.x, index1D / dimension.x };
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file " << e.what() << std::endl;
+			delete sbr;
+			sbr = nullptr;
+		}
 
-				auto& cellStack = sbrt->getStack(ind2D.x, ind2D.y);
+		return sbr;
+	}
+
+	template<class T>
+	std::vector<const char*> SBRReader<T>::indexLines(const char *begin, const char *end) {
+		size_t size = end - begin;
+		size_t nChunks = std::max<size_t>(1, std::min<size_t>(size / MIN_CHUNK_BYTES, parallel::getThreads() * 4));
+
+		// First pass: line breaks per chunk
+		std::vector<size_t> offsets(nChunks + 1, 0);
+		parallel::forChunks(nChunks, [&](size_t chunk) {
+			offsets[chunk + 1] = std::count(begin + chunk * size / nChunks, begin + (chunk + 1) * size / nChunks, '\n');
+		});
+
+		for (size_t chunk = 0; chunk < nChunks; ++chunk)
+			offsets[chunk + 1] += offsets[chunk];
+
+		// Second pass: every line starts after a line break, except the first one
+		bool trailingLine = size > 0 && end[-1] != '\n';
+		std::vector<const char*> lines(offsets[nChunks] + (trailingLine ? 1 : 0));
+		if (lines.empty())
+			return lines;
+
+		lines[0] = begin;
+		parallel::forChunks(nChunks, [&](size_t chunk) {
+			size_t line = offsets[chunk] + 1;
+			const char *chunkEnd = begin + (chunk + 1) * size / nChunks;
+
+			for (const char *current = begin + chunk * size / nChunks; current < chunkEnd; ++current) {
+				if (*current == '\n' && line < lines.size())
+					lines[line++] = current + 1;
+			}
+		});
 
-				string::size_type intervalPos;
+		return lines;
+	}
 
-				while ((intervalPos = tokenStack.find(intervalDelimiter)) != string::npos) {
-					auto tokenInterval = tokenStack.substr(0, intervalPos);
+	template<class T>
+	float SBRReader<T>::parseStack(const char *begin, const char *end, float minHeight, float maxHeight, Stack<T>& stack) {
+		while (end > begin && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' '))
+			--end;
 
-					auto valuePos = tokenInterval.find(valueDelimiter);
-					auto tokenValue = tokenInterval.substr(0, valuePos);
-					auto tokenHeight = tokenInterval.substr(valuePos + 1, tokenInterval.length());
+		stack.getIntervals().reserve(std::count(begin, end, '$') + 1);
 
-					auto value = stoi(tokenValue);
-					auto height = stod(tokenHeight, &sz);
+		float thinnest = std::numeric_limits<float>::max();
+		float previousHeight = minHeight;
+		const char *current = begin;
 
-					sbrt->setMaterial(value);
+		while (current < end) {
+			long long value;
+			float height;
 
-					cellStack.addInterval(value, height);
-					tokenStack.erase(0, intervalPos + intervalDelimiter.length());
-				}
+			auto valueResult = std::from_chars(current, end, value);
+			if (valueResult.ec != std::errc() || valueResult.ptr == end || *valueResult.ptr != '|')
+				throw std::runtime_error("Invalid interval \"" + string(current, std::find(current, end, '$')) + "\"");
 
-				index1D++;
-			}
+			auto heightResult = std::from_chars(valueResult.ptr + 1, end, height);
+			if (heightResult.ec != std::errc() || (heightResult.ptr != end && *heightResult.ptr != '$'))
+				throw std::runtime_error("Invalid interval \"" + string(current, std::find(current, end, '$')) + "\"");
 
-			inputStream.close();
+			// Empty stacks are written as a single unknown interval up to the maximum height
+			bool emptyMarker = current == begin && value == Stack<T>::UNKNOWN_VALUE && height == maxHeight
+				&& (heightResult.ptr == end || heightResult.ptr + 1 == end);
+			if (emptyMarker)
+				break;
 
-		} catch (ifstream::failure &e) {
-			cerr << "Exception reading file " << e.what() << endl;
-		}
+			stack.addInterval(static_cast<T>(value), height);
 
+			if (height > previousHeight)
+				thinnest = std::min(thinnest, height - previousHeight);
+			previousHeight = height;
 
+			current = heightResult.ptr == end ? end : heightResult.ptr + 1;
+		}
 
-		return sbr;
+		return thinnest;
 	}
 
 
@@ -139,5 +222,7 @@ namespace io {
 }
 
 using IntSBRReader = io::SBRReader<int>;
+using ShortSBRReader = io::SBRReader<short>;
+using ByteSBRReader = io::SBRReader<char>;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,164 @@
+/**
+*	Writer of stack-based representations in the custom text format read by SBRReader.
+*	Stacks are formatted in parallel into a fixed number of chunk buffers which are
+*	written in order, so memory does not grow with the size of the representation.
+*	Numbers are formatted with std::to_chars as std::to_string would print them.
+*
+*	@class SBRWriter
+*/
+
+#ifndef SBR_WRITER_H
+#define SBR_WRITER_H
+
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "core/parallel.h"
+#include "core/stackbasedrep.h"
+
+namespace io {
+
+	template <class T>
+	class SBRWriter {
+
+		static const size_t STACKS_PER_CHUNK = 1 << 14; /** < Stacks formatted by a thread at once */
+
+		static const size_t MAX_NUMBER_CHARS = 64; /** < Enough for any fixed float or integer */
+
+		/**
+		Appends the text of a stack to buffer, ending with a line break
+		*/
+		static void formatStack(Stack<T>& stack, float maxHeight, std::vector<char>& buffer);
+
+	public:
+
+		/**
+		Appends value to buffer as std::to_string would print it
+		*/
+		static void appendNumber(std::vector<char>& buffer, float value);
+
+		static void appendNumber(std::vector<char>& buffer, long long value);
+
+		/**
+		Constructor
+		*/
+		SBRWriter();
+
+		/**
+		Returns false if the file cannot be written
+		*/
+		bool write(StackBasedRep<T>& sbr, std::string filePath);
+
+		/**
+		Destructor
+		*/
+		~SBRWriter();
+	};
+
+	template<class T>
+	SBRWriter<T>::SBRWriter() {
+	}
+
+	template<class T>
+	void SBRWriter<T>::appendNumber(std::vector<char>& buffer, float value) {
+		char text[MAX_NUMBER_CHARS];
+		auto result = std::to_chars(text, text + MAX_NUMBER_CHARS, static_cast<double>(value), std::chars_format::fixed, 6);
+		buffer.insert(buffer.end(), text, result.ptr);
+	}
+
+	template<class T>
+	void SBRWriter<T>::appendNumber(std::vector<char>& buffer, long long value) {
+		char text[MAX_NUMBER_CHARS];
+		auto result = std::to_chars(text, text + MAX_NUMBER_CHARS, value);
+		buffer.insert(buffer.end(), text, result.ptr);
+	}
+
+	template<class T>
+	void SBRWriter<T>::formatStack(Stack<T>& stack, float maxHeight, std::vector<char>& buffer) {
+		auto& intervals = stack.getIntervals();
+
+		if (intervals.empty()) {
+			appendNumber(buffer, static_cast<long long>(Stack<T>::UNKNOWN_VALUE));
+			buffer.push_back('|');
+			appendNumber(buffer, maxHeight);
+			buffer.push_back('$');
+		}
+
+		for (const Interval<T> &interval : intervals) {
+			appendNumber(buffer, static_cast<long long>(interval._attribute));
+			buffer.push_back('|');
+			appendNumber(buffer, interval._accumulatedHeight);
+			buffer.push_back('$');
+		}
+
+		buffer.push_back('\n');
+	}
+
+	template<class T>
+	bool SBRWriter<T>::write(StackBasedRep<T>& sbr, std::string filePath) {
+		std::ofstream outputStream(filePath, std::ios::binary);
+		if (!outputStream) {
+			std::cerr << "Cannot open " << filePath << " for writing" << std::endl;
+			return false;
+		}
+
+		std::vector<char> header;
+		auto appendLine = [&header](const std::string& label, float first, float second) {
+			header.insert(header.end(), label.begin(), label.end());
+			appendNumber(header, first);
+			header.push_back(' ');
+			appendNumber(header, second);
+			header.push_back('\n');
+		};
+
+		appendLine("Origin ", sbr.getOriginX(), sbr.getOriginY());
+		std::string dimension = "Dimension " + std::to_string(sbr.getDimension().x) + " " + std::to_string(sbr.getDimension().y) + "\n";
+		header.insert(header.end(), dimension.begin(), dimension.end());
+		appendLine("Spacing ", sbr.getSpacing().x, sbr.getSpacing().y);
+		appendLine("Height ", sbr.getMinHeight(), sbr.getMaxHeight());
+
+		outputStream.write(header.data(), header.size());
+
+		// Stacks are formatted by groups of chunks, one buffer per chunk, and written in order
+		Stack<T> *stacks = sbr.begin();
+		size_t nStacks = sbr.end() - sbr.begin();
+		size_t nBuffers = parallel::getThreads();
+		std::vector<std::vector<char>> buffers(nBuffers);
+		float maxHeight = sbr.getMaxHeight();
+
+		for (size_t first = 0; first < nStacks && outputStream; first += nBuffers * STACKS_PER_CHUNK) {
+			parallel::forChunks(nBuffers, [&](size_t chunk) {
+				std::vector<char>& buffer = buffers[chunk];
+				buffer.clear();
+
+				size_t begin = std::min(nStacks, first + chunk * STACKS_PER_CHUNK);
+				size_t end = std::min(nStacks, begin + STACKS_PER_CHUNK);
+				for (size_t index = begin; index < end; ++index)
+					formatStack(stacks[index], maxHeight, buffer);
+			});
+
+			for (auto& buffer : buffers)
+				outputStream.write(buffer.data(), buffer.size());
+		}
+
+		if (!outputStream) {
+			std::cerr << "Error writing " << filePath << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	template<class T>
+	SBRWriter<T>::~SBRWriter() {
+	}
+
+}
+
+using IntSBRWriter = io::SBRWriter<int>;
+using ShortSBRWriter = io::SBRWriter<short>;
+using ByteSBRWriter = io::SBRWriter<char>;
+
+#endif
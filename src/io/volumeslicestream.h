@@ -0,0 +1,175 @@
+/**
+*	Sequential reader of the z slices of a raw binary volume. Only one slice of raw data
+*	is kept in memory, so large grids can feed a StackBasedRep or a VoxelModel without
+*	an intermediate copy of the whole file.
+*
+*	@class VolumeSliceStream
+*/
+
+#ifndef VOLUME_SLICE_STREAM_H
+#define VOLUME_SLICE_STREAM_H
+
+#include "core/stackbasedrep.h"
+#include "core/voxelmodel.h"
+#include "io/rawscalars.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace io {
+
+	/**
+	Location and description of the scalars of a binary volume inside a file
+	*/
+	struct RawVolumeLayout {
+		ivec3 dimension; /** < Number of voxels on each direction, x varying fastest */
+		vec3 spacing;
+		vec3 origin;
+		std::string attribute;
+		ScalarType type; /** < Type of the scalars stored in the file */
+		bool swap; /** < True if the file byte order differs from the host */
+		std::streamoff dataOffset; /** < Position of the first scalar */
+	};
+
+	template<class T>
+	class VolumeSliceStream {
+
+		RawVolumeLayout _layout;
+
+		std::ifstream _input;
+
+		std::vector<char> _raw; /** < Raw bytes of the current slice */
+
+		unsigned _nextSlice;
+
+		/**
+		Copy constructor disabled
+		*/
+		VolumeSliceStream(const VolumeSliceStream<T>& other);
+
+		/**
+		Copy assignment operator disabled
+		*/
+		VolumeSliceStream<T>& operator=(const VolumeSliceStream<T>& other);
+
+	public:
+
+		/**
+		Opens the file. Throws std::runtime_error if it is shorter than the layout requires
+		*/
+		VolumeSliceStream(const std::string& filePath, const RawVolumeLayout& layout);
+
+		const RawVolumeLayout& getLayout() const { return _layout; }
+
+		ivec3 getDimension() const { return _layout.dimension; }
+
+		size_t getSliceSize() const { return static_cast<size_t>(_layout.dimension.x) * _layout.dimension.y; }
+
+		unsigned getNextSlice() const { return _nextSlice; }
+
+		bool hasNext() const { return _nextSlice < static_cast<unsigned>(_layout.dimension.z); }
+
+		/**
+		Reads the next z slice into slice, which must hold getSliceSize() values.
+		Returns false once every slice has been read
+		*/
+		bool next(T *slice);
+
+		/**
+		Reads the remaining slices into a new voxel model
+		*/
+		VoxelModel<T>* readVoxelModel();
+
+		/**
+		Builds a stack-based representation from the remaining slices
+		*/
+		StackBasedRep<T>* readStackBasedRep();
+
+		/**
+		Default destructor
+		*/
+		~VolumeSliceStream();
+	};
+
+	template<class T>
+	VolumeSliceStream<T>::VolumeSliceStream(const std::string& filePath, const RawVolumeLayout& layout) :
+	_layout(layout),
+	_input(filePath, std::ios::binary),
+	_raw(getSliceSize() * scalarSize(layout.type)),
+	_nextSlice(0) {
+
+		if (!_input)
+			throw std::runtime_error("Cannot open " + filePath);
+
+		_input.seekg(0, std::ios::end);
+		std::streamoff required = layout.dataOffset + static_cast<std::streamoff>(_raw.size()) * layout.dimension.z;
+		if (static_cast<std::streamoff>(_input.tellg()) < required)
+			throw std::runtime_error("Truncated scalar data in " + filePath);
+
+		_input.seekg(layout.dataOffset);
+	}
+
+	template<class T>
+	bool VolumeSliceStream<T>::next(T *slice) {
+		if (!hasNext())
+			return false;
+
+		if (!_input.read(_raw.data(), _raw.size()))
+			throw std::runtime_error("Error reading slice " + std::to_string(_nextSlice));
+
+		convertScalars(_raw.data(), slice, getSliceSize(), _layout.type, _layout.swap);
+		++_nextSlice;
+
+		return true;
+	}
+
+	template<class T>
+	VoxelModel<T>* VolumeSliceStream<T>::readVoxelModel() {
+		ivec3 dimension(_layout.dimension.x, _layout.dimension.y, _layout.dimension.z - _nextSlice);
+		vec3 origin(_layout.origin.x, _layout.origin.y, _layout.origin.z + _nextSlice * _layout.spacing.z);
+
+		VoxelModel<T>* vm = new VoxelModel<T>(dimension, _layout.spacing, origin, _layout.attribute);
+
+		try {
+			T *slice = vm->getBuffer();
+			while (next(slice))
+				slice += getSliceSize();
+		} catch (...) {
+			delete vm;
+			throw;
+		}
+
+		return vm;
+	}
+
+	template<class T>
+	StackBasedRep<T>* VolumeSliceStream<T>::readStackBasedRep() {
+		float minHeight = _layout.origin.z + _nextSlice * _layout.spacing.z;
+		float maxHeight = _layout.origin.z + _layout.dimension.z * _layout.spacing.z;
+		vec2 origin(_layout.origin.x, _layout.origin.y);
+		vec2 spacing(_layout.spacing.x, _layout.spacing.x);
+
+		StackBasedRep<T>* sbr = new StackBasedRep<T>(minHeight, maxHeight, _layout.spacing.z, _layout.attribute,
+			origin, spacing, ivec2(_layout.dimension.x, _layout.dimension.y));
+
+		try {
+			std::vector<T> slice(getSliceSize());
+			for (unsigned zValue = 0; next(slice.data()); ++zValue)
+				sbr->addSlice(slice.data(), zValue);
+		} catch (...) {
+			delete sbr;
+			throw;
+		}
+
+		return sbr;
+	}
+
+	template<class T>
+	VolumeSliceStream<T>::~VolumeSliceStream() {
+	}
+
+}
+
+#endif
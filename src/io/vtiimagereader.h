@@ -0,0 +1,258 @@
+/**
+*	Reader for VTK XML ImageData files (.vti) whose scalars are stored as raw appended
+*	data. Both UInt32 and UInt64 block headers and both byte orders are supported;
+*	compressed or base64 encoded data is rejected.
+*
+*	The scalars are taken from the active Scalars array of CellData, or from its first
+*	array, falling back to PointData when there is no cell array.
+*
+*	@class VTIImageReader
+*/
+
+#ifndef VTI_IMAGE_READER_H
+#define VTI_IMAGE_READER_H
+
+#include "io/volumeslicestream.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace io {
+
+	template<class T>
+	class VTIImageReader {
+
+		/**
+		Returns the value of attribute name in the tag starting at position tagBegin of xml
+		or an empty string if it does not exist
+		*/
+		static std::string attribute(const std::string& xml, size_t tagBegin, const std::string& name);
+
+		/**
+		Position of the DataArray holding the scalars of section (CellData or PointData),
+		or npos if the section has no array
+		*/
+		static size_t findArray(const std::string& xml, const std::string& section);
+
+	public:
+
+		/**
+		Constructor
+		*/
+		VTIImageReader();
+
+		/**
+		Parses the XML header. Throws std::runtime_error if it is not a supported file
+		*/
+		RawVolumeLayout readLayout(const std::string& filePath);
+
+		/**
+		Returns nullptr if the file cannot be read
+		*/
+		VoxelModel<T>* open(const std::string& filePath);
+
+		/**
+		Opens the file to be read slice by slice. Returns nullptr if the file cannot be read
+		*/
+		VolumeSliceStream<T>* openSlices(const std::string& filePath);
+
+		/**
+		Default destructor
+		*/
+		~VTIImageReader();
+	};
+
+	template<class T>
+	VTIImageReader<T>::VTIImageReader() {
+	}
+
+	template<class T>
+	std::string VTIImageReader<T>::attribute(const std::string& xml, size_t tagBegin, const std::string& name) {
+		size_t tagEnd = xml.find('>', tagBegin);
+		size_t position = tagBegin;
+
+		while ((position = xml.find(name + "=\"", position)) < tagEnd) {
+			char previous = xml[position - 1];
+			position += name.size() + 2;
+
+			if (previous == ' ' || previous == '\t' || previous == '\n' || previous == '\r')
+				return xml.substr(position, xml.find('"', position) - position);
+		}
+
+		return "";
+	}
+
+	template<class T>
+	size_t VTIImageReader<T>::findArray(const std::string& xml, const std::string& section) {
+		size_t sectionBegin = xml.find("<" + section);
+		if (sectionBegin == std::string::npos)
+			return std::string::npos;
+
+		size_t tagEnd = xml.find('>', sectionBegin);
+		if (tagEnd == std::string::npos || xml[tagEnd - 1] == '/')
+			return std::string::npos;
+
+		size_t sectionEnd = xml.find("</" + section, sectionBegin);
+		std::string scalars = attribute(xml, sectionBegin, "Scalars");
+		size_t first = xml.find("<DataArray", sectionBegin);
+
+		if (first >= sectionEnd)
+			return std::string::npos;
+
+		for (size_t array = first; array < sectionEnd; array = xml.find("<DataArray", array + 1)) {
+			if (!scalars.empty() && attribute(xml, array, "Name") == scalars)
+				return array;
+		}
+
+		return first;
+	}
+
+	template<class T>
+	RawVolumeLayout VTIImageReader<T>::readLayout(const std::string& filePath) {
+		std::ifstream inputStream(filePath, std::ios::binary);
+		if (!inputStream)
+			throw std::runtime_error("Cannot open " + filePath);
+
+		// Read the XML part of the file, which ends where the appended data begins
+		static const std::string APPENDED_TAG = "<AppendedData";
+		std::string xml;
+		size_t appended = std::string::npos, marker = std::string::npos;
+		char buffer[1 << 16];
+
+		while (marker == std::string::npos && inputStream) {
+			inputStream.read(buffer, sizeof(buffer));
+			xml.append(buffer, static_cast<size_t>(inputStream.gcount()));
+
+			if (appended == std::string::npos)
+				appended = xml.find(APPENDED_TAG);
+			if (appended != std::string::npos && xml.find('>', appended) != std::string::npos)
+				marker = xml.find('_', xml.find('>', appended));
+		}
+
+		if (marker == std::string::npos)
+			throw std::runtime_error("No raw appended data in " + filePath);
+
+		size_t file = xml.find("<VTKFile");
+		if (file == std::string::npos || attribute(xml, file, "type") != "ImageData")
+			throw std::runtime_error("Not an ImageData VTK XML file");
+
+		if (!attribute(xml, file, "compressor").empty())
+			throw std::runtime_error("Compressed appended data is not supported");
+
+		if (attribute(xml, appended, "encoding") != "raw")
+			throw std::runtime_error("Only raw appended data is supported");
+
+		std::string headerType = attribute(xml, file, "header_type");
+		size_t headerSize = headerType == "UInt64" ? 8 : 4;
+		if (!headerType.empty() && headerType != "UInt32" && headerType != "UInt64")
+			throw std::runtime_error("Unsupported header_type " + headerType);
+
+		RawVolumeLayout layout;
+		bool bigEndian = attribute(xml, file, "byte_order") == "BigEndian";
+		layout.swap = bigEndian == hostIsLittleEndian();
+
+		size_t image = xml.find("<ImageData");
+		if (image == std::string::npos)
+			throw std::runtime_error("Missing ImageData element");
+
+		int extent[6];
+		std::istringstream extentStream(attribute(xml, image, "WholeExtent"));
+		for (int i = 0; i < 6; ++i)
+			extentStream >> extent[i];
+
+		std::istringstream originStream(attribute(xml, image, "Origin"));
+		originStream >> layout.origin.x >> layout.origin.y >> layout.origin.z;
+
+		std::istringstream spacingStream(attribute(xml, image, "Spacing"));
+		spacingStream >> layout.spacing.x >> layout.spacing.y >> layout.spacing.z;
+
+		if (extentStream.fail() || originStream.fail() || spacingStream.fail())
+			throw std::runtime_error("Malformed ImageData element");
+
+		bool cellData = true;
+		size_t array = findArray(xml, "CellData");
+		if (array == std::string::npos) {
+			array = findArray(xml, "PointData");
+			cellData = false;
+		}
+
+		if (array == std::string::npos)
+			throw std::runtime_error("No data array in " + filePath);
+
+		if (attribute(xml, array, "format") != "appended")
+			throw std::runtime_error("Only appended data arrays are supported");
+
+		std::string components = attribute(xml, array, "NumberOfComponents");
+		if (!components.empty() && components != "1")
+			throw std::runtime_error("Only single component scalars are supported");
+
+		layout.attribute = attribute(xml, array, "Name");
+		layout.type = xmlScalarType(attribute(xml, array, "type"));
+
+		int points = cellData ? 0 : 1;
+		layout.dimension = ivec3(extent[1] - extent[0] + points, extent[3] - extent[2] + points, extent[5] - extent[4] + points);
+		layout.origin += vec3(extent[0] * layout.spacing.x, extent[2] * layout.spacing.y, extent[4] * layout.spacing.z);
+
+		if (layout.dimension.x <= 0 || layout.dimension.y <= 0 || layout.dimension.z <= 0)
+			throw std::runtime_error("Empty WholeExtent");
+
+		// The block of the array starts with its size in bytes, stored as header_type
+		std::streamoff blockOffset = static_cast<std::streamoff>(marker + 1) + std::stoll(attribute(xml, array, "offset"));
+		char blockHeader[8];
+
+		inputStream.clear();
+		inputStream.seekg(blockOffset);
+		if (!inputStream.read(blockHeader, headerSize))
+			throw std::runtime_error("Truncated appended data");
+
+		unsigned long long blockSize = headerSize == 8 ? loadScalar<uint64_t>(blockHeader, layout.swap) : loadScalar<uint32_t>(blockHeader, layout.swap);
+		unsigned long long expected = static_cast<unsigned long long>(layout.dimension.x) * layout.dimension.y * layout.dimension.z * scalarSize(layout.type);
+		if (blockSize != expected)
+			throw std::runtime_error("Appended block size does not match the extent");
+
+		layout.dataOffset = blockOffset + static_cast<std::streamoff>(headerSize);
+
+		return layout;
+	}
+
+	template<class T>
+	VoxelModel<T>* VTIImageReader<T>::open(const std::string& filePath) {
+		VoxelModel<T>* vm = nullptr;
+
+		try {
+			VolumeSliceStream<T> stream(filePath, readLayout(filePath));
+			vm = stream.readVoxelModel();
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file\n" << e.what() << std::endl;
+		}
+
+		return vm;
+	}
+
+	template<class T>
+	VolumeSliceStream<T>* VTIImageReader<T>::openSlices(const std::string& filePath) {
+		VolumeSliceStream<T>* stream = nullptr;
+
+		try {
+			stream = new VolumeSliceStream<T>(filePath, readLayout(filePath));
+		} catch (std::exception &e) {
+			std::cerr << "Exception reading file\n" << e.what() << std::endl;
+		}
+
+		return stream;
+	}
+
+	template<class T>
+	VTIImageReader<T>::~VTIImageReader() {
+	}
+
+}
+
+using IntVTIReader = io::VTIImageReader<int>;
+using ShortVTIReader = io::VTIImageReader<short>;
+using ByteVTIReader = io::VTIImageReader<char>;
+
+#endif
@@ -53,7 +53,7 @@ namespace io {
 		string attribute, line, type;
 		T *data;
 		int nData;
-		VoxelModel<T>* vm;
+		VoxelModel<T>* vm = nullptr;
 
 		try {
 
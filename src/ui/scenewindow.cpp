@@ -1,10 +1,11 @@
 #include "scenewindow.h"
 
 #include "graphics/quadstackview.h"
-#include "io/vtkgridreader.h"
+#include "io/parallelvtkgridreader.h"
 #include "core/stackbasedrep.h"
-#include "core/octree.h"
+#include "core/flatoctree.h"
 #include "core/compressionmanager.h"
+#include <QCoreApplication>
 #include <chrono>
 
 using std::cout;
@@ -26,10 +27,18 @@ _resizeRenderBuffers(false){
 }
 
 QuadStack* SceneWindow::initModel() {
-	ShortVTKReader reader;
+	ShortParallelVTKReader reader;
+
+	// The dataset can be given as the first argument of the application
+	QStringList arguments = QCoreApplication::arguments();
+	std::string filePath = arguments.size() > 1 ? arguments[1].toStdString() : "data/sample_terrain.vtk";
 	
-	std::cout << "Reading..." << std::endl;
-	ShortVM *vm = reader.open("data/sample_terrain.vtk");
+	std::cout << "Reading " << filePath << "..." << std::endl;
+	ShortVM *vm = reader.open(filePath);
+	if (!vm) {
+		std::cout << "Dataset could not be read." << std::endl;
+		exit(1);
+	}
 
 	unsigned nRows = vm->getDimensionX();
 	unsigned nCols = vm->getDimensionY();
@@ -41,7 +50,7 @@ QuadStack* SceneWindow::initModel() {
 
 	std::cout << "Octree construction..." << std::endl;
 	auto start = std::chrono::high_resolution_clock::now();
-	ShortOctree *octree = new ShortOctree(vm);
+	ShortFlatOctree *octree = new ShortFlatOctree(*vm);
 	auto stop = std::chrono::high_resolution_clock::now();
 	auto durationOctree = std::chrono::duration_cast<std::chrono::seconds>(stop - start).count();
 	std::cout << "Construction time: " << durationOctree << " s" << std::endl;
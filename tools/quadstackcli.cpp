@@ -0,0 +1,515 @@
+/**
+*	Batch pipeline over the QuadStack library, without the viewer. A dataset is read, turned
+*	into a stack-based representation and then into a QuadStack whose heightfields are
+*	compressed. The results can be written, queried at random points and are reported as
+*	metric,value CSV rows, while the progress goes to the standard error.
+*
+*	Usage: quadstack-cli --input file [--format auto|vtk|vtk-binary|vti|voxels|sbr|qsbr]
+*		[--threads N] [--release-data] [--block-cache BYTES] [--tile N]
+*		[--output file.qspg] [--page-budget BYTES] [--sbr-output file]
+*		[--queries N] [--stats file.csv]
+*
+*	With the auto format the file is recognized by its first bytes: binary SBR containers by
+*	their magic, legacy VTK files by their header, which tells ASCII from BINARY, VTI files
+*	by their XML tag and SBR text files by their Origin line. Anything else is read as the
+*	raw voxels of BinaryVoxelReader.
+*
+*	--tile builds a QuadStackForest of N x N tiles instead of a single QuadStack, and
+*	--output then writes every tile to its own file, with _x_y appended to the name. Written
+*	QuadStacks are opened again as PagedQuadStacks of --page-budget bytes, and the queries
+*	are run on them too, so their checksums must agree. --sbr-output writes the binary
+*	container if the name ends in .qsbr and the text format otherwise.
+*
+*	Byte counts accept the suffixes K, M and G. Without --block-cache the trees share the
+*	cache of the process, and a block cache of 0 bytes disables it.
+*/
+
+#include "core/blockcache.h"
+#include "core/compressionmanager.h"
+#include "core/pagedquadstack.h"
+#include "core/parallel.h"
+#include "core/quadstack.h"
+#include "core/quadstackforest.h"
+#include "core/stackbasedrep.h"
+#include "core/voxelmodel.h"
+#include "io/binarysbrreader.h"
+#include "io/binarysbrwriter.h"
+#include "io/binaryvoxelreader.h"
+#include "io/binaryvtkgridreader.h"
+#include "io/parallelvtkgridreader.h"
+#include "io/sbrreader.h"
+#include "io/sbrwriter.h"
+#include "io/vtiimagereader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	enum class Format { Auto, VTK, BinaryVTK, VTI, Voxels, SBR, BinarySBR };
+
+	struct Options {
+		std::string inputPath;
+		Format format = Format::Auto;
+		bool releaseData = false;
+		bool customCache = false; /** < A block cache of cacheBytes replaces the shared one */
+		size_t cacheBytes = 0;
+		int tileSize = 0; /** < 0 for a single QuadStack */
+		std::string outputPath;
+		size_t pageBudget = PagedQuadStack::DEFAULT_BUDGET;
+		std::string sbrOutputPath;
+		size_t nQueries = 0;
+		std::string statsPath;
+	};
+
+	/**
+	Sizes of the nodes and heightfields of a QuadStack, added over the tiles of a forest
+	*/
+	struct TreeStatistics {
+		size_t nodes = 0;
+		size_t leaves = 0;
+		size_t intervals = 0;
+		size_t heightFields = 0; /** < Owned by an interval */
+		size_t compressedHeightFields = 0;
+		size_t encodings = 0; /** < Distinct encodings of the compressed heightfields, the others share them */
+		size_t predicted = 0; /** < Compressed heightfields coded as residuals of the layer below */
+		int height = 0;
+		double rawBytes = 0; /** < Heightfields as shorts */
+		double compressedBytes = 0; /** < Heightfields as they are stored */
+	};
+
+	const char *USAGE = " --input file [--format auto|vtk|vtk-binary|vti|voxels|sbr|qsbr] [--threads N] [--release-data]"
+		" [--block-cache BYTES] [--tile N] [--output file.qspg] [--page-budget BYTES] [--sbr-output file] [--queries N] [--stats file.csv]";
+
+	size_t residentBytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.WorkingSetSize;
+		return 0;
+#else
+		std::ifstream statm("/proc/self/statm");
+		size_t pages = 0, resident = 0;
+		if (statm >> pages >> resident)
+			return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		return 0;
+#endif
+	}
+
+	double since(Clock::time_point start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	/**
+	Number of bytes with an optional K, M or G suffix. Throws std::invalid_argument if text
+	is not one
+	*/
+	size_t parseBytes(const char *text) {
+		char *end;
+		unsigned long long value = strtoull(text, &end, 10);
+		if (end == text)
+			throw std::invalid_argument(std::string("Invalid number of bytes: ") + text);
+
+		switch (*end) {
+		case 'G': case 'g': value <<= 10; // fall through
+		case 'M': case 'm': value <<= 10; // fall through
+		case 'K': case 'k': value <<= 10; ++end; break;
+		default: break;
+		}
+
+		if (*end != '\0')
+			throw std::invalid_argument(std::string("Invalid number of bytes: ") + text);
+
+		return static_cast<size_t>(value);
+	}
+
+	Format parseFormat(const std::string& name) {
+		if (name == "auto") return Format::Auto;
+		if (name == "vtk") return Format::VTK;
+		if (name == "vtk-binary") return Format::BinaryVTK;
+		if (name == "vti") return Format::VTI;
+		if (name == "voxels") return Format::Voxels;
+		if (name == "sbr") return Format::SBR;
+		if (name == "qsbr") return Format::BinarySBR;
+		throw std::invalid_argument("Unknown format " + name);
+	}
+
+	/**
+	Format of the file, recognized by its first bytes. Throws std::runtime_error if the file
+	cannot be opened
+	*/
+	Format detectFormat(const std::string& filePath) {
+		std::ifstream file(filePath, std::ios::binary);
+		if (!file)
+			throw std::runtime_error("Cannot open " + filePath);
+
+		char buffer[8];
+		file.read(buffer, sizeof(buffer));
+		std::string start(buffer, static_cast<size_t>(file.gcount()));
+
+		if (start.rfind("QSBR", 0) == 0)
+			return Format::BinarySBR;
+
+		if (start.rfind("# vtk", 0) == 0) {
+			// The third line of the header is either ASCII or BINARY
+			file.clear();
+			file.seekg(0);
+			std::string line;
+			for (int i = 0; i < 3 && std::getline(file, line); ++i);
+			return line.find("BINARY") != std::string::npos ? Format::BinaryVTK : Format::VTK;
+		}
+
+		if (start.rfind("<", 0) == 0)
+			return Format::VTI;
+
+		if (start.rfind("Origin", 0) == 0)
+			return Format::SBR;
+
+		return Format::Voxels;
+	}
+
+	ShortVM* readVoxelModel(const std::string& filePath, Format format) {
+		switch (format) {
+		case Format::VTK: { ShortParallelVTKReader reader; return reader.open(filePath); }
+		case Format::BinaryVTK: { ShortBinaryVTKReader reader; return reader.open(filePath); }
+		case Format::VTI: { ShortVTIReader reader; return reader.open(filePath); }
+		default: { ShortBinaryReader reader; return reader.open(filePath); }
+		}
+	}
+
+	/**
+	Stack-based representation of the input, built from its voxel model unless the input
+	already is one. Throws std::runtime_error if the input cannot be read
+	*/
+	ShortSBR* load(const Options& options, std::ostream& report) {
+		Format format = options.format == Format::Auto ? detectFormat(options.inputPath) : options.format;
+
+		auto start = Clock::now();
+		ShortSBR *sbr = nullptr;
+		if (format == Format::SBR) {
+			ShortSBRReader reader;
+			sbr = reader.open(options.inputPath);
+		} else if (format == Format::BinarySBR) {
+			ShortBinarySBRReader reader;
+			sbr = reader.open(options.inputPath);
+		} else {
+			std::unique_ptr<ShortVM> vm(readVoxelModel(options.inputPath, format));
+			if (!vm)
+				throw std::runtime_error("Cannot read " + options.inputPath);
+
+			report << "read_seconds," << since(start) << "\n";
+			report << "voxel_dimension," << vm->getDimensionX() << "x" << vm->getDimensionY() << "x" << vm->getDimensionZ() << "\n";
+			report << "voxel_bytes," << vm->memorySize() << "\n";
+
+			std::cerr << "SBR construction..." << std::endl;
+			start = Clock::now();
+			sbr = new ShortSBR(*vm);
+			report << "sbr_seconds," << since(start) << "\n";
+		}
+
+		if (!sbr)
+			throw std::runtime_error("Cannot read " + options.inputPath);
+
+		if (format == Format::SBR || format == Format::BinarySBR)
+			report << "read_seconds," << since(start) << "\n";
+
+		report << "sbr_dimension," << sbr->getDimension().x << "x" << sbr->getDimension().y << "\n";
+		report << "sbr_bytes," << sbr->memorySize() << "\n";
+		return sbr;
+	}
+
+	void accumulate(QuadStack& quadStack, TreeStatistics& statistics) {
+		statistics.height = std::max(statistics.height, quadStack.treeHeight());
+
+		quadStack.traversal().forEachNode([&](auto& node, size_t) {
+			++statistics.nodes;
+			if (node.isLeaf())
+				++statistics.leaves;
+
+			for (auto& interval : node.getGStack()) {
+				++statistics.intervals;
+				if (!interval.isOwner() || !interval.hasHeightField())
+					continue;
+
+				auto *heightField = interval.getHeightField();
+				++statistics.heightFields;
+				if (heightField->isCompressed())
+					++statistics.compressedHeightFields;
+				statistics.rawBytes += heightField->memorySize();
+				statistics.compressedBytes += heightField->memorySizeCompressed();
+			}
+		}, QuadStack::Execution::SEQUENTIAL);
+
+		statistics.encodings += quadStack.getCompressionStatistics()._encodings;
+		statistics.predicted += quadStack.getCompressionStatistics()._predicted;
+	}
+
+	/**
+	Samples nQueries random points with sample(x, y, height) in parallel. Returns the sum
+	of the materials found
+	*/
+	template<class Sampler>
+	long long runQueries(ivec2 dimension, float minHeight, float maxHeight, size_t nQueries, Sampler sample, double& seconds) {
+		std::mt19937 generator(42);
+		std::uniform_int_distribution<int> x(0, dimension.x - 1), y(0, dimension.y - 1);
+		std::uniform_real_distribution<float> height(minHeight, maxHeight);
+
+		std::vector<vec3> points(nQueries);
+		for (auto& point : points)
+			point = vec3(x(generator), y(generator), height(generator));
+
+		std::vector<int> materials(nQueries);
+		auto start = Clock::now();
+		parallel::forRange(0, nQueries, [&](size_t index) {
+			materials[index] = sample(static_cast<int>(points[index].x), static_cast<int>(points[index].y), points[index].z);
+		}, 1024);
+		seconds = since(start);
+
+		long long checksum = 0;
+		for (int material : materials)
+			checksum += material;
+		return checksum;
+	}
+
+	bool endsWith(const std::string& text, const std::string& suffix) {
+		return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	/**
+	Name of the file of a tile: the output path with _x_y inserted before its extension
+	*/
+	std::string tilePath(const std::string& outputPath, ivec2 tile) {
+		size_t dot = outputPath.find_last_of('.');
+		size_t slash = outputPath.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			dot = outputPath.size();
+
+		return outputPath.substr(0, dot) + "_" + std::to_string(tile.x) + "_" + std::to_string(tile.y) + outputPath.substr(dot);
+	}
+
+	int run(const Options& options, std::ostream& report) {
+		size_t initialBytes = residentBytes();
+		report << "metric,value\n";
+		report << "threads," << parallel::getThreads() << "\n";
+
+		std::cerr << "Reading " << options.inputPath << "..." << std::endl;
+		std::unique_ptr<ShortSBR> sbr(load(options, report));
+		ivec2 dimension = sbr->getDimension();
+		float minHeight = sbr->getMinHeight(), maxHeight = sbr->getMaxHeight();
+
+		if (!options.sbrOutputPath.empty()) {
+			std::cerr << "Writing " << options.sbrOutputPath << "..." << std::endl;
+			auto start = Clock::now();
+			bool written;
+			if (endsWith(options.sbrOutputPath, ".qsbr")) {
+				ShortBinarySBRWriter writer;
+				written = writer.write(*sbr, options.sbrOutputPath);
+			} else {
+				ShortSBRWriter writer;
+				written = writer.write(*sbr, options.sbrOutputPath);
+			}
+
+			if (!written)
+				throw std::runtime_error("Cannot write " + options.sbrOutputPath);
+			report << "sbr_write_seconds," << since(start) << "\n";
+		}
+
+		std::cerr << "QuadStack construction..." << std::endl;
+		auto start = Clock::now();
+
+		// Declared first, since the trees keep a pointer to it
+		std::unique_ptr<BlockCache> customCache;
+		BlockCache *cache = &BlockCache::getShared();
+		if (options.customCache) {
+			if (options.cacheBytes > 0)
+				customCache.reset(new BlockCache(options.cacheBytes));
+			cache = customCache.get();
+		}
+
+		std::unique_ptr<QuadStack> quadStack;
+		std::unique_ptr<QuadStackForest> forest;
+		std::vector<QuadStack*> quadStacks;
+
+		if (options.tileSize > 0) {
+			forest.reset(new QuadStackForest(sbr.get(), options.tileSize, options.releaseData));
+			forest->build();
+
+			ivec2 nTiles = forest->getNumberOfTiles();
+			for (int y = 0; y < nTiles.y; ++y)
+				for (int x = 0; x < nTiles.x; ++x)
+					quadStacks.push_back(forest->getQuadStack(ivec2(x, y)));
+			report << "tiles," << quadStacks.size() << "\n";
+		} else {
+			CompressionManager manager(sbr.get());
+			quadStack.reset(manager.getQuadStack());
+			manager.execute(options.releaseData);
+			quadStacks.push_back(quadStack.get());
+		}
+		report << "quadstack_seconds," << since(start) << "\n";
+
+		for (auto *tree : quadStacks)
+			tree->setBlockCache(cache);
+
+		TreeStatistics statistics;
+		for (auto *tree : quadStacks)
+			accumulate(*tree, statistics);
+
+		report << "nodes," << statistics.nodes << "\n";
+		report << "leaves," << statistics.leaves << "\n";
+		report << "tree_height," << statistics.height << "\n";
+		report << "intervals," << statistics.intervals << "\n";
+		report << "heightfields," << statistics.heightFields << "\n";
+		report << "compressed_heightfields," << statistics.compressedHeightFields << "\n";
+		report << "heightfield_encodings," << statistics.encodings << "\n";
+		report << "predicted_heightfields," << statistics.predicted << "\n";
+		report << "shared_heightfields," << statistics.compressedHeightFields - std::min(statistics.encodings, statistics.compressedHeightFields) << "\n";
+		report << "heightfield_raw_bytes," << statistics.rawBytes << "\n";
+		report << "heightfield_compressed_bytes," << statistics.compressedBytes << "\n";
+		report << "compression_ratio," << (statistics.compressedBytes > 0 ? statistics.rawBytes / statistics.compressedBytes : 0.0) << "\n";
+		report << "resident_bytes," << residentBytes() << "\n";
+		report << "resident_growth_bytes," << static_cast<long long>(residentBytes()) - static_cast<long long>(initialBytes) << "\n";
+
+		long long checksum = 0;
+		if (options.nQueries > 0) {
+			std::cerr << "Querying..." << std::endl;
+			double seconds;
+			if (forest)
+				checksum = runQueries(dimension, minHeight, maxHeight, options.nQueries, [&](int x, int y, float height) { return forest->sample(x, y, height, maxHeight); }, seconds);
+			else
+				checksum = runQueries(dimension, minHeight, maxHeight, options.nQueries, [&](int x, int y, float height) { return quadStack->sample(x, y, height, maxHeight); }, seconds);
+
+			report << "queries_per_second," << options.nQueries / seconds << "\n";
+			report << "query_checksum," << checksum << "\n";
+		}
+
+		if (options.outputPath.empty())
+			return 0;
+
+		std::cerr << "Writing " << options.outputPath << "..." << std::endl;
+		start = Clock::now();
+		if (forest) {
+			ivec2 nTiles = forest->getNumberOfTiles();
+			for (int y = 0; y < nTiles.y; ++y)
+				for (int x = 0; x < nTiles.x; ++x)
+					forest->writeTile(ivec2(x, y), tilePath(options.outputPath, ivec2(x, y)));
+		} else
+			PagedQuadStack::write(*quadStack, options.outputPath);
+		report << "write_seconds," << since(start) << "\n";
+
+		if (options.nQueries == 0)
+			return 0;
+
+		// The written files replace the trees held in memory
+		std::unique_ptr<PagedQuadStack> paged;
+		if (forest) {
+			ivec2 nTiles = forest->getNumberOfTiles();
+			for (int y = 0; y < nTiles.y; ++y)
+				for (int x = 0; x < nTiles.x; ++x) {
+					forest->loadTile(ivec2(x, y), tilePath(options.outputPath, ivec2(x, y)), options.pageBudget);
+					forest->getPagedQuadStack(ivec2(x, y))->setBlockCache(cache);
+				}
+		} else {
+			quadStack.reset();
+			paged.reset(new PagedQuadStack(options.outputPath, options.pageBudget));
+			paged->setBlockCache(cache);
+		}
+
+		std::cerr << "Querying the written files..." << std::endl;
+		double seconds;
+		long long pagedChecksum;
+		if (forest)
+			pagedChecksum = runQueries(dimension, minHeight, maxHeight, options.nQueries, [&](int x, int y, float height) { return forest->sample(x, y, height, maxHeight); }, seconds);
+		else
+			pagedChecksum = runQueries(dimension, minHeight, maxHeight, options.nQueries, [&](int x, int y, float height) { return paged->sample(x, y, height, maxHeight); }, seconds);
+
+		report << "paged_queries_per_second," << options.nQueries / seconds << "\n";
+		report << "paged_query_checksum," << pagedChecksum << "\n";
+
+		if (pagedChecksum != checksum) {
+			std::cerr << "The written QuadStack does not answer as the one it was written from" << std::endl;
+			return 1;
+		}
+
+		return 0;
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options;
+
+	try {
+		for (int i = 1; i < argc; ++i) {
+			if (!strcmp(argv[i], "--input") && i + 1 < argc)
+				options.inputPath = argv[++i];
+			else if (!strcmp(argv[i], "--format") && i + 1 < argc)
+				options.format = parseFormat(argv[++i]);
+			else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+				parallel::setThreads(atoi(argv[++i]));
+			else if (!strcmp(argv[i], "--release-data"))
+				options.releaseData = true;
+			else if (!strcmp(argv[i], "--block-cache") && i + 1 < argc) {
+				options.customCache = true;
+				options.cacheBytes = parseBytes(argv[++i]);
+			} else if (!strcmp(argv[i], "--tile") && i + 1 < argc)
+				options.tileSize = atoi(argv[++i]);
+			else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+				options.outputPath = argv[++i];
+			else if (!strcmp(argv[i], "--page-budget") && i + 1 < argc)
+				options.pageBudget = parseBytes(argv[++i]);
+			else if (!strcmp(argv[i], "--sbr-output") && i + 1 < argc)
+				options.sbrOutputPath = argv[++i];
+			else if (!strcmp(argv[i], "--queries") && i + 1 < argc)
+				options.nQueries = strtoull(argv[++i], nullptr, 10);
+			else if (!strcmp(argv[i], "--stats") && i + 1 < argc)
+				options.statsPath = argv[++i];
+			else {
+				std::cerr << "Usage: " << argv[0] << USAGE << std::endl;
+				return 1;
+			}
+		}
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (options.inputPath.empty()) {
+		std::cerr << "Usage: " << argv[0] << USAGE << std::endl;
+		return 1;
+	}
+
+	std::ofstream statsFile;
+	if (!options.statsPath.empty()) {
+		statsFile.open(options.statsPath);
+		if (!statsFile) {
+			std::cerr << "Cannot open " << options.statsPath << " for writing" << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& report = options.statsPath.empty() ? std::cout : statsFile;
+
+	try {
+		return run(options, report);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}